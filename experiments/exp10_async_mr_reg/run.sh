@@ -0,0 +1,56 @@
+#!/bin/bash
+# EXP-10: 异步MR注册启动时间测试
+# 用法: ./run.sh [总内存GB] [缓冲区MB]
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+RESULTS_DIR="$SCRIPT_DIR/results"
+PROJECT_DIR="$(dirname "$(dirname "$SCRIPT_DIR")")"
+
+TOTAL_GB=${1:-64}
+BUF_MB=${2:-1024}
+
+echo "=========================================="
+echo "EXP-10: 异步MR注册启动时间"
+echo "总内存: ${TOTAL_GB}GB, 缓冲区: ${BUF_MB}MB"
+echo "=========================================="
+echo ""
+
+mkdir -p "$RESULTS_DIR"
+
+# 编译测试程序
+if [ ! -f "$SCRIPT_DIR/exp10_async_mr_reg" ]; then
+    echo "[Build] Compiling exp10_async_mr_reg..."
+    gcc -O2 -o "$SCRIPT_DIR/exp10_async_mr_reg" \
+        "$SCRIPT_DIR/src/exp10_async_mr_reg.c" -libverbs -ldl -lpthread || {
+        echo "[ERROR] Failed to compile"
+        exit 1
+    }
+fi
+
+export LD_PRELOAD="$PROJECT_DIR/build/librdma_intercept.so"
+export RDMA_INTERCEPT_ENABLE=1
+
+echo "[Test] 场景1: 同步ibv_reg_mr（拦截库，基线）"
+"$SCRIPT_DIR/exp10_async_mr_reg" -m sync -g "$TOTAL_GB" -b "$BUF_MB" -o "$RESULTS_DIR/sync.txt"
+
+echo ""
+echo "[Test] 场景2: 异步注册，不预取页面"
+RDMA_INTERCEPT_ASYNC_REG_WORKERS=4 RDMA_INTERCEPT_ASYNC_PREFAULT_THREADS=0 \
+    "$SCRIPT_DIR/exp10_async_mr_reg" -m async -g "$TOTAL_GB" -b "$BUF_MB" -o "$RESULTS_DIR/async_no_prefault.txt"
+
+echo ""
+echo "[Test] 场景3: 异步注册，4线程并行预取页面"
+RDMA_INTERCEPT_ASYNC_REG_WORKERS=4 RDMA_INTERCEPT_ASYNC_PREFAULT_THREADS=4 \
+    "$SCRIPT_DIR/exp10_async_mr_reg" -m async -g "$TOTAL_GB" -b "$BUF_MB" -o "$RESULTS_DIR/async_prefault.txt"
+unset LD_PRELOAD
+
+echo ""
+echo "=========================================="
+echo "实验完成！"
+echo "结果保存在:"
+echo "  - $RESULTS_DIR/sync.txt"
+echo "  - $RESULTS_DIR/async_no_prefault.txt"
+echo "  - $RESULTS_DIR/async_prefault.txt"
+echo "=========================================="
@@ -0,0 +1,217 @@
+/*
+ * EXP-10: 异步MR注册启动时间测试程序
+ *
+ * 测试目的: 对比同步ibv_reg_mr与rdma_intercept_reg_mr_async注册大块内存集合时
+ *           应用线程的阻塞时间和全部注册完成的时间
+ *
+ * 使用方法:
+ *   ./exp10_async_mr_reg --mode sync  --total-gb 64 --buf-mb 1024 --output sync.txt
+ *   ./exp10_async_mr_reg --mode async --total-gb 64 --buf-mb 1024 --output async.txt
+ *
+ * async模式需要通过LD_PRELOAD加载librdma_intercept.so
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <infiniband/verbs.h>
+#include <stdint.h>
+
+#define DEFAULT_TOTAL_GB 64
+#define DEFAULT_BUF_MB 1024
+
+/* 拦截库导出的异步注册接口（运行时解析，避免链接依赖） */
+typedef struct rdma_mr_async rdma_mr_async_t;
+typedef rdma_mr_async_t *(*reg_mr_async_fn)(struct ibv_pd *, void *, size_t, int);
+typedef int (*mr_async_wait_fn)(rdma_mr_async_t *, struct ibv_mr **);
+typedef void (*mr_async_free_fn)(rdma_mr_async_t *);
+
+typedef struct {
+    int async;
+    size_t total_gb;
+    size_t buf_mb;
+    char *output_file;
+    int verbose;
+} config_t;
+
+static inline double get_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("\nOptions:\n");
+    printf("  -m, --mode MODE      sync | async (default: sync)\n");
+    printf("  -g, --total-gb N     Total registered memory in GB (default: %d)\n", DEFAULT_TOTAL_GB);
+    printf("  -b, --buf-mb N       Size of each buffer in MB (default: %d)\n", DEFAULT_BUF_MB);
+    printf("  -o, --output FILE    Output file for results\n");
+    printf("  -v, --verbose        Verbose output\n");
+    printf("  -h, --help           Show this help\n");
+}
+
+static int parse_args(int argc, char **argv, config_t *config) {
+    config->async = 0;
+    config->total_gb = DEFAULT_TOTAL_GB;
+    config->buf_mb = DEFAULT_BUF_MB;
+    config->output_file = NULL;
+    config->verbose = 0;
+
+    static struct option long_options[] = {
+        {"mode", required_argument, 0, 'm'},
+        {"total-gb", required_argument, 0, 'g'},
+        {"buf-mb", required_argument, 0, 'b'},
+        {"output", required_argument, 0, 'o'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "m:g:b:o:vh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'm':
+                config->async = (strcmp(optarg, "async") == 0);
+                break;
+            case 'g':
+                config->total_gb = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                config->buf_mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                config->output_file = optarg;
+                break;
+            case 'v':
+                config->verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(0);
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (config->total_gb == 0 || config->buf_mb == 0 || config->buf_mb > config->total_gb * 1024) {
+        fprintf(stderr, "Error: invalid size parameters\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    config_t config;
+    if (parse_args(argc, argv, &config) != 0) {
+        return 1;
+    }
+
+    size_t buf_size = config.buf_mb << 20;
+    int num_bufs = (int)((config.total_gb << 10) / config.buf_mb);
+
+    reg_mr_async_fn reg_async = NULL;
+    mr_async_wait_fn wait_async = NULL;
+    mr_async_free_fn free_async = NULL;
+    if (config.async) {
+        reg_async = (reg_mr_async_fn)dlsym(RTLD_DEFAULT, "rdma_intercept_reg_mr_async");
+        wait_async = (mr_async_wait_fn)dlsym(RTLD_DEFAULT, "rdma_intercept_mr_async_wait");
+        free_async = (mr_async_free_fn)dlsym(RTLD_DEFAULT, "rdma_intercept_mr_async_free");
+        if (!reg_async || !wait_async || !free_async) {
+            fprintf(stderr, "Error: async API not found, run with LD_PRELOAD=librdma_intercept.so\n");
+            return 1;
+        }
+    }
+
+    void **bufs = calloc(num_bufs, sizeof(void *));
+    struct ibv_mr **mrs = calloc(num_bufs, sizeof(struct ibv_mr *));
+    rdma_mr_async_t **handles = calloc(num_bufs, sizeof(rdma_mr_async_t *));
+    if (!bufs || !mrs || !handles) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    /* 只映射不触碰，模拟应用启动时新分配的缓冲区 */
+    for (int i = 0; i < num_bufs; i++) {
+        bufs[i] = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufs[i] == MAP_FAILED) {
+            fprintf(stderr, "Error: Failed to map buffer %d\n", i);
+            return 1;
+        }
+    }
+
+    struct ibv_device **dev_list = ibv_get_device_list(NULL);
+    if (!dev_list || !dev_list[0]) {
+        fprintf(stderr, "Error: No RDMA device found\n");
+        return 1;
+    }
+    struct ibv_context *ctx = ibv_open_device(dev_list[0]);
+    struct ibv_pd *pd = ctx ? ibv_alloc_pd(ctx) : NULL;
+    if (!pd) {
+        fprintf(stderr, "Error: Failed to open device / allocate PD\n");
+        return 1;
+    }
+
+    int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    int success = 0;
+    double start = get_time_us();
+    double unblocked;
+
+    if (!config.async) {
+        for (int i = 0; i < num_bufs; i++) {
+            mrs[i] = ibv_reg_mr(pd, bufs[i], buf_size, access);
+            if (mrs[i]) success++;
+            else if (config.verbose) printf("MR %d: FAILED (errno=%d)\n", i, errno);
+        }
+        unblocked = get_time_us();
+    } else {
+        for (int i = 0; i < num_bufs; i++) {
+            handles[i] = reg_async(pd, bufs[i], buf_size, access);
+            if (!handles[i] && config.verbose) printf("MR %d: submit FAILED (errno=%d)\n", i, errno);
+        }
+        unblocked = get_time_us();
+        for (int i = 0; i < num_bufs; i++) {
+            if (!handles[i]) continue;
+            int err = wait_async(handles[i], &mrs[i]);
+            if (err == 0) success++;
+            else if (config.verbose) printf("MR %d: FAILED (errno=%d)\n", i, err);
+            free_async(handles[i]);
+        }
+    }
+    double done = get_time_us();
+
+    FILE *out = config.output_file ? fopen(config.output_file, "w") : stdout;
+    if (!out) out = stdout;
+    fprintf(out, "模式: %s\n", config.async ? "async" : "sync");
+    fprintf(out, "总内存: %zu GB\n", config.total_gb);
+    fprintf(out, "缓冲区大小: %zu MB\n", config.buf_mb);
+    fprintf(out, "缓冲区数量: %d\n", num_bufs);
+    fprintf(out, "成功: %d\n", success);
+    fprintf(out, "应用线程阻塞时间: %.2f ms\n", (unblocked - start) / 1e3);
+    fprintf(out, "全部注册完成时间: %.2f ms\n", (done - start) / 1e3);
+    fprintf(out, "注册吞吐: %.2f GB/s\n", success * (double)buf_size / (1ULL << 30) / ((done - start) / 1e6));
+    if (out != stdout) {
+        fclose(out);
+        printf("Results written to %s\n", config.output_file);
+    }
+
+    for (int i = 0; i < num_bufs; i++) {
+        if (mrs[i]) ibv_dereg_mr(mrs[i]);
+        munmap(bufs[i], buf_size);
+    }
+    ibv_dealloc_pd(pd);
+    ibv_close_device(ctx);
+    ibv_free_device_list(dev_list);
+    free(bufs);
+    free(mrs);
+    free(handles);
+    return 0;
+}
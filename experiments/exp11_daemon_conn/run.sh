@@ -0,0 +1,120 @@
+#!/bin/bash
+# EXP-11: 租户管理守护进程请求吞吐测试
+# 用法: ./run.sh [并发客户端数] [请求总数]
+# 设置BASELINE_DAEMON为旧版（select单请求循环）守护进程路径时额外测量基线
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+RESULTS_DIR="$SCRIPT_DIR/results"
+PROJECT_DIR="$(dirname "$(dirname "$SCRIPT_DIR")")"
+
+CLIENTS=${1:-8}
+REQUESTS=${2:-20000}
+DAEMON_BIN="$PROJECT_DIR/build/tenant_manager_daemon"
+CLIENT_BIN="$PROJECT_DIR/build/tenant_manager_client"
+
+echo "=========================================="
+echo "EXP-11: 守护进程长连接请求吞吐"
+echo "并发客户端: ${CLIENTS}, 请求总数: ${REQUESTS}"
+echo "=========================================="
+echo ""
+
+mkdir -p "$RESULTS_DIR"
+
+# 编译测试程序
+if [ ! -f "$SCRIPT_DIR/exp11_daemon_conn" ]; then
+    echo "[Build] Compiling exp11_daemon_conn..."
+    gcc -O2 -I"$PROJECT_DIR/include" -o "$SCRIPT_DIR/exp11_daemon_conn" \
+        "$SCRIPT_DIR/src/exp11_daemon_conn.c" -lpthread || {
+        echo "[ERROR] Failed to compile"
+        exit 1
+    }
+fi
+
+DAEMON_PID=""
+start_daemon() {
+    "$1" --daemon --foreground 2>/dev/null &
+    DAEMON_PID=$!
+    sleep 1
+    "$CLIENT_BIN" create 20 100 100 >/dev/null
+    # 填满租户表，后台LIST_TENANTS返回最大的响应
+    for id in $(seq 21 63); do
+        "$CLIENT_BIN" create "$id" 100 100 >/dev/null
+    done
+}
+stop_daemon() {
+    kill "$DAEMON_PID" 2>/dev/null || true
+    wait "$DAEMON_PID" 2>/dev/null || true
+}
+trap stop_daemon EXIT
+
+if [ -n "$BASELINE_DAEMON" ]; then
+    echo "[Test] 基线: 旧守护进程，每请求新建连接"
+    start_daemon "$BASELINE_DAEMON"
+    "$SCRIPT_DIR/exp11_daemon_conn" -m oneshot -c "$CLIENTS" -n "$REQUESTS" -o "$RESULTS_DIR/baseline_oneshot.txt"
+    echo "[Test] 基线: 旧守护进程，4个连接后台循环LIST_TENANTS"
+    "$SCRIPT_DIR/exp11_daemon_conn" -p 1 -c 1 -n "$REQUESTS" -L 4 -o "$RESULTS_DIR/baseline_list_load.txt"
+    stop_daemon
+    echo ""
+fi
+
+start_daemon "$DAEMON_BIN"
+
+echo "[Test] 场景1: 每请求新建连接"
+"$SCRIPT_DIR/exp11_daemon_conn" -m oneshot -c "$CLIENTS" -n "$REQUESTS" -o "$RESULTS_DIR/oneshot.txt"
+
+echo ""
+echo "[Test] 场景2: 长连接，请求-响应交替"
+"$SCRIPT_DIR/exp11_daemon_conn" -m persistent -p 1 -c "$CLIENTS" -n "$REQUESTS" -o "$RESULTS_DIR/persistent.txt"
+
+echo ""
+echo "[Test] 场景3: 长连接，流水线深度16"
+"$SCRIPT_DIR/exp11_daemon_conn" -m persistent -p 16 -c "$CLIENTS" -n "$REQUESTS" -o "$RESULTS_DIR/pipelined.txt"
+
+for PROTO in json binary; do
+    echo ""
+    echo "[Test] 场景4: ${PROTO}协议，单连接请求-响应交替"
+    "$SCRIPT_DIR/exp11_daemon_conn" -m persistent -P "$PROTO" -p 1 -c 1 -n "$REQUESTS" \
+        -d "$DAEMON_PID" -o "$RESULTS_DIR/${PROTO}_rtt.txt"
+    echo ""
+    echo "[Test] 场景5: ${PROTO}协议，4连接流水线深度16"
+    "$SCRIPT_DIR/exp11_daemon_conn" -m persistent -P "$PROTO" -p 16 -c 4 -n $((REQUESTS * 10)) \
+        -d "$DAEMON_PID" -o "$RESULTS_DIR/${PROTO}_pipelined.txt"
+done
+
+echo ""
+echo "[Test] 场景6: 共享内存命令环，1个客户端"
+"$SCRIPT_DIR/exp11_daemon_conn" -P ring -c 1 -n "$REQUESTS" -d "$DAEMON_PID" -o "$RESULTS_DIR/ring_rtt.txt"
+echo ""
+echo "[Test] 场景7: 共享内存命令环，4个客户端"
+"$SCRIPT_DIR/exp11_daemon_conn" -P ring -c 4 -n $((REQUESTS * 4)) -d "$DAEMON_PID" -o "$RESULTS_DIR/ring_4clients.txt"
+
+echo ""
+echo "[Test] 场景8: 4个连接后台循环LIST_TENANTS时的配额更新延迟"
+"$SCRIPT_DIR/exp11_daemon_conn" -p 1 -c 1 -n "$REQUESTS" -L 4 -d "$DAEMON_PID" -o "$RESULTS_DIR/list_load.txt"
+
+echo ""
+echo "[Test] 场景9: 持续更新配额期间平滑升级两次（--upgrade）"
+"$SCRIPT_DIR/exp11_daemon_conn" -m persistent -p 4 -c 2 -n $((REQUESTS * 10)) -o "$RESULTS_DIR/upgrade_json.txt" &
+UPGRADE_CLIENTS="$!"
+"$SCRIPT_DIR/exp11_daemon_conn" -m persistent -P binary -p 4 -c 2 -n $((REQUESTS * 10)) -o "$RESULTS_DIR/upgrade_binary.txt" &
+UPGRADE_CLIENTS="$UPGRADE_CLIENTS $!"
+"$SCRIPT_DIR/exp11_daemon_conn" -m oneshot -c 2 -n $((REQUESTS / 2)) -o "$RESULTS_DIR/upgrade_oneshot.txt" &
+UPGRADE_CLIENTS="$UPGRADE_CLIENTS $!"
+"$SCRIPT_DIR/exp11_daemon_conn" -P ring -c 1 -n $((REQUESTS * 15 / 2)) -o "$RESULTS_DIR/upgrade_ring.txt" &
+UPGRADE_CLIENTS="$UPGRADE_CLIENTS $!"
+sleep 0.5
+for n in 1 2; do
+    # 旧进程交出连接后自行退出，之后由新进程接受下一次升级
+    "$DAEMON_BIN" --daemon --foreground --upgrade 2>/dev/null &
+    DAEMON_PID=$!
+    sleep 1
+done
+wait $UPGRADE_CLIENTS
+
+echo ""
+echo "=========================================="
+echo "实验完成！"
+echo "结果保存在: $RESULTS_DIR"
+echo "=========================================="
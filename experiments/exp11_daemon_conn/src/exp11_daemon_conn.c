@@ -0,0 +1,544 @@
+/*
+ * EXP-11: 租户管理守护进程请求吞吐测试程序
+ *
+ * 测试目的: 对比每个请求新建连接（旧的select单请求循环只支持这种方式）
+ *           与长连接+流水线请求时UPDATE_QUOTA的吞吐和延迟，JSON与二进制
+ *           协议下守护进程每个请求消耗的CPU时间，共享内存命令环的往返延迟，
+ *           以及后台持续LIST_TENANTS时配额更新的尾延迟
+ *
+ * 使用方法:
+ *   ./exp11_daemon_conn --mode oneshot    --clients 8 --requests 20000 --output oneshot.txt
+ *   ./exp11_daemon_conn --mode persistent --clients 8 --requests 20000 --pipeline 16 --output persistent.txt
+ *   ./exp11_daemon_conn --mode persistent --proto binary --clients 1 --pipeline 1 --daemon-pid PID
+ *   ./exp11_daemon_conn --proto ring --clients 1 --daemon-pid PID     # 命令环每客户端只有一个请求在途
+ *   ./exp11_daemon_conn --clients 1 --pipeline 1 --list-load 4        # 4个连接在后台循环LIST_TENANTS
+ *
+ * 运行前需要启动tenant_manager_daemon并创建测试租户
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include "tenant_proto.h"
+#include "tenant_cmd_ring.h"
+
+#define SOCKET_PATH "/tmp/rdma_tenant_manager.sock"
+#define DEFAULT_CLIENTS 8
+#define DEFAULT_REQUESTS 20000
+#define DEFAULT_PIPELINE 16
+#define DEFAULT_TENANT 20
+#define MAX_PIPELINE 1024
+
+typedef struct {
+    int persistent;
+    int binary;
+    int ring;                           // 经共享内存命令环提交（消息体同二进制协议）
+    int daemon_pid;
+    int clients;
+    int requests;
+    int pipeline;
+    int tenant;
+    int list_load;                      // 后台循环LIST_TENANTS的连接数
+    char *output_file;
+} config_t;
+
+typedef struct {
+    const config_t *config;
+    int id;
+    int count;
+    double *lat_us;
+    int done;
+    int failed;
+} worker_t;
+
+static volatile int list_stop;
+
+static inline double get_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("\nOptions:\n");
+    printf("  -m, --mode MODE      oneshot | persistent (default: persistent)\n");
+    printf("  -P, --proto PROTO    json | binary | ring (default: json)\n");
+    printf("  -d, --daemon-pid PID Report daemon CPU time per request\n");
+    printf("  -c, --clients N      Concurrent clients (default: %d)\n", DEFAULT_CLIENTS);
+    printf("  -n, --requests N     Total requests (default: %d)\n", DEFAULT_REQUESTS);
+    printf("  -p, --pipeline N     Requests in flight per connection (default: %d)\n", DEFAULT_PIPELINE);
+    printf("  -t, --tenant ID      Tenant to update (default: %d)\n", DEFAULT_TENANT);
+    printf("  -L, --list-load N    Background connections looping LIST_TENANTS (default: 0)\n");
+    printf("  -o, --output FILE    Output file for results\n");
+    printf("  -h, --help           Show this help\n");
+}
+
+static int parse_args(int argc, char **argv, config_t *config) {
+    config->persistent = 1;
+    config->binary = 0;
+    config->ring = 0;
+    config->daemon_pid = 0;
+    config->clients = DEFAULT_CLIENTS;
+    config->requests = DEFAULT_REQUESTS;
+    config->pipeline = DEFAULT_PIPELINE;
+    config->tenant = DEFAULT_TENANT;
+    config->list_load = 0;
+    config->output_file = NULL;
+
+    static struct option long_options[] = {
+        {"mode", required_argument, 0, 'm'},
+        {"proto", required_argument, 0, 'P'},
+        {"daemon-pid", required_argument, 0, 'd'},
+        {"clients", required_argument, 0, 'c'},
+        {"requests", required_argument, 0, 'n'},
+        {"pipeline", required_argument, 0, 'p'},
+        {"tenant", required_argument, 0, 't'},
+        {"list-load", required_argument, 0, 'L'},
+        {"output", required_argument, 0, 'o'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "m:P:d:c:n:p:t:L:o:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'm':
+                if (strcmp(optarg, "oneshot") == 0) config->persistent = 0;
+                else if (strcmp(optarg, "persistent") == 0) config->persistent = 1;
+                else return -1;
+                break;
+            case 'P':
+                if (strcmp(optarg, "json") == 0) config->binary = 0;
+                else if (strcmp(optarg, "binary") == 0) config->binary = 1;
+                else if (strcmp(optarg, "ring") == 0) config->binary = config->ring = 1;
+                else return -1;
+                break;
+            case 'd': config->daemon_pid = atoi(optarg); break;
+            case 'c': config->clients = atoi(optarg); break;
+            case 'n': config->requests = atoi(optarg); break;
+            case 'p': config->pipeline = atoi(optarg); break;
+            case 't': config->tenant = atoi(optarg); break;
+            case 'L': config->list_load = atoi(optarg); break;
+            case 'o': config->output_file = optarg; break;
+            case 'h': print_usage(argv[0]); exit(0);
+            default: return -1;
+        }
+    }
+    if (config->clients <= 0 || config->requests <= 0 || config->list_load < 0 ||
+        config->pipeline <= 0 || config->pipeline > MAX_PIPELINE) {
+        return -1;
+    }
+    return 0;
+}
+
+static int connect_daemon(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int format_binary(char *buf, size_t len, uint16_t type, int seq, const uint8_t *body, size_t body_len) {
+    tenant_proto_hdr_t hdr = {
+        .magic = TENANT_PROTO_MAGIC,
+        .version = TENANT_PROTO_VERSION,
+        .type = type,
+        .seq = (uint32_t)seq,
+        .length = (uint32_t)body_len
+    };
+    if (sizeof(hdr) + body_len > len) {
+        return -1;
+    }
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), body, body_len);
+    return (int)(sizeof(hdr) + body_len);
+}
+
+static int format_request(char *buf, size_t len, const config_t *config, int seq) {
+    // 配额在两个值之间交替，保证每次都真正写入共享内存
+    if (config->binary) {
+        uint8_t body[64];
+        size_t off = 0;
+        tenant_proto_put_u32(body, &off, sizeof(body), TENANT_TLV_TENANT, config->tenant);
+        tenant_proto_put_u32(body, &off, sizeof(body), TENANT_TLV_QP, 100 + (seq & 1));
+        tenant_proto_put_u32(body, &off, sizeof(body), TENANT_TLV_MR, 100);
+        tenant_proto_put_u64(body, &off, sizeof(body), TENANT_TLV_MEMORY, 1073741824ULL);
+        return format_binary(buf, len, TENANT_PROTO_UPDATE_QUOTA, seq + 1, body, off);
+    }
+    return snprintf(buf, len, "{\"cmd\":\"UPDATE_QUOTA\",\"tenant\":%d,\"qp\":%d,\"mr\":100,\"memory\":1073741824}\n",
+                    config->tenant, 100 + (seq & 1));
+}
+
+static int format_hello(char *buf, size_t len) {
+    uint8_t body[16];
+    size_t off = 0;
+    tenant_proto_put_u32(body, &off, sizeof(body), TENANT_TLV_VERSION, TENANT_PROTO_VERSION);
+    return format_binary(buf, len, TENANT_PROTO_HELLO, 0, body, off);
+}
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* 读取want个二进制响应帧，返回实际收到的数量 */
+static int recv_frames(int fd, int want, int *success) {
+    uint8_t body[TENANT_PROTO_MAX_BODY];
+    int got = 0;
+    while (got < want) {
+        tenant_proto_hdr_t hdr;
+        size_t have = 0;
+        while (have < sizeof(hdr)) {
+            ssize_t n = recv(fd, (char *)&hdr + have, sizeof(hdr) - have, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return got;
+            have += n;
+        }
+        if (hdr.magic != TENANT_PROTO_MAGIC || hdr.length > sizeof(body)) return got;
+        have = 0;
+        while (have < hdr.length) {
+            ssize_t n = recv(fd, body + have, hdr.length - have, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return got;
+            have += n;
+        }
+        size_t off = 0;
+        uint16_t tag, len;
+        const uint8_t *val;
+        uint64_t status;
+        while (tenant_proto_next(body, hdr.length, &off, &tag, &val, &len) > 0) {
+            if (tag == TENANT_TLV_STATUS && tenant_proto_get_uint(val, len, &status) == 0 && status != 0) {
+                if (success) *success = 0;
+            }
+        }
+        got++;
+    }
+    return got;
+}
+
+/* 读取响应直到收到want个换行，返回实际收到的数量 */
+static int recv_lines(int fd, int want, int *success) {
+    char buf[8192];
+    int got = 0;
+    while (got < want) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') got++;
+        }
+        if (success && memmem(buf, n, "\"success\": false", 16)) *success = 0;
+    }
+    return got;
+}
+
+static int recv_responses(const config_t *config, int fd, int want, int *success) {
+    return config->binary ? recv_frames(fd, want, success) : recv_lines(fd, want, success);
+}
+
+static void run_oneshot(worker_t *w) {
+    char req[512];
+    for (int i = 0; i < w->count; i++) {
+        // 二进制协议每个连接先发HELLO，与请求合并为一次发送
+        int hello = w->config->binary ? format_hello(req, sizeof(req)) : 0;
+        int len = hello + format_request(req + hello, sizeof(req) - hello, w->config, i);
+        double t0 = get_time_us();
+        int fd = connect_daemon();
+        if (fd < 0) {
+            w->failed++;
+            continue;
+        }
+        int ok = 1;
+        int want = w->config->binary ? 2 : 1;
+        if (send_all(fd, req, len) != 0 || recv_responses(w->config, fd, want, &ok) != want || !ok) {
+            w->failed++;
+        } else {
+            w->lat_us[w->done++] = get_time_us() - t0;
+        }
+        close(fd);
+    }
+}
+
+static void run_persistent(worker_t *w) {
+    int fd = connect_daemon();
+    if (fd < 0) {
+        w->failed = w->count;
+        return;
+    }
+
+    char req[256];
+    double sent_at[MAX_PIPELINE];
+    int depth = w->config->pipeline;
+    if (w->config->binary) {
+        int ok = 1;
+        int len = format_hello(req, sizeof(req));
+        if (send_all(fd, req, len) != 0 || recv_frames(fd, 1, &ok) != 1 || !ok) {
+            w->failed = w->count;
+            close(fd);
+            return;
+        }
+    }
+    for (int i = 0; i < w->count; i += depth) {
+        int batch = (w->count - i < depth) ? w->count - i : depth;
+        for (int j = 0; j < batch; j++) {
+            int len = format_request(req, sizeof(req), w->config, i + j);
+            sent_at[j] = get_time_us();
+            if (send_all(fd, req, len) != 0) {
+                w->failed += w->count - i;
+                close(fd);
+                return;
+            }
+        }
+        int ok = 1;
+        int got = recv_responses(w->config, fd, batch, &ok);
+        double now = get_time_us();
+        for (int j = 0; j < got; j++) {
+            w->lat_us[w->done++] = now - sent_at[j];
+        }
+        if (got < batch) {
+            w->failed += w->count - i - got;
+            break;
+        }
+    }
+    close(fd);
+}
+
+static tenant_cmd_ring_t *open_ring(void) {
+    int fd = shm_open(TENANT_RING_NAME, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    tenant_cmd_ring_t *ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED || __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != TENANT_RING_MAGIC) {
+        return NULL;
+    }
+    return ring;
+}
+
+/* 命令环：每个客户端占一个响应槽，请求-响应交替 */
+static void run_ring(worker_t *w) {
+    tenant_cmd_ring_t *ring = open_ring();
+    int slot = ring ? tenant_ring_acquire_slot(ring) : -1;
+    if (slot < 0) {
+        w->failed = w->count;
+        return;
+    }
+
+    char req[256];
+    uint8_t resp[TENANT_RING_MSG_MAX];
+    for (int i = 0; i < w->count; i++) {
+        int len = format_request(req, sizeof(req), w->config, i);
+        const tenant_proto_hdr_t *hdr = (const tenant_proto_hdr_t *)req;
+        tenant_proto_hdr_t rhdr;
+        double t0 = get_time_us();
+        if (tenant_ring_submit(ring, slot, hdr->type, hdr->seq, (const uint8_t *)req + sizeof(*hdr),
+                               len - sizeof(*hdr)) != 0 ||
+            tenant_ring_wait(ring, slot, 5000, &rhdr, resp) != 0) {
+            w->failed += w->count - i;
+            return;
+        }
+        double t1 = get_time_us();
+        size_t off = 0;
+        uint16_t tag, vlen;
+        const uint8_t *val;
+        uint64_t status = 0;
+        while (tenant_proto_next(resp, rhdr.length, &off, &tag, &val, &vlen) > 0) {
+            if (tag == TENANT_TLV_STATUS) {
+                tenant_proto_get_uint(val, vlen, &status);
+            }
+        }
+        if (rhdr.seq != hdr->seq || status != 0) {
+            w->failed++;
+        } else {
+            w->lat_us[w->done++] = t1 - t0;
+        }
+    }
+    tenant_ring_release_slot(ring, slot);
+    munmap(ring, sizeof(*ring));
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    if (w->config->ring) {
+        run_ring(w);
+    } else if (w->config->persistent) {
+        run_persistent(w);
+    } else {
+        run_oneshot(w);
+    }
+    return NULL;
+}
+
+/* 后台负载：在独立连接上循环LIST_TENANTS直到测量结束，返回完成的请求数 */
+static void *list_main(void *arg) {
+    static const char req[] = "{\"cmd\":\"LIST_TENANTS\"}\n";
+    long *count = arg;
+    int fd = connect_daemon();
+    if (fd < 0) return NULL;
+    while (!list_stop) {
+        if (send_all(fd, req, sizeof(req) - 1) != 0 || recv_lines(fd, 1, NULL) != 1) {
+            break;
+        }
+        (*count)++;
+    }
+    close(fd);
+    return NULL;
+}
+
+/* 读取进程累计CPU时间（us），失败返回-1 */
+static double process_cpu_us(int pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // 跳过可能含空格的进程名，utime/stime为其后的第12、13个字段
+    char *p = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    config_t config;
+    if (parse_args(argc, argv, &config) != 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    worker_t *workers = calloc(config.clients, sizeof(worker_t));
+    pthread_t *threads = calloc(config.clients, sizeof(pthread_t));
+    double *lat = calloc(config.requests, sizeof(double));
+    if (!workers || !threads || !lat) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < config.clients; i++) {
+        workers[i].config = &config;
+        workers[i].id = i;
+        workers[i].count = config.requests / config.clients + (i < config.requests % config.clients);
+        workers[i].lat_us = lat + offset;
+        offset += workers[i].count;
+    }
+
+    // 命令环的门铃和唤醒次数反映了需要系统调用的请求数
+    tenant_cmd_ring_t *ring = config.ring ? open_ring() : NULL;
+    uint64_t doorbells = ring ? ring->doorbells : 0;
+    uint64_t wakeups = ring ? ring->client_wakeups : 0;
+
+    pthread_t *list_threads = calloc(config.list_load + 1, sizeof(pthread_t));
+    long *list_counts = calloc(config.list_load + 1, sizeof(long));
+    for (int i = 0; i < config.list_load; i++) {
+        pthread_create(&list_threads[i], NULL, list_main, &list_counts[i]);
+    }
+    if (config.list_load > 0) {
+        usleep(100000);                 // 等后台LIST进入稳定状态
+    }
+
+    double cpu_start = config.daemon_pid ? process_cpu_us(config.daemon_pid) : -1;
+    double start = get_time_us();
+    for (int i = 0; i < config.clients; i++) {
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+    for (int i = 0; i < config.clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = get_time_us() - start;
+    double cpu_end = config.daemon_pid ? process_cpu_us(config.daemon_pid) : -1;
+
+    list_stop = 1;
+    long lists = 0;
+    for (int i = 0; i < config.list_load; i++) {
+        pthread_join(list_threads[i], NULL);
+        lists += list_counts[i];
+    }
+
+    // 汇总成功请求的延迟
+    int done = 0, failed = 0;
+    for (int i = 0; i < config.clients; i++) {
+        memmove(lat + done, workers[i].lat_us, workers[i].done * sizeof(double));
+        done += workers[i].done;
+        failed += workers[i].failed;
+    }
+    qsort(lat, done, sizeof(double), cmp_double);
+
+    FILE *out = config.output_file ? fopen(config.output_file, "w") : stdout;
+    if (!out) out = stdout;
+    fprintf(out, "模式: %s\n", config.persistent ? "persistent" : "oneshot");
+    fprintf(out, "协议: %s\n", config.ring ? "ring" : (config.binary ? "binary" : "json"));
+    fprintf(out, "并发客户端: %d\n", config.clients);
+    fprintf(out, "流水线深度: %d\n", config.persistent && !config.ring ? config.pipeline : 1);
+    if (config.list_load > 0) {
+        fprintf(out, "后台LIST连接: %d (完成%ld次LIST_TENANTS)\n", config.list_load, lists);
+    }
+    fprintf(out, "成功请求: %d\n", done);
+    fprintf(out, "失败请求: %d\n", failed);
+    fprintf(out, "总耗时: %.2f ms\n", elapsed / 1e3);
+    fprintf(out, "吞吐: %.0f req/s\n", done / (elapsed / 1e6));
+    if (done > 0) {
+        fprintf(out, "延迟P50: %.1f us\n", lat[done / 2]);
+        fprintf(out, "延迟P99: %.1f us\n", lat[(int)(done * 0.99)]);
+        fprintf(out, "延迟最大: %.1f us\n", lat[done - 1]);
+    }
+    if (done > 0 && cpu_start >= 0 && cpu_end >= 0) {
+        fprintf(out, "守护进程CPU: %.2f us/req\n", (cpu_end - cpu_start) / done);
+    }
+    if (ring) {
+        fprintf(out, "门铃(FUTEX_WAKE守护进程): %llu\n", (unsigned long long)(ring->doorbells - doorbells));
+        fprintf(out, "唤醒客户端(FUTEX_WAKE客户端): %llu\n", (unsigned long long)(ring->client_wakeups - wakeups));
+        munmap(ring, sizeof(*ring));
+    }
+    if (out != stdout) {
+        fclose(out);
+        printf("Results written to %s\n", config.output_file);
+    }
+
+    free(workers);
+    free(threads);
+    free(list_threads);
+    free(list_counts);
+    free(lat);
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/bash
+# EXP-12: STATUS/LIST_TENANTS响应编码开销测试
+# 用法: ./run.sh [每个场景的请求数]
+# 不需要运行中的守护进程：测试程序按不同的MAX_TENANTS编译，使用独立的租户共享内存
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+RESULTS_DIR="$SCRIPT_DIR/results"
+PROJECT_DIR="$(dirname "$(dirname "$SCRIPT_DIR")")"
+
+ITERATIONS=${1:-1000}
+
+echo "=========================================="
+echo "EXP-12: STATUS/LIST_TENANTS响应编码开销"
+echo "每个场景请求数: ${ITERATIONS}"
+echo "=========================================="
+echo ""
+
+mkdir -p "$RESULTS_DIR"
+
+# 租户数 = MAX_TENANTS - 1（租户ID 0保留）
+for MAX in 64 512 4096; do
+    BIN="$SCRIPT_DIR/exp12_status_encoding_$MAX"
+    if [ ! -f "$BIN" ]; then
+        echo "[Build] Compiling exp12_status_encoding (MAX_TENANTS=$MAX)..."
+        gcc -O2 -DMAX_TENANTS=$MAX -DTENANT_SHM_NAME="\"/rdma_exp12_tenant_shm\"" \
+            -I"$PROJECT_DIR/include" -I"$PROJECT_DIR/src" -o "$BIN" \
+            "$SCRIPT_DIR/src/exp12_status_encoding.c" "$PROJECT_DIR/src/shm/shared_memory_tenant.c" \
+            "$PROJECT_DIR/src/shm/tenant_journal.c" \
+            -ljson-c -lpthread -lrt || {
+            echo "[ERROR] Failed to compile"
+            exit 1
+        }
+    fi
+    
+    # 租户多时减少请求数，保持每个场景的运行时间相近
+    N=$ITERATIONS
+    [ "$MAX" -ge 512 ] && N=$((ITERATIONS / 4))
+    [ "$MAX" -ge 4096 ] && N=$((ITERATIONS / 10))
+    
+    echo ""
+    echo "[Test] $((MAX - 1))个租户"
+    "$BIN" --iterations "$N" --output "$RESULTS_DIR/tenants_$((MAX - 1)).txt" 2>/dev/null
+done
+
+echo ""
+echo "=========================================="
+echo "实验完成！"
+echo "结果保存在: $RESULTS_DIR"
+echo "=========================================="
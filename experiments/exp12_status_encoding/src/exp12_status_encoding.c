@@ -0,0 +1,320 @@
+/*
+ * EXP-12: STATUS/LIST_TENANTS响应编码开销测试程序
+ *
+ * 测试目的: 对比旧的json-c对象树编码（每个字段一个对象，序列化后再strdup）
+ *           与守护进程的流式JSON编码（从租户快照直接写到Socket）在不同租户数下
+ *           每个请求的内存分配次数、编码+发送耗时和响应大小
+ *
+ * 程序直接包含守护进程源码，调用其中的handle_status()/handle_list_tenants()；
+ * 对照组是重构前的json-c编码（legacy_*，逐字复制）。租户数由编译时的
+ * -DMAX_TENANTS决定，使用独立的租户共享内存（-DTENANT_SHM_NAME），不影响运行中的守护进程。
+ *
+ * 使用方法:
+ *   gcc -O2 -DMAX_TENANTS=512 -DTENANT_SHM_NAME='"/rdma_exp12_tenant_shm"' -Iinclude -Isrc \
+ *       exp12_status_encoding.c src/shm/shared_memory_tenant.c src/shm/tenant_journal.c -ljson-c -lpthread -lrt
+ *   ./exp12_status_encoding --iterations 1000 --output result.txt
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+
+/* 统计本线程的malloc/calloc/realloc次数（glibc内部和json-c的分配同样经过这里） */
+extern void* __libc_malloc(size_t n);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t n);
+extern void __libc_free(void* p);
+
+static __thread int counting;
+static __thread uint64_t alloc_count;
+
+void* malloc(size_t n) {
+    if (counting) alloc_count++;
+    return __libc_malloc(n);
+}
+
+void* calloc(size_t n, size_t size) {
+    if (counting) alloc_count++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t n) {
+    if (counting) alloc_count++;
+    return __libc_realloc(p, n);
+}
+
+void free(void* p) {
+    __libc_free(p);
+}
+
+#define main tenant_manager_daemon_main
+#include "../../../src/tenant_manager_daemon.c"
+#undef main
+
+#include <getopt.h>
+
+/* ========== 对照组：重构前的json-c编码 ========== */
+
+static char* legacy_status_all(void) {
+    json_object* tenants_array = json_object_new_array();
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    
+    if (shm) {
+        for (int i = 0; i < MAX_TENANTS; i++) {
+            tenant_quota_t quota;
+            if (shm->tenants[i].status != TENANT_STATUS_INACTIVE && tenant_get_quota(i, &quota) == 0) {
+                json_object* t = json_object_new_object();
+                json_object_object_add(t, "id", json_object_new_int(shm->tenants[i].tenant_id));
+                json_object_object_add(t, "name", json_object_new_string(shm->tenants[i].tenant_name));
+                json_object_object_add(t, "status", json_object_new_int(shm->tenants[i].status));
+                json_object_object_add(t, "qp_used", json_object_new_int(shm->tenants[i].usage.qp_count));
+                json_object_object_add(t, "qp_limit", json_object_new_int(quota.max_qp_per_tenant));
+                json_object_object_add(t, "mr_used", json_object_new_int(shm->tenants[i].usage.mr_count));
+                json_object_object_add(t, "mr_limit", json_object_new_int(quota.max_mr_per_tenant));
+                json_object_object_add(t, "memory_used", json_object_new_int64(shm->tenants[i].usage.memory_used));
+                json_object_object_add(t, "memory_limit", json_object_new_int64(quota.max_memory_per_tenant));
+                json_object_object_add(t, "dm_used", json_object_new_int64(shm->tenants[i].usage.dm_used));
+                json_object_object_add(t, "dm_limit", json_object_new_int64(quota.max_dm_bytes_per_tenant));
+                json_object_array_add(tenants_array, t);
+            }
+        }
+    }
+    
+    return build_response(1, "All tenants status", tenants_array);
+}
+
+static char* legacy_list_tenants(void) {
+    json_object* tenants_array = json_object_new_array();
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    
+    if (shm) {
+        for (int i = 0; i < MAX_TENANTS; i++) {
+            tenant_quota_t quota;
+            if (shm->tenants[i].status != TENANT_STATUS_INACTIVE && tenant_get_quota(i, &quota) == 0) {
+                json_object* t = json_object_new_object();
+                json_object_object_add(t, "id", json_object_new_int(shm->tenants[i].tenant_id));
+                json_object_object_add(t, "name", json_object_new_string(shm->tenants[i].tenant_name));
+                json_object_object_add(t, "qp_used", json_object_new_int(shm->tenants[i].usage.qp_count));
+                json_object_object_add(t, "qp_limit", json_object_new_int(quota.max_qp_per_tenant));
+                json_object_object_add(t, "mr_used", json_object_new_int(shm->tenants[i].usage.mr_count));
+                json_object_object_add(t, "mr_limit", json_object_new_int(quota.max_mr_per_tenant));
+                json_object_object_add(t, "dm_used", json_object_new_int64(shm->tenants[i].usage.dm_used));
+                json_object_object_add(t, "dm_limit", json_object_new_int64(quota.max_dm_bytes_per_tenant));
+                json_object_array_add(tenants_array, t);
+            }
+        }
+    }
+    
+    json_object* data = json_object_new_object();
+    json_object_object_add(data, "count", json_object_new_int(json_object_array_length(tenants_array)));
+    json_object_object_add(data, "version", json_object_new_int64(shm ? shm->version : 0));
+    json_object_object_add(data, "quota_epoch", json_object_new_int64(tenant_quota_epoch()));
+    if (shm) {
+        json_object* limits = json_object_new_object();
+        json_object_object_add(limits, "qp", json_object_new_int64(shm->global_limits.max_total_qp));
+        json_object_object_add(limits, "mr", json_object_new_int64(shm->global_limits.max_total_mr));
+        json_object_object_add(limits, "memory", json_object_new_int64(shm->global_limits.max_total_memory));
+        json_object_object_add(data, "global_limits", limits);
+    }
+    json_object_object_add(data, "tenants", tenants_array);
+    
+    return build_response(1, "Tenant list", data);
+}
+
+/* ========== 测试框架 ========== */
+
+typedef struct {
+    int iterations;
+    char *output_file;
+} config_t;
+
+/* 对端读线程：把响应读空，统计字节数 */
+static int peer_fd = -1;
+static volatile uint64_t peer_bytes;
+
+static void* drain_thread(void* arg) {
+    (void)arg;
+    char buf[65536];
+    ssize_t n;
+    while ((n = recv(peer_fd, buf, sizeof(buf), 0)) > 0) {
+        __atomic_add_fetch(&peer_bytes, n, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* 与conn_handle_request相同：响应字符串追加到输出缓冲后发送 */
+static void send_string(client_conn_t* conn, char* response) {
+    buf_append(&conn->out, &conn->out_len, &conn->out_cap, response, strlen(response));
+    buf_append(&conn->out, &conn->out_len, &conn->out_cap, "\n", 1);
+    free(response);
+}
+
+typedef struct {
+    const char* name;
+    int streaming;
+    int list;
+} scenario_t;
+
+static void run_scenario(const config_t* config, const scenario_t* sc, client_conn_t* conn,
+                         json_object* status_cmd, FILE* out) {
+    double* lat = calloc(config->iterations, sizeof(double));
+    uint64_t allocs = 0;
+    uint64_t bytes_before = __atomic_load_n(&peer_bytes, __ATOMIC_RELAXED);
+    
+    for (int i = 0; i < config->iterations; i++) {
+        double t0 = now_us();
+        alloc_count = 0;
+        counting = 1;
+        if (sc->streaming) {
+            if (sc->list) {
+                handle_list_tenants(conn);
+            } else {
+                handle_status(status_cmd, conn);
+            }
+        } else {
+            send_string(conn, sc->list ? legacy_list_tenants() : legacy_status_all());
+        }
+        counting = 0;
+        allocs += alloc_count;
+        // 对端来不及读时等待输出缓冲发完
+        while (conn->out_len > 0) {
+            conn_flush(conn);
+        }
+        lat[i] = now_us() - t0;
+    }
+    
+    // 等待对端读完，统计平均响应大小
+    uint64_t expect_min = bytes_before + config->iterations;
+    while (__atomic_load_n(&peer_bytes, __ATOMIC_RELAXED) < expect_min) {
+        usleep(100);
+    }
+    usleep(10000);
+    double resp_bytes = (double)(__atomic_load_n(&peer_bytes, __ATOMIC_RELAXED) - bytes_before) / config->iterations;
+    
+    qsort(lat, config->iterations, sizeof(double), cmp_double);
+    double sum = 0;
+    for (int i = 0; i < config->iterations; i++) {
+        sum += lat[i];
+    }
+    
+    char line[256];
+    snprintf(line, sizeof(line), "%-28s %8d %10.1f %10.1f %10.1f %10.1f %10.0f\n",
+             sc->name, MAX_TENANTS - 1, (double)allocs / config->iterations, sum / config->iterations,
+             lat[config->iterations / 2], lat[(int)(config->iterations * 0.99)], resp_bytes);
+    fputs(line, stdout);
+    if (out) {
+        fputs(line, out);
+    }
+    free(lat);
+}
+
+static void exp_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --iterations N   Requests per scenario (default 1000)\n");
+    printf("  --output FILE    Append results to FILE\n");
+}
+
+int main(int argc, char* argv[]) {
+    config_t config = { .iterations = 1000, .output_file = NULL };
+    
+    static struct option long_options[] = {
+        {"iterations", required_argument, 0, 'n'},
+        {"output",     required_argument, 0, 'o'},
+        {"help",       no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:o:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'n': config.iterations = atoi(optarg); break;
+        case 'o': config.output_file = optarg; break;
+        default:
+            exp_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (config.iterations <= 0) {
+        exp_usage(argv[0]);
+        return 1;
+    }
+    
+    // 独立的租户共享内存，每次从空白开始
+    shm_unlink(TENANT_SHM_NAME);
+    if (tenant_shm_init() != 0) {
+        return 1;
+    }
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    tenant_quota_t quota = {
+        .max_qp_per_tenant = 1024, .max_mr_per_tenant = 4096,
+        .max_memory_per_tenant = 64ULL << 30, .max_dm_bytes_per_tenant = 256 << 10,
+    };
+    for (uint32_t id = 1; id < MAX_TENANTS; id++) {
+        char name[TENANT_NAME_MAX];
+        snprintf(name, sizeof(name), "tenant-%04u", id);
+        if (tenant_create(id, name, &quota) != 0) {
+            fprintf(stderr, "Failed to create tenant %u\n", id);
+            return 1;
+        }
+        // 用量取典型的多位数值，避免全0让响应偏短
+        shm->tenants[id].usage.qp_count = 100 + id % 900;
+        shm->tenants[id].usage.mr_count = 1000 + id % 3000;
+        shm->tenants[id].usage.memory_used = (uint64_t)id * 123456789ULL;
+        shm->tenants[id].usage.dm_used = id * 1024;
+    }
+    
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    peer_fd = sv[1];
+    pthread_t tid;
+    pthread_create(&tid, NULL, drain_thread, NULL);
+    
+    client_conn_t conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.fd = sv[0];
+    conn.proto = CONN_PROTO_JSON;
+    json_object* status_cmd = json_tokener_parse("{\"cmd\":\"STATUS\"}");
+    
+    FILE* out = config.output_file ? fopen(config.output_file, "a") : NULL;
+    const char* hdr = "%-28s %8s %10s %10s %10s %10s %10s\n";
+    printf(hdr, "scenario", "tenants", "allocs/req", "avg_us", "p50_us", "p99_us", "bytes");
+    if (out) {
+        fprintf(out, hdr, "scenario", "tenants", "allocs/req", "avg_us", "p50_us", "p99_us", "bytes");
+    }
+    
+    static const scenario_t scenarios[] = {
+        { "LIST_TENANTS json-c",   0, 1 },
+        { "LIST_TENANTS stream",   1, 1 },
+        { "STATUS(all) json-c",    0, 0 },
+        { "STATUS(all) stream",    1, 0 },
+    };
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        run_scenario(&config, &scenarios[i], &conn, status_cmd, out);
+    }
+    
+    if (out) {
+        fclose(out);
+    }
+    json_object_put(status_cmd);
+    shutdown(sv[0], SHUT_WR);
+    pthread_join(tid, NULL);
+    close(sv[0]);
+    close(sv[1]);
+    tenant_shm_destroy();
+    shm_unlink(TENANT_SHM_NAME);
+    return 0;
+}
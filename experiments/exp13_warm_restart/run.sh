@@ -0,0 +1,84 @@
+#!/bin/bash
+# EXP-13: 守护进程热启动恢复时间测试
+# 用法: ./run.sh [日志记录数] [每种缓存状态的恢复次数]
+# 日志重放部分不需要守护进程：测试程序按不同的MAX_TENANTS编译，使用独立的租户共享内存。
+# 守护进程对照（经Socket重新下发、从日志启动）只在build/tenant_manager_daemon存在且
+# 没有运行中的守护进程（/dev/shm/rdma_intercept_tenant_shm_v2不存在）时进行
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+RESULTS_DIR="$SCRIPT_DIR/results"
+PROJECT_DIR="$(dirname "$(dirname "$SCRIPT_DIR")")"
+
+ENTRIES=${1:-10000}
+RUNS=${2:-20}
+DAEMON_BIN="$PROJECT_DIR/build/tenant_manager_daemon"
+TENANT_SHM="/dev/shm/rdma_intercept_tenant_shm_v2"
+
+echo "=========================================="
+echo "EXP-13: 守护进程热启动恢复时间"
+echo "日志记录数: ${ENTRIES}, 恢复次数: ${RUNS}"
+echo "=========================================="
+echo ""
+
+mkdir -p "$RESULTS_DIR"
+
+# 租户数 = MAX_TENANTS - 1（租户ID 0保留）
+for MAX in 64 512; do
+    BIN="$SCRIPT_DIR/exp13_warm_restart_$MAX"
+    if [ ! -f "$BIN" ]; then
+        echo "[Build] Compiling exp13_warm_restart (MAX_TENANTS=$MAX)..."
+        gcc -O2 -DMAX_TENANTS=$MAX -DTENANT_SHM_NAME="\"/rdma_exp13_tenant_shm\"" \
+            -I"$PROJECT_DIR/include" -I"$PROJECT_DIR/src" -o "$BIN" \
+            "$SCRIPT_DIR/src/exp13_warm_restart.c" "$PROJECT_DIR/src/shm/shared_memory_tenant.c" \
+            "$PROJECT_DIR/src/shm/tenant_journal.c" -lpthread -lrt || {
+            echo "[ERROR] Failed to compile"
+            exit 1
+        }
+    fi
+
+    echo ""
+    echo "[Test] $((MAX - 1))个租户，从日志恢复"
+    "$BIN" --entries "$ENTRIES" --runs "$RUNS" --file "$RESULTS_DIR/state_$((MAX - 1)).journal" \
+        --output "$RESULTS_DIR/journal_$((MAX - 1)).txt" 2>/dev/null
+done
+
+if [ ! -x "$DAEMON_BIN" ] || [ -e "$TENANT_SHM" ]; then
+    echo ""
+    echo "[Skip] 守护进程对照（需要$DAEMON_BIN且没有运行中的守护进程）"
+    exit 0
+fi
+
+DAEMON_PID=""
+stop_daemon() {
+    kill "$DAEMON_PID" 2>/dev/null || true
+    wait "$DAEMON_PID" 2>/dev/null || true
+    DAEMON_PID=""
+    rm -f "$TENANT_SHM"
+}
+trap stop_daemon EXIT
+
+echo ""
+echo "[Test] 对照: 空租户表启动守护进程，经Socket重新下发同样的修改"
+"$DAEMON_BIN" --daemon --foreground --no-state 2>/dev/null &
+DAEMON_PID=$!
+sleep 1
+"$SCRIPT_DIR/exp13_warm_restart_64" --entries "$ENTRIES" --socket --output "$RESULTS_DIR/socket_63.txt"
+stop_daemon
+
+echo ""
+echo "[Test] 守护进程从日志启动（使用副本，退出时的压缩不影响下次测量）"
+cp "$RESULTS_DIR/state_63.journal" "$RESULTS_DIR/daemon_63.journal"
+"$DAEMON_BIN" --daemon --foreground --state "$RESULTS_DIR/daemon_63.journal" 2>"$RESULTS_DIR/daemon_63.log" &
+DAEMON_PID=$!
+sleep 1
+grep "Restored" "$RESULTS_DIR/daemon_63.log" || true
+stop_daemon
+rm -f "$RESULTS_DIR/daemon_63.journal"
+
+echo ""
+echo "=========================================="
+echo "实验完成！"
+echo "结果保存在: $RESULTS_DIR"
+echo "=========================================="
@@ -0,0 +1,409 @@
+/*
+ * EXP-13: 守护进程热启动恢复时间测试程序
+ *
+ * 测试目的: 生成含N条记录的租户持久化日志（创建全部租户后混合配额更新、SET_CAPS、
+ *           SET_CREATE_RATE、BATCH、删除重建和全局上限修改），测量追加每条记录的开销，
+ *           以及在空的租户共享内存中按日志恢复全部租户的耗时（页缓存命中/丢弃两种情况）；
+ *           --socket模式把同样的修改经Socket重新下发给运行中的守护进程，作为对照
+ *
+ * 租户数由编译时的-DMAX_TENANTS决定，使用独立的租户共享内存（-DTENANT_SHM_NAME），
+ * 不影响运行中的守护进程。
+ *
+ * 使用方法:
+ *   gcc -O2 -DMAX_TENANTS=512 -DTENANT_SHM_NAME='"/rdma_exp13_tenant_shm"' -Iinclude -Isrc \
+ *       exp13_warm_restart.c src/shm/shared_memory_tenant.c src/shm/tenant_journal.c -lpthread -lrt
+ *   ./exp13_warm_restart --entries 10000 --file state.journal --output result.txt
+ *   ./exp13_warm_restart --entries 10000 --socket    # 需要以空租户表启动的守护进程（默认MAX_TENANTS）
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "shm/shared_memory_tenant.h"
+#include "shm/tenant_journal.h"
+
+#define SOCKET_PATH "/tmp/rdma_tenant_manager.sock"
+#define DEFAULT_ENTRIES 10000
+#define DEFAULT_RUNS 20
+#define BATCH_SIZE 8
+
+enum { OP_CREATE, OP_UPDATE, OP_CAPS, OP_RATE, OP_BATCH, OP_DELETE, OP_GLOBALS };
+
+typedef struct {
+    int type;
+    int count;                          // BATCH中的租户数，其余为1
+    uint32_t tenants[BATCH_SIZE];
+    uint32_t value[BATCH_SIZE];         // QP配额 / send_wr / 创建速率 / 全局QP上限
+} op_t;
+
+typedef struct {
+    int entries;
+    int runs;
+    int socket;
+    const char *file;
+    const char *output_file;
+} config_t;
+
+static inline uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("\nOptions:\n");
+    printf("  -n, --entries N     Journal records to generate (default: %d)\n", DEFAULT_ENTRIES);
+    printf("  -r, --runs N        Restore runs per cache state (default: %d)\n", DEFAULT_RUNS);
+    printf("  -f, --file PATH     Journal file (default: exp13_state.journal)\n");
+    printf("  -s, --socket        Re-issue the same changes to the running daemon instead\n");
+    printf("  -o, --output FILE   Output file for results\n");
+    printf("  -h, --help          Show this help\n");
+}
+
+static int parse_args(int argc, char **argv, config_t *config) {
+    config->entries = DEFAULT_ENTRIES;
+    config->runs = DEFAULT_RUNS;
+    config->socket = 0;
+    config->file = "exp13_state.journal";
+    config->output_file = NULL;
+
+    static struct option long_options[] = {
+        {"entries", required_argument, 0, 'n'},
+        {"runs", required_argument, 0, 'r'},
+        {"file", required_argument, 0, 'f'},
+        {"socket", no_argument, 0, 's'},
+        {"output", required_argument, 0, 'o'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:r:f:so:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n': config->entries = atoi(optarg); break;
+            case 'r': config->runs = atoi(optarg); break;
+            case 'f': config->file = optarg; break;
+            case 's': config->socket = 1; break;
+            case 'o': config->output_file = optarg; break;
+            case 'h': print_usage(argv[0]); exit(0);
+            default: return -1;
+        }
+    }
+    return (config->entries > 0 && config->runs > 0) ? 0 : -1;
+}
+
+/* 生成下一个修改：先创建全部租户，之后按比例混合各类修改；返回占用的记录数 */
+static int next_op(op_t *op, unsigned *seed, uint32_t *created, uint32_t *recreate) {
+    memset(op, 0, sizeof(*op));
+    op->count = 1;
+    if (*created < MAX_TENANTS - 1) {
+        op->type = OP_CREATE;
+        op->tenants[0] = ++*created;
+        return 1;
+    }
+    if (*recreate) {
+        op->type = OP_CREATE;
+        op->tenants[0] = *recreate;
+        *recreate = 0;
+        return 1;
+    }
+
+    uint32_t id = 1 + rand_r(seed) % (MAX_TENANTS - 1);
+    int r = rand_r(seed) % 100;
+    op->tenants[0] = id;
+    op->value[0] = 1 + rand_r(seed) % 1000;
+    if (r < 70) {
+        op->type = OP_UPDATE;
+    } else if (r < 80) {
+        op->type = OP_CAPS;
+    } else if (r < 85) {
+        op->type = OP_RATE;
+    } else if (r < 90 && MAX_TENANTS - 1 >= BATCH_SIZE) {
+        op->type = OP_BATCH;
+        op->count = BATCH_SIZE;
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            op->tenants[i] = 1 + (id - 1 + i) % (MAX_TENANTS - 1);
+            op->value[i] = 1 + rand_r(seed) % 1000;
+        }
+    } else if (r < 95) {
+        op->type = OP_DELETE;
+        *recreate = id;
+    } else {
+        op->type = OP_GLOBALS;
+        op->value[0] += 1000000;        // 足够大，不会拒绝之后的配额更新
+    }
+    return op->count;
+}
+
+/* ========== 日志模式 ========== */
+
+static int journal_emit(tenant_journal_t *j, const op_t *op) {
+    const tenant_journal_state_t *st = tenant_journal_state(j);
+    tenant_journal_tenant_t recs[BATCH_SIZE];
+    uint32_t id = op->tenants[0];
+
+    switch (op->type) {
+        case OP_CREATE:
+            memset(&recs[0], 0, sizeof(recs[0]));
+            recs[0].tenant_id = id;
+            recs[0].status = TENANT_STATUS_ACTIVE;
+            snprintf(recs[0].name, sizeof(recs[0].name), "tenant-%u", id);
+            recs[0].quota.max_qp_per_tenant = 100;
+            recs[0].quota.max_mr_per_tenant = 100;
+            recs[0].quota.max_memory_per_tenant = 1073741824ULL;
+            recs[0].quota.max_cq_per_tenant = 100;
+            recs[0].quota.max_pd_per_tenant = 10;
+            return tenant_journal_put(j, recs, 1);
+        case OP_UPDATE:
+        case OP_BATCH:
+            for (int i = 0; i < op->count; i++) {
+                recs[i] = st->tenants[op->tenants[i]];
+                recs[i].quota.max_qp_per_tenant = op->value[i];
+                recs[i].quota.max_cq_per_tenant = op->value[i];
+            }
+            return tenant_journal_put(j, recs, op->count);
+        case OP_CAPS:
+            recs[0] = st->tenants[id];
+            recs[0].quota.caps.max_send_wr = op->value[0];
+            return tenant_journal_put(j, recs, 1);
+        case OP_RATE:
+            recs[0] = st->tenants[id];
+            recs[0].quota.qp_create_rate = op->value[0];
+            return tenant_journal_put(j, recs, 1);
+        case OP_DELETE:
+            return tenant_journal_delete(j, id);
+        case OP_GLOBALS: {
+            tenant_journal_globals_t g = st->globals;
+            g.limits.max_total_qp = op->value[0];
+            return tenant_journal_set_globals(j, &g);
+        }
+    }
+    return -1;
+}
+
+/* 丢弃文件的页缓存，下一次打开从存储设备读取 */
+static void drop_page_cache(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double p50_us(uint64_t *v, int n) {
+    qsort(v, n, sizeof(*v), cmp_u64);
+    return v[n / 2] / 1e3;
+}
+
+static int run_journal(const config_t *config, FILE *out) {
+    unlink(config->file);
+    tenant_journal_t *j = tenant_journal_open(config->file, TENANT_JOURNAL_DEFAULT_CAPACITY, 0, NULL);
+    if (!j) {
+        fprintf(stderr, "Failed to create %s: %s\n", config->file, strerror(errno));
+        return -1;
+    }
+
+    unsigned seed = 42;
+    uint32_t created = 0, recreate = 0;
+    int entries = 0;
+    op_t op;
+    uint64_t start = get_time_ns();
+    while (entries < config->entries) {
+        entries += next_op(&op, &seed, &created, &recreate);
+        if (journal_emit(j, &op) != 0) {
+            fprintf(stderr, "Journal append failed: %s\n", strerror(errno));
+            tenant_journal_close(j);
+            return -1;
+        }
+    }
+    uint64_t append_ns = get_time_ns() - start;
+    tenant_journal_close(j);
+
+    struct stat sb;
+    stat(config->file, &sb);
+
+    // 每轮在新建的租户共享内存中恢复：打开并重放日志、初始化共享内存、创建租户
+    uint64_t *replay = calloc(config->runs, sizeof(uint64_t));
+    uint64_t *shm_init = calloc(config->runs, sizeof(uint64_t));
+    uint64_t *restore = calloc(config->runs, sizeof(uint64_t));
+    uint64_t *total = calloc(config->runs, sizeof(uint64_t));
+    tenant_journal_stats_t stats;
+    int restored = 0, active = 0;
+
+    for (int cold = 0; cold <= 1; cold++) {
+        for (int r = 0; r < config->runs; r++) {
+            tenant_shm_destroy();
+            if (cold) {
+                drop_page_cache(config->file);
+            }
+            uint64_t t0 = get_time_ns();
+            j = tenant_journal_open(config->file, 0, 0, &stats);
+            uint64_t t1 = get_time_ns();
+            if (!j || tenant_shm_init() != 0) {
+                fprintf(stderr, "Restore failed: %s\n", strerror(errno));
+                return -1;
+            }
+            uint64_t t2 = get_time_ns();
+            restored = tenant_journal_restore(tenant_journal_state(j));
+            uint64_t t3 = get_time_ns();
+            active = tenant_shm_get_ptr()->active_tenant_count;
+            tenant_journal_close(j);
+            replay[r] = t1 - t0;
+            shm_init[r] = t2 - t1;
+            restore[r] = t3 - t2;
+            total[r] = t3 - t0;
+        }
+        if (!cold) {
+            fprintf(out, "日志记录: %d（快照代号%llu，重放%u条）\n", entries,
+                    (unsigned long long)stats.snapshot_gen, stats.records);
+            fprintf(out, "租户数: %u（共享内存中%d个，恢复%d个）\n", stats.tenants, active, restored);
+            fprintf(out, "日志文件: %lld 字节\n", (long long)sb.st_size);
+            fprintf(out, "追加开销: %.0f ns/条\n", (double)append_ns / entries);
+        }
+        const char *label = cold ? "丢弃页缓存" : "页缓存命中";
+        fprintf(out, "[%s] 打开+重放P50: %.1f us\n", label, p50_us(replay, config->runs));
+        fprintf(out, "[%s] 共享内存初始化P50: %.1f us\n", label, p50_us(shm_init, config->runs));
+        fprintf(out, "[%s] 创建租户P50: %.1f us\n", label, p50_us(restore, config->runs));
+        fprintf(out, "[%s] 合计P50: %.1f us\n", label, p50_us(total, config->runs));
+    }
+    tenant_shm_destroy();
+    free(replay);
+    free(shm_init);
+    free(restore);
+    free(total);
+    return active == (int)stats.tenants ? 0 : -1;
+}
+
+/* ========== Socket模式（对照） ========== */
+
+typedef struct {
+    int fd;
+    int entries;
+    int requests;
+} sender_t;
+
+static int format_op(char *buf, size_t len, const op_t *op) {
+    uint32_t id = op->tenants[0];
+    switch (op->type) {
+        case OP_CREATE:
+            return snprintf(buf, len, "{\"cmd\":\"CREATE\",\"tenant\":%u,\"name\":\"tenant-%u\",\"qp\":100,\"mr\":100}\n", id, id);
+        case OP_UPDATE:
+            return snprintf(buf, len, "{\"cmd\":\"UPDATE_QUOTA\",\"tenant\":%u,\"qp\":%u,\"mr\":100}\n", id, op->value[0]);
+        case OP_CAPS:
+            return snprintf(buf, len, "{\"cmd\":\"SET_CAPS\",\"tenant\":%u,\"send_wr\":%u}\n", id, op->value[0]);
+        case OP_RATE:
+            return snprintf(buf, len, "{\"cmd\":\"SET_CREATE_RATE\",\"tenant\":%u,\"rate\":%u}\n", id, op->value[0]);
+        case OP_DELETE:
+            return snprintf(buf, len, "{\"cmd\":\"DELETE\",\"tenant\":%u}\n", id);
+        case OP_GLOBALS:
+            return snprintf(buf, len, "{\"cmd\":\"SET_GLOBAL_LIMITS\",\"qp\":%u}\n", op->value[0]);
+        case OP_BATCH: {
+            int n = snprintf(buf, len, "{\"cmd\":\"BATCH\",\"updates\":[");
+            for (int i = 0; i < op->count; i++) {
+                n += snprintf(buf + n, len - n, "%s{\"tenant\":%u,\"qp\":%u,\"mr\":100}",
+                              i ? "," : "", op->tenants[i], op->value[i]);
+            }
+            return n + snprintf(buf + n, len - n, "]}\n");
+        }
+    }
+    return 0;
+}
+
+static void *sender_main(void *arg) {
+    sender_t *s = arg;
+    unsigned seed = 42;
+    uint32_t created = 0, recreate = 0;
+    int entries = 0;
+    char buf[1024];
+    op_t op;
+
+    while (entries < s->entries) {
+        entries += next_op(&op, &seed, &created, &recreate);
+        int n = format_op(buf, sizeof(buf), &op);
+        for (int off = 0; off < n; ) {
+            ssize_t w = send(s->fd, buf + off, n - off, 0);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return NULL;
+            off += w;
+        }
+        s->requests++;
+    }
+    shutdown(s->fd, SHUT_WR);
+    return NULL;
+}
+
+static int run_socket(const config_t *config, FILE *out) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", SOCKET_PATH, strerror(errno));
+        return -1;
+    }
+
+    sender_t s = { .fd = fd, .entries = config->entries };
+    pthread_t tid;
+    uint64_t start = get_time_ns();
+    pthread_create(&tid, NULL, sender_main, &s);
+
+    // 读到对端关闭为止，统计响应行数和失败数
+    char buf[65536];
+    int lines = 0, failed = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0 || (n < 0 && errno == EINTR)) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') lines++;
+        }
+        for (char *p = buf; n > 0 && (p = memmem(p, buf + n - p, "\"success\": false", 16)) != NULL; p += 16) {
+            failed++;
+        }
+    }
+    uint64_t elapsed = get_time_ns() - start;
+    pthread_join(tid, NULL);
+    close(fd);
+
+    fprintf(out, "日志记录: %d（经Socket下发%d个请求）\n", config->entries, s.requests);
+    fprintf(out, "响应: %d（失败%d）\n", lines, failed);
+    fprintf(out, "合计: %.1f us\n", elapsed / 1e3);
+    return (lines == s.requests && failed == 0) ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    config_t config;
+    if (parse_args(argc, argv, &config) != 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *out = config.output_file ? fopen(config.output_file, "w") : stdout;
+    if (!out) out = stdout;
+    fprintf(out, "MAX_TENANTS: %d\n", MAX_TENANTS);
+    fprintf(out, "模式: %s\n", config.socket ? "socket" : "journal");
+
+    int ret = config.socket ? run_socket(&config, out) : run_journal(&config, out);
+
+    if (out != stdout) {
+        fclose(out);
+        printf("Results written to %s\n", config.output_file);
+    }
+    return ret ? 2 : 0;
+}
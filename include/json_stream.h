@@ -0,0 +1,205 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * 流式JSON写入器
+ *
+ * 直接把JSON文本写入调用方提供的定长缓冲区（通常在栈上），缓冲区满时通过flush
+ * 回调整块交出（例如直接send到Socket），最后由json_stream_finish交出剩余部分。
+ * 不构建对象树、不分配内存，输出大小与缓冲区大小无关。
+ *
+ * 调用方按文档顺序调用begin/end和各类值函数，逗号由写入器按嵌套层次自动插入；
+ * key为NULL表示数组元素。键名须为不需要转义的常量字符串，字符串值会被转义。
+ * flush回调返回非0后写入器停止输出，json_stream_finish返回-1。
+ */
+
+#define JSON_STREAM_MAX_DEPTH 32
+
+typedef int (*json_stream_flush_fn)(void* ctx, const char* data, size_t len);
+
+typedef struct {
+    char* buf;
+    size_t len, cap;
+    json_stream_flush_fn flush;
+    void* ctx;
+    int depth;
+    uint32_t has_items;                 // 第i位：第i层已经写过元素，下一个元素前需要逗号
+    int error;
+    uint64_t flushes;                   // 调用flush的次数
+} json_stream_t;
+
+static inline void json_stream_init(json_stream_t* js, char* buf, size_t cap,
+                                    json_stream_flush_fn flush, void* ctx) {
+    memset(js, 0, sizeof(*js));
+    js->buf = buf;
+    js->cap = cap;
+    js->flush = flush;
+    js->ctx = ctx;
+}
+
+static inline void json_stream_drain(json_stream_t* js) {
+    if (js->len > 0 && !js->error) {
+        js->flushes++;
+        if (js->flush(js->ctx, js->buf, js->len) != 0) {
+            js->error = 1;
+        }
+    }
+    js->len = 0;
+}
+
+/* 追加原始文本，缓冲区满时分块交出 */
+static inline void json_stream_raw(json_stream_t* js, const char* s, size_t n) {
+    while (n > 0 && !js->error) {
+        size_t room = js->cap - js->len;
+        if (room == 0) {
+            json_stream_drain(js);
+            continue;
+        }
+        size_t k = n < room ? n : room;
+        memcpy(js->buf + js->len, s, k);
+        js->len += k;
+        s += k;
+        n -= k;
+    }
+}
+
+static inline void json_stream_putc(json_stream_t* js, char c) {
+    if (js->len == js->cap) {
+        json_stream_drain(js);
+    }
+    if (!js->error) {
+        js->buf[js->len++] = c;
+    }
+}
+
+/* 元素前缀：按需写逗号，对象成员再写键名 */
+static inline void json_stream_key(json_stream_t* js, const char* key) {
+    uint32_t bit = 1U << js->depth;
+    if (js->has_items & bit) {
+        json_stream_putc(js, ',');
+    }
+    js->has_items |= bit;
+    if (key) {
+        json_stream_putc(js, '"');
+        json_stream_raw(js, key, strlen(key));
+        json_stream_raw(js, "\":", 2);
+    }
+}
+
+static inline void json_stream_open(json_stream_t* js, const char* key, char c) {
+    json_stream_key(js, key);
+    json_stream_putc(js, c);
+    if (js->depth + 1 >= JSON_STREAM_MAX_DEPTH) {
+        js->error = 1;
+        return;
+    }
+    js->depth++;
+    js->has_items &= ~(1U << js->depth);
+}
+
+static inline void json_stream_close(json_stream_t* js, char c) {
+    json_stream_putc(js, c);
+    if (js->depth > 0) {
+        js->depth--;
+    }
+}
+
+static inline void json_stream_begin_object(json_stream_t* js, const char* key) {
+    json_stream_open(js, key, '{');
+}
+
+static inline void json_stream_end_object(json_stream_t* js) {
+    json_stream_close(js, '}');
+}
+
+static inline void json_stream_begin_array(json_stream_t* js, const char* key) {
+    json_stream_open(js, key, '[');
+}
+
+static inline void json_stream_end_array(json_stream_t* js) {
+    json_stream_close(js, ']');
+}
+
+static inline void json_stream_uint(json_stream_t* js, const char* key, uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    json_stream_key(js, key);
+    json_stream_raw(js, tmp + sizeof(tmp) - n, n);
+}
+
+static inline void json_stream_int(json_stream_t* js, const char* key, int64_t v) {
+    if (v >= 0) {
+        json_stream_uint(js, key, (uint64_t)v);
+        return;
+    }
+    char tmp[21];
+    uint64_t u = (uint64_t)0 - (uint64_t)v;
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    tmp[sizeof(tmp) - 1 - n++] = '-';
+    json_stream_key(js, key);
+    json_stream_raw(js, tmp + sizeof(tmp) - n, n);
+}
+
+static inline void json_stream_bool(json_stream_t* js, const char* key, int v) {
+    json_stream_key(js, key);
+    if (v) {
+        json_stream_raw(js, "true", 4);
+    } else {
+        json_stream_raw(js, "false", 5);
+    }
+}
+
+/* 写字符串值：转义引号、反斜杠和控制字符，其余字节（含UTF-8）原样输出 */
+static inline void json_stream_string(json_stream_t* js, const char* key, const char* s) {
+    static const char hex[] = "0123456789abcdef";
+    json_stream_key(js, key);
+    json_stream_putc(js, '"');
+    const char* run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        json_stream_raw(js, run, s - run);
+        run = s + 1;
+        char esc[6] = { '\\', (char)c, 0, 0, 0, 0 };
+        size_t n = 2;
+        switch (c) {
+        case '"': case '\\': break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            n = 6;
+            break;
+        }
+        json_stream_raw(js, esc, n);
+    }
+    json_stream_raw(js, run, s - run);
+    json_stream_putc(js, '"');
+}
+
+/* 交出缓冲区中剩余的输出，返回0成功，-1表示嵌套溢出或flush失败 */
+static inline int json_stream_finish(json_stream_t* js) {
+    json_stream_drain(js);
+    return js->error ? -1 : 0;
+}
+
+#endif // JSON_STREAM_H
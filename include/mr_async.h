@@ -0,0 +1,41 @@
+#ifndef MR_ASYNC_H
+#define MR_ASYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <infiniband/verbs.h>
+#include "rdma_intercept.h"
+
+/*
+ * 异步MR注册工作线程池
+ *
+ * 大块内存注册时内核需要逐页pin住物理页，调用线程会阻塞数十毫秒。
+ * 提交的注册请求由后台工作线程执行：先并行预取页面，再调用真实注册函数。
+ * 准入（配额预扣）由拦截层在提交时完成，工作线程只负责执行。
+ */
+
+// 后台执行的注册函数（由拦截层传入，负责真实注册与记账）
+typedef struct ibv_mr *(*mr_async_reg_fn)(struct ibv_pd *, void *, size_t, int, uint32_t tenant_id);
+
+/**
+ * 设置线程池参数（需在首次提交前调用）
+ * @param workers 后台注册线程数
+ * @param prefault_threads 每个请求预取页面的并行线程数，0表示不预取
+ */
+void mr_async_configure(uint32_t workers, uint32_t prefault_threads);
+
+/**
+ * 提交注册请求，首次调用时启动工作线程
+ * @return 完成句柄，失败返回NULL（errno被设置）
+ */
+rdma_mr_async_t *mr_async_submit(struct ibv_pd *pd, void *addr, size_t length, int access,
+                                 uint32_t tenant_id, mr_async_reg_fn reg_fn);
+
+/**
+ * 并行预取[addr, addr+length)的页面
+ * @param write 是否以写方式预取（可写MR必须预取为私有可写页）
+ */
+void mr_async_prefault(void *addr, size_t length, uint32_t threads, bool write);
+
+#endif // MR_ASYNC_H
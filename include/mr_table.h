@@ -0,0 +1,110 @@
+#ifndef MR_TABLE_H
+#define MR_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <infiniband/verbs.h>
+
+/*
+ * 进程内MR表
+ *
+ * 合并注册模式（MR coalescing）：同一PD、相同访问权限的相邻/包含注册
+ * 共享一个覆盖范围的真实MR。应用拿到的是轻量级的ibv_mr视图（view），
+ * 视图与父MR共享lkey/rkey，父MR按引用计数释放。
+ *
+ * 视图的rkey可访问整个覆盖范围，带远程访问权限的注册不能合并，
+ * 调用方应对MR_COALESCE_REMOTE_ACCESS中的权限按精确范围注册。
+ */
+
+// 哈希桶数量
+#define MR_TABLE_BUCKETS 1024
+#define MR_PARENT_BUCKETS 64
+
+// 真实注册函数（由拦截层传入原始ibv_reg_mr/ibv_dereg_mr）
+typedef struct ibv_mr *(*mr_table_reg_fn)(struct ibv_pd *, void *, size_t, int);
+typedef int (*mr_table_dereg_fn)(struct ibv_mr *);
+
+// 不能合并注册的访问权限（远端可经rkey访问应用未注册的相邻内存）
+#define MR_COALESCE_REMOTE_ACCESS (IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC)
+
+// 合并注册统计（进程级）
+typedef struct {
+    uint64_t views_served;        // 由已有父MR直接服务的注册次数（节省的MR条目）
+    uint64_t parents_registered;  // 实际向网卡注册的覆盖MR次数
+    uint64_t parents_released;    // 已释放的覆盖MR次数
+    uint32_t active_parents;      // 当前父MR数（实际占用的MPT条目）
+    uint32_t active_views;        // 当前返回给应用的视图数
+} mr_coalesce_stats_t;
+
+/**
+ * 设置合并注册的对齐粒度
+ * @param align 覆盖范围对齐粒度（字节，2的幂；0表示仅按页对齐）
+ */
+void mr_coalesce_set_align(size_t align);
+
+/**
+ * 查找可覆盖[addr, addr+length)的已有父MR，命中则返回新视图
+ * @return 视图指针，未命中返回NULL
+ */
+struct ibv_mr *mr_coalesce_lookup(struct ibv_pd *pd, void *addr, size_t length, int access);
+
+/**
+ * 注册覆盖范围的父MR并返回视图
+ * 覆盖范围为请求按对齐粒度扩展、并裁掉已有父MR已覆盖的扩展部分，注册失败时回退到精确范围
+ * @param dereg_fn 注册成功但无法创建视图时用于撤销注册
+ * @param pinned_length 输出参数，实际注册的覆盖长度
+ * @return 视图指针，失败返回NULL（errno由底层注册设置）
+ */
+struct ibv_mr *mr_coalesce_register(struct ibv_pd *pd, void *addr, size_t length, int access,
+                                    mr_table_reg_fn reg_fn, mr_table_dereg_fn dereg_fn,
+                                    size_t *pinned_length);
+
+/**
+ * 判断mr是否为合并注册返回的视图
+ */
+bool mr_coalesce_is_view(struct ibv_mr *mr);
+
+/**
+ * 释放视图，父MR引用计数归零时真正注销
+ * @param released_length 输出参数，父MR被注销时为其覆盖长度，否则为0
+ * @return 0成功，-1失败（不是视图或底层注销失败）
+ */
+int mr_coalesce_release(struct ibv_mr *view, mr_table_dereg_fn dereg_fn, size_t *released_length);
+
+/**
+ * 获取合并注册统计
+ */
+void mr_coalesce_get_stats(mr_coalesce_stats_t *stats);
+
+/*
+ * MR记账表
+ *
+ * 记录每个已计入配额的MR（非合并视图）注册时的租户和记账长度。
+ * 注销和重注册按记录的长度归还/补扣配额，而不是信任mr->length。
+ */
+
+/**
+ * 添加MR记账记录
+ * @return 0成功，-1失败（内存不足）
+ */
+int mr_account_add(struct ibv_mr *mr, uint32_t tenant_id, size_t length);
+
+/**
+ * 查询MR记账记录
+ * @return 0找到，-1未记录（拦截未启用时注册的MR）
+ */
+int mr_account_get(struct ibv_mr *mr, uint32_t *tenant_id, size_t *length);
+
+/**
+ * 更新MR记账长度（重注册改变范围后调用）
+ */
+int mr_account_set_length(struct ibv_mr *mr, size_t length);
+
+/**
+ * 移除MR记账记录，输出记录的租户和长度
+ * @return 0成功，-1未记录
+ */
+int mr_account_remove(struct ibv_mr *mr, uint32_t *tenant_id, size_t *length);
+
+#endif // MR_TABLE_H
@@ -0,0 +1,73 @@
+#ifndef QUEUE_MEM_MODEL_H
+#define QUEUE_MEM_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <infiniband/verbs.h>
+
+/*
+ * QP/CQ队列缓冲区内存估算模型
+ *
+ * 租户配额按对象个数计数时，16K深、16个SGE的QP与最小QP都只算1个，
+ * 但前者占用数MB的pinned主机内存和网卡WQE缓存。创建时按cap.*和cqe
+ * 估算队列缓冲区大小并计入租户的queue_mem_used。
+ * 模型可替换：内置mlx5（按WQE基本块步长计算）和none（不记账），
+ * 也可以注册自定义模型，或通过参数串校准内置模型的常数。
+ */
+
+#define QUEUE_MEM_MODEL_NAME_LEN 32
+#define QUEUE_MEM_MAX_MODELS 8
+
+// 可校准的模型常数（字节）
+typedef struct {
+    uint32_t send_wqe_bb;        // 发送WQE基本块（步长），mlx5为64
+    uint32_t data_seg;           // 每个SGE的数据段
+    uint32_t inline_hdr;         // 内联数据段头
+    uint32_t rc_overhead;        // RC/UC发送WQE固定段（控制段+远端地址段+原子段）
+    uint32_t ud_overhead;        // UD发送WQE固定段（控制段+数据报段）
+    uint32_t recv_seg;           // 接收WQE每个SGE的数据段
+    uint32_t cqe_size;           // CQE大小
+    uint32_t page_size;          // 队列缓冲区分配粒度
+} queue_mem_params_t;
+
+typedef struct queue_mem_model {
+    char name[QUEUE_MEM_MODEL_NAME_LEN];
+    // 估算QP的发送/接收队列缓冲区字节数（attr->srq非空时不含接收队列）
+    uint64_t (*qp_bytes)(const struct queue_mem_model *model, const struct ibv_qp_init_attr *attr);
+    // 估算CQ缓冲区字节数
+    uint64_t (*cq_bytes)(const struct queue_mem_model *model, int cqe);
+    queue_mem_params_t params;
+} queue_mem_model_t;
+
+/**
+ * 注册自定义模型（同名模型被替换）
+ * @return 0成功，-1表已满或参数无效
+ */
+int queue_mem_model_register(const queue_mem_model_t *model);
+
+/**
+ * 选择当前使用的模型
+ * @return 0成功，-1未找到（保持原模型）
+ */
+int queue_mem_model_select(const char *name);
+
+/**
+ * 用"key=value,..."参数串校准当前模型（键：send_wqe_bb, data_seg, inline_hdr,
+ * rc_overhead, ud_overhead, recv_seg, cqe_size, page_size）
+ * @return 0成功，-1参数串无效（不修改模型）
+ */
+int queue_mem_model_calibrate(const char *spec);
+
+/**
+ * 按当前模型估算QP/CQ的队列缓冲区字节数
+ */
+uint64_t queue_mem_estimate_qp(const struct ibv_qp_init_attr *attr);
+uint64_t queue_mem_estimate_cq(int cqe);
+
+/**
+ * 按当前模型估算SRQ的缓冲区字节数（按只有接收队列的QP估算）
+ */
+uint64_t queue_mem_estimate_srq(uint32_t max_wr, uint32_t max_sge);
+
+#endif // QUEUE_MEM_MODEL_H
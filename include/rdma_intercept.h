@@ -63,6 +63,45 @@ typedef struct {
     bool enable_mr_control;       /* 启用内存区域控制 */
     uint32_t max_mr_per_process;  /* 每个进程的最大MR数量 */
     uint64_t max_memory_per_process; /* 每个进程的最大内存使用量（字节） */
+    
+    /* MR合并注册配置 */
+    bool enable_mr_coalesce;      /* 启用MR合并注册（相邻小注册共享覆盖MR） */
+    uint64_t mr_coalesce_align;   /* 覆盖范围对齐粒度（字节） */
+    
+    /* 异步MR注册配置 */
+    uint32_t async_reg_workers;   /* 后台注册工作线程数 */
+    uint32_t async_prefault_threads; /* 注册前并行预取页面的线程数（0表示不预取） */
+    
+    /* QP池配置 */
+    bool enable_qp_pool;          /* 启用QP池（销毁的QP复位后供兼容的创建复用） */
+    uint32_t qp_pool_max;         /* 每进程池中最多闲置的QP数 */
+    
+    /* CQ/PD池配置 */
+    bool enable_cq_pd_pool;       /* 启用CQ/PD池（销毁的CQ/PD按上下文暂存复用） */
+    uint32_t cq_pd_pool_max;      /* 每进程池中最多闲置的CQ数和PD数（分别计） */
+    uint32_t cq_pd_pool_ttl_sec;  /* 闲置超过该时间的CQ/PD被真正释放 */
+    
+    /* AH缓存配置 */
+    bool enable_ah_cache;         /* 启用AH缓存（相同目的端的ibv_create_ah共享同一AH） */
+    uint32_t ah_cache_max;        /* 每进程最多保留的闲置AH数 */
+    
+    /* RQ到SRQ替换配置 */
+    bool enable_srq_substitute;   /* 未指定SRQ的RC/UD QP透明挂到按(PD, 接收CQ)共享的SRQ */
+    uint32_t srq_substitute_depth; /* 共享SRQ的深度（max_wr） */
+    
+    /* UD虚拟QP复用配置 */
+    bool enable_ud_mux;           /* UD QP以虚拟QP形式复用少量真实UD QP */
+    uint32_t ud_mux_real_qps;     /* 每进程承载虚拟QP的真实UD QP数上限 */
+    
+    /* 队列内存估算配置 */
+    char queue_mem_model[32];     /* QP/CQ队列缓冲区估算模型（mlx5/none或自定义注册的模型） */
+    char queue_mem_params[128];   /* 模型校准参数（key=value,...，空表示使用默认常数） */
+    
+    /* QP工作集跟踪配置 */
+    bool enable_qp_working_set;   /* 跟踪每个QP的最近投递时间并按窗口统计租户工作集 */
+    uint32_t qp_ws_window_us;     /* 工作集窗口长度（微秒） */
+    bool qp_ws_throttle;          /* 窗口内工作集已满时延迟投递到新QP */
+    uint32_t qp_create_wait_ms;   /* QP创建超出速率时最长排队时间(ms) */
 } intercept_config_t;
 
 /* QP创建信息 */
@@ -127,6 +166,43 @@ void rdma_intercept_log_qp_creation(const qp_creation_info_t *info);
 const char *rdma_intercept_version(void);
 bool rdma_intercept_is_enabled(void);
 
+/* 异步MR注册：提交时完成租户配额准入，后台线程预取页面并注册 */
+typedef struct rdma_mr_async rdma_mr_async_t;
+
+/**
+ * 提交异步MR注册
+ * @return 完成句柄；超出配额（errno=EPERM）或提交失败时返回NULL
+ */
+rdma_mr_async_t *rdma_intercept_reg_mr_async(struct ibv_pd *pd, void *addr, size_t length, int access);
+
+/**
+ * 查询注册是否完成（不阻塞）
+ * @return 0完成且成功，EAGAIN未完成，其它为注册失败的errno
+ */
+int rdma_intercept_mr_async_test(rdma_mr_async_t *handle, struct ibv_mr **mr);
+
+/**
+ * 等待注册完成
+ * @return 0成功，否则为注册失败的errno
+ */
+int rdma_intercept_mr_async_wait(rdma_mr_async_t *handle, struct ibv_mr **mr);
+
+/**
+ * 释放完成句柄（未完成时先等待），不会注销已注册的MR
+ */
+void rdma_intercept_mr_async_free(rdma_mr_async_t *handle);
+
+/**
+ * 注册租户内跨进程共享的MR
+ * 同一租户的进程以相同(shm_name, offset, length, access)注册时，只有首个进程真正注册并发布
+ * PD/MR句柄，其余进程通过ibv_import_pd/ibv_import_mr导入，内存只计入租户一次。
+ * MR按iova=offset注册，SGE地址使用共享内存对象内的偏移；导入方须使用mr->pd创建QP。
+ * 通过ibv_dereg_mr释放，最后一个持有者释放时才真正注销。
+ * @param addr 共享内存对象在本进程中的映射地址加offset
+ */
+struct ibv_mr *rdma_intercept_reg_shared_mr(struct ibv_pd *pd, const char *shm_name, void *addr,
+                                            uint64_t offset, size_t length, int access);
+
 /* 被拦截的RDMA函数声明 */
 struct ibv_qp *ibv_create_qp_intercept(struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr);
 struct ibv_qp *ibv_create_qp_ex_intercept(struct ibv_context *context, struct ibv_qp_init_attr_ex *qp_init_attr_ex);
@@ -0,0 +1,351 @@
+#ifndef TENANT_CMD_RING_H
+#define TENANT_CMD_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tenant_proto.h"
+
+/*
+ * tenant_manager_daemon本机共享内存命令环
+ *
+ * 同节点上对延迟敏感的控制器不经过Unix Socket，直接把二进制协议请求
+ * （tenant_proto.h的消息头 + TLV消息体）写入共享内存中的多生产者单消费者环，
+ * 守护进程仍是租户状态的唯一写者。每个客户端占用一个响应槽，守护进程处理完后
+ * 把响应写回该槽。
+ *
+ * 常见情况下双方都不进入内核：守护进程忙时会在空闲前自旋一小段时间，
+ * 客户端提交后先自旋等待响应；只有守护进程已睡眠时生产者才敲门铃
+ * （FUTEX_WAKE），只有客户端等待超过自旋时间时守护进程才唤醒它。
+ * 单CPU时自旋只会推迟对方运行，双方直接在futex上等待。
+ *
+ * 生产者先把请求暂存在自己的响应槽里，占到位置后以CAS在请求项上登记响应槽下标，
+ * 再以CAS发布；请求项只经这两次CAS写入。若生产者在发布前退出（或长时间停住），
+ * 守护进程在它已退出或占用超过TENANT_RING_STALE_NS后以CAS回收该位置，环不会卡死；
+ * 被跳过的生产者之后的CAS失败并返回错误，不会改写已分给新生产者的请求项。
+ *
+ * 共享段由守护进程创建，权限0660，只对同组的本机控制器开放；远程或无权限的
+ * 客户端继续使用Unix Socket。段内字段均为主机字节序。
+ */
+
+#define TENANT_RING_NAME        "/rdma_tenant_cmd_ring"
+#define TENANT_RING_MAGIC       0x4D54524EU
+#define TENANT_RING_VERSION     3
+#define TENANT_RING_SLOTS       256     // 请求环大小（2的幂）
+#define TENANT_RING_CLIENTS     64      // 响应槽数，即同时在途的客户端数
+#define TENANT_RING_MSG_MAX     256     // 单个请求/响应消息体的最大字节数
+#define TENANT_RING_SPIN_NS     50000   // 多CPU时进入futex等待前的自旋时间
+#define TENANT_RING_STALE_NS    1000000000ULL   // 已占用但未提交的位置超过该时间后被守护进程跳过
+#define TENANT_RING_NO_CLIENT   0xFFFFFFFFU     // 请求项尚未登记响应槽
+
+// 请求项状态：低32位为序号，高32位为占用者的响应槽下标
+#define TENANT_RING_STATE(seq, client) (((uint64_t)(client) << 32) | (uint32_t)(seq))
+#define TENANT_RING_SEQ(state)         ((uint32_t)(state))
+#define TENANT_RING_CLIENT(state)      ((uint32_t)((state) >> 32))
+
+// 响应槽状态（同时是futex字）
+#define TENANT_RING_RESP_FREE     0
+#define TENANT_RING_RESP_PENDING  1     // 已提交，客户端在自旋
+#define TENANT_RING_RESP_SLEEPING 2     // 已提交，客户端在futex上等待
+#define TENANT_RING_RESP_READY    3     // 响应已写入
+
+typedef struct {
+    volatile uint64_t state;            // 序号等于位置时可写，等于位置+1时可读
+} tenant_ring_entry_t;
+
+typedef struct {
+    volatile uint32_t state;
+    volatile pid_t owner;
+    volatile uint64_t reserved_ns;      // 最近一次占用请求位置的时间（CLOCK_MONOTONIC）
+    tenant_proto_hdr_t req_hdr;         // 暂存的请求
+    uint8_t req_body[TENANT_RING_MSG_MAX];
+    tenant_proto_hdr_t hdr;             // 响应
+    uint8_t body[TENANT_RING_MSG_MAX];
+} tenant_ring_resp_t;
+
+typedef struct {
+    volatile uint32_t magic;            // 守护进程初始化完成后最后写入
+    uint32_t version;
+    volatile pid_t daemon_pid;
+
+    volatile uint32_t head __attribute__((aligned(64)));   // 生产者下一个位置
+    volatile uint32_t tail __attribute__((aligned(64)));   // 守护进程下一个位置
+    volatile uint32_t daemon_sleeping;  // 守护进程准备睡眠，生产者需要敲门铃
+    volatile uint32_t doorbell;         // 守护进程的futex字
+
+    // 统计（守护进程写）
+    uint64_t processed;
+    uint64_t doorbells;                 // 生产者敲门铃次数（生产者写，原子加）
+    uint64_t client_wakeups;            // 守护进程唤醒睡眠客户端的次数
+    uint64_t stale_skipped;             // 跳过的未提交位置数
+
+    // 守护进程私有：尾部位置开始卡住的位置和时间
+    uint32_t stall_pos;
+    uint64_t stall_since;
+
+    tenant_ring_entry_t entries[TENANT_RING_SLOTS];
+    tenant_ring_resp_t resp[TENANT_RING_CLIENTS];
+} tenant_cmd_ring_t;
+
+static inline long tenant_ring_futex(volatile uint32_t* addr, int op, uint32_t val, const struct timespec* ts) {
+    return syscall(SYS_futex, (uint32_t*)addr, op, val, ts, NULL, 0);
+}
+
+static inline uint64_t tenant_ring_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* 自旋等待的时间，单CPU时为0 */
+static inline uint64_t tenant_ring_spin_ns(void) {
+    static long cpus = 0;
+    if (cpus == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return cpus > 1 ? TENANT_RING_SPIN_NS : 0;
+}
+
+/* 守护进程：初始化新创建的共享段 */
+static inline void tenant_ring_init(tenant_cmd_ring_t* ring) {
+    memset(ring, 0, sizeof(*ring));
+    for (uint32_t i = 0; i < TENANT_RING_SLOTS; i++) {
+        ring->entries[i].state = TENANT_RING_STATE(i, TENANT_RING_NO_CLIENT);
+    }
+    ring->version = TENANT_RING_VERSION;
+    ring->daemon_pid = getpid();
+    __atomic_store_n(&ring->magic, TENANT_RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+/*
+ * 客户端：占用一个响应槽，失败返回-1。原占用者已退出且响应已写回的槽可回收；
+ * 请求仍在途的槽不回收，避免迟到的响应覆盖新占用者的响应
+ */
+static inline int tenant_ring_acquire_slot(tenant_cmd_ring_t* ring) {
+    pid_t self = getpid();
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < TENANT_RING_CLIENTS; i++) {
+            tenant_ring_resp_t* r = &ring->resp[i];
+            uint32_t state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+            if (state != TENANT_RING_RESP_FREE) {
+                if (pass == 0 || state != TENANT_RING_RESP_READY || r->owner == self ||
+                    kill(r->owner, 0) == 0 || errno != ESRCH) {
+                    continue;
+                }
+            }
+            if (__atomic_compare_exchange_n(&r->state, &state, TENANT_RING_RESP_PENDING, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                r->owner = self;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+static inline void tenant_ring_release_slot(tenant_cmd_ring_t* ring, int slot) {
+    ring->resp[slot].owner = 0;
+    __atomic_store_n(&ring->resp[slot].state, TENANT_RING_RESP_FREE, __ATOMIC_RELEASE);
+}
+
+/*
+ * 客户端：提交一个请求，响应写到slot。环满时返回-1（errno=EAGAIN），
+ * 调用方可改走Unix Socket
+ */
+static inline int tenant_ring_submit(tenant_cmd_ring_t* ring, int slot, uint16_t type, uint32_t seq,
+                                     const uint8_t* body, uint32_t len) {
+    if (len > TENANT_RING_MSG_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    // 请求暂存在自己的响应槽里，占位后不再有普通写入落到请求项上
+    tenant_ring_resp_t* r = &ring->resp[slot];
+    r->state = TENANT_RING_RESP_PENDING;
+    r->req_hdr = (tenant_proto_hdr_t){
+        .magic = TENANT_PROTO_MAGIC,
+        .version = TENANT_PROTO_VERSION,
+        .type = type,
+        .seq = seq,
+        .length = len
+    };
+    memcpy(r->req_body, body, len);
+
+    uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    tenant_ring_entry_t* e;
+    for (;;) {
+        e = &ring->entries[pos & (TENANT_RING_SLOTS - 1)];
+        int32_t diff = (int32_t)(TENANT_RING_SEQ(__atomic_load_n(&e->state, __ATOMIC_ACQUIRE)) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            errno = EAGAIN;
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    // 先登记响应槽（守护进程据此找到占用者和占用时间），再发布；任一CAS失败说明停住太久，
+    // 位置已被守护进程跳过，请求未进入环
+    __atomic_store_n(&r->reserved_ns, tenant_ring_now_ns(), __ATOMIC_RELAXED);
+    uint64_t unclaimed = TENANT_RING_STATE(pos, TENANT_RING_NO_CLIENT);
+    uint64_t claimed = TENANT_RING_STATE(pos, slot);
+    if (!__atomic_compare_exchange_n(&e->state, &unclaimed, claimed, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED) ||
+        !__atomic_compare_exchange_n(&e->state, &claimed, TENANT_RING_STATE(pos + 1, slot), false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    // 与守护进程设置daemon_sleeping后的复查配对：二者至少有一方看到对方的写入
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->daemon_sleeping, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&ring->doorbells, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ring->doorbell, 1, __ATOMIC_RELEASE);
+        tenant_ring_futex(&ring->doorbell, FUTEX_WAKE, 1, NULL);
+    }
+    return 0;
+}
+
+/*
+ * 客户端：等待slot上的响应，先自旋再futex等待。
+ * 超时返回-1（errno=ETIMEDOUT），此时请求可能仍会被处理，调用方不应归还该槽
+ */
+static inline int tenant_ring_wait(tenant_cmd_ring_t* ring, int slot, uint32_t timeout_ms,
+                                   tenant_proto_hdr_t* hdr, uint8_t* body) {
+    tenant_ring_resp_t* r = &ring->resp[slot];
+    uint64_t spin_ns = tenant_ring_spin_ns();
+    uint64_t start = tenant_ring_now_ns();
+    uint64_t deadline = start + (uint64_t)timeout_ms * 1000000ULL;
+
+    for (;;) {
+        uint32_t state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+        if (state == TENANT_RING_RESP_READY) {
+            break;
+        }
+        uint64_t now = tenant_ring_now_ns();
+        if (now >= deadline) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (now - start < spin_ns) {
+            __sync_synchronize();
+            continue;
+        }
+        if (state == TENANT_RING_RESP_PENDING &&
+            !__atomic_compare_exchange_n(&r->state, &state, TENANT_RING_RESP_SLEEPING, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        uint64_t left = deadline - now;
+        struct timespec ts = { .tv_sec = left / 1000000000ULL, .tv_nsec = left % 1000000000ULL };
+        tenant_ring_futex(&r->state, FUTEX_WAIT, TENANT_RING_RESP_SLEEPING, &ts);
+    }
+
+    *hdr = r->hdr;
+    if (hdr->length > TENANT_RING_MSG_MAX) {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(body, r->body, hdr->length);
+    return 0;
+}
+
+/* 守护进程：取出下一个已提交的请求，环空时返回NULL */
+static inline tenant_ring_entry_t* tenant_ring_peek(tenant_cmd_ring_t* ring) {
+    uint32_t pos = ring->tail;
+    tenant_ring_entry_t* e = &ring->entries[pos & (TENANT_RING_SLOTS - 1)];
+    if (TENANT_RING_SEQ(__atomic_load_n(&e->state, __ATOMIC_ACQUIRE)) != pos + 1) {
+        return NULL;
+    }
+    return e;
+}
+
+/* 守护进程：已提交请求项对应的请求（暂存在提交者的响应槽里），槽位下标无效时返回NULL */
+static inline const tenant_ring_resp_t* tenant_ring_request(tenant_cmd_ring_t* ring, const tenant_ring_entry_t* e) {
+    uint32_t slot = TENANT_RING_CLIENT(__atomic_load_n(&e->state, __ATOMIC_ACQUIRE));
+    return slot < TENANT_RING_CLIENTS ? &ring->resp[slot] : NULL;
+}
+
+/* 守护进程：写回响应并归还请求项 */
+static inline void tenant_ring_complete(tenant_cmd_ring_t* ring, tenant_ring_entry_t* e,
+                                        const tenant_proto_hdr_t* hdr, const uint8_t* body) {
+    uint32_t slot = TENANT_RING_CLIENT(__atomic_load_n(&e->state, __ATOMIC_ACQUIRE));
+    uint32_t pos = ring->tail;
+
+    if (slot < TENANT_RING_CLIENTS) {
+        tenant_ring_resp_t* r = &ring->resp[slot];
+        uint32_t len = hdr->length < TENANT_RING_MSG_MAX ? hdr->length : TENANT_RING_MSG_MAX;
+        r->hdr = *hdr;
+        r->hdr.length = len;
+        memcpy(r->body, body, len);
+        uint32_t old = __atomic_exchange_n(&r->state, TENANT_RING_RESP_READY, __ATOMIC_ACQ_REL);
+        if (old == TENANT_RING_RESP_SLEEPING) {
+            ring->client_wakeups++;
+            tenant_ring_futex(&r->state, FUTEX_WAKE, 1, NULL);
+        }
+    }
+
+    __atomic_store_n(&e->state, TENANT_RING_STATE(pos + TENANT_RING_SLOTS, TENANT_RING_NO_CLIENT), __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->tail, pos + 1, __ATOMIC_RELAXED);
+    ring->processed++;
+}
+
+/*
+ * 守护进程：尾部位置已被占用却迟迟未提交时（环中没有可处理的请求才调用），
+ * 若占用者已退出或占用超过TENANT_RING_STALE_NS则跳过该位置，返回1。
+ * 占用者已退出时把它的响应槽置为已响应，供客户端按已退出占用者回收
+ */
+static inline int tenant_ring_reclaim_stale(tenant_cmd_ring_t* ring) {
+    uint32_t pos = ring->tail;
+    tenant_ring_entry_t* e = &ring->entries[pos & (TENANT_RING_SLOTS - 1)];
+    uint64_t state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == pos || TENANT_RING_SEQ(state) != pos) {
+        ring->stall_since = 0;
+        return 0;
+    }
+
+    uint64_t now = tenant_ring_now_ns();
+    if (ring->stall_since == 0 || ring->stall_pos != pos) {
+        ring->stall_pos = pos;
+        ring->stall_since = now;
+    }
+    // 占用者还没来得及登记响应槽时按守护进程第一次发现卡住的时间计算
+    uint32_t slot = TENANT_RING_CLIENT(state);
+    pid_t producer = slot < TENANT_RING_CLIENTS ? ring->resp[slot].owner : 0;
+    uint64_t since = producer ? __atomic_load_n(&ring->resp[slot].reserved_ns, __ATOMIC_RELAXED) : ring->stall_since;
+    int dead = producer && kill(producer, 0) != 0 && errno == ESRCH;
+    if (!dead && (now < since || now - since < TENANT_RING_STALE_NS)) {
+        return 0;
+    }
+
+    if (!__atomic_compare_exchange_n(&e->state, &state, TENANT_RING_STATE(pos + TENANT_RING_SLOTS, TENANT_RING_NO_CLIENT),
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        // 占用者恰好登记或提交了，下次按新状态处理
+        return 0;
+    }
+    if (dead) {
+        ring->resp[slot].hdr.length = 0;
+        __atomic_store_n(&ring->resp[slot].state, TENANT_RING_RESP_READY, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&ring->tail, pos + 1, __ATOMIC_RELAXED);
+    ring->stall_since = 0;
+    ring->stale_skipped++;
+    return 1;
+}
+
+#endif // TENANT_CMD_RING_H
@@ -0,0 +1,121 @@
+#ifndef TENANT_PROTO_H
+#define TENANT_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * tenant_manager_daemon二进制控制协议
+ *
+ * JSON协议每个请求都要解析成json-c对象树、再构建响应对象树，
+ * 对脚本化控制器高频下发的UPDATE_QUOTA来说开销过大。二进制协议
+ * 使用定长消息头 + TLV消息体，只在本机Unix Socket上使用，字段均为主机字节序。
+ *
+ * 协议按连接协商：连接上的第一个字节为TENANT_PROTO_MAGIC_BYTE时该连接使用
+ * 二进制协议，否则使用按行分帧的JSON协议。客户端先发送HELLO（携带支持的
+ * 最高版本），守护进程回复双方都支持的版本；HELLO之后的请求可以流水线发送，
+ * 响应按请求顺序返回，消息头的seq原样带回。
+ *
+ * 未知的TLV标签被忽略，便于后续版本增加字段。
+ */
+
+#define TENANT_PROTO_MAGIC      0x4D5452B1U     // 小端序下线上第一个字节为0xB1
+#define TENANT_PROTO_MAGIC_BYTE 0xB1
+#define TENANT_PROTO_VERSION    1
+#define TENANT_PROTO_MAX_BODY   65536
+
+// 消息类型（响应类型为请求类型 | TENANT_PROTO_RESPONSE）
+#define TENANT_PROTO_HELLO          1
+#define TENANT_PROTO_UPDATE_QUOTA   2
+#define TENANT_PROTO_DELETE         3
+#define TENANT_PROTO_RESPONSE       0x8000
+
+// TLV标签：整数值长度为4或8字节，字符串不含结尾的'\0'
+#define TENANT_TLV_TENANT       1
+#define TENANT_TLV_QP           2
+#define TENANT_TLV_MR           3
+#define TENANT_TLV_MEMORY       4
+#define TENANT_TLV_DM           5
+#define TENANT_TLV_AH           6
+#define TENANT_TLV_QMEM         7
+#define TENANT_TLV_ACTIVE_QP    8
+#define TENANT_TLV_WS_QPS       9
+#define TENANT_TLV_STATUS       0x100   // 响应状态：0成功，否则为errno
+#define TENANT_TLV_MESSAGE      0x101   // 响应说明
+#define TENANT_TLV_VERSION      0x102   // HELLO协商的协议版本
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint32_t seq;                       // 请求序号，响应原样带回
+    uint32_t length;                    // 消息体字节数
+} tenant_proto_hdr_t;
+
+typedef struct {
+    uint16_t tag;
+    uint16_t len;
+} tenant_proto_tlv_t;
+
+/* 在消息体末尾追加一个TLV，空间不足时返回-1 */
+static inline int tenant_proto_put(uint8_t* body, size_t* off, size_t cap,
+                                   uint16_t tag, const void* val, uint16_t len) {
+    if (*off + sizeof(tenant_proto_tlv_t) + len > cap) {
+        return -1;
+    }
+    tenant_proto_tlv_t tlv = { .tag = tag, .len = len };
+    memcpy(body + *off, &tlv, sizeof(tlv));
+    memcpy(body + *off + sizeof(tlv), val, len);
+    *off += sizeof(tlv) + len;
+    return 0;
+}
+
+static inline int tenant_proto_put_u32(uint8_t* body, size_t* off, size_t cap, uint16_t tag, uint32_t val) {
+    return tenant_proto_put(body, off, cap, tag, &val, sizeof(val));
+}
+
+static inline int tenant_proto_put_u64(uint8_t* body, size_t* off, size_t cap, uint16_t tag, uint64_t val) {
+    return tenant_proto_put(body, off, cap, tag, &val, sizeof(val));
+}
+
+/*
+ * 遍历消息体中的TLV：*off为当前位置，返回1并填充tag/val/len，
+ * 到达末尾返回0，TLV越界返回-1
+ */
+static inline int tenant_proto_next(const uint8_t* body, size_t body_len, size_t* off,
+                                    uint16_t* tag, const uint8_t** val, uint16_t* len) {
+    if (*off == body_len) {
+        return 0;
+    }
+    if (body_len - *off < sizeof(tenant_proto_tlv_t)) {
+        return -1;
+    }
+    tenant_proto_tlv_t tlv;
+    memcpy(&tlv, body + *off, sizeof(tlv));
+    if (body_len - *off - sizeof(tlv) < tlv.len) {
+        return -1;
+    }
+    *tag = tlv.tag;
+    *len = tlv.len;
+    *val = body + *off + sizeof(tlv);
+    *off += sizeof(tlv) + tlv.len;
+    return 1;
+}
+
+/* 读取4或8字节的整数值，长度不符时返回-1 */
+static inline int tenant_proto_get_uint(const uint8_t* val, uint16_t len, uint64_t* out) {
+    if (len == sizeof(uint32_t)) {
+        uint32_t v;
+        memcpy(&v, val, sizeof(v));
+        *out = v;
+        return 0;
+    }
+    if (len == sizeof(uint64_t)) {
+        memcpy(out, val, sizeof(*out));
+        return 0;
+    }
+    return -1;
+}
+
+#endif // TENANT_PROTO_H
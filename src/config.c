@@ -100,6 +100,145 @@ static int parse_max_global_qp(const char *value, intercept_config_t *config) {
     return 0;
 }
 
+static int parse_enable_mr_coalesce(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->enable_mr_coalesce);
+}
+
+static int parse_mr_coalesce_align(const char *value, intercept_config_t *config) {
+    unsigned long long val = strtoull(value, NULL, 10);
+    if (val == 0 || (val & (val - 1)) != 0) {
+        return -1;
+    }
+    config->mr_coalesce_align = val;
+    return 0;
+}
+
+static int parse_async_reg_workers(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val <= 0 || val > 64) {
+        return -1;
+    }
+    config->async_reg_workers = (uint32_t)val;
+    return 0;
+}
+
+static int parse_async_prefault_threads(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val < 0 || val > 64) {
+        return -1;
+    }
+    config->async_prefault_threads = (uint32_t)val;
+    return 0;
+}
+
+static int parse_enable_qp_pool(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->enable_qp_pool);
+}
+
+static int parse_qp_pool_max(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val <= 0 || val > UINT32_MAX) {
+        return -1;
+    }
+    config->qp_pool_max = (uint32_t)val;
+    return 0;
+}
+
+static int parse_enable_cq_pd_pool(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->enable_cq_pd_pool);
+}
+
+static int parse_cq_pd_pool_max(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val <= 0 || val > UINT32_MAX) {
+        return -1;
+    }
+    config->cq_pd_pool_max = (uint32_t)val;
+    return 0;
+}
+
+static int parse_cq_pd_pool_ttl(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val <= 0 || val > 86400) {
+        return -1;
+    }
+    config->cq_pd_pool_ttl_sec = (uint32_t)val;
+    return 0;
+}
+
+static int parse_enable_ah_cache(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->enable_ah_cache);
+}
+
+static int parse_ah_cache_max(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val < 0 || val > UINT32_MAX) {
+        return -1;
+    }
+    config->ah_cache_max = (uint32_t)val;
+    return 0;
+}
+
+static int parse_enable_srq_substitute(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->enable_srq_substitute);
+}
+
+static int parse_srq_substitute_depth(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val <= 0 || val > (1L << 24)) {
+        return -1;
+    }
+    config->srq_substitute_depth = (uint32_t)val;
+    return 0;
+}
+
+static int parse_enable_ud_mux(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->enable_ud_mux);
+}
+
+static int parse_ud_mux_real_qps(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val <= 0 || val > 1024) {
+        return -1;
+    }
+    config->ud_mux_real_qps = (uint32_t)val;
+    return 0;
+}
+
+static int parse_queue_mem_model(const char *value, intercept_config_t *config) {
+    return parse_string(value, config->queue_mem_model, sizeof(config->queue_mem_model));
+}
+
+static int parse_queue_mem_params(const char *value, intercept_config_t *config) {
+    return parse_string(value, config->queue_mem_params, sizeof(config->queue_mem_params));
+}
+
+static int parse_enable_qp_working_set(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->enable_qp_working_set);
+}
+
+static int parse_qp_ws_window_us(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val <= 0 || val > 10000000) {
+        return -1;
+    }
+    config->qp_ws_window_us = (uint32_t)val;
+    return 0;
+}
+
+static int parse_qp_ws_throttle(const char *value, intercept_config_t *config) {
+    return parse_bool(value, &config->qp_ws_throttle);
+}
+
+static int parse_qp_create_wait_ms(const char *value, intercept_config_t *config) {
+    long val = strtol(value, NULL, 10);
+    if (val < 0 || val > 600000) {
+        return -1;
+    }
+    config->qp_create_wait_ms = (uint32_t)val;
+    return 0;
+}
+
 /* 配置表 */
 static config_entry_t config_table[] = {
     {"enable_intercept", NULL, (int (*)(const char *, intercept_config_t *))parse_enable_intercept},
@@ -118,6 +257,47 @@ static config_entry_t config_table[] = {
     {"allow_ud_qp", NULL, (int (*)(const char *, intercept_config_t *))parse_allow_ud_qp},
     {"max_global_qp", NULL, (int (*)(const char *, intercept_config_t *))parse_max_global_qp},
     
+    /* MR合并注册配置项 */
+    {"enable_mr_coalesce", NULL, parse_enable_mr_coalesce},
+    {"mr_coalesce_align", NULL, parse_mr_coalesce_align},
+    
+    /* 异步MR注册配置项 */
+    {"async_reg_workers", NULL, parse_async_reg_workers},
+    {"async_prefault_threads", NULL, parse_async_prefault_threads},
+    
+    /* QP池配置项 */
+    {"enable_qp_pool", NULL, parse_enable_qp_pool},
+    {"qp_pool_max", NULL, parse_qp_pool_max},
+    
+    /* CQ/PD复用池配置项 */
+    {"enable_cq_pd_pool", NULL, parse_enable_cq_pd_pool},
+    {"cq_pd_pool_max", NULL, parse_cq_pd_pool_max},
+    {"cq_pd_pool_ttl_sec", NULL, parse_cq_pd_pool_ttl},
+    
+    /* AH缓存配置项 */
+    {"enable_ah_cache", NULL, parse_enable_ah_cache},
+    {"ah_cache_max", NULL, parse_ah_cache_max},
+    
+    /* 共享SRQ替换配置项 */
+    {"enable_srq_substitute", NULL, parse_enable_srq_substitute},
+    {"srq_substitute_depth", NULL, parse_srq_substitute_depth},
+    
+    /* UD QP多路复用配置项 */
+    {"enable_ud_mux", NULL, parse_enable_ud_mux},
+    {"ud_mux_real_qps", NULL, parse_ud_mux_real_qps},
+    
+    /* 队列内存估算配置项 */
+    {"queue_mem_model", NULL, parse_queue_mem_model},
+    {"queue_mem_params", NULL, parse_queue_mem_params},
+    
+    /* QP工作集配置项 */
+    {"enable_qp_working_set", NULL, parse_enable_qp_working_set},
+    {"qp_ws_window_us", NULL, parse_qp_ws_window_us},
+    {"qp_ws_throttle", NULL, parse_qp_ws_throttle},
+    
+    /* QP创建限速配置项 */
+    {"qp_create_wait_ms", NULL, parse_qp_create_wait_ms},
+    
     {NULL, NULL, NULL}
 };
 
@@ -337,6 +517,118 @@ static void load_config_from_env(intercept_config_t *config) {
         }
     }
     
+    /* MR合并注册 */
+    env_val = getenv("RDMA_INTERCEPT_MR_COALESCE");
+    if (env_val) {
+        parse_bool(env_val, &config->enable_mr_coalesce);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_MR_COALESCE_ALIGN");
+    if (env_val) {
+        parse_mr_coalesce_align(env_val, config);
+    }
+    
+    /* 异步MR注册 */
+    env_val = getenv("RDMA_INTERCEPT_ASYNC_REG_WORKERS");
+    if (env_val) {
+        parse_async_reg_workers(env_val, config);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_ASYNC_PREFAULT_THREADS");
+    if (env_val) {
+        parse_async_prefault_threads(env_val, config);
+    }
+    
+    /* QP池 */
+    env_val = getenv("RDMA_INTERCEPT_QP_POOL");
+    if (env_val) {
+        parse_bool(env_val, &config->enable_qp_pool);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_QP_POOL_MAX");
+    if (env_val) {
+        parse_qp_pool_max(env_val, config);
+    }
+    
+    /* CQ/PD池 */
+    env_val = getenv("RDMA_INTERCEPT_CQ_PD_POOL");
+    if (env_val) {
+        parse_bool(env_val, &config->enable_cq_pd_pool);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_CQ_PD_POOL_MAX");
+    if (env_val) {
+        parse_cq_pd_pool_max(env_val, config);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_CQ_PD_POOL_TTL");
+    if (env_val) {
+        parse_cq_pd_pool_ttl(env_val, config);
+    }
+    
+    /* AH缓存 */
+    env_val = getenv("RDMA_INTERCEPT_AH_CACHE");
+    if (env_val) {
+        parse_bool(env_val, &config->enable_ah_cache);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_AH_CACHE_MAX");
+    if (env_val) {
+        parse_ah_cache_max(env_val, config);
+    }
+    
+    /* RQ到SRQ替换 */
+    env_val = getenv("RDMA_INTERCEPT_SRQ_SUBSTITUTE");
+    if (env_val) {
+        parse_bool(env_val, &config->enable_srq_substitute);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_SRQ_DEPTH");
+    if (env_val) {
+        parse_srq_substitute_depth(env_val, config);
+    }
+    
+    /* UD虚拟QP复用 */
+    env_val = getenv("RDMA_INTERCEPT_UD_MUX");
+    if (env_val) {
+        parse_bool(env_val, &config->enable_ud_mux);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_UD_MUX_QPS");
+    if (env_val) {
+        parse_ud_mux_real_qps(env_val, config);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_QUEUE_MEM_MODEL");
+    if (env_val) {
+        parse_queue_mem_model(env_val, config);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_QUEUE_MEM_PARAMS");
+    if (env_val) {
+        parse_queue_mem_params(env_val, config);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_QP_WS");
+    if (env_val) {
+        parse_bool(env_val, &config->enable_qp_working_set);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_QP_WS_WINDOW_US");
+    if (env_val) {
+        parse_qp_ws_window_us(env_val, config);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_QP_WS_THROTTLE");
+    if (env_val) {
+        parse_bool(env_val, &config->qp_ws_throttle);
+    }
+    
+    env_val = getenv("RDMA_INTERCEPT_QP_CREATE_WAIT_MS");
+    if (env_val) {
+        parse_qp_create_wait_ms(env_val, config);
+    }
+    
     /* 日志文件路径 */
     env_val = getenv("RDMA_INTERCEPT_LOG_FILE_PATH");
     if (env_val) {
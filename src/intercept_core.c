@@ -43,7 +43,46 @@ intercept_state_t g_intercept_state = {
         /* 内存资源管理默认配置 */
         .enable_mr_control = false,  /* 默认关闭内存控制 */
         .max_mr_per_process = 1000,  /* 默认每个进程最多1000个MR */
-        .max_memory_per_process = 1024ULL * 1024ULL * 1024ULL * 10ULL  /* 默认每个进程最多10GB内存 */
+        .max_memory_per_process = 1024ULL * 1024ULL * 1024ULL * 10ULL, /* 默认每个进程最多10GB内存 */
+        
+        /* MR合并注册默认配置 */
+        .enable_mr_coalesce = false, /* 默认关闭合并注册 */
+        .mr_coalesce_align = 2ULL * 1024ULL * 1024ULL, /* 默认按2MB对齐覆盖范围 */
+        
+        /* 异步MR注册默认配置 */
+        .async_reg_workers = 2,      /* 默认2个后台注册线程 */
+        .async_prefault_threads = 4, /* 默认4个线程并行预取页面 */
+        
+        /* QP池默认配置 */
+        .enable_qp_pool = false,     /* 默认关闭QP池 */
+        .qp_pool_max = 64,           /* 默认每进程最多闲置64个QP */
+        
+        /* CQ/PD池默认配置 */
+        .enable_cq_pd_pool = false,  /* 默认关闭CQ/PD池 */
+        .cq_pd_pool_max = 32,        /* 默认每进程最多闲置32个CQ和32个PD */
+        .cq_pd_pool_ttl_sec = 30,    /* 默认闲置30秒后释放 */
+        
+        /* AH缓存默认配置 */
+        .enable_ah_cache = false,    /* 默认关闭AH缓存 */
+        .ah_cache_max = 1024,        /* 默认每进程最多保留1024个闲置AH */
+        
+        /* RQ到SRQ替换默认配置 */
+        .enable_srq_substitute = false, /* 默认关闭，需应用确认接收缓冲区可互换 */
+        .srq_substitute_depth = 4096, /* 默认共享SRQ深度4096 */
+        
+        /* UD虚拟QP复用默认配置 */
+        .enable_ud_mux = false,      /* 默认关闭UD复用 */
+        .ud_mux_real_qps = 4,        /* 默认每进程最多4个真实UD QP */
+        
+        /* 队列内存估算默认配置 */
+        .queue_mem_model = "mlx5",   /* 默认按mlx5的WQE步长估算 */
+        .queue_mem_params = "",      /* 默认不校准 */
+        
+        /* QP工作集跟踪默认配置 */
+        .enable_qp_working_set = false, /* 默认关闭，开启后接管投递路径 */
+        .qp_ws_window_us = 1000,     /* 默认1ms窗口 */
+        .qp_ws_throttle = false,     /* 默认只统计不节流 */
+        .qp_create_wait_ms = 5000    /* 创建排队最多等待5秒 */
     },
     .log_file = NULL,
     .log_mutex = PTHREAD_MUTEX_INITIALIZER,
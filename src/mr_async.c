@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+/* NO_DEBUG: Disable debug output for performance testing */
+#ifdef NO_DEBUG
+  #define DEBUG_FPRINTF(...) ((void)0)
+#else
+  #define DEBUG_FPRINTF(...) fprintf(__VA_ARGS__)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "mr_async.h"
+
+/* Linux 5.14+，旧头文件中可能没有定义 */
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+// 小于该长度的区间不再拆分给多个线程预取
+#define PREFAULT_MIN_CHUNK (64UL * 1024 * 1024)
+
+/* 完成句柄 */
+struct rdma_mr_async {
+    struct ibv_pd *pd;
+    void *addr;
+    size_t length;
+    int access;
+    uint32_t tenant_id;
+    mr_async_reg_fn reg_fn;
+
+    struct ibv_mr *mr;            // 注册结果
+    int err;                      // 失败时的errno
+    bool done;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    struct rdma_mr_async *next;   // 待处理队列
+};
+
+/* 预取任务 */
+typedef struct {
+    char *start;
+    size_t length;
+    bool write;
+} prefault_chunk_t;
+
+static rdma_mr_async_t *g_queue_head = NULL;
+static rdma_mr_async_t *g_queue_tail = NULL;
+static pthread_mutex_t g_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t g_pool_once = PTHREAD_ONCE_INIT;
+static uint32_t g_pool_workers = 2;
+static uint32_t g_prefault_threads = 4;
+static uint32_t g_started_workers = 0;
+
+void mr_async_configure(uint32_t workers, uint32_t prefault_threads) {
+    if (workers > 0) {
+        g_pool_workers = workers;
+    }
+    g_prefault_threads = prefault_threads;
+}
+
+static void prefault_range(char *start, size_t length, bool write) {
+    if (length == 0) {
+        return;
+    }
+
+    /* 优先使用MADV_POPULATE_*，不修改页面内容 */
+    if (madvise(start, length, write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0) {
+        return;
+    }
+
+    /* 旧内核回退为逐页读取（只读预取，写时复制仍由注册完成） */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    for (size_t off = 0; off < length; off += page) {
+        sink ^= ((volatile char *)start)[off];
+    }
+    (void)sink;
+}
+
+static void *prefault_thread(void *arg) {
+    prefault_chunk_t *chunk = arg;
+    prefault_range(chunk->start, chunk->length, chunk->write);
+    return NULL;
+}
+
+void mr_async_prefault(void *addr, size_t length, uint32_t threads, bool write) {
+    if (!addr || length == 0 || threads == 0) {
+        return;
+    }
+
+    /* madvise要求起始地址页对齐 */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t s = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+    uintptr_t e = (uintptr_t)addr + length;
+    size_t total = e - s;
+
+    uint32_t n = threads;
+    if (total / n < PREFAULT_MIN_CHUNK) {
+        n = (uint32_t)(total / PREFAULT_MIN_CHUNK);
+        if (n == 0) n = 1;
+    }
+
+    if (n == 1) {
+        prefault_range((char *)s, total, write);
+        return;
+    }
+
+    prefault_chunk_t chunks[n];
+    pthread_t tids[n];
+    bool spawned[n];
+    size_t per = ((total / n) + page - 1) & ~(page - 1);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uintptr_t cs = s + (uintptr_t)i * per;
+        uintptr_t ce = (i == n - 1 || cs + per > e) ? e : cs + per;
+        chunks[i].start = (char *)cs;
+        chunks[i].length = (cs < ce) ? ce - cs : 0;
+        chunks[i].write = write;
+        spawned[i] = pthread_create(&tids[i], NULL, prefault_thread, &chunks[i]) == 0;
+        if (!spawned[i]) {
+            prefault_range(chunks[i].start, chunks[i].length, write);
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (spawned[i]) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+}
+
+static void *async_worker(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&g_queue_mutex);
+        while (!g_queue_head) {
+            pthread_cond_wait(&g_queue_cond, &g_queue_mutex);
+        }
+        rdma_mr_async_t *h = g_queue_head;
+        g_queue_head = h->next;
+        if (!g_queue_head) {
+            g_queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&g_queue_mutex);
+
+        bool write = (h->access & (IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+                                   IBV_ACCESS_REMOTE_ATOMIC)) != 0;
+        mr_async_prefault(h->addr, h->length, g_prefault_threads, write);
+
+        struct ibv_mr *mr = h->reg_fn(h->pd, h->addr, h->length, h->access, h->tenant_id);
+        int err = mr ? 0 : (errno ? errno : EIO);
+
+        pthread_mutex_lock(&h->mutex);
+        h->mr = mr;
+        h->err = err;
+        h->done = true;
+        pthread_cond_broadcast(&h->cond);
+        pthread_mutex_unlock(&h->mutex);
+
+        DEBUG_FPRINTF(stderr, "[MR_ASYNC] registered %p+%zu -> %p (err=%d)\n",
+                      h->addr, h->length, mr, err);
+    }
+    return NULL;
+}
+
+static void start_pool(void) {
+    for (uint32_t i = 0; i < g_pool_workers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, async_worker, NULL) == 0) {
+            pthread_detach(tid);
+            g_started_workers++;
+        }
+    }
+    DEBUG_FPRINTF(stderr, "[MR_ASYNC] started %u workers\n", g_started_workers);
+}
+
+rdma_mr_async_t *mr_async_submit(struct ibv_pd *pd, void *addr, size_t length, int access,
+                                 uint32_t tenant_id, mr_async_reg_fn reg_fn) {
+    if (!pd || !reg_fn || length == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_once(&g_pool_once, start_pool);
+    if (g_started_workers == 0) {
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    rdma_mr_async_t *h = calloc(1, sizeof(*h));
+    if (!h) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    h->pd = pd;
+    h->addr = addr;
+    h->length = length;
+    h->access = access;
+    h->tenant_id = tenant_id;
+    h->reg_fn = reg_fn;
+    pthread_mutex_init(&h->mutex, NULL);
+    pthread_cond_init(&h->cond, NULL);
+
+    pthread_mutex_lock(&g_queue_mutex);
+    if (g_queue_tail) {
+        g_queue_tail->next = h;
+    } else {
+        g_queue_head = h;
+    }
+    g_queue_tail = h;
+    pthread_cond_signal(&g_queue_cond);
+    pthread_mutex_unlock(&g_queue_mutex);
+
+    return h;
+}
+
+int rdma_intercept_mr_async_test(rdma_mr_async_t *handle, struct ibv_mr **mr) {
+    if (!handle) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&handle->mutex);
+    int ret = handle->done ? handle->err : EAGAIN;
+    if (handle->done && mr) {
+        *mr = handle->mr;
+    }
+    pthread_mutex_unlock(&handle->mutex);
+    return ret;
+}
+
+int rdma_intercept_mr_async_wait(rdma_mr_async_t *handle, struct ibv_mr **mr) {
+    if (!handle) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&handle->mutex);
+    while (!handle->done) {
+        pthread_cond_wait(&handle->cond, &handle->mutex);
+    }
+    if (mr) {
+        *mr = handle->mr;
+    }
+    int ret = handle->err;
+    pthread_mutex_unlock(&handle->mutex);
+    return ret;
+}
+
+void rdma_intercept_mr_async_free(rdma_mr_async_t *handle) {
+    if (!handle) {
+        return;
+    }
+
+    /* 未完成时先等待，注册成功的MR仍归应用所有 */
+    rdma_intercept_mr_async_wait(handle, NULL);
+    pthread_mutex_destroy(&handle->mutex);
+    pthread_cond_destroy(&handle->cond);
+    free(handle);
+}
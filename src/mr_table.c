@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+/* NO_DEBUG: Disable debug output for performance testing */
+#ifdef NO_DEBUG
+  #define DEBUG_FPRINTF(...) ((void)0)
+#else
+  #define DEBUG_FPRINTF(...) fprintf(__VA_ARGS__)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include "mr_table.h"
+
+/* 覆盖注册的父MR（实际占用网卡MPT条目） */
+typedef struct mr_parent {
+    struct ibv_mr *mr;            // 真实MR
+    struct ibv_pd *pd;
+    int access;
+    uintptr_t start;              // 覆盖范围[start, end)
+    uintptr_t end;
+    uint32_t refcnt;              // 引用该父MR的视图数
+    struct mr_parent *next;
+} mr_parent_t;
+
+/* 返回给应用的视图，view必须是第一个成员 */
+typedef struct mr_view {
+    struct ibv_mr view;
+    mr_parent_t *parent;
+    struct mr_view *next;
+} mr_view_t;
+
+/* 记账记录 */
+typedef struct mr_account {
+    struct ibv_mr *mr;
+    uint32_t tenant_id;
+    size_t length;                // 已计入配额的长度
+    struct mr_account *next;
+} mr_account_t;
+
+static mr_parent_t *g_parents[MR_PARENT_BUCKETS];
+static mr_view_t *g_views[MR_TABLE_BUCKETS];
+static mr_account_t *g_accounts[MR_TABLE_BUCKETS];
+static pthread_mutex_t g_mr_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static mr_coalesce_stats_t g_coalesce_stats;
+static size_t g_coalesce_align = 0;
+
+static uint32_t hash_ptr(const void *ptr, uint32_t buckets) {
+    uintptr_t v = (uintptr_t)ptr;
+    return (uint32_t)(((v >> 4) * 2654435761U) % buckets);
+}
+
+static size_t effective_align(void) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (g_coalesce_align > page) ? g_coalesce_align : page;
+}
+
+void mr_coalesce_set_align(size_t align) {
+    /* 只接受2的幂，其余情况退化为页对齐 */
+    if (align && (align & (align - 1)) == 0) {
+        g_coalesce_align = align;
+    } else {
+        g_coalesce_align = 0;
+    }
+}
+
+/* 在父MR上创建视图（调用方持锁） */
+static mr_view_t *create_view_locked(mr_parent_t *parent, void *addr, size_t length) {
+    mr_view_t *v = calloc(1, sizeof(*v));
+    if (!v) {
+        return NULL;
+    }
+
+    v->view.context = parent->mr->context;
+    v->view.pd = parent->mr->pd;
+    v->view.addr = addr;
+    v->view.length = length;
+    v->view.handle = parent->mr->handle;
+    v->view.lkey = parent->mr->lkey;
+    v->view.rkey = parent->mr->rkey;
+    v->parent = parent;
+
+    uint32_t b = hash_ptr(v, MR_TABLE_BUCKETS);
+    v->next = g_views[b];
+    g_views[b] = v;
+
+    parent->refcnt++;
+    g_coalesce_stats.active_views++;
+    return v;
+}
+
+struct ibv_mr *mr_coalesce_lookup(struct ibv_pd *pd, void *addr, size_t length, int access) {
+    uintptr_t s = (uintptr_t)addr;
+    uintptr_t e = s + length;
+    mr_parent_t *best = NULL;
+
+    pthread_mutex_lock(&g_mr_table_mutex);
+
+    /* 选择覆盖请求范围的最大父MR，使旧的小父MR尽快随视图释放 */
+    for (mr_parent_t *p = g_parents[hash_ptr(pd, MR_PARENT_BUCKETS)]; p; p = p->next) {
+        if (p->pd == pd && p->access == access && p->start <= s && e <= p->end) {
+            if (!best || (p->end - p->start) > (best->end - best->start)) {
+                best = p;
+            }
+        }
+    }
+
+    mr_view_t *v = best ? create_view_locked(best, addr, length) : NULL;
+    if (v) {
+        g_coalesce_stats.views_served++;
+    }
+
+    pthread_mutex_unlock(&g_mr_table_mutex);
+
+    if (v) {
+        DEBUG_FPRINTF(stderr, "[MR_TABLE] coalesced %p+%zu into parent %p\n", addr, length, best->mr);
+    }
+    return v ? &v->view : NULL;
+}
+
+struct ibv_mr *mr_coalesce_register(struct ibv_pd *pd, void *addr, size_t length, int access,
+                                    mr_table_reg_fn reg_fn, mr_table_dereg_fn dereg_fn,
+                                    size_t *pinned_length) {
+    if (!reg_fn || !dereg_fn || length == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    uintptr_t s = (uintptr_t)addr;
+    uintptr_t e = s + length;
+
+    /*
+     * 按对齐粒度向两侧扩展，使后续相邻注册命中新父MR；扩展部分与已有父MR重叠时
+     * 裁到已有父MR的边界（最多裁到请求所在的页），同一段内存不会被反复注册。
+     * 只有请求本身跨过已有父MR边界的部分会再注册一次（视图只能属于一个父MR）
+     */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t align = effective_align();
+    uintptr_t ps = s & ~(uintptr_t)(page - 1);
+    uintptr_t pe = (e + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t as = s & ~(uintptr_t)(align - 1);
+    uintptr_t ae = (e + align - 1) & ~(uintptr_t)(align - 1);
+    pthread_mutex_lock(&g_mr_table_mutex);
+    for (mr_parent_t *p = g_parents[hash_ptr(pd, MR_PARENT_BUCKETS)]; p; p = p->next) {
+        if (p->pd != pd || p->access != access) {
+            continue;
+        }
+        if (p->start < ps && p->end > as) {
+            as = p->end < ps ? p->end : ps;
+        }
+        if (p->end > pe && p->start < ae) {
+            ae = p->start > pe ? p->start : pe;
+        }
+    }
+    pthread_mutex_unlock(&g_mr_table_mutex);
+
+    /* 依次尝试：扩展后的覆盖范围 -> 精确范围 */
+    uintptr_t tries[2][2] = { { as, ae }, { s, e } };
+    struct ibv_mr *real = NULL;
+    uintptr_t rs = 0, re = 0;
+    for (int i = 0; i < 2 && !real; i++) {
+        if (i > 0 && tries[i][0] == tries[i - 1][0] && tries[i][1] == tries[i - 1][1]) {
+            continue;
+        }
+        rs = tries[i][0];
+        re = tries[i][1];
+        real = reg_fn(pd, (void *)rs, re - rs, access);
+    }
+
+    if (!real) {
+        return NULL;
+    }
+
+    mr_parent_t *parent = calloc(1, sizeof(*parent));
+    if (!parent) {
+        dereg_fn(real);
+        errno = ENOMEM;
+        return NULL;
+    }
+    parent->mr = real;
+    parent->pd = pd;
+    parent->access = access;
+    parent->start = rs;
+    parent->end = re;
+
+    pthread_mutex_lock(&g_mr_table_mutex);
+
+    mr_view_t *v = create_view_locked(parent, addr, length);
+    if (v) {
+        uint32_t b = hash_ptr(pd, MR_PARENT_BUCKETS);
+        parent->next = g_parents[b];
+        g_parents[b] = parent;
+        g_coalesce_stats.parents_registered++;
+        g_coalesce_stats.active_parents++;
+    }
+
+    pthread_mutex_unlock(&g_mr_table_mutex);
+
+    if (!v) {
+        /* 父MR未入表，直接撤销注册，否则既不计入配额也无法释放 */
+        free(parent);
+        dereg_fn(real);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (pinned_length) {
+        *pinned_length = re - rs;
+    }
+
+    DEBUG_FPRINTF(stderr, "[MR_TABLE] registered covering MR %p [%#lx, %#lx) for %p+%zu\n",
+                  real, (unsigned long)rs, (unsigned long)re, addr, length);
+    return &v->view;
+}
+
+bool mr_coalesce_is_view(struct ibv_mr *mr) {
+    if (!mr) {
+        return false;
+    }
+
+    bool found = false;
+    pthread_mutex_lock(&g_mr_table_mutex);
+    if (g_coalesce_stats.active_views > 0) {
+        for (mr_view_t *v = g_views[hash_ptr(mr, MR_TABLE_BUCKETS)]; v; v = v->next) {
+            if (&v->view == mr) {
+                found = true;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_mr_table_mutex);
+    return found;
+}
+
+/* 从链表中摘除父MR（调用方持锁） */
+static void unlink_parent_locked(mr_parent_t *parent) {
+    mr_parent_t **pp = &g_parents[hash_ptr(parent->pd, MR_PARENT_BUCKETS)];
+    while (*pp) {
+        if (*pp == parent) {
+            *pp = parent->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+}
+
+int mr_coalesce_release(struct ibv_mr *mr, mr_table_dereg_fn dereg_fn, size_t *released_length) {
+    if (released_length) {
+        *released_length = 0;
+    }
+    if (!mr || !dereg_fn) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_mr_table_mutex);
+
+    mr_view_t **vp = &g_views[hash_ptr(mr, MR_TABLE_BUCKETS)];
+    mr_view_t *v = NULL;
+    while (*vp) {
+        if (&(*vp)->view == mr) {
+            v = *vp;
+            *vp = v->next;
+            break;
+        }
+        vp = &(*vp)->next;
+    }
+
+    if (!v) {
+        pthread_mutex_unlock(&g_mr_table_mutex);
+        errno = EINVAL;
+        return -1;
+    }
+
+    mr_parent_t *parent = v->parent;
+    parent->refcnt--;
+    g_coalesce_stats.active_views--;
+
+    if (parent->refcnt > 0) {
+        pthread_mutex_unlock(&g_mr_table_mutex);
+        free(v);
+        return 0;
+    }
+
+    unlink_parent_locked(parent);
+    g_coalesce_stats.active_parents--;
+    pthread_mutex_unlock(&g_mr_table_mutex);
+
+    /* 最后一个视图，注销覆盖MR（不持锁，避免阻塞其它注册） */
+    if (dereg_fn(parent->mr) != 0) {
+        int saved_errno = errno;
+
+        /* 注销失败：恢复父MR和视图，保持应用句柄可用 */
+        pthread_mutex_lock(&g_mr_table_mutex);
+        uint32_t pb = hash_ptr(parent->pd, MR_PARENT_BUCKETS);
+        parent->next = g_parents[pb];
+        g_parents[pb] = parent;
+        parent->refcnt++;
+        uint32_t vb = hash_ptr(v, MR_TABLE_BUCKETS);
+        v->next = g_views[vb];
+        g_views[vb] = v;
+        g_coalesce_stats.active_parents++;
+        g_coalesce_stats.active_views++;
+        pthread_mutex_unlock(&g_mr_table_mutex);
+
+        errno = saved_errno;
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_mr_table_mutex);
+    g_coalesce_stats.parents_released++;
+    pthread_mutex_unlock(&g_mr_table_mutex);
+
+    if (released_length) {
+        *released_length = parent->end - parent->start;
+    }
+
+    free(parent);
+    free(v);
+    return 0;
+}
+
+void mr_coalesce_get_stats(mr_coalesce_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    pthread_mutex_lock(&g_mr_table_mutex);
+    memcpy(stats, &g_coalesce_stats, sizeof(*stats));
+    pthread_mutex_unlock(&g_mr_table_mutex);
+}
+
+/* 查找记账记录（调用方持锁） */
+static mr_account_t *find_account_locked(struct ibv_mr *mr) {
+    for (mr_account_t *a = g_accounts[hash_ptr(mr, MR_TABLE_BUCKETS)]; a; a = a->next) {
+        if (a->mr == mr) {
+            return a;
+        }
+    }
+    return NULL;
+}
+
+int mr_account_add(struct ibv_mr *mr, uint32_t tenant_id, size_t length) {
+    mr_account_t *a = malloc(sizeof(*a));
+    if (!a) {
+        return -1;
+    }
+    a->mr = mr;
+    a->tenant_id = tenant_id;
+    a->length = length;
+
+    uint32_t b = hash_ptr(mr, MR_TABLE_BUCKETS);
+    pthread_mutex_lock(&g_mr_table_mutex);
+    a->next = g_accounts[b];
+    g_accounts[b] = a;
+    pthread_mutex_unlock(&g_mr_table_mutex);
+    return 0;
+}
+
+int mr_account_get(struct ibv_mr *mr, uint32_t *tenant_id, size_t *length) {
+    pthread_mutex_lock(&g_mr_table_mutex);
+    mr_account_t *a = find_account_locked(mr);
+    if (a) {
+        if (tenant_id) *tenant_id = a->tenant_id;
+        if (length) *length = a->length;
+    }
+    pthread_mutex_unlock(&g_mr_table_mutex);
+    return a ? 0 : -1;
+}
+
+int mr_account_set_length(struct ibv_mr *mr, size_t length) {
+    pthread_mutex_lock(&g_mr_table_mutex);
+    mr_account_t *a = find_account_locked(mr);
+    if (a) {
+        a->length = length;
+    }
+    pthread_mutex_unlock(&g_mr_table_mutex);
+    return a ? 0 : -1;
+}
+
+int mr_account_remove(struct ibv_mr *mr, uint32_t *tenant_id, size_t *length) {
+    mr_account_t *a = NULL;
+
+    pthread_mutex_lock(&g_mr_table_mutex);
+    for (mr_account_t **pp = &g_accounts[hash_ptr(mr, MR_TABLE_BUCKETS)]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->mr == mr) {
+            a = *pp;
+            *pp = a->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_mr_table_mutex);
+
+    if (!a) {
+        return -1;
+    }
+    if (tenant_id) *tenant_id = a->tenant_id;
+    if (length) *length = a->length;
+    free(a);
+    return 0;
+}
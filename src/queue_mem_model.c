@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+/* NO_DEBUG: Disable debug output for performance testing */
+#ifdef NO_DEBUG
+  #define DEBUG_FPRINTF(...) ((void)0)
+#else
+  #define DEBUG_FPRINTF(...) fprintf(__VA_ARGS__)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "queue_mem_model.h"
+
+static uint64_t round_up_pow2(uint64_t v) {
+    uint64_t r = 1;
+    while (r < v) {
+        r <<= 1;
+    }
+    return r;
+}
+
+static uint64_t align_up(uint64_t v, uint64_t align) {
+    return align ? (v + align - 1) / align * align : v;
+}
+
+/* mlx5：发送WQE按基本块对齐，队列深度和接收WQE步长取2的幂，整体按页分配 */
+static uint64_t mlx5_qp_bytes(const queue_mem_model_t *model, const struct ibv_qp_init_attr *attr) {
+    const queue_mem_params_t *p = &model->params;
+    uint64_t bytes = 0;
+
+    if (attr->cap.max_send_wr > 0) {
+        uint64_t overhead = (attr->qp_type == IBV_QPT_UD) ? p->ud_overhead : p->rc_overhead;
+        uint64_t sge = overhead + (uint64_t)attr->cap.max_send_sge * p->data_seg;
+        uint64_t inl = attr->cap.max_inline_data ?
+                       overhead + align_up(attr->cap.max_inline_data + p->inline_hdr, p->data_seg) : 0;
+        uint64_t wqe = align_up(sge > inl ? sge : inl, p->send_wqe_bb);
+        uint64_t bbs = round_up_pow2((uint64_t)attr->cap.max_send_wr * wqe / p->send_wqe_bb);
+        bytes += bbs * p->send_wqe_bb;
+    }
+
+    if (!attr->srq && attr->cap.max_recv_wr > 0) {
+        uint32_t sges = attr->cap.max_recv_sge ? attr->cap.max_recv_sge : 1;
+        uint64_t stride = round_up_pow2((uint64_t)sges * p->recv_seg);
+        bytes += round_up_pow2(attr->cap.max_recv_wr) * stride;
+    }
+
+    return align_up(bytes, p->page_size);
+}
+
+/* mlx5：CQ容量取2的幂（至少比请求多1个），整体按页分配 */
+static uint64_t mlx5_cq_bytes(const queue_mem_model_t *model, int cqe) {
+    if (cqe <= 0) {
+        return 0;
+    }
+    return align_up(round_up_pow2((uint64_t)cqe + 1) * model->params.cqe_size, model->params.page_size);
+}
+
+static uint64_t none_qp_bytes(const queue_mem_model_t *model, const struct ibv_qp_init_attr *attr) {
+    (void)model;
+    (void)attr;
+    return 0;
+}
+
+static uint64_t none_cq_bytes(const queue_mem_model_t *model, int cqe) {
+    (void)model;
+    (void)cqe;
+    return 0;
+}
+
+static queue_mem_model_t g_models[QUEUE_MEM_MAX_MODELS] = {
+    {
+        .name = "mlx5",
+        .qp_bytes = mlx5_qp_bytes,
+        .cq_bytes = mlx5_cq_bytes,
+        .params = {
+            .send_wqe_bb = 64,
+            .data_seg = 16,
+            .inline_hdr = 4,
+            .rc_overhead = 48,
+            .ud_overhead = 64,
+            .recv_seg = 16,
+            .cqe_size = 64,
+            .page_size = 4096
+        }
+    },
+    {
+        .name = "none",
+        .qp_bytes = none_qp_bytes,
+        .cq_bytes = none_cq_bytes
+    }
+};
+static int g_model_count = 2;
+static queue_mem_model_t *g_current = &g_models[0];
+static pthread_rwlock_t g_model_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static queue_mem_model_t *find_model_locked(const char *name) {
+    for (int i = 0; i < g_model_count; i++) {
+        if (strcmp(g_models[i].name, name) == 0) {
+            return &g_models[i];
+        }
+    }
+    return NULL;
+}
+
+int queue_mem_model_register(const queue_mem_model_t *model) {
+    if (!model || !model->name[0] || !model->qp_bytes || !model->cq_bytes) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&g_model_lock);
+    queue_mem_model_t *slot = find_model_locked(model->name);
+    if (!slot && g_model_count < QUEUE_MEM_MAX_MODELS) {
+        slot = &g_models[g_model_count++];
+    }
+    if (slot) {
+        *slot = *model;
+        slot->name[QUEUE_MEM_MODEL_NAME_LEN - 1] = '\0';
+    }
+    pthread_rwlock_unlock(&g_model_lock);
+
+    return slot ? 0 : -1;
+}
+
+int queue_mem_model_select(const char *name) {
+    if (!name) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&g_model_lock);
+    queue_mem_model_t *m = find_model_locked(name);
+    if (m) {
+        g_current = m;
+    }
+    pthread_rwlock_unlock(&g_model_lock);
+
+    if (!m) {
+        DEBUG_FPRINTF(stderr, "[QUEUE_MEM] Unknown model '%s', keeping '%s'\n", name, g_current->name);
+        return -1;
+    }
+    return 0;
+}
+
+int queue_mem_model_calibrate(const char *spec) {
+    if (!spec) {
+        return -1;
+    }
+
+    char buf[256];
+    if (strlen(spec) >= sizeof(buf)) {
+        return -1;
+    }
+    strcpy(buf, spec);
+
+    pthread_rwlock_wrlock(&g_model_lock);
+    queue_mem_params_t p = g_current->params;
+    int ret = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        char *end;
+        unsigned long val = strtoul(eq + 1, &end, 10);
+        if (*end != '\0' || val > (1UL << 20)) {
+            ret = -1;
+            break;
+        }
+
+        uint32_t *field = NULL;
+        if (strcmp(tok, "send_wqe_bb") == 0) field = &p.send_wqe_bb;
+        else if (strcmp(tok, "data_seg") == 0) field = &p.data_seg;
+        else if (strcmp(tok, "inline_hdr") == 0) field = &p.inline_hdr;
+        else if (strcmp(tok, "rc_overhead") == 0) field = &p.rc_overhead;
+        else if (strcmp(tok, "ud_overhead") == 0) field = &p.ud_overhead;
+        else if (strcmp(tok, "recv_seg") == 0) field = &p.recv_seg;
+        else if (strcmp(tok, "cqe_size") == 0) field = &p.cqe_size;
+        else if (strcmp(tok, "page_size") == 0) field = &p.page_size;
+        if (!field) {
+            ret = -1;
+            break;
+        }
+        *field = (uint32_t)val;
+    }
+    // 步长参与除法，不能为0
+    if (ret == 0 && p.send_wqe_bb == 0 && g_current->qp_bytes == mlx5_qp_bytes) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        g_current->params = p;
+    }
+    pthread_rwlock_unlock(&g_model_lock);
+
+    if (ret != 0) {
+        DEBUG_FPRINTF(stderr, "[QUEUE_MEM] Invalid calibration '%s'\n", spec);
+    }
+    return ret;
+}
+
+uint64_t queue_mem_estimate_qp(const struct ibv_qp_init_attr *attr) {
+    if (!attr) {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&g_model_lock);
+    uint64_t bytes = g_current->qp_bytes(g_current, attr);
+    pthread_rwlock_unlock(&g_model_lock);
+    return bytes;
+}
+
+uint64_t queue_mem_estimate_srq(uint32_t max_wr, uint32_t max_sge) {
+    struct ibv_qp_init_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_type = IBV_QPT_RC;
+    attr.cap.max_recv_wr = max_wr;
+    attr.cap.max_recv_sge = max_sge;
+    return queue_mem_estimate_qp(&attr);
+}
+
+uint64_t queue_mem_estimate_cq(int cqe) {
+    pthread_rwlock_rdlock(&g_model_lock);
+    uint64_t bytes = g_current->cq_bytes(g_current, cqe);
+    pthread_rwlock_unlock(&g_model_lock);
+    return bytes;
+}
@@ -20,12 +20,16 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/syscall.h>
 #include <infiniband/verbs.h>
 #include "rdma_intercept.h"
 #include "ebpf/ebpf_monitor_shm.h"
 #include "shm/shared_memory.h"
 #include "shm/shared_memory_tenant.h"
 #include "dynamic_policy.h"
+#include "mr_table.h"
+#include "mr_async.h"
+#include "queue_mem_model.h"
 
 // 前向声明
 uint32_t collector_get_global_qp_count(void);
@@ -46,10 +50,29 @@ typedef struct ibv_qp *(*ibv_create_qp_ex_fn)(struct ibv_context *, struct ibv_q
 typedef int (*ibv_destroy_qp_fn)(struct ibv_qp *);
 typedef struct ibv_cq *(*ibv_create_cq_fn)(struct ibv_context *, int, void *, struct ibv_comp_channel *, int);
 typedef int (*ibv_destroy_cq_fn)(struct ibv_cq *);
+typedef int (*ibv_destroy_srq_fn)(struct ibv_srq *);
+typedef int (*ibv_destroy_comp_channel_fn)(struct ibv_comp_channel *);
 typedef struct ibv_pd *(*ibv_alloc_pd_fn)(struct ibv_context *);
 typedef int (*ibv_dealloc_pd_fn)(struct ibv_pd *);
 typedef int (*ibv_dereg_mr_fn)(struct ibv_mr *);
 typedef struct ibv_mr *(*ibv_reg_mr_fn)(struct ibv_pd *, void *, size_t, int);
+typedef struct ibv_mr *(*ibv_reg_mr_iova2_fn)(struct ibv_pd *, void *, size_t, uint64_t, unsigned int);
+typedef struct ibv_mr *(*ibv_reg_dmabuf_mr_fn)(struct ibv_pd *, uint64_t, size_t, uint64_t, int, int);
+typedef int (*ibv_rereg_mr_fn)(struct ibv_mr *, int, struct ibv_pd *, void *, size_t, int);
+typedef int (*ibv_modify_qp_fn)(struct ibv_qp *, struct ibv_qp_attr *, int);
+typedef int (*ibv_query_qp_fn)(struct ibv_qp *, struct ibv_qp_attr *, int, struct ibv_qp_init_attr *);
+typedef struct ibv_ah *(*ibv_create_ah_fn)(struct ibv_pd *, struct ibv_ah_attr *);
+typedef int (*ibv_destroy_ah_fn)(struct ibv_ah *);
+typedef struct ibv_context *(*ibv_open_device_fn)(struct ibv_device *);
+typedef int (*ibv_close_device_fn)(struct ibv_context *);
+
+/* 设备内存操作表函数类型（verbs_context中的操作） */
+typedef struct ibv_dm *(*alloc_dm_op_fn)(struct ibv_context *, struct ibv_alloc_dm_attr *);
+typedef int (*free_dm_op_fn)(struct ibv_dm *);
+typedef struct ibv_mr *(*reg_dm_mr_op_fn)(struct ibv_pd *, struct ibv_dm *, uint64_t, size_t, unsigned int);
+typedef int (*post_recv_op_fn)(struct ibv_qp *, struct ibv_recv_wr *, struct ibv_recv_wr **);
+typedef int (*post_send_op_fn)(struct ibv_qp *, struct ibv_send_wr *, struct ibv_send_wr **);
+typedef int (*poll_cq_op_fn)(struct ibv_cq *, int, struct ibv_wc *);
 
 /* 原始函数指针存储 */
 static ibv_create_qp_fn real_ibv_create_qp = NULL;
@@ -57,10 +80,21 @@ static ibv_create_qp_ex_fn real_ibv_create_qp_ex = NULL;
 static ibv_destroy_qp_fn real_ibv_destroy_qp = NULL;
 static ibv_create_cq_fn real_ibv_create_cq = NULL;
 static ibv_destroy_cq_fn real_ibv_destroy_cq = NULL;
+static ibv_destroy_srq_fn real_ibv_destroy_srq = NULL;
+static ibv_destroy_comp_channel_fn real_ibv_destroy_comp_channel = NULL;
 static ibv_alloc_pd_fn real_ibv_alloc_pd = NULL;
 static ibv_dealloc_pd_fn real_ibv_dealloc_pd = NULL;
 static ibv_dereg_mr_fn real_ibv_dereg_mr = NULL;
 static ibv_reg_mr_fn real_ibv_reg_mr = NULL;
+static ibv_reg_mr_iova2_fn real_ibv_reg_mr_iova2 = NULL;
+static ibv_reg_dmabuf_mr_fn real_ibv_reg_dmabuf_mr = NULL;
+static ibv_rereg_mr_fn real_ibv_rereg_mr = NULL;
+static ibv_modify_qp_fn real_ibv_modify_qp = NULL;
+static ibv_query_qp_fn real_ibv_query_qp = NULL;
+static ibv_create_ah_fn real_ibv_create_ah = NULL;
+static ibv_destroy_ah_fn real_ibv_destroy_ah = NULL;
+static ibv_open_device_fn real_ibv_open_device = NULL;
+static ibv_close_device_fn real_ibv_close_device = NULL;
 
 /* 静态初始化标志 */
 static pthread_once_t hooks_init_once = PTHREAD_ONCE_INIT;
@@ -137,10 +171,21 @@ static void init_function_pointers(void) {
     real_ibv_destroy_qp = (ibv_destroy_qp_fn)dlsym(libibverbs, "ibv_destroy_qp");
     real_ibv_create_cq = (ibv_create_cq_fn)dlsym(libibverbs, "ibv_create_cq");
     real_ibv_destroy_cq = (ibv_destroy_cq_fn)dlsym(libibverbs, "ibv_destroy_cq");
+    real_ibv_destroy_srq = (ibv_destroy_srq_fn)dlsym(libibverbs, "ibv_destroy_srq");
+    real_ibv_destroy_comp_channel = (ibv_destroy_comp_channel_fn)dlsym(libibverbs, "ibv_destroy_comp_channel");
     real_ibv_alloc_pd = (ibv_alloc_pd_fn)dlsym(libibverbs, "ibv_alloc_pd");
     real_ibv_dealloc_pd = (ibv_dealloc_pd_fn)dlsym(libibverbs, "ibv_dealloc_pd");
     real_ibv_dereg_mr = (ibv_dereg_mr_fn)dlsym(libibverbs, "ibv_dereg_mr");
     real_ibv_reg_mr = (ibv_reg_mr_fn)dlsym(libibverbs, "ibv_reg_mr");
+    real_ibv_reg_mr_iova2 = (ibv_reg_mr_iova2_fn)dlsym(libibverbs, "ibv_reg_mr_iova2");
+    real_ibv_reg_dmabuf_mr = (ibv_reg_dmabuf_mr_fn)dlsym(libibverbs, "ibv_reg_dmabuf_mr");
+    real_ibv_rereg_mr = (ibv_rereg_mr_fn)dlsym(libibverbs, "ibv_rereg_mr");
+    real_ibv_modify_qp = (ibv_modify_qp_fn)dlsym(libibverbs, "ibv_modify_qp");
+    real_ibv_query_qp = (ibv_query_qp_fn)dlsym(libibverbs, "ibv_query_qp");
+    real_ibv_create_ah = (ibv_create_ah_fn)dlsym(libibverbs, "ibv_create_ah");
+    real_ibv_destroy_ah = (ibv_destroy_ah_fn)dlsym(libibverbs, "ibv_destroy_ah");
+    real_ibv_open_device = (ibv_open_device_fn)dlsym(libibverbs, "ibv_open_device");
+    real_ibv_close_device = (ibv_close_device_fn)dlsym(libibverbs, "ibv_close_device");
     
     real_ibv_create_qp_ex = (ibv_create_qp_ex_fn)dlsym(libibverbs, "ibv_create_qp_ex");
     
@@ -168,6 +213,21 @@ static void init_function_pointers(void) {
     /* 初始化动态策略 */
     init_dynamic_policy();
     
+    /* MR合并注册对齐粒度 */
+    if (g_intercept_state.config.enable_mr_coalesce) {
+        mr_coalesce_set_align((size_t)g_intercept_state.config.mr_coalesce_align);
+    }
+    
+    /* 异步MR注册线程池参数（首次提交时启动） */
+    mr_async_configure(g_intercept_state.config.async_reg_workers,
+                       g_intercept_state.config.async_prefault_threads);
+    
+    /* 队列内存估算模型及校准参数 */
+    queue_mem_model_select(g_intercept_state.config.queue_mem_model);
+    if (g_intercept_state.config.queue_mem_params[0]) {
+        queue_mem_model_calibrate(g_intercept_state.config.queue_mem_params);
+    }
+    
     /* 绑定当前进程到租户（如果设置了环境变量） */
     const char *tenant_env = getenv("RDMA_TENANT_ID");
     if (tenant_env && tenant_initialized) {
@@ -208,6 +268,42 @@ static void update_tenant_resource_count(uint32_t tenant_id, int resource_type,
         case 4: // PD
             usage.pd_count += delta;
             break;
+        case 5: // Device Memory
+            usage.dm_count += delta;
+            break;
+        case 6: // MR合并命中（不占用新的MR条目）
+            if (delta > 0) usage.total_mr_coalesced += delta;
+            break;
+        case 7: // 共享MR导入（不重复注册）
+            if (delta > 0) usage.total_mr_imported += delta;
+            break;
+        case 8: // QP池中闲置的QP
+            usage.qp_pooled += delta;
+            break;
+        case 9: // CQ池中闲置的CQ
+            usage.cq_pooled += delta;
+            break;
+        case 10: // PD池中闲置的PD
+            usage.pd_pooled += delta;
+            break;
+        case 12: // AH缓存命中
+            if (delta > 0) usage.ah_cache_hits += delta;
+            break;
+        case 13: // 挂到共享SRQ的QP
+            usage.srq_substituted += delta;
+            break;
+        case 14: // 共享SRQ省去的RQ深度
+            usage.recv_wr_saved += delta;
+            break;
+        case 17: // 容量被收缩到预算内
+            if (delta > 0) usage.caps_clamped += delta;
+            break;
+        case 15: // 虚拟UD QP
+            usage.ud_vqp_count += delta;
+            break;
+        case 16: // 承载虚拟UD QP的真实QP
+            usage.ud_real_qp_count += delta;
+            break;
     }
     
     tenant_update_resource_usage(tenant_id, &usage);
@@ -232,6 +328,14 @@ static bool check_tenant_qp_limit(uint32_t tenant_id) {
     return true;
 }
 
+/* 记账租户AH数：检查配额与计数在同一把锁内完成（配额为0表示不限制），归还总是成功 */
+static bool charge_tenant_ah(uint32_t tenant_id, int delta) {
+    if (tenant_id == 0 || !tenant_initialized) {
+        return true;
+    }
+    return tenant_charge_resource(tenant_id, 11, delta) == 0 || delta < 0; // 11=AH
+}
+
 /* 检查MR创建是否符合租户资源限制 */
 // check_tenant_mr_limit函数已内联到调用处
 static inline bool check_tenant_mr_limit_inline(uint32_t tenant_id, size_t length) {
@@ -272,19 +376,89 @@ static inline bool check_tenant_mr_limit_inline(uint32_t tenant_id, size_t lengt
     return true;
 }
 
-/* 检查QP创建是否符合资源限制 */
-static bool check_qp_creation_restrictions(struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr) {
-    (void)pd;
+/* 原子记账租户注册内存，delta为负时归还（失败表示超出内存配额） */
+static bool charge_tenant_memory(uint32_t tenant_id, int64_t delta) {
+    if (tenant_id == 0 || !tenant_initialized || delta == 0) {
+        return true;
+    }
+    return tenant_charge_resource(tenant_id, 2, delta) == 0; // 2=Memory
+}
+
+/* 注册前准入：检查MR数量并预扣内存配额 */
+static bool admit_tenant_mr(uint32_t tenant_id, size_t length) {
+    if (!check_tenant_mr_limit_inline(tenant_id, 0)) {
+        return false;
+    }
+    if (!charge_tenant_memory(tenant_id, (int64_t)length)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] 租户%u 内存配额不足 (请求%zu字节)\n", tenant_id, length);
+        return false;
+    }
+    return true;
+}
+
+/* 不经本库钩子的真实注册
+ * libibverbs的ibv_reg_mr经PLT尾调用ibv_reg_mr_iova2，调用real_ibv_reg_mr会再次进入本库的
+ * ibv_reg_mr_iova2钩子，同一个MR被记账两次而注销只归还一次
+ */
+static struct ibv_mr *reg_mr_unhooked(struct ibv_pd *pd, void *addr, size_t length, int access) {
+    if (real_ibv_reg_mr_iova2) {
+        return real_ibv_reg_mr_iova2(pd, addr, length, (uintptr_t)addr, (unsigned int)access);
+    }
+    return real_ibv_reg_mr(pd, addr, length, access);
+}
+
+/* 注册后记录MR并更新计数；注册失败时归还预扣的内存配额
+ * is_view为真表示合并注册的视图，由MR表按父MR记账
+ */
+static struct ibv_mr *track_registered_mr(uint32_t tenant_id, struct ibv_mr *mr, size_t length, bool is_view) {
+    if (!mr) {
+        int saved_errno = errno;
+        charge_tenant_memory(tenant_id, -(int64_t)length);
+        errno = saved_errno;
+        return NULL;
+    }
     
-    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DEBUG: enable_qp_control=%d, enable_intercept=%d\n", 
-            g_intercept_state.config.enable_qp_control, g_intercept_state.config.enable_intercept);
+    if (!is_view && mr_account_add(mr, tenant_id, length) != 0) {
+        /* 无法记录记账长度则撤销注册，避免注销时无法归还 */
+        real_ibv_dereg_mr(mr);
+        charge_tenant_memory(tenant_id, -(int64_t)length);
+        errno = ENOMEM;
+        return NULL;
+    }
     
+    pthread_mutex_lock(&g_intercept_state.resource_mutex);
+    g_intercept_state.mr_count++;
+    g_intercept_state.memory_used += length;
+    pthread_mutex_unlock(&g_intercept_state.resource_mutex);
+    
+    /* 更新租户资源 */
+    update_tenant_resource_count(tenant_id, 1, 1); // 1=MR
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR registered: %p, length=%zu\n", mr, length);
+    return mr;
+}
+
+/* MR注销后归还计数和记账长度 */
+static void untrack_released_mr(uint32_t tenant_id, size_t length) {
+    pthread_mutex_lock(&g_intercept_state.resource_mutex);
+    if (g_intercept_state.mr_count > 0) {
+        g_intercept_state.mr_count--;
+    }
+    if (g_intercept_state.memory_used >= length) {
+        g_intercept_state.memory_used -= length;
+    }
+    pthread_mutex_unlock(&g_intercept_state.resource_mutex);
+    
+    charge_tenant_memory(tenant_id, -(int64_t)length);
+    update_tenant_resource_count(tenant_id, 1, -1); // 1=MR
+}
+
+/* 检查QP类型是否被允许 */
+static bool check_qp_type_allowed(const struct ibv_qp_init_attr *qp_init_attr) {
     if (!g_intercept_state.config.enable_qp_control) {
-        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DEBUG: QP control disabled, skipping checks\n");
         return true;
     }
     
-    /* 检查QP类型限制 */
     switch (qp_init_attr->qp_type) {
         case IBV_QPT_RC:
             if (!g_intercept_state.config.allow_rc_qp) {
@@ -308,209 +482,3024 @@ static bool check_qp_creation_restrictions(struct ibv_pd *pd, struct ibv_qp_init
             break;
     }
     
-    uint32_t tenant_id = get_current_tenant_id();
-    
-    /* 检查租户限制（直接从租户共享内存获取） */
-    if (!check_tenant_qp_limit(tenant_id)) {
-        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: tenant %u QP limit reached\n", tenant_id);
+    return true;
+}
+
+/* 按预算检查/收缩单项容量，超出且不允许收缩时返回false */
+static bool clamp_cap(uint32_t *value, uint32_t budget, bool clamp, bool *clamped) {
+    if (budget == 0 || *value <= budget) {
+        return true;
+    }
+    if (!clamp) {
         return false;
     }
+    *value = budget;
+    *clamped = true;
+    return true;
+}
+
+/* 按租户容量预算检查QP请求，clamp策略下把cap收缩到预算内（实际值由创建回写） */
+static bool apply_tenant_qp_caps(uint32_t tenant_id, struct ibv_qp_init_attr *attr) {
+    tenant_quota_t quota;
+    if (tenant_id == 0 || !tenant_initialized || !attr || tenant_get_quota(tenant_id, &quota) != 0) {
+        return true;
+    }
     
-    /* 注意：动态策略检查暂时跳过，因为策略数组不在共享内存中
-     * 租户限制已通过 tenant_shm 进行检查
-     */
-    // if (dynamic_policy_check_tenant_limit(tenant_id, RESOURCE_QP, 0, 1)) {
-    //     DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: dynamic policy limit\n");
-    //     return false;
-    // }
+    const tenant_caps_budget_t *b = &quota.caps;
+    bool clamp = b->clamp != 0;
+    bool clamped = false;
+    struct ibv_qp_cap cap = attr->cap;
     
-    /* 获取进程资源使用情况 */
-    resource_usage_t proc_usage;
-    int pid = getpid();
-    int collector_err = get_process_resources_via_shared_memory(pid, &proc_usage);
+    if (!clamp_cap(&cap.max_send_wr, b->max_send_wr, clamp, &clamped) ||
+        !clamp_cap(&cap.max_recv_wr, b->max_recv_wr, clamp, &clamped) ||
+        !clamp_cap(&cap.max_send_sge, b->max_sge, clamp, &clamped) ||
+        !clamp_cap(&cap.max_recv_sge, b->max_sge, clamp, &clamped) ||
+        !clamp_cap(&cap.max_inline_data, b->max_inline_data, clamp, &clamped)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: tenant %u caps budget\n", tenant_id);
+        return false;
+    }
     
-    if (collector_err == 0) {
-        uint32_t effective_qp_count = (uint32_t)proc_usage.qp_count;
-        if ((effective_qp_count + 1) > g_intercept_state.config.max_qp_per_process) {
-            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: per-process limit\n");
-            return false;
-        }
+    if (clamped) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP caps clamped for tenant %u: send_wr %u->%u, recv_wr %u->%u\n",
+                      tenant_id, attr->cap.max_send_wr, cap.max_send_wr, attr->cap.max_recv_wr, cap.max_recv_wr);
+        attr->cap = cap;
+        update_tenant_resource_count(tenant_id, 17, 1); // 17=容量被收缩
+    }
+    return true;
+}
+
+/* 按租户容量预算检查CQ请求，max_cqe返回预算（0表示不限制） */
+static bool apply_tenant_cq_caps(uint32_t tenant_id, int *cqe, uint32_t *max_cqe) {
+    tenant_quota_t quota;
+    *max_cqe = 0;
+    if (tenant_id == 0 || !tenant_initialized || *cqe <= 0 || tenant_get_quota(tenant_id, &quota) != 0) {
+        return true;
     }
     
-    /* 检查全局限制 */
-    resource_usage_t global_usage;
-    int global_err = get_global_resources_via_shared_memory(&global_usage);
-    if (global_err == 0) {
-        if ((uint32_t)global_usage.qp_count >= g_intercept_state.config.max_global_qp) {
-            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: global limit\n");
-            return false;
-        }
+    *max_cqe = quota.caps.max_cqe;
+    bool clamped = false;
+    uint32_t value = (uint32_t)*cqe;
+    if (!clamp_cap(&value, quota.caps.max_cqe, quota.caps.clamp != 0, &clamped)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] CQ creation denied: tenant %u caps budget\n", tenant_id);
+        return false;
     }
     
+    if (clamped) {
+        *cqe = (int)value;
+        update_tenant_resource_count(tenant_id, 17, 1); // 17=容量被收缩
+    }
     return true;
 }
 
-/* 被拦截的ibv_create_qp函数 */
-struct ibv_qp *ibv_create_qp(struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr) {
-    pthread_once(&hooks_init_once, init_function_pointers);
-    
-    if (!rdma_intercept_is_enabled() || !real_ibv_create_qp) {
-        if (real_ibv_create_qp) {
-            return real_ibv_create_qp(pd, qp_init_attr);
-        }
-        errno = ENOSYS;
-        return NULL;
+/* ========== 队列内存记账 ==========
+ * 按当前模型估算真实QP/CQ的队列缓冲区字节数，创建前在租户max_queue_memory内预扣，
+ * 真正销毁时归还。池中闲置的QP/CQ仍占用缓冲区，继续计入；UD虚拟QP没有独立缓冲区，不计入。
+ * RQ替换用的共享SRQ按其深度在创建时计入一次，随SRQ销毁归还。
+ */
+#define QUEUE_MEM_BUCKETS 256
+
+typedef struct queue_mem_entry {
+    void *obj;                        // struct ibv_qp * 或 struct ibv_cq *
+    uint32_t tenant_id;
+    uint64_t bytes;
+    struct queue_mem_entry *next;
+} queue_mem_entry_t;
+
+static queue_mem_entry_t *queue_mem_table[QUEUE_MEM_BUCKETS];
+static pthread_mutex_t queue_mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t queue_mem_hash(void *obj) {
+    return (uint32_t)((((uintptr_t)obj) >> 4) * 2654435761U) % QUEUE_MEM_BUCKETS;
+}
+
+/* 预扣队列内存，超出租户配额时返回false */
+static bool queue_mem_admit(uint32_t tenant_id, uint64_t bytes) {
+    if (tenant_id == 0 || bytes == 0 || !tenant_initialized) {
+        return true;
+    }
+    if (tenant_charge_resource(tenant_id, 18, (int64_t)bytes) != 0) { // 18=队列内存
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Queue memory denied: tenant %u, %lu bytes\n",
+                      tenant_id, (unsigned long)bytes);
+        return false;
     }
+    return true;
+}
 
-    if (!check_qp_creation_restrictions(pd, qp_init_attr)) {
-        errno = EPERM;
-        return NULL;
+/* 创建失败时归还预扣 */
+static void queue_mem_cancel(uint32_t tenant_id, uint64_t bytes) {
+    if (tenant_id != 0 && bytes != 0 && tenant_initialized) {
+        tenant_charge_resource(tenant_id, 18, -(int64_t)bytes); // 18=队列内存
     }
+}
 
-    struct ibv_qp *qp = real_ibv_create_qp(pd, qp_init_attr);
+/* 记录对象占用的队列内存，销毁时按记录归还 */
+static void queue_mem_track(uint32_t tenant_id, void *obj, uint64_t bytes) {
+    if (tenant_id == 0 || bytes == 0 || !tenant_initialized) {
+        return;
+    }
     
-    if (qp) {
-        pthread_mutex_lock(&g_intercept_state.resource_mutex);
-        g_intercept_state.qp_count++;
-        pthread_mutex_unlock(&g_intercept_state.resource_mutex);
-        
-        /* 更新共享内存 */
-        resource_usage_t new_usage;
-        int pid = getpid();
-        new_usage.qp_count = g_intercept_state.qp_count;
-        new_usage.mr_count = g_intercept_state.mr_count;
-        new_usage.memory_used = g_intercept_state.memory_used;
-        shm_update_process_resources(pid, &new_usage);
-        
-        /* 更新租户资源 */
-        update_tenant_resource_count(get_current_tenant_id(), 0, 1); // 0=QP
-        
-        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP created: %p\n", qp);
+    queue_mem_entry_t *e = malloc(sizeof(*e));
+    if (!e) {
+        queue_mem_cancel(tenant_id, bytes);
+        return;
     }
-
-    return qp;
+    e->obj = obj;
+    e->tenant_id = tenant_id;
+    e->bytes = bytes;
+    
+    uint32_t b = queue_mem_hash(obj);
+    pthread_mutex_lock(&queue_mem_mutex);
+    e->next = queue_mem_table[b];
+    queue_mem_table[b] = e;
+    pthread_mutex_unlock(&queue_mem_mutex);
 }
 
-/* 被拦截的ibv_destroy_qp函数 */
-int ibv_destroy_qp(struct ibv_qp *qp) {
-    pthread_once(&hooks_init_once, init_function_pointers);
-    
-    if (!rdma_intercept_is_enabled() || !real_ibv_destroy_qp) {
-        if (real_ibv_destroy_qp) {
-            return real_ibv_destroy_qp(qp);
+static void queue_mem_release(void *obj) {
+    queue_mem_entry_t *e = NULL;
+    pthread_mutex_lock(&queue_mem_mutex);
+    for (queue_mem_entry_t **pp = &queue_mem_table[queue_mem_hash(obj)]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->obj == obj) {
+            e = *pp;
+            *pp = e->next;
+            break;
         }
-        errno = ENOSYS;
-        return -1;
     }
-
-    int result = real_ibv_destroy_qp(qp);
+    pthread_mutex_unlock(&queue_mem_mutex);
     
-    if (result == 0) {
-        pthread_mutex_lock(&g_intercept_state.resource_mutex);
-        if (g_intercept_state.qp_count > 0) {
-            g_intercept_state.qp_count--;
-        }
-        pthread_mutex_unlock(&g_intercept_state.resource_mutex);
-        
-        /* 更新租户资源 */
-        update_tenant_resource_count(get_current_tenant_id(), 0, -1); // 0=QP
-        
-        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP destroyed: %p\n", qp);
+    if (e) {
+        queue_mem_cancel(e->tenant_id, e->bytes);
+        free(e);
     }
+}
 
-    return result;
+/* ========== QP状态跟踪 ==========
+ * 按qp_num记录本进程每个真实QP的当前状态，ibv_modify_qp迁移时同步租户按状态的QP计数。
+ * 网卡QP上下文缓存的压力来自处于RTS的活跃QP，因此max_active_qp_per_tenant只在进入RTS时检查，
+ * 已创建但未建链或已复位（含池中闲置）的QP不占用该配额。ibv_query_qp查到的状态（如被硬件置为ERR）同样回写。
+ */
+#define QP_STATE_BUCKETS 1024
+
+typedef struct qp_state_entry {
+    uint32_t qp_num;
+    struct ibv_qp *qp;
+    uint32_t tenant_id;
+    int state;                        // enum ibv_qp_state
+    struct qp_state_entry *next;
+} qp_state_entry_t;
+
+static qp_state_entry_t *qp_state_table[QP_STATE_BUCKETS];
+static pthread_mutex_t qp_state_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static qp_state_entry_t **qp_state_find_locked(struct ibv_qp *qp, uint32_t qp_num) {
+    qp_state_entry_t **pp = &qp_state_table[qp_num % QP_STATE_BUCKETS];
+    while (*pp && (*pp)->qp != qp) {
+        pp = &(*pp)->next;
+    }
+    return pp;
 }
 
-/* 被拦截的ibv_reg_mr函数 - 使用不同名称避免宏冲突 */
-struct ibv_mr *__real_ibv_reg_mr_tenant(struct ibv_pd *pd, void *addr, size_t length, int access) {
-    pthread_once(&hooks_init_once, init_function_pointers);
+static void qp_state_track(uint32_t tenant_id, struct ibv_qp *qp) {
+    if (tenant_id == 0 || !tenant_initialized) {
+        return;
+    }
     
-    if (!rdma_intercept_is_enabled() || !real_ibv_reg_mr) {
-        if (real_ibv_reg_mr) {
-            return real_ibv_reg_mr(pd, addr, length, access);
-        }
-        errno = ENOSYS;
-        return NULL;
+    qp_state_entry_t *e = malloc(sizeof(*e));
+    if (!e) {
+        return;
     }
-
-    uint32_t tenant_id = get_current_tenant_id();
+    e->qp_num = qp->qp_num;
+    e->qp = qp;
+    e->tenant_id = tenant_id;
+    e->state = (qp->state < TENANT_QP_STATES) ? (int)qp->state : IBV_QPS_RESET;
     
-    /* 检查租户MR限制 */
-    if (!check_tenant_mr_limit_inline(tenant_id, length)) {
-        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR registration denied: tenant %u limit\n", tenant_id);
-        errno = EPERM;
-        return NULL;
+    pthread_mutex_lock(&qp_state_mutex);
+    e->next = qp_state_table[e->qp_num % QP_STATE_BUCKETS];
+    qp_state_table[e->qp_num % QP_STATE_BUCKETS] = e;
+    tenant_qp_state_change(tenant_id, -1, e->state, false);
+    pthread_mutex_unlock(&qp_state_mutex);
+}
+
+/* QP已销毁，按创建前保存的qp_num摘除 */
+static void qp_state_untrack(struct ibv_qp *qp, uint32_t qp_num) {
+    pthread_mutex_lock(&qp_state_mutex);
+    qp_state_entry_t **pp = qp_state_find_locked(qp, qp_num);
+    qp_state_entry_t *e = *pp;
+    if (e) {
+        *pp = e->next;
+        tenant_qp_state_change(e->tenant_id, e->state, -1, false);
     }
+    pthread_mutex_unlock(&qp_state_mutex);
+    free(e);
+}
 
-    struct ibv_mr *mr = real_ibv_reg_mr(pd, addr, length, access);
+/* 记录状态迁移，enforce时进入RTS受活跃QP配额限制；未跟踪的QP总是成功，prev返回原状态（未跟踪为-1） */
+static bool qp_state_set(struct ibv_qp *qp, int state, bool enforce, int *prev) {
+    bool ok = true;
+    int old = -1;
     
-    if (mr) {
-        pthread_mutex_lock(&g_intercept_state.resource_mutex);
-        g_intercept_state.mr_count++;
-        g_intercept_state.memory_used += length;
-        pthread_mutex_unlock(&g_intercept_state.resource_mutex);
-        
-        /* 更新租户资源 */
-        update_tenant_resource_count(tenant_id, 1, 1); // 1=MR
-        
-        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR registered: %p, length=%zu\n", mr, length);
+    pthread_mutex_lock(&qp_state_mutex);
+    qp_state_entry_t *e = *qp_state_find_locked(qp, qp->qp_num);
+    if (e) {
+        old = e->state;
+        if (old != state) {
+            ok = tenant_qp_state_change(e->tenant_id, old, state, enforce) == 0;
+            if (ok) {
+                e->state = state;
+            }
+        }
     }
+    pthread_mutex_unlock(&qp_state_mutex);
+    
+    if (prev) {
+        *prev = old;
+    }
+    return ok;
+}
 
-    return mr;
+/* ========== QP工作集 ==========
+ * 网卡QP上下文缓存被挤占取决于短时间内投递过的QP数。启用后按qp_num开放寻址的紧凑数组记录
+ * 每个QP的最近投递时间和所在窗口（窗口号=CLOCK_MONOTONIC/窗口长度，各进程对齐）。
+ * 同一QP在窗口内只有首次投递进入慢路径，把租户工作集计数加1，因此每个进程内是精确去重，
+ * 不需要概率草图。启用节流时，工作集已满的窗口里投递到新QP会等到下一个窗口再计入，
+ * 最多等待QP_WS_THROTTLE_MAX_WINDOWS个窗口后放行。
+ */
+#define QP_WS_SLOTS 8192
+#define QP_WS_THROTTLE_MAX_WINDOWS 8
+#define QP_WS_TOMBSTONE ((struct ibv_qp *)1)
+
+typedef struct {
+    struct ibv_qp *qp;                // NULL为空槽，QP_WS_TOMBSTONE为已删除
+    uint32_t tenant_id;
+    uint64_t window;                  // 最近一次计入工作集的窗口号
+    uint64_t last_post_ns;            // 最近一次投递时间
+} qp_ws_slot_t;
+
+static qp_ws_slot_t qp_ws_slots[QP_WS_SLOTS];
+static uint32_t qp_ws_max_probe = 0;
+static pthread_mutex_t qp_ws_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint32_t qp_ws_hash(uint32_t qp_num) {
+    return (qp_num * 2654435761U) % QP_WS_SLOTS;
 }
 
-/* 被拦截的ibv_dereg_mr函数 - 使用不同名称避免宏冲突 */
-int __real_ibv_dereg_mr_tenant(struct ibv_mr *mr) {
-    pthread_once(&hooks_init_once, init_function_pointers);
+static inline uint64_t qp_ws_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void qp_ws_track(uint32_t tenant_id, struct ibv_qp *qp) {
+    if (!g_intercept_state.config.enable_qp_working_set || tenant_id == 0 || !tenant_initialized) {
+        return;
+    }
     
-    if (!rdma_intercept_is_enabled() || !real_ibv_dereg_mr) {
-        if (real_ibv_dereg_mr) {
-            return real_ibv_dereg_mr(mr);
+    uint32_t h = qp_ws_hash(qp->qp_num);
+    pthread_mutex_lock(&qp_ws_mutex);
+    for (uint32_t i = 0; i < QP_WS_SLOTS; i++) {
+        qp_ws_slot_t *s = &qp_ws_slots[(h + i) % QP_WS_SLOTS];
+        if (s->qp == NULL || s->qp == QP_WS_TOMBSTONE) {
+            s->tenant_id = tenant_id;
+            s->window = 0;
+            s->last_post_ns = 0;
+            __atomic_store_n(&s->qp, qp, __ATOMIC_RELEASE);
+            if (i > qp_ws_max_probe) {
+                qp_ws_max_probe = i;
+            }
+            break;
         }
-        errno = ENOSYS;
-        return -1;
     }
+    pthread_mutex_unlock(&qp_ws_mutex);
+}
 
-    size_t mr_length = mr ? mr->length : 0;
-    int result = real_ibv_dereg_mr(mr);
-    
-    if (result == 0) {
-        pthread_mutex_lock(&g_intercept_state.resource_mutex);
-        if (g_intercept_state.mr_count > 0) {
-            g_intercept_state.mr_count--;
+/* 无锁查找（投递路径） */
+static inline qp_ws_slot_t *qp_ws_lookup(struct ibv_qp *qp) {
+    uint32_t h = qp_ws_hash(qp->qp_num);
+    uint32_t max_probe = __atomic_load_n(&qp_ws_max_probe, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i <= max_probe; i++) {
+        qp_ws_slot_t *s = &qp_ws_slots[(h + i) % QP_WS_SLOTS];
+        struct ibv_qp *cur = __atomic_load_n(&s->qp, __ATOMIC_ACQUIRE);
+        if (cur == qp) {
+            return s;
         }
-        if (g_intercept_state.memory_used >= mr_length) {
-            g_intercept_state.memory_used -= mr_length;
+        if (cur == NULL) {
+            break;
         }
-        pthread_mutex_unlock(&g_intercept_state.resource_mutex);
-        
-        /* 更新租户资源 */
-        update_tenant_resource_count(get_current_tenant_id(), 1, -1); // 1=MR
-        
-        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR deregistered: %p\n", mr);
     }
-
-    return result;
+    return NULL;
 }
 
-/* 被拦截的ibv_create_cq函数 */
-struct ibv_cq *ibv_create_cq(struct ibv_context *context, int cqe, void *cq_context,
-                            struct ibv_comp_channel *channel, int comp_vector) {
-    pthread_once(&hooks_init_once, init_function_pointers);
+static void qp_ws_untrack(struct ibv_qp *qp, uint32_t qp_num) {
+    if (!g_intercept_state.config.enable_qp_working_set) {
+        return;
+    }
     
-    if (!rdma_intercept_is_enabled() || !real_ibv_create_cq) {
-        if (real_ibv_create_cq) {
-            return real_ibv_create_cq(context, cqe, cq_context, channel, comp_vector);
+    uint32_t h = qp_ws_hash(qp_num);
+    pthread_mutex_lock(&qp_ws_mutex);
+    for (uint32_t i = 0; i <= qp_ws_max_probe; i++) {
+        qp_ws_slot_t *s = &qp_ws_slots[(h + i) % QP_WS_SLOTS];
+        if (s->qp == qp) {
+            __atomic_store_n(&s->qp, QP_WS_TOMBSTONE, __ATOMIC_RELEASE);
+            break;
+        }
+        if (s->qp == NULL) {
+            break;
         }
-        errno = ENOSYS;
-        return NULL;
     }
+    pthread_mutex_unlock(&qp_ws_mutex);
+}
 
-    struct ibv_cq *cq = real_ibv_create_cq(context, cqe, cq_context, channel, comp_vector);
+/* 窗口内首次投递：计入租户工作集，节流时等待新窗口 */
+static void qp_ws_enter(qp_ws_slot_t *s, uint64_t now, uint64_t window_ns, uint64_t window) {
+    bool throttle = g_intercept_state.config.qp_ws_throttle;
     
-    if (cq) {
+    for (int waited = 0; ; waited++) {
+        bool enforce = throttle && waited < QP_WS_THROTTLE_MAX_WINDOWS;
+        if (tenant_ws_enter(s->tenant_id, window, enforce) == 0 || !enforce) {
+            return;
+        }
+        
+        uint64_t wait_ns = (window + 1) * window_ns - now;
+        struct timespec ts = {
+            .tv_sec = (time_t)(wait_ns / 1000000000ULL),
+            .tv_nsec = (long)(wait_ns % 1000000000ULL)
+        };
+        nanosleep(&ts, NULL);
+        
+        now = qp_ws_now_ns();
+        window = now / window_ns;
+        __atomic_store_n(&s->window, window, __ATOMIC_RELAXED);
+    }
+}
+
+/* 记录投递（热路径只有一次时钟读取和两次原子访问） */
+static inline void qp_ws_touch(struct ibv_qp *qp) {
+    qp_ws_slot_t *s = qp_ws_lookup(qp);
+    if (!s) {
+        return;
+    }
+    
+    uint64_t window_ns = (uint64_t)g_intercept_state.config.qp_ws_window_us * 1000ULL;
+    uint64_t now = qp_ws_now_ns();
+    uint64_t window = now / window_ns;
+    __atomic_store_n(&s->last_post_ns, now, __ATOMIC_RELAXED);
+    
+    if (__atomic_load_n(&s->window, __ATOMIC_RELAXED) == window ||
+        __atomic_exchange_n(&s->window, window, __ATOMIC_ACQ_REL) == window) {
+        return;
+    }
+    qp_ws_enter(s, now, window_ns, window);
+}
+
+/* 检查QP创建是否符合资源限制 */
+static bool check_qp_creation_restrictions(struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr) {
+    (void)pd;
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DEBUG: enable_qp_control=%d, enable_intercept=%d\n", 
+            g_intercept_state.config.enable_qp_control, g_intercept_state.config.enable_intercept);
+    
+    if (!g_intercept_state.config.enable_qp_control) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DEBUG: QP control disabled, skipping checks\n");
+        return true;
+    }
+    
+    /* 检查QP类型限制 */
+    if (!check_qp_type_allowed(qp_init_attr)) {
+        return false;
+    }
+    
+    uint32_t tenant_id = get_current_tenant_id();
+    
+    /* 检查租户限制（直接从租户共享内存获取） */
+    if (!check_tenant_qp_limit(tenant_id)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: tenant %u QP limit reached\n", tenant_id);
+        return false;
+    }
+    
+    /* 注意：动态策略检查暂时跳过，因为策略数组不在共享内存中
+     * 租户限制已通过 tenant_shm 进行检查
+     */
+    // if (dynamic_policy_check_tenant_limit(tenant_id, RESOURCE_QP, 0, 1)) {
+    //     DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: dynamic policy limit\n");
+    //     return false;
+    // }
+    
+    /* 获取进程资源使用情况 */
+    resource_usage_t proc_usage;
+    int pid = getpid();
+    int collector_err = get_process_resources_via_shared_memory(pid, &proc_usage);
+    
+    if (collector_err == 0) {
+        uint32_t effective_qp_count = (uint32_t)proc_usage.qp_count;
+        if ((effective_qp_count + 1) > g_intercept_state.config.max_qp_per_process) {
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: per-process limit\n");
+            return false;
+        }
+    }
+    
+    /* 检查全局限制 */
+    resource_usage_t global_usage;
+    int global_err = get_global_resources_via_shared_memory(&global_usage);
+    if (global_err == 0) {
+        if ((uint32_t)global_usage.qp_count >= g_intercept_state.config.max_global_qp) {
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation denied: global limit\n");
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/* ========== RQ到SRQ的透明替换 ==========
+ * 启用后未指定SRQ的RC/UD QP被透明挂到按(PD, 接收CQ)共享的SRQ上，ibv_post_recv被重定向
+ * 到该SRQ，接收队列深度只按SRQ分配一次。应用必须把接收缓冲区视为可互换的，并在同组QP
+ * 全部销毁前保持缓冲区有效，因此该模式只能由租户显式开启（RDMA_INTERCEPT_SRQ_SUBSTITUTE=1）。
+ *
+ * 每个共享SRQ按挂入QP请求的max_recv_wr之和预留深度：应用在每个QP上预投满max_recv_wr
+ * 也不会超出SRQ深度。已满的SRQ不再接纳新QP，同组的后续QP挂到新建的共享SRQ上；
+ * 单个QP请求超过RDMA_INTERCEPT_SRQ_DEPTH时保留私有RQ。已销毁QP投递的WR
+ * 仍留在SRQ中，其预留深度直到SRQ销毁才归还。
+ */
+#define SRQ_SUB_BUCKETS 256
+
+typedef struct shared_srq {
+    struct ibv_pd *pd;
+    struct ibv_cq *recv_cq;
+    struct ibv_srq *srq;
+    uint32_t max_sge;
+    uint32_t max_wr;               // SRQ实际深度
+    uint32_t committed;            // 已预留给挂入QP的深度（各QP请求的max_recv_wr之和）
+    uint32_t tenant_id;            // 队列内存记在创建者名下
+    uint64_t qmem;                 // SRQ缓冲区的队列内存（每个共享SRQ只记一次）
+    uint32_t refcnt;               // 挂在该SRQ上的QP数
+    struct shared_srq *next;
+} shared_srq_t;
+
+typedef struct srq_sub_entry {
+    struct ibv_qp *qp;
+    shared_srq_t *shared;
+    uint32_t tenant_id;
+    uint32_t saved_wr;             // 省去的接收队列深度
+    struct srq_sub_entry *next;
+} srq_sub_entry_t;
+
+static srq_sub_entry_t *srq_sub_table[SRQ_SUB_BUCKETS];
+static shared_srq_t *shared_srqs = NULL;
+static uint32_t srq_sub_count = 0;
+static pthread_rwlock_t srq_sub_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static uint32_t srq_sub_hash(struct ibv_qp *qp) {
+    return (uint32_t)((((uintptr_t)qp) >> 4) * 2654435761U) % SRQ_SUB_BUCKETS;
+}
+
+/* 只替换结构上与SRQ兼容的QP */
+static bool srq_sub_compatible(const struct ibv_qp_init_attr *attr) {
+    return g_intercept_state.config.enable_srq_substitute &&
+           (attr->qp_type == IBV_QPT_RC || attr->qp_type == IBV_QPT_UD) &&
+           attr->srq == NULL && attr->recv_cq != NULL &&
+           attr->cap.max_recv_wr > 0;
+}
+
+/*
+ * 获取(PD, 接收CQ)对应且剩余深度足够的共享SRQ并预留该QP的max_recv_wr，没有时新建并预扣其队列内存；
+ * 单个QP请求超过共享SRQ深度、创建失败或队列内存不够时返回NULL（保留私有RQ）
+ */
+static shared_srq_t *srq_sub_acquire(uint32_t tenant_id, struct ibv_pd *pd, const struct ibv_qp_init_attr *attr) {
+    uint32_t need_sge = attr->cap.max_recv_sge ? attr->cap.max_recv_sge : 1;
+    uint32_t need_wr = attr->cap.max_recv_wr;
+    shared_srq_t *s;
+    
+    if (need_wr > g_intercept_state.config.srq_substitute_depth) {
+        return NULL;
+    }
+    
+    pthread_rwlock_wrlock(&srq_sub_lock);
+    for (s = shared_srqs; s; s = s->next) {
+        if (s->pd == pd && s->recv_cq == attr->recv_cq && s->max_sge >= need_sge &&
+            s->committed + need_wr <= s->max_wr) {
+            break;
+        }
+    }
+    
+    if (s) {
+        s->refcnt++;
+        s->committed += need_wr;
+        pthread_rwlock_unlock(&srq_sub_lock);
+        return s;
+    }
+    
+    struct ibv_srq_init_attr srq_attr;
+    memset(&srq_attr, 0, sizeof(srq_attr));
+    srq_attr.attr.max_wr = g_intercept_state.config.srq_substitute_depth;
+    srq_attr.attr.max_sge = need_sge;
+    
+    uint64_t qmem = tenant_id ? queue_mem_estimate_srq(srq_attr.attr.max_wr, need_sge) : 0;
+    if (!queue_mem_admit(tenant_id, qmem)) {
+        pthread_rwlock_unlock(&srq_sub_lock);
+        return NULL;
+    }
+    
+    struct ibv_srq *srq = ibv_create_srq(pd, &srq_attr);
+    s = srq ? calloc(1, sizeof(*s)) : NULL;
+    if (!s) {
+        if (srq) {
+            real_ibv_destroy_srq(srq);
+        }
+        queue_mem_cancel(tenant_id, qmem);
+        pthread_rwlock_unlock(&srq_sub_lock);
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Shared SRQ creation failed, keeping private RQ\n");
+        return NULL;
+    }
+    
+    s->pd = pd;
+    s->recv_cq = attr->recv_cq;
+    s->srq = srq;
+    s->max_sge = srq_attr.attr.max_sge;
+    s->max_wr = srq_attr.attr.max_wr;
+    s->committed = need_wr;
+    s->tenant_id = tenant_id;
+    s->qmem = qmem;
+    s->refcnt = 1;
+    s->next = shared_srqs;
+    shared_srqs = s;
+    pthread_rwlock_unlock(&srq_sub_lock);
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Shared SRQ created: pd=%p, recv_cq=%p, depth=%u\n",
+                  pd, attr->recv_cq, srq_attr.attr.max_wr);
+    return s;
+}
+
+/* 释放共享SRQ的一个引用，最后一个引用销毁SRQ（调用方持写锁） */
+static void srq_sub_put_locked(shared_srq_t *s) {
+    if (--s->refcnt > 0) {
+        return;
+    }
+    for (shared_srq_t **pp = &shared_srqs; *pp; pp = &(*pp)->next) {
+        if (*pp == s) {
+            *pp = s->next;
+            break;
+        }
+    }
+    if (real_ibv_destroy_srq(s->srq) != 0) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Failed to destroy shared SRQ %p\n", s->srq);
+    } else {
+        queue_mem_cancel(s->tenant_id, s->qmem);
+    }
+    free(s);
+}
+
+/* QP未能创建时撤销srq_sub_acquire：该QP没有投递过WR，归还预留的深度 */
+static void srq_sub_cancel(shared_srq_t *s, uint32_t wr) {
+    pthread_rwlock_wrlock(&srq_sub_lock);
+    s->committed -= wr;
+    srq_sub_put_locked(s);
+    pthread_rwlock_unlock(&srq_sub_lock);
+}
+
+/* 记录QP到共享SRQ的映射 */
+static void srq_sub_bind(uint32_t tenant_id, struct ibv_qp *qp, shared_srq_t *s, uint32_t saved_wr) {
+    srq_sub_entry_t *e = calloc(1, sizeof(*e));
+    if (!e) {
+        /* 无法记录时ibv_post_recv无法重定向，QP仍可用于发送 */
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Out of memory tracking SRQ substitution for QP %p\n", qp);
+        return;
+    }
+    e->qp = qp;
+    e->shared = s;
+    e->tenant_id = tenant_id;
+    e->saved_wr = saved_wr;
+    
+    uint32_t b = srq_sub_hash(qp);
+    pthread_rwlock_wrlock(&srq_sub_lock);
+    e->next = srq_sub_table[b];
+    srq_sub_table[b] = e;
+    srq_sub_count++;
+    pthread_rwlock_unlock(&srq_sub_lock);
+    
+    update_tenant_resource_count(tenant_id, 13, 1);                // 13=挂到共享SRQ的QP
+    update_tenant_resource_count(tenant_id, 14, (int)saved_wr);    // 14=省去的RQ深度
+}
+
+/* QP真正销毁后解除映射 */
+static void srq_sub_release_qp(struct ibv_qp *qp) {
+    if (srq_sub_count == 0) {
+        return;
+    }
+    
+    srq_sub_entry_t *e = NULL;
+    pthread_rwlock_wrlock(&srq_sub_lock);
+    for (srq_sub_entry_t **pp = &srq_sub_table[srq_sub_hash(qp)]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->qp == qp) {
+            e = *pp;
+            *pp = e->next;
+            srq_sub_count--;
+            srq_sub_put_locked(e->shared);
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&srq_sub_lock);
+    
+    if (e) {
+        update_tenant_resource_count(e->tenant_id, 13, -1);               // 13=挂到共享SRQ的QP
+        update_tenant_resource_count(e->tenant_id, 14, -(int)e->saved_wr); // 14=省去的RQ深度
+        free(e);
+    }
+}
+
+/* 查找QP被替换到的SRQ，未替换返回NULL（ibv_post_recv热路径） */
+static struct ibv_srq *srq_sub_lookup(struct ibv_qp *qp) {
+    if (srq_sub_count == 0) {
+        return NULL;
+    }
+    
+    struct ibv_srq *srq = NULL;
+    pthread_rwlock_rdlock(&srq_sub_lock);
+    for (srq_sub_entry_t *e = srq_sub_table[srq_sub_hash(qp)]; e; e = e->next) {
+        if (e->qp == qp) {
+            srq = e->shared->srq;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&srq_sub_lock);
+    return srq;
+}
+
+/* ========== QP池 ==========
+ * 启用后ibv_destroy_qp把QP转到RESET状态暂存，之后参数兼容的ibv_create_qp直接复用，
+ * 省去固件创建QP的开销。池中闲置的QP仍计入进程和租户的QP配额，配额不足时先淘汰最旧的闲置QP。
+ */
+#define QP_POOL_LIVE_BUCKETS 256
+
+typedef struct qp_pool_entry {
+    struct ibv_qp *qp;
+    struct ibv_qp_init_attr req;   // 创建时请求的参数（匹配键，忽略qp_context）
+    struct ibv_qp_cap cap;         // 实际容量（复用时回写给调用方）
+    struct qp_pool_entry *next;
+} qp_pool_entry_t;
+
+static qp_pool_entry_t *qp_live[QP_POOL_LIVE_BUCKETS];    // 活跃QP的创建参数
+static qp_pool_entry_t *qp_pool_head = NULL;              // 闲置QP（FIFO，头部最旧）
+static qp_pool_entry_t *qp_pool_tail = NULL;
+static uint32_t qp_pool_count = 0;
+static pthread_mutex_t qp_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t qp_live_hash(struct ibv_qp *qp) {
+    return (uint32_t)((((uintptr_t)qp) >> 4) * 2654435761U) % QP_POOL_LIVE_BUCKETS;
+}
+
+static uint64_t elapsed_us(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (uint64_t)(t1.tv_sec - t0->tv_sec) * 1000000ULL + (uint64_t)(t1.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+/* 只复用RESET后可以重新建链的QP类型 */
+static bool qp_pool_type_supported(enum ibv_qp_type type) {
+    return type == IBV_QPT_RC || type == IBV_QPT_UC || type == IBV_QPT_UD;
+}
+
+static bool qp_pool_match(const qp_pool_entry_t *e, struct ibv_pd *pd, const struct ibv_qp_init_attr *attr) {
+    return e->qp->pd == pd &&
+           e->req.qp_type == attr->qp_type &&
+           e->req.send_cq == attr->send_cq &&
+           e->req.recv_cq == attr->recv_cq &&
+           e->req.srq == attr->srq &&
+           e->req.sq_sig_all == attr->sq_sig_all &&
+           memcmp(&e->req.cap, &attr->cap, sizeof(attr->cap)) == 0;
+}
+
+static void qp_live_insert(qp_pool_entry_t *e) {
+    uint32_t b = qp_live_hash(e->qp);
+    pthread_mutex_lock(&qp_pool_mutex);
+    e->next = qp_live[b];
+    qp_live[b] = e;
+    pthread_mutex_unlock(&qp_pool_mutex);
+}
+
+static qp_pool_entry_t *qp_live_remove(struct ibv_qp *qp) {
+    qp_pool_entry_t *e = NULL;
+    pthread_mutex_lock(&qp_pool_mutex);
+    for (qp_pool_entry_t **pp = &qp_live[qp_live_hash(qp)]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->qp == qp) {
+            e = *pp;
+            *pp = e->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qp_pool_mutex);
+    return e;
+}
+
+/* 从池中摘除第一个满足条件的闲置QP（调用方持锁） */
+static qp_pool_entry_t *qp_pool_unlink_locked(qp_pool_entry_t **pp, qp_pool_entry_t *prev) {
+    qp_pool_entry_t *e = *pp;
+    *pp = e->next;
+    if (qp_pool_tail == e) {
+        qp_pool_tail = prev;
+    }
+    qp_pool_count--;
+    e->next = NULL;
+    return e;
+}
+
+static qp_pool_entry_t *qp_pool_take(struct ibv_pd *pd, const struct ibv_qp_init_attr *attr) {
+    qp_pool_entry_t *e = NULL;
+    pthread_mutex_lock(&qp_pool_mutex);
+    qp_pool_entry_t *prev = NULL;
+    for (qp_pool_entry_t **pp = &qp_pool_head; *pp; prev = *pp, pp = &(*pp)->next) {
+        if (qp_pool_match(*pp, pd, attr)) {
+            e = qp_pool_unlink_locked(pp, prev);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qp_pool_mutex);
+    return e;
+}
+
+static qp_pool_entry_t *qp_pool_pop_oldest(void) {
+    qp_pool_entry_t *e = NULL;
+    pthread_mutex_lock(&qp_pool_mutex);
+    if (qp_pool_head) {
+        e = qp_pool_unlink_locked(&qp_pool_head, NULL);
+    }
+    pthread_mutex_unlock(&qp_pool_mutex);
+    return e;
+}
+
+/* 复位并暂存QP，池满或复位失败时返回false */
+static bool qp_pool_park(qp_pool_entry_t *e) {
+    if (qp_pool_count >= g_intercept_state.config.qp_pool_max) {
+        return false;
+    }
+    
+    struct ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RESET;
+    if (ibv_modify_qp(e->qp, &attr, IBV_QP_STATE) != 0) {
+        return false;
+    }
+    
+    bool parked = false;
+    pthread_mutex_lock(&qp_pool_mutex);
+    if (qp_pool_count < g_intercept_state.config.qp_pool_max) {
+        e->next = NULL;
+        if (qp_pool_tail) {
+            qp_pool_tail->next = e;
+        } else {
+            qp_pool_head = e;
+        }
+        qp_pool_tail = e;
+        qp_pool_count++;
+        parked = true;
+    }
+    pthread_mutex_unlock(&qp_pool_mutex);
+    return parked;
+}
+
+/* 真实销毁QP并归还计数 */
+static int destroy_qp_tracked(struct ibv_qp *qp) {
+    uint32_t qp_num = qp->qp_num;
+    int result = real_ibv_destroy_qp(qp);
+    
+    if (result == 0) {
+        pthread_mutex_lock(&g_intercept_state.resource_mutex);
+        if (g_intercept_state.qp_count > 0) {
+            g_intercept_state.qp_count--;
+        }
+        pthread_mutex_unlock(&g_intercept_state.resource_mutex);
+        
+        /* 更新租户资源 */
+        update_tenant_resource_count(get_current_tenant_id(), 0, -1); // 0=QP
+        srq_sub_release_qp(qp);
+        queue_mem_release(qp);
+        qp_state_untrack(qp, qp_num);
+        qp_ws_untrack(qp, qp_num);
+        
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP destroyed: %p\n", qp);
+    }
+    
+    return result;
+}
+
+/* 销毁池中闲置的QP */
+static void destroy_pooled_qp(qp_pool_entry_t *e) {
+    if (destroy_qp_tracked(e->qp) != 0) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Failed to destroy pooled QP %p: %s\n", e->qp, strerror(errno));
+    }
+    update_tenant_resource_count(get_current_tenant_id(), 8, -1); // 8=池中QP
+    free(e);
+}
+
+/* 销毁引用指定上下文/PD/CQ/SRQ的闲置QP（在这些对象销毁前调用） */
+static void qp_pool_flush(struct ibv_context *context, struct ibv_pd *pd, struct ibv_cq *cq,
+                          struct ibv_srq *srq) {
+    if (qp_pool_count == 0) {
+        return;
+    }
+    
+    qp_pool_entry_t *victims = NULL;
+    pthread_mutex_lock(&qp_pool_mutex);
+    qp_pool_entry_t *prev = NULL;
+    for (qp_pool_entry_t **pp = &qp_pool_head; *pp; ) {
+        struct ibv_qp *qp = (*pp)->qp;
+        if ((context && qp->context == context) || (pd && qp->pd == pd) ||
+            (cq && (qp->send_cq == cq || qp->recv_cq == cq)) || (srq && qp->srq == srq)) {
+            qp_pool_entry_t *e = qp_pool_unlink_locked(pp, prev);
+            e->next = victims;
+            victims = e;
+        } else {
+            prev = *pp;
+            pp = &(*pp)->next;
+        }
+    }
+    pthread_mutex_unlock(&qp_pool_mutex);
+    
+    while (victims) {
+        qp_pool_entry_t *e = victims;
+        victims = e->next;
+        destroy_pooled_qp(e);
+    }
+}
+
+/* 记录新创建的真实QP（进程计数、共享内存、租户计数） */
+static void account_qp_created(uint32_t tenant_id) {
+    pthread_mutex_lock(&g_intercept_state.resource_mutex);
+    g_intercept_state.qp_count++;
+    pthread_mutex_unlock(&g_intercept_state.resource_mutex);
+    
+    /* 更新共享内存 */
+    resource_usage_t new_usage;
+    int pid = getpid();
+    new_usage.qp_count = g_intercept_state.qp_count;
+    new_usage.mr_count = g_intercept_state.mr_count;
+    new_usage.memory_used = g_intercept_state.memory_used;
+    shm_update_process_resources(pid, &new_usage);
+    
+    /* 更新租户资源 */
+    update_tenant_resource_count(tenant_id, 0, 1); // 0=QP
+}
+
+/* ========== UD虚拟QP复用 ==========
+ * 每线程/每对端一个UD QP的应用会耗尽网卡的QP上下文缓存。启用后ibv_create_qp为UD QP返回
+ * 虚拟QP，多个虚拟QP复用每进程少量的真实UD QP（要求PD、CQ相同且容量不超过真实QP）。
+ * 每个虚拟QP同一时刻只绑定一个真实QP，因此各自的投递顺序不变；投递时wr_id被替换为标签
+ * （魔数|代号|槽位），ibv_poll_cq只还原来自真实复用QP的完成，槽位释放时代号加一，
+ * 过期标签和已销毁虚拟QP的完成被丢弃。真实QP与普通QP一样计入租户QP、队列内存、
+ * 活跃QP和工作集配额。
+ * 同组虚拟QP共享真实QP的QPN与UD地址参数（端口、P_Key、Q_Key），INIT或修改时参数与所在
+ * 真实QP不同的虚拟QP换绑到参数一致的真实QP（没有则新建），qp_num随之改变，应用应在
+ * ibv_modify_qp之后读取qp_num。收到的数据报可能落入组内任一虚拟QP投递的接收缓冲区，
+ * 接收缓冲区需在同组虚拟QP全部销毁前保持有效。
+ * 虚拟QP指针和真实QP的qp_num记录在无锁开放寻址表中，普通QP的投递、轮询、修改和查询
+ * 只做原子读，不取ud_mux_mutex。
+ */
+#define UD_MUX_SET_SLOTS 8192
+#define UD_MUX_MAX_VQPS (UD_MUX_SET_SLOTS / 2)    // 负载因子不超过1/2，探测链保持很短
+#define UD_MUX_SET_TOMBSTONE 1ULL
+#define UD_MUX_QPN_KEY(qpn) ((1ULL << 32) | (uint64_t)(qpn))
+#define UD_MUX_MAX_TAGS 65536
+#define UD_MUX_TAG_MAGIC 0xD1A6ULL
+#define UD_MUX_IS_TAG(wr_id) (((wr_id) >> 48) == UD_MUX_TAG_MAGIC)
+#define UD_MUX_TAG(gen, idx) ((UD_MUX_TAG_MAGIC << 48) | ((uint64_t)(gen) << 16) | (idx))
+#define UD_MUX_TAG_IDX(wr_id) ((uint32_t)((wr_id) & 0xFFFF))
+#define UD_MUX_TAG_GEN(wr_id) ((uint32_t)((wr_id) >> 16))
+#define UD_MUX_STACK_WRS 32
+
+typedef struct ud_vqp ud_vqp_t;
+
+/* UD地址参数，真实QP在INIT时确定 */
+typedef struct {
+    uint8_t port_num;
+    uint16_t pkey_index;
+    uint32_t qkey;
+    uint32_t sq_psn;              // 只在真实QP进入RTS时使用，不参与分组
+} ud_mux_addr_t;
+
+typedef struct ud_real_qp {
+    struct ibv_qp *qp;
+    uint32_t qp_num;
+    struct ibv_qp_cap cap;
+    int sq_sig_all;
+    enum ibv_qp_state state;      // 真实QP已到达的状态
+    ud_mux_addr_t addr;           // state不低于INIT时有效
+    uint32_t live;                // 绑定的未销毁虚拟QP数
+    bool retiring;                // 最后一个虚拟QP已离开，真实QP正在销毁
+    struct ud_real_qp *next;
+} ud_real_qp_t;
+
+struct ud_vqp {
+    struct ibv_qp vqp;            // 返回给应用的QP，必须是第一个成员
+    ud_real_qp_t *real;
+    struct ibv_qp_init_attr init; // 创建请求，换绑时据此选择或新建真实QP
+    ud_mux_addr_t addr;           // 应用为该虚拟QP设置的UD地址参数
+    uint32_t pending;             // 未完成的带标签WR数（可能分布在换绑前后的真实QP上）
+    bool destroyed;               // 已销毁，pending归零时释放
+};
+
+typedef struct {
+    uint64_t wr_id;               // 应用原始wr_id
+    ud_vqp_t *owner;              // NULL表示空闲
+    ud_real_qp_t *real;           // WR所在的真实QP
+    uint32_t gen;                 // 槽位每次释放后加一，识别复用前的过期标签
+    uint32_t next_free;
+} ud_mux_tag_t;
+
+/* 开放寻址表：增删在ud_mux_mutex下进行，查找只做原子读（0为空槽） */
+typedef struct {
+    uint64_t keys[UD_MUX_SET_SLOTS];
+    uint32_t max_probe;
+} ud_mux_set_t;
+
+static ud_mux_set_t ud_vqp_set;       // 虚拟QP指针
+static ud_mux_set_t ud_real_qpn_set;  // 真实复用QP的qp_num
+static ud_real_qp_t *ud_reals = NULL;
+static uint32_t ud_real_count = 0;
+static uint32_t ud_vqp_count = 0;
+static ud_mux_tag_t *ud_tags = NULL;
+static uint32_t ud_tag_free = UINT32_MAX;
+static pthread_mutex_t ud_mux_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ud_modify_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint32_t ud_mux_set_hash(uint64_t key) {
+    return (uint32_t)((key ^ (key >> 4)) * 2654435761U) % UD_MUX_SET_SLOTS;
+}
+
+/* 同一qp_num在真实QP销毁与移出之间可能被新QP复用，允许重复插入 */
+static void ud_mux_set_insert_locked(ud_mux_set_t *set, uint64_t key) {
+    uint32_t h = ud_mux_set_hash(key);
+    for (uint32_t i = 0; i < UD_MUX_SET_SLOTS; i++) {
+        uint64_t *slot = &set->keys[(h + i) % UD_MUX_SET_SLOTS];
+        if (*slot == 0 || *slot == UD_MUX_SET_TOMBSTONE) {
+            if (i > set->max_probe) {
+                __atomic_store_n(&set->max_probe, i, __ATOMIC_RELEASE);
+            }
+            __atomic_store_n(slot, key, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+/* 无锁查找（投递、轮询热路径） */
+static inline bool ud_mux_set_contains(ud_mux_set_t *set, uint64_t key) {
+    uint32_t h = ud_mux_set_hash(key);
+    uint32_t max_probe = __atomic_load_n(&set->max_probe, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i <= max_probe; i++) {
+        uint64_t cur = __atomic_load_n(&set->keys[(h + i) % UD_MUX_SET_SLOTS], __ATOMIC_ACQUIRE);
+        if (cur == key) {
+            return true;
+        }
+        if (cur == 0) {
+            break;
+        }
+    }
+    return false;
+}
+
+static void ud_mux_set_remove_locked(ud_mux_set_t *set, uint64_t key) {
+    uint32_t h = ud_mux_set_hash(key);
+    for (uint32_t i = 0; i <= set->max_probe; i++) {
+        uint64_t *slot = &set->keys[(h + i) % UD_MUX_SET_SLOTS];
+        if (*slot == key) {
+            __atomic_store_n(slot, UD_MUX_SET_TOMBSTONE, __ATOMIC_RELEASE);
+            return;
+        }
+        if (*slot == 0) {
+            return;
+        }
+    }
+}
+
+/* 查找虚拟QP，普通QP返回NULL（投递热路径，不取锁） */
+static inline ud_vqp_t *ud_mux_lookup(struct ibv_qp *qp) {
+    if (__atomic_load_n(&ud_vqp_count, __ATOMIC_RELAXED) == 0 ||
+        !ud_mux_set_contains(&ud_vqp_set, (uint64_t)(uintptr_t)qp)) {
+        return NULL;
+    }
+    return (ud_vqp_t *)qp;
+}
+
+static bool ud_mux_tags_init_locked(void) {
+    if (ud_tags) {
+        return true;
+    }
+    ud_tags = calloc(UD_MUX_MAX_TAGS, sizeof(ud_mux_tag_t));
+    if (!ud_tags) {
+        return false;
+    }
+    for (uint32_t i = 0; i < UD_MUX_MAX_TAGS; i++) {
+        ud_tags[i].next_free = (i + 1 < UD_MUX_MAX_TAGS) ? i + 1 : UINT32_MAX;
+    }
+    ud_tag_free = 0;
+    return true;
+}
+
+static bool ud_mux_tag_alloc_locked(ud_vqp_t *v, ud_real_qp_t *r, uint64_t wr_id, uint64_t *tag) {
+    if (ud_tag_free == UINT32_MAX) {
+        return false;
+    }
+    uint32_t idx = ud_tag_free;
+    ud_tag_free = ud_tags[idx].next_free;
+    ud_tags[idx].wr_id = wr_id;
+    ud_tags[idx].owner = v;
+    ud_tags[idx].real = r;
+    v->pending++;
+    *tag = UD_MUX_TAG(ud_tags[idx].gen, idx);
+    return true;
+}
+
+static void ud_mux_tag_free_locked(uint32_t idx) {
+    ud_tags[idx].owner = NULL;
+    ud_tags[idx].real = NULL;
+    ud_tags[idx].gen++;
+    ud_tags[idx].next_free = ud_tag_free;
+    ud_tag_free = idx;
+}
+
+static bool ud_mux_addr_equal(const ud_mux_addr_t *a, const ud_mux_addr_t *b) {
+    return a->port_num == b->port_num && a->pkey_index == b->pkey_index && a->qkey == b->qkey;
+}
+
+static bool ud_mux_compatible(const ud_real_qp_t *r, struct ibv_pd *pd, const struct ibv_qp_init_attr *attr) {
+    return !r->retiring &&
+           r->qp->pd == pd &&
+           r->qp->send_cq == attr->send_cq &&
+           r->qp->recv_cq == attr->recv_cq &&
+           r->sq_sig_all == attr->sq_sig_all &&
+           attr->cap.max_send_wr <= r->cap.max_send_wr &&
+           attr->cap.max_recv_wr <= r->cap.max_recv_wr &&
+           attr->cap.max_send_sge <= r->cap.max_send_sge &&
+           attr->cap.max_recv_sge <= r->cap.max_recv_sge &&
+           attr->cap.max_inline_data <= r->cap.max_inline_data;
+}
+
+/* 选择负载最低的兼容真实QP（调用方持锁），addr非空时只选尚未INIT或UD地址参数一致的 */
+static ud_real_qp_t *ud_mux_pick_locked(struct ibv_pd *pd, const struct ibv_qp_init_attr *attr,
+                                        const ud_mux_addr_t *addr) {
+    ud_real_qp_t *best = NULL;
+    for (ud_real_qp_t *r = ud_reals; r; r = r->next) {
+        if (!ud_mux_compatible(r, pd, attr) ||
+            (addr && r->state != IBV_QPS_RESET && !ud_mux_addr_equal(&r->addr, addr))) {
+            continue;
+        }
+        if (!best || r->live < best->live) {
+            best = r;
+        }
+    }
+    return best;
+}
+
+/* 新建复用用的真实UD QP，与普通QP走同样的准入（类型/数量限制、创建限速、队列内存）和跟踪 */
+static ud_real_qp_t *ud_mux_create_real(struct ibv_pd *pd, const struct ibv_qp_init_attr *attr,
+                                        uint32_t tenant_id) {
+    struct ibv_qp_init_attr real_attr = *attr;
+    real_attr.qp_context = NULL;
+    
+    if (!check_qp_creation_restrictions(pd, &real_attr)) {
+        errno = EPERM;
+        return NULL;
+    }
+    uint64_t qmem = tenant_id ? queue_mem_estimate_qp(&real_attr) : 0;
+    if (!queue_mem_admit(tenant_id, qmem)) {
+        errno = EPERM;
+        return NULL;
+    }
+    if (tenant_id != 0 && tenant_initialized &&
+        tenant_qp_create_admit(tenant_id, g_intercept_state.config.qp_create_wait_ms) != 0) {
+        queue_mem_cancel(tenant_id, qmem);
+        errno = EAGAIN;
+        return NULL;
+    }
+    
+    ud_real_qp_t *r = calloc(1, sizeof(*r));
+    struct ibv_qp *qp = r ? real_ibv_create_qp(pd, &real_attr) : NULL;
+    if (!qp) {
+        int saved_errno = r ? errno : ENOMEM;
+        free(r);
+        queue_mem_cancel(tenant_id, qmem);
+        errno = saved_errno;
+        return NULL;
+    }
+    
+    account_qp_created(tenant_id);
+    queue_mem_track(tenant_id, qp, qmem);
+    qp_state_track(tenant_id, qp);
+    qp_ws_track(tenant_id, qp);
+    update_tenant_resource_count(tenant_id, 16, 1); // 16=复用用的真实UD QP
+    
+    r->qp = qp;
+    r->qp_num = qp->qp_num;
+    r->cap = real_attr.cap;
+    r->sq_sig_all = attr->sq_sig_all;
+    r->state = IBV_QPS_RESET;
+    return r;
+}
+
+/* 为虚拟QP取得真实QP并增加其live：真实QP未达上限或没有合适的真实QP时新建，否则选负载最低的
+ * 选中的真实QP在持锁时增加live，新建的真实QP在持锁时预占ud_real_count，
+ * 解锁期间其它线程的销毁不会释放它，也不会越过真实QP上限
+ */
+static ud_real_qp_t *ud_mux_acquire_real(struct ibv_pd *pd, const struct ibv_qp_init_attr *attr,
+                                         const ud_mux_addr_t *addr, uint32_t tenant_id) {
+    pthread_mutex_lock(&ud_mux_mutex);
+    ud_real_qp_t *best = ud_mux_pick_locked(pd, attr, addr);
+    bool need_real = !best || ud_real_count < g_intercept_state.config.ud_mux_real_qps;
+    if (need_real) {
+        ud_real_count++;
+    } else {
+        best->live++;
+    }
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    if (!need_real) {
+        return best;
+    }
+    
+    ud_real_qp_t *created = ud_mux_create_real(pd, attr, tenant_id);
+    int saved_errno = errno;
+    
+    pthread_mutex_lock(&ud_mux_mutex);
+    if (created) {
+        created->live = 1;
+        created->next = ud_reals;
+        ud_reals = created;
+        ud_mux_set_insert_locked(&ud_real_qpn_set, UD_MUX_QPN_KEY(created->qp_num));
+        best = created;
+    } else {
+        /* 新建失败时退回共享已有的合适真实QP */
+        ud_real_count--;
+        best = ud_mux_pick_locked(pd, attr, addr);
+        if (best) {
+            best->live++;
+        }
+    }
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    if (!best) {
+        errno = saved_errno;
+    }
+    return best;
+}
+
+static void ud_mux_bind_locked(ud_vqp_t *v, ud_real_qp_t *r) {
+    v->real = r;
+    v->vqp.handle = r->qp->handle;
+    v->vqp.qp_num = r->qp_num;
+}
+
+/* 虚拟QP离开真实QP（调用方持锁），返回因此不再有虚拟QP、需要销毁的真实QP */
+static ud_real_qp_t *ud_mux_unbind_locked(ud_vqp_t *v) {
+    ud_real_qp_t *r = v->real;
+    if (--r->live > 0) {
+        return NULL;
+    }
+    /* 销毁完成前仍留在链表中，其完成照常还原或丢弃，但不再被选中 */
+    r->retiring = true;
+    return r;
+}
+
+/* 销毁已没有虚拟QP的真实QP，回收其上全部标签，已销毁且没有其它未完成WR的虚拟QP随之释放 */
+static void ud_mux_retire(ud_real_qp_t *retire, uint32_t tenant_id) {
+    if (destroy_qp_tracked(retire->qp) != 0) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Failed to destroy multiplexed UD QP %u\n", retire->qp_num);
+    }
+    update_tenant_resource_count(tenant_id, 16, -1); // 16=复用用的真实UD QP
+    
+    /* 真实QP销毁后不会再有完成（提供者销毁QP时清除CQ中属于它的完成） */
+    pthread_mutex_lock(&ud_mux_mutex);
+    for (ud_real_qp_t **pp = &ud_reals; *pp; pp = &(*pp)->next) {
+        if (*pp == retire) {
+            *pp = retire->next;
+            break;
+        }
+    }
+    ud_mux_set_remove_locked(&ud_real_qpn_set, UD_MUX_QPN_KEY(retire->qp_num));
+    ud_real_count--;
+    for (uint32_t i = 0; i < UD_MUX_MAX_TAGS; i++) {
+        ud_vqp_t *owner = ud_tags[i].owner;
+        if (owner && ud_tags[i].real == retire) {
+            ud_mux_tag_free_locked(i);
+            if (--owner->pending == 0 && owner->destroyed) {
+                free(owner);
+            }
+        }
+    }
+    pthread_mutex_unlock(&ud_mux_mutex);
+    free(retire);
+}
+
+/* 创建虚拟UD QP，绑定的真实QP由ud_mux_acquire_real选择或新建 */
+static struct ibv_qp *ud_mux_create(struct ibv_pd *pd, struct ibv_qp_init_attr *attr, uint32_t tenant_id) {
+    ud_vqp_t *v = calloc(1, sizeof(*v));
+    if (!v) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    v->init = *attr;
+    v->init.qp_context = NULL;
+    
+    /* 预占虚拟QP数，表的负载因子不超过1/2 */
+    pthread_mutex_lock(&ud_mux_mutex);
+    if (!ud_mux_tags_init_locked() || ud_vqp_count >= UD_MUX_MAX_VQPS) {
+        pthread_mutex_unlock(&ud_mux_mutex);
+        free(v);
+        errno = ENOMEM;
+        return NULL;
+    }
+    __atomic_add_fetch(&ud_vqp_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    ud_real_qp_t *best = ud_mux_acquire_real(pd, attr, NULL, tenant_id);
+    if (!best) {
+        int saved_errno = errno;
+        pthread_mutex_lock(&ud_mux_mutex);
+        __atomic_sub_fetch(&ud_vqp_count, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&ud_mux_mutex);
+        free(v);
+        errno = saved_errno;
+        return NULL;
+    }
+    
+    struct ibv_qp *rq = best->qp;
+    v->vqp.context = rq->context;
+    v->vqp.qp_context = attr->qp_context;
+    v->vqp.pd = pd;
+    v->vqp.send_cq = attr->send_cq;
+    v->vqp.recv_cq = attr->recv_cq;
+    v->vqp.srq = NULL;
+    v->vqp.state = IBV_QPS_RESET;
+    v->vqp.qp_type = IBV_QPT_UD;
+    pthread_mutex_init(&v->vqp.mutex, NULL);
+    pthread_cond_init(&v->vqp.cond, NULL);
+    
+    pthread_mutex_lock(&ud_mux_mutex);
+    ud_mux_bind_locked(v, best);
+    attr->cap = best->cap;
+    ud_mux_set_insert_locked(&ud_vqp_set, (uint64_t)(uintptr_t)&v->vqp);
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    update_tenant_resource_count(tenant_id, 15, 1); // 15=虚拟UD QP
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Virtual UD QP %p bound to QP %u\n", &v->vqp, best->qp_num);
+    return &v->vqp;
+}
+
+/* 销毁虚拟QP，组内最后一个虚拟QP销毁时一并销毁真实QP */
+static int ud_mux_destroy(ud_vqp_t *v) {
+    pthread_mutex_lock(&ud_mux_mutex);
+    ud_mux_set_remove_locked(&ud_vqp_set, (uint64_t)(uintptr_t)&v->vqp);
+    __atomic_sub_fetch(&ud_vqp_count, 1, __ATOMIC_RELAXED);
+    ud_real_qp_t *retire = ud_mux_unbind_locked(v);
+    v->destroyed = true;
+    if (v->pending == 0) {
+        free(v);
+    }
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    uint32_t tenant_id = get_current_tenant_id();
+    update_tenant_resource_count(tenant_id, 15, -1); // 15=虚拟UD QP
+    
+    if (retire) {
+        ud_mux_retire(retire, tenant_id);
+    }
+    return 0;
+}
+
+/* 把真实QP逐级迁移到target（调用方持ud_modify_mutex），INIT使用addr中的UD地址参数，
+ * 每一步与普通QP一样先记账，进入RTS受活跃QP配额限制
+ */
+static int ud_mux_real_advance(ud_real_qp_t *r, enum ibv_qp_state target, const ud_mux_addr_t *addr) {
+    while (r->state < target) {
+        struct ibv_qp_attr step;
+        int mask = IBV_QP_STATE;
+        memset(&step, 0, sizeof(step));
+        step.qp_state = (enum ibv_qp_state)(r->state + 1);
+        if (step.qp_state == IBV_QPS_INIT) {
+            step.port_num = addr->port_num;
+            step.pkey_index = addr->pkey_index;
+            step.qkey = addr->qkey;
+            mask |= IBV_QP_PORT | IBV_QP_PKEY_INDEX | IBV_QP_QKEY;
+        } else if (step.qp_state == IBV_QPS_RTS) {
+            step.sq_psn = addr->sq_psn;
+            mask |= IBV_QP_SQ_PSN;
+        }
+        
+        int prev = -1;
+        if (!qp_state_set(r->qp, (int)step.qp_state, true, &prev)) {
+            return EPERM;
+        }
+        int ret = real_ibv_modify_qp(r->qp, &step, mask);
+        if (ret != 0) {
+            if (prev >= 0) {
+                qp_state_set(r->qp, prev, false, NULL);
+            }
+            return ret;
+        }
+        if (step.qp_state == IBV_QPS_INIT) {
+            r->addr = *addr;
+        }
+        r->state = step.qp_state;
+    }
+    return 0;
+}
+
+/* 虚拟QP换绑到UD地址参数为addr的真实QP（没有则新建），原真实QP不再有虚拟QP时销毁
+ * 换绑前投递的WR仍在原真实QP上完成，标签记录WR所在的真实QP，照常还原
+ */
+static int ud_mux_rebind(ud_vqp_t *v, const ud_mux_addr_t *addr) {
+    uint32_t tenant_id = get_current_tenant_id();
+    ud_real_qp_t *r = ud_mux_acquire_real(v->vqp.pd, &v->init, addr, tenant_id);
+    if (!r) {
+        return errno ? errno : ENOMEM;
+    }
+    
+    pthread_mutex_lock(&ud_mux_mutex);
+    ud_real_qp_t *retire = ud_mux_unbind_locked(v);
+    ud_mux_bind_locked(v, r);
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    if (retire) {
+        ud_mux_retire(retire, tenant_id);
+    }
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Virtual UD QP %p rebound to QP %u (qkey 0x%x)\n",
+                  &v->vqp, r->qp_num, addr->qkey);
+    return 0;
+}
+
+/* 虚拟QP修改：独占真实QP且状态同步时直接透传；否则只迁移虚拟QP，真实QP落后时代为逐级迁移
+ * UD地址参数与真实QP不同的虚拟QP换绑到参数一致的真实QP；不带IBV_QP_STATE的修改视为同状态迁移。
+ * 共享真实QP时SQ PSN等不影响UD分组的属性沿用真实QP已设置的值
+ */
+static int ud_mux_modify(ud_vqp_t *v, struct ibv_qp_attr *attr, int attr_mask) {
+    int ret = 0;
+    
+    pthread_mutex_lock(&ud_modify_mutex);
+    
+    ud_real_qp_t *r = v->real;
+    enum ibv_qp_state cur = v->vqp.state;
+    enum ibv_qp_state target = (attr_mask & IBV_QP_STATE) ? attr->qp_state : cur;
+    ud_mux_addr_t addr = v->addr;
+    if (attr_mask & IBV_QP_PORT) {
+        addr.port_num = attr->port_num;
+    }
+    if (attr_mask & IBV_QP_PKEY_INDEX) {
+        addr.pkey_index = attr->pkey_index;
+    }
+    if (attr_mask & IBV_QP_QKEY) {
+        addr.qkey = attr->qkey;
+    }
+    if (attr_mask & IBV_QP_SQ_PSN) {
+        addr.sq_psn = attr->sq_psn;
+    }
+    
+    if (target == IBV_QPS_RESET || target > IBV_QPS_RTS) {
+        /* RESET/SQD/SQE/ERR只作用于虚拟QP，不影响共享的真实QP */
+        v->vqp.state = target;
+    } else if (cur <= IBV_QPS_RTS && (int)target > (int)cur + 1) {
+        ret = EINVAL;
+    } else if (r->live == 1 && r->state == cur) {
+        /* 独占真实QP且状态同步，透传应用的修改（包括同状态下修改Q_Key等） */
+        int prev = -1;
+        if (target != r->state && !qp_state_set(r->qp, (int)target, true, &prev)) {
+            /* 真实QP进入RTS同样受活跃QP配额限制 */
+            ret = EPERM;
+        } else {
+            ret = real_ibv_modify_qp(r->qp, attr, attr_mask);
+            if (ret != 0 && prev >= 0) {
+                qp_state_set(r->qp, prev, false, NULL);
+            }
+        }
+        if (ret == 0) {
+            r->addr = addr;
+            r->state = target;
+        }
+    } else {
+        if (r->state != IBV_QPS_RESET && !ud_mux_addr_equal(&r->addr, &addr)) {
+            ret = ud_mux_rebind(v, &addr);
+            r = v->real;
+        }
+        if (ret == 0) {
+            ret = ud_mux_real_advance(r, target, &addr);
+        }
+    }
+    
+    if (ret == 0) {
+        v->vqp.state = target;
+        v->addr = addr;
+    }
+    pthread_mutex_unlock(&ud_modify_mutex);
+    return ret;
+}
+
+/* 带标签投递到真实QP（发送只给会产生完成的WR加标签），应用的WR链保持不变 */
+static int ud_mux_post_send(ud_vqp_t *v, struct ibv_send_wr *wr, struct ibv_send_wr **bad_wr,
+                            post_send_op_fn post) {
+    ud_real_qp_t *r = v->real;
+    if (v->vqp.state != IBV_QPS_RTS) {
+        *bad_wr = wr;
+        return EINVAL;
+    }
+    
+    size_t n = 0;
+    for (struct ibv_send_wr *w = wr; w; w = w->next) n++;
+    struct ibv_send_wr stack_copy[UD_MUX_STACK_WRS];
+    struct ibv_send_wr *copy = (n <= UD_MUX_STACK_WRS) ? stack_copy : malloc(n * sizeof(*copy));
+    if (!copy) {
+        *bad_wr = wr;
+        return ENOMEM;
+    }
+    
+    size_t tagged = 0;
+    int ret = 0;
+    pthread_mutex_lock(&ud_mux_mutex);
+    for (struct ibv_send_wr *w = wr; w; w = w->next, tagged++) {
+        copy[tagged] = *w;
+        copy[tagged].next = (tagged + 1 < n) ? &copy[tagged + 1] : NULL;
+        if (((w->send_flags & IBV_SEND_SIGNALED) || r->sq_sig_all) &&
+            !ud_mux_tag_alloc_locked(v, r, w->wr_id, &copy[tagged].wr_id)) {
+            ret = ENOMEM;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    struct ibv_send_wr *bad = copy;
+    if (ret == 0) {
+        if (g_intercept_state.config.enable_qp_working_set) {
+            qp_ws_touch(r->qp);
+        }
+        ret = post(r->qp, copy, &bad);
+    }
+    
+    if (ret) {
+        size_t first = bad ? (size_t)(bad - copy) : 0;
+        pthread_mutex_lock(&ud_mux_mutex);
+        /* 未投递的WR释放标签（wr_id与应用WR不同的即带标签），bad_wr指回应用的WR */
+        struct ibv_send_wr *w = wr;
+        for (size_t k = 0; k < tagged && w; k++, w = w->next) {
+            if (k == first) {
+                *bad_wr = w;
+            }
+            if (k >= first && copy[k].wr_id != w->wr_id) {
+                ud_mux_tag_free_locked(UD_MUX_TAG_IDX(copy[k].wr_id));
+                v->pending--;
+            }
+        }
+        pthread_mutex_unlock(&ud_mux_mutex);
+        if (first >= tagged) {
+            *bad_wr = w;
+        }
+    }
+    
+    if (copy != stack_copy) {
+        free(copy);
+    }
+    return ret;
+}
+
+/* 接收WR总会产生完成（成功或冲刷），全部加标签 */
+static int ud_mux_post_recv(ud_vqp_t *v, struct ibv_recv_wr *wr, struct ibv_recv_wr **bad_wr,
+                            post_recv_op_fn post) {
+    ud_real_qp_t *r = v->real;
+    if (v->vqp.state == IBV_QPS_RESET || v->vqp.state == IBV_QPS_ERR) {
+        *bad_wr = wr;
+        return EINVAL;
+    }
+    
+    size_t n = 0;
+    for (struct ibv_recv_wr *w = wr; w; w = w->next) n++;
+    struct ibv_recv_wr stack_copy[UD_MUX_STACK_WRS];
+    struct ibv_recv_wr *copy = (n <= UD_MUX_STACK_WRS) ? stack_copy : malloc(n * sizeof(*copy));
+    if (!copy) {
+        *bad_wr = wr;
+        return ENOMEM;
+    }
+    
+    size_t tagged = 0;
+    int ret = 0;
+    pthread_mutex_lock(&ud_mux_mutex);
+    for (struct ibv_recv_wr *w = wr; w; w = w->next, tagged++) {
+        copy[tagged] = *w;
+        copy[tagged].next = (tagged + 1 < n) ? &copy[tagged + 1] : NULL;
+        if (!ud_mux_tag_alloc_locked(v, r, w->wr_id, &copy[tagged].wr_id)) {
+            ret = ENOMEM;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ud_mux_mutex);
+    
+    struct ibv_recv_wr *bad = copy;
+    if (ret == 0) {
+        if (g_intercept_state.config.enable_qp_working_set) {
+            qp_ws_touch(r->qp);
+        }
+        ret = post(r->qp, copy, &bad);
+    }
+    
+    if (ret) {
+        size_t first = bad ? (size_t)(bad - copy) : 0;
+        pthread_mutex_lock(&ud_mux_mutex);
+        /* 未投递的WR释放标签（wr_id与应用WR不同的即带标签），bad_wr指回应用的WR */
+        struct ibv_recv_wr *w = wr;
+        for (size_t k = 0; k < tagged && w; k++, w = w->next) {
+            if (k == first) {
+                *bad_wr = w;
+            }
+            if (k >= first && copy[k].wr_id != w->wr_id) {
+                ud_mux_tag_free_locked(UD_MUX_TAG_IDX(copy[k].wr_id));
+                v->pending--;
+            }
+        }
+        pthread_mutex_unlock(&ud_mux_mutex);
+        if (first >= tagged) {
+            *bad_wr = w;
+        }
+    }
+    
+    if (copy != stack_copy) {
+        free(copy);
+    }
+    return ret;
+}
+
+/* 还原一个来自真实复用QP的带标签完成（调用方持锁），返回是否交给应用 */
+static bool ud_mux_demux_one_locked(struct ibv_wc *wc) {
+    uint32_t idx = UD_MUX_TAG_IDX(wc->wr_id);
+    ud_vqp_t *owner = ud_tags[idx].owner;
+    if (!owner || ud_tags[idx].gen != UD_MUX_TAG_GEN(wc->wr_id)) {
+        return false;   // 槽位已回收或已被复用，属于旧的WR
+    }
+    
+    wc->wr_id = ud_tags[idx].wr_id;
+    ud_mux_tag_free_locked(idx);
+    owner->pending--;
+    if (owner->destroyed) {
+        if (owner->pending == 0) {
+            free(owner);
+        }
+        return false;
+    }
+    return true;
+}
+
+/* 还原完成中的wr_id，丢弃过期标签和已销毁虚拟QP的完成，返回保留的完成数
+ * 只有来自真实复用QP（无锁表查得）的带魔数完成才取锁，其它QP上恰好带魔数的应用wr_id原样返回
+ */
+static int ud_mux_demux_completions(struct ibv_wc *wc, int n) {
+    if (!ud_tags || n <= 0) {
+        return n;
+    }
+    
+    int kept = 0;
+    bool locked = false;
+    for (int i = 0; i < n; i++) {
+        if (UD_MUX_IS_TAG(wc[i].wr_id) &&
+            ud_mux_set_contains(&ud_real_qpn_set, UD_MUX_QPN_KEY(wc[i].qp_num))) {
+            if (!locked) {
+                pthread_mutex_lock(&ud_mux_mutex);
+                locked = true;
+            }
+            if (!ud_mux_demux_one_locked(&wc[i])) {
+                continue;
+            }
+        }
+        if (kept != i) {
+            wc[kept] = wc[i];
+        }
+        kept++;
+    }
+    if (locked) {
+        pthread_mutex_unlock(&ud_mux_mutex);
+    }
+    return kept;
+}
+
+/* 查询虚拟QP：属性来自真实QP，状态与用户上下文来自虚拟QP */
+static int ud_mux_query(ud_vqp_t *v, struct ibv_qp_attr *attr, int attr_mask,
+                        struct ibv_qp_init_attr *init_attr) {
+    int ret = real_ibv_query_qp(v->real->qp, attr, attr_mask, init_attr);
+    if (ret == 0) {
+        attr->qp_state = v->vqp.state;
+        attr->cur_qp_state = v->vqp.state;
+        if (init_attr) {
+            init_attr->qp_context = v->vqp.qp_context;
+        }
+    }
+    return ret;
+}
+
+/* 被拦截的ibv_create_qp函数 */
+struct ibv_qp *ibv_create_qp(struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_create_qp) {
+        if (real_ibv_create_qp) {
+            return real_ibv_create_qp(pd, qp_init_attr);
+        }
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint32_t tenant_id = get_current_tenant_id();
+    
+    /* 按租户容量预算检查或收缩请求的cap */
+    if (!apply_tenant_qp_caps(tenant_id, qp_init_attr)) {
+        errno = EPERM;
+        return NULL;
+    }
+    
+    /* UD QP复用到真实QP上，虚拟QP表已满时退回普通QP */
+    if (g_intercept_state.config.enable_ud_mux && qp_init_attr && qp_init_attr->qp_type == IBV_QPT_UD &&
+        qp_init_attr->srq == NULL && check_qp_type_allowed(qp_init_attr) &&
+        __atomic_load_n(&ud_vqp_count, __ATOMIC_RELAXED) < UD_MUX_MAX_VQPS) {
+        return ud_mux_create(pd, qp_init_attr, tenant_id);
+    }
+    
+    bool pool = g_intercept_state.config.enable_qp_pool && qp_init_attr &&
+                qp_pool_type_supported(qp_init_attr->qp_type) && check_qp_type_allowed(qp_init_attr);
+    
+    /* 命中QP池：QP已计入配额，直接复用 */
+    if (pool) {
+        qp_pool_entry_t *e = qp_pool_take(pd, qp_init_attr);
+        if (e) {
+            e->qp->qp_context = qp_init_attr->qp_context;
+            qp_init_attr->cap = e->cap;
+            qp_live_insert(e);
+            update_tenant_resource_count(tenant_id, 8, -1); // 8=池中QP
+            tenant_record_qp_create(tenant_id, 1, elapsed_us(&t0));
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP reused from pool: %p\n", e->qp);
+            return e->qp;
+        }
+    }
+
+    while (!check_qp_creation_restrictions(pd, qp_init_attr)) {
+        /* 配额被闲置QP占用时先淘汰最旧的闲置QP */
+        qp_pool_entry_t *victim = pool ? qp_pool_pop_oldest() : NULL;
+        if (!victim) {
+            errno = EPERM;
+            return NULL;
+        }
+        destroy_pooled_qp(victim);
+    }
+
+    qp_pool_entry_t *entry = NULL;
+    if (pool) {
+        entry = calloc(1, sizeof(*entry));
+        if (entry) {
+            entry->req = *qp_init_attr;
+        }
+    }
+
+    /* 兼容的QP改为挂到共享SRQ，不分配私有接收队列 */
+    struct ibv_qp_init_attr sub_attr;
+    struct ibv_qp_init_attr *create_attr = qp_init_attr;
+    shared_srq_t *shared = (qp_init_attr && srq_sub_compatible(qp_init_attr)) ?
+                           srq_sub_acquire(tenant_id, pd, qp_init_attr) : NULL;
+    if (shared) {
+        sub_attr = *qp_init_attr;
+        sub_attr.srq = shared->srq;
+        sub_attr.cap.max_recv_wr = 0;
+        sub_attr.cap.max_recv_sge = 0;
+        create_attr = &sub_attr;
+    }
+
+    /* 预扣队列内存（挂到共享SRQ的QP不含接收队列），不足时同样先淘汰闲置QP */
+    uint64_t qmem = tenant_id ? queue_mem_estimate_qp(create_attr) : 0;
+    while (!queue_mem_admit(tenant_id, qmem)) {
+        qp_pool_entry_t *victim = pool ? qp_pool_pop_oldest() : NULL;
+        if (!victim) {
+            if (shared) {
+                srq_sub_cancel(shared, qp_init_attr->cap.max_recv_wr);
+            }
+            free(entry);
+            errno = EPERM;
+            return NULL;
+        }
+        destroy_pooled_qp(victim);
+    }
+
+    /* 通过全部检查后才按租户和全局创建速率排队，被拒绝的创建不消耗令牌 */
+    if (tenant_id != 0 && tenant_initialized &&
+        tenant_qp_create_admit(tenant_id, g_intercept_state.config.qp_create_wait_ms) != 0) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP creation rate limited for tenant %u\n", tenant_id);
+        queue_mem_cancel(tenant_id, qmem);
+        if (shared) {
+            srq_sub_cancel(shared, qp_init_attr->cap.max_recv_wr);
+        }
+        free(entry);
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    struct ibv_qp *qp = real_ibv_create_qp(pd, create_attr);
+    
+    if (shared) {
+        if (qp) {
+            /* 回写实际发送队列容量，接收容量对应用保持请求值（由共享SRQ承担） */
+            struct ibv_qp_cap req_cap = qp_init_attr->cap;
+            qp_init_attr->cap = sub_attr.cap;
+            qp_init_attr->cap.max_recv_wr = req_cap.max_recv_wr;
+            qp_init_attr->cap.max_recv_sge = req_cap.max_recv_sge;
+            srq_sub_bind(tenant_id, qp, shared, req_cap.max_recv_wr);
+        } else {
+            srq_sub_cancel(shared, qp_init_attr->cap.max_recv_wr);
+        }
+    }
+    
+    if (qp) {
+        account_qp_created(tenant_id);
+        queue_mem_track(tenant_id, qp, qmem);
+        qp_state_track(tenant_id, qp);
+        qp_ws_track(tenant_id, qp);
+        tenant_record_qp_create(tenant_id, pool ? 0 : -1, elapsed_us(&t0));
+        
+        /* 记录创建参数，销毁时用于入池 */
+        if (entry) {
+            entry->qp = qp;
+            entry->cap = qp_init_attr->cap;
+            qp_live_insert(entry);
+            entry = NULL;
+        }
+        
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP created: %p\n", qp);
+    } else {
+        queue_mem_cancel(tenant_id, qmem);
+    }
+    free(entry);
+
+    return qp;
+}
+
+/* 被拦截的ibv_destroy_qp函数 */
+int ibv_destroy_qp(struct ibv_qp *qp) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_destroy_qp) {
+        if (real_ibv_destroy_qp) {
+            return real_ibv_destroy_qp(qp);
+        }
+        errno = ENOSYS;
+        return -1;
+    }
+
+    ud_vqp_t *v = ud_mux_lookup(qp);
+    if (v) {
+        return ud_mux_destroy(v);
+    }
+
+    /* 启用QP池时复位后暂存，不真正销毁 */
+    qp_pool_entry_t *e = g_intercept_state.config.enable_qp_pool ? qp_live_remove(qp) : NULL;
+    if (e) {
+        if (qp_pool_park(e)) {
+            update_tenant_resource_count(get_current_tenant_id(), 8, 1); // 8=池中QP
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP parked in pool: %p\n", qp);
+            return 0;
+        }
+        free(e);
+    }
+
+    return destroy_qp_tracked(qp);
+}
+
+/* 被拦截的ibv_modify_qp函数 */
+int ibv_modify_qp(struct ibv_qp *qp, struct ibv_qp_attr *attr, int attr_mask) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_modify_qp) {
+        return ENOSYS;
+    }
+    
+    ud_vqp_t *v = ud_mux_lookup(qp);
+    if (v) {
+        return ud_mux_modify(v, attr, attr_mask);
+    }
+    
+    /* 状态迁移先记账（进入RTS时检查活跃QP配额），失败后回退 */
+    bool state_change = attr && (attr_mask & IBV_QP_STATE) && attr->qp_state < TENANT_QP_STATES;
+    int prev = -1;
+    if (state_change && !qp_state_set(qp, (int)attr->qp_state, true, &prev)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] QP %u RTS denied: active QP quota\n", qp->qp_num);
+        return EPERM;
+    }
+    
+    int ret = real_ibv_modify_qp(qp, attr, attr_mask);
+    if (ret != 0 && state_change && prev >= 0) {
+        qp_state_set(qp, prev, false, NULL);
+    }
+    return ret;
+}
+
+/* 被拦截的ibv_query_qp函数 */
+int ibv_query_qp(struct ibv_qp *qp, struct ibv_qp_attr *attr, int attr_mask,
+                 struct ibv_qp_init_attr *init_attr) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_query_qp) {
+        return ENOSYS;
+    }
+    
+    ud_vqp_t *v = ud_mux_lookup(qp);
+    if (v) {
+        return ud_mux_query(v, attr, attr_mask, init_attr);
+    }
+    
+    int ret = real_ibv_query_qp(qp, attr, attr_mask, init_attr);
+    if (ret == 0 && (attr_mask & IBV_QP_STATE) && attr->qp_state < TENANT_QP_STATES) {
+        qp_state_set(qp, (int)attr->qp_state, false, NULL);
+    }
+    return ret;
+}
+
+/* ========== 租户内跨进程共享MR ==========
+ * 首个进程注册并在租户共享内存中发布PD/MR句柄，其余进程通过pidfd_getfd
+ * 复制持有进程的cmd_fd，再用ibv_import_pd/ibv_import_mr导入，不再重复pin内存。
+ */
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+
+// 等待其它进程完成注册的最大重试次数（每次1ms）
+#define SHARED_MR_BUSY_RETRIES 1000
+
+/* 导入的上下文和PD（同一来源的多个MR复用） */
+typedef struct imported_pd {
+    pid_t owner_pid;
+    int owner_fd;
+    uint32_t pd_handle;
+    struct ibv_context *context;
+    struct ibv_pd *pd;
+    int refcnt;
+    struct imported_pd *next;
+} imported_pd_t;
+
+/* 本进程持有的共享MR */
+typedef struct shared_mr_record {
+    struct ibv_mr *mr;
+    int slot;
+    size_t length;
+    imported_pd_t *ipd;             // NULL表示本进程是首个注册者
+    struct shared_mr_record *next;
+} shared_mr_record_t;
+
+static imported_pd_t *imported_pds = NULL;
+static shared_mr_record_t *shared_mr_records = NULL;
+static pthread_mutex_t shared_mr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_shared_mr_record(shared_mr_record_t *rec) {
+    pthread_mutex_lock(&shared_mr_mutex);
+    rec->next = shared_mr_records;
+    shared_mr_records = rec;
+    pthread_mutex_unlock(&shared_mr_mutex);
+}
+
+/* 从持有进程复制cmd_fd并导入PD */
+static imported_pd_t *get_imported_pd(const shared_mr_entry_t *entry) {
+    pthread_mutex_lock(&shared_mr_mutex);
+    for (imported_pd_t *ipd = imported_pds; ipd; ipd = ipd->next) {
+        if (ipd->owner_pid == entry->owner_pid && ipd->owner_fd == entry->owner_fd &&
+            ipd->pd_handle == entry->pd_handle) {
+            ipd->refcnt++;
+            pthread_mutex_unlock(&shared_mr_mutex);
+            return ipd;
+        }
+    }
+    pthread_mutex_unlock(&shared_mr_mutex);
+    
+    int pidfd = (int)syscall(SYS_pidfd_open, entry->owner_pid, 0);
+    if (pidfd < 0) {
+        return NULL;
+    }
+    int fd = (int)syscall(SYS_pidfd_getfd, pidfd, entry->owner_fd, 0);
+    close(pidfd);
+    if (fd < 0) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] pidfd_getfd from %d failed: %s\n",
+                      entry->owner_pid, strerror(errno));
+        return NULL;
+    }
+    
+    /* 导入后cmd_fd归上下文所有，由ibv_close_device关闭 */
+    struct ibv_context *context = ibv_import_device(fd);
+    if (!context) {
+        close(fd);
+        return NULL;
+    }
+    
+    struct ibv_pd *pd = ibv_import_pd(context, entry->pd_handle);
+    imported_pd_t *ipd = pd ? malloc(sizeof(*ipd)) : NULL;
+    if (!ipd) {
+        if (pd) ibv_unimport_pd(pd);
+        ibv_close_device(context);
+        return NULL;
+    }
+    
+    ipd->owner_pid = entry->owner_pid;
+    ipd->owner_fd = entry->owner_fd;
+    ipd->pd_handle = entry->pd_handle;
+    ipd->context = context;
+    ipd->pd = pd;
+    ipd->refcnt = 1;
+    
+    pthread_mutex_lock(&shared_mr_mutex);
+    ipd->next = imported_pds;
+    imported_pds = ipd;
+    pthread_mutex_unlock(&shared_mr_mutex);
+    return ipd;
+}
+
+static void put_imported_pd(imported_pd_t *ipd) {
+    pthread_mutex_lock(&shared_mr_mutex);
+    bool last = (--ipd->refcnt == 0);
+    if (last) {
+        for (imported_pd_t **pp = &imported_pds; *pp; pp = &(*pp)->next) {
+            if (*pp == ipd) {
+                *pp = ipd->next;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shared_mr_mutex);
+    
+    if (last) {
+        ibv_unimport_pd(ipd->pd);
+        ibv_close_device(ipd->context);
+        free(ipd);
+    }
+}
+
+/* 导入已发布的共享MR */
+static struct ibv_mr *import_shared_mr(uint32_t tenant_id, int slot, const shared_mr_entry_t *entry) {
+    imported_pd_t *ipd = get_imported_pd(entry);
+    if (!ipd) {
+        return NULL;
+    }
+    
+    struct ibv_mr *mr = ibv_import_mr(ipd->pd, entry->mr_handle);
+    shared_mr_record_t *rec = mr ? malloc(sizeof(*rec)) : NULL;
+    if (!rec) {
+        if (mr) ibv_unimport_mr(mr);
+        put_imported_pd(ipd);
+        return NULL;
+    }
+    
+    /* 导入的MR不带地址信息，按注册时的iova补齐 */
+    mr->addr = (void *)(uintptr_t)entry->offset;
+    mr->length = entry->length;
+    
+    rec->mr = mr;
+    rec->slot = slot;
+    rec->length = entry->length;
+    rec->ipd = ipd;
+    add_shared_mr_record(rec);
+    
+    tenant_shared_mr_set_holder_fd(slot, getpid(), ipd->context->cmd_fd);
+    update_tenant_resource_count(tenant_id, 7, 1); // 7=共享MR导入
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] shared MR imported: %s+%llu from pid %d\n",
+                  entry->shm_name, (unsigned long long)entry->offset, entry->owner_pid);
+    return mr;
+}
+
+struct ibv_mr *rdma_intercept_reg_shared_mr(struct ibv_pd *pd, const char *shm_name, void *addr,
+                                            uint64_t offset, size_t length, int access) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!pd || !shm_name || length == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    uint32_t tenant_id = get_current_tenant_id();
+    if (!rdma_intercept_is_enabled() || !tenant_initialized || tenant_id == 0 || !real_ibv_reg_mr_iova2) {
+        /* 无租户时退化为私有注册，地址同样按偏移 */
+        return ibv_reg_mr_iova2(pd, addr, length, offset, access);
+    }
+    
+    pid_t pid = getpid();
+    int slot = -1;
+    shared_mr_entry_t entry;
+    int ret;
+    for (int i = 0; ; i++) {
+        ret = tenant_shared_mr_acquire(tenant_id, shm_name, offset, length, access, pid, &slot, &entry);
+        if (ret >= 0 || errno != EBUSY || i >= SHARED_MR_BUSY_RETRIES) {
+            break;
+        }
+        usleep(1000);
+    }
+    
+    if (ret == 1) {
+        struct ibv_mr *mr = import_shared_mr(tenant_id, slot, &entry);
+        if (mr) {
+            return mr;
+        }
+        tenant_shared_mr_release(slot, pid, NULL);
+    }
+    
+    if (ret != 0) {
+        /* 登记表不可用或导入失败（如ptrace权限不足），退化为私有注册 */
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] shared MR %s+%llu not shared, registering privately\n",
+                      shm_name, (unsigned long long)offset);
+        return ibv_reg_mr_iova2(pd, addr, length, offset, access);
+    }
+    
+    /* 本进程是首个注册者 */
+    if (!admit_tenant_mr(tenant_id, length)) {
+        tenant_shared_mr_release(slot, pid, NULL);
+        errno = EPERM;
+        return NULL;
+    }
+    
+    struct ibv_mr *mr = real_ibv_reg_mr_iova2(pd, addr, length, offset, access);
+    shared_mr_record_t *rec = mr ? malloc(sizeof(*rec)) : NULL;
+    if (!rec || tenant_shared_mr_publish(slot, pid, pd->context->cmd_fd, pd->handle,
+                                         mr->handle, mr->lkey, mr->rkey) != 0) {
+        int saved_errno = mr ? ENOMEM : errno;
+        if (mr) real_ibv_dereg_mr(mr);
+        free(rec);
+        charge_tenant_memory(tenant_id, -(int64_t)length);
+        tenant_shared_mr_release(slot, pid, NULL);
+        errno = saved_errno;
+        return NULL;
+    }
+    
+    rec->mr = mr;
+    rec->slot = slot;
+    rec->length = length;
+    rec->ipd = NULL;
+    add_shared_mr_record(rec);
+    
+    /* 租户MR计数在发布时计入，这里只更新进程计数 */
+    pthread_mutex_lock(&g_intercept_state.resource_mutex);
+    g_intercept_state.mr_count++;
+    g_intercept_state.memory_used += length;
+    pthread_mutex_unlock(&g_intercept_state.resource_mutex);
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] shared MR published: %s+%llu, length=%zu\n",
+                  shm_name, (unsigned long long)offset, length);
+    return mr;
+}
+
+/* mr是否为本进程持有的共享MR（首个注册者或导入者） */
+static bool is_shared_mr(struct ibv_mr *mr) {
+    bool found = false;
+    
+    pthread_mutex_lock(&shared_mr_mutex);
+    for (shared_mr_record_t *rec = shared_mr_records; rec; rec = rec->next) {
+        if (rec->mr == mr) {
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shared_mr_mutex);
+    return found;
+}
+
+/* 共享MR的注销：不是最后一个持有者时只解除本进程的句柄 */
+static bool release_shared_mr(struct ibv_mr *mr, int *result) {
+    shared_mr_record_t *rec = NULL;
+    
+    pthread_mutex_lock(&shared_mr_mutex);
+    if (shared_mr_records) {
+        for (shared_mr_record_t **pp = &shared_mr_records; *pp; pp = &(*pp)->next) {
+            if ((*pp)->mr == mr) {
+                rec = *pp;
+                *pp = rec->next;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shared_mr_mutex);
+    
+    if (!rec) {
+        return false;
+    }
+    
+    /* 租户内存和MR计数由登记表在最后一个持有者释放时归还 */
+    bool last = false;
+    tenant_shared_mr_release(rec->slot, getpid(), &last);
+    
+    if (last) {
+        *result = real_ibv_dereg_mr(mr);
+    } else {
+        ibv_unimport_mr(mr);
+        *result = 0;
+    }
+    
+    if (rec->ipd) {
+        put_imported_pd(rec->ipd);
+    } else {
+        pthread_mutex_lock(&g_intercept_state.resource_mutex);
+        if (g_intercept_state.mr_count > 0) {
+            g_intercept_state.mr_count--;
+        }
+        if (g_intercept_state.memory_used >= rec->length) {
+            g_intercept_state.memory_used -= rec->length;
+        }
+        pthread_mutex_unlock(&g_intercept_state.resource_mutex);
+    }
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] shared MR released: %p (last=%d)\n", mr, last);
+    free(rec);
+    return true;
+}
+
+/* 被拦截的ibv_reg_mr函数 - 使用不同名称避免宏冲突 */
+struct ibv_mr *__real_ibv_reg_mr_tenant(struct ibv_pd *pd, void *addr, size_t length, int access) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_reg_mr) {
+        if (real_ibv_reg_mr) {
+            return reg_mr_unhooked(pd, addr, length, access);
+        }
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    uint32_t tenant_id = get_current_tenant_id();
+    /* 远程访问的MR按精确范围注册，视图rkey不能暴露覆盖范围内的其它内存 */
+    bool coalesce = g_intercept_state.config.enable_mr_coalesce &&
+                    !(access & MR_COALESCE_REMOTE_ACCESS);
+    
+    /* 合并注册：已有覆盖MR时直接返回视图，不占用新的MR条目 */
+    if (coalesce) {
+        struct ibv_mr *view = mr_coalesce_lookup(pd, addr, length, access);
+        if (view) {
+            update_tenant_resource_count(tenant_id, 6, 1); // 6=MR合并命中
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR coalesced: %p, length=%zu\n", view, length);
+            return view;
+        }
+    }
+    
+    /* 检查租户MR限制，内存配额在注册前原子预扣 */
+    if (!admit_tenant_mr(tenant_id, length)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR registration denied: tenant %u limit\n", tenant_id);
+        errno = EPERM;
+        return NULL;
+    }
+
+    if (!coalesce) {
+        struct ibv_mr *mr = reg_mr_unhooked(pd, addr, length, access);
+        return track_registered_mr(tenant_id, mr, length, false);
+    }
+    
+    size_t pinned_length = length;
+    struct ibv_mr *mr = mr_coalesce_register(pd, addr, length, access,
+                                             reg_mr_unhooked, real_ibv_dereg_mr, &pinned_length);
+    if (!mr) {
+        return track_registered_mr(tenant_id, NULL, length, true);
+    }
+    
+    /* 覆盖范围大于请求时补扣差额，超额则撤销 */
+    if (pinned_length > length && !charge_tenant_memory(tenant_id, (int64_t)(pinned_length - length))) {
+        mr_coalesce_release(mr, real_ibv_dereg_mr, NULL);
+        charge_tenant_memory(tenant_id, -(int64_t)length);
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR registration denied: tenant %u covering range %zu exceeds quota\n",
+                      tenant_id, pinned_length);
+        errno = EPERM;
+        return NULL;
+    }
+    
+    return track_registered_mr(tenant_id, mr, pinned_length, true);
+}
+
+/* 被拦截的ibv_dereg_mr函数 - 使用不同名称避免宏冲突 */
+int __real_ibv_dereg_mr_tenant(struct ibv_mr *mr) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_dereg_mr) {
+        if (real_ibv_dereg_mr) {
+            return real_ibv_dereg_mr(mr);
+        }
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* 租户内共享的MR：由共享登记表决定是否真正注销 */
+    int shared_result;
+    if (release_shared_mr(mr, &shared_result)) {
+        return shared_result;
+    }
+
+    /* 合并注册的视图：仅在覆盖MR真正注销时更新计数 */
+    if (mr_coalesce_is_view(mr)) {
+        size_t released_length = 0;
+        int result = mr_coalesce_release(mr, real_ibv_dereg_mr, &released_length);
+        
+        if (result == 0 && released_length > 0) {
+            untrack_released_mr(get_current_tenant_id(), released_length);
+        }
+        
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR view released: %p (parent released: %zu bytes)\n", 
+                      mr, released_length);
+        return result;
+    }
+    
+    /* 先摘除记账记录，防止注销后地址被新MR复用时误删 */
+    uint32_t tenant_id = 0;
+    size_t accounted_length = 0;
+    bool tracked = mr_account_remove(mr, &tenant_id, &accounted_length) == 0;
+    
+    int result = real_ibv_dereg_mr(mr);
+    
+    if (!tracked) {
+        // 拦截启用前注册的MR，未计入配额
+        return result;
+    }
+    
+    if (result != 0) {
+        int saved_errno = errno;
+        mr_account_add(mr, tenant_id, accounted_length);
+        errno = saved_errno;
+        return result;
+    }
+    
+    untrack_released_mr(tenant_id, accounted_length);
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR deregistered: %p, length=%zu\n", mr, accounted_length);
+    return result;
+}
+
+/* 被拦截的ibv_reg_mr_iova2函数
+ * libibverbs中的ibv_reg_mr、ibv_reg_mr_iova和__ibv_reg_mr都经PLT调用此入口；
+ * 本库内部的注册使用reg_mr_unhooked，不会在这里重复记账
+ */
+struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length, uint64_t iova,
+                                unsigned int access) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_reg_mr_iova2) {
+        if (real_ibv_reg_mr_iova2) {
+            return real_ibv_reg_mr_iova2(pd, addr, length, iova, access);
+        }
+        errno = ENOSYS;
+        return NULL;
+    }
+    
+    uint32_t tenant_id = get_current_tenant_id();
+    if (!admit_tenant_mr(tenant_id, length)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR (iova) registration denied: tenant %u limit\n", tenant_id);
+        errno = EPERM;
+        return NULL;
+    }
+    
+    struct ibv_mr *mr = real_ibv_reg_mr_iova2(pd, addr, length, iova, access);
+    return track_registered_mr(tenant_id, mr, length, false);
+}
+
+/* 被拦截的ibv_reg_dmabuf_mr函数 */
+struct ibv_mr *ibv_reg_dmabuf_mr(struct ibv_pd *pd, uint64_t offset, size_t length, uint64_t iova,
+                                 int fd, int access) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_reg_dmabuf_mr) {
+        if (real_ibv_reg_dmabuf_mr) {
+            return real_ibv_reg_dmabuf_mr(pd, offset, length, iova, fd, access);
+        }
+        errno = ENOSYS;
+        return NULL;
+    }
+    
+    uint32_t tenant_id = get_current_tenant_id();
+    if (!admit_tenant_mr(tenant_id, length)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] dmabuf MR registration denied: tenant %u limit\n", tenant_id);
+        errno = EPERM;
+        return NULL;
+    }
+    
+    struct ibv_mr *mr = real_ibv_reg_dmabuf_mr(pd, offset, length, iova, fd, access);
+    return track_registered_mr(tenant_id, mr, length, false);
+}
+
+/* 被拦截的ibv_rereg_mr函数：按新旧记账长度的差额补扣或归还 */
+int ibv_rereg_mr(struct ibv_mr *mr, int flags, struct ibv_pd *pd, void *addr, size_t length, int access) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_rereg_mr) {
+        if (real_ibv_rereg_mr) {
+            return real_ibv_rereg_mr(mr, flags, pd, addr, length, access);
+        }
+        errno = ENOSYS;
+        return IBV_REREG_MR_ERR_INPUT;
+    }
+    
+    /* 视图与其它视图共享父MR，不能单独改变范围 */
+    if (mr_coalesce_is_view(mr)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] rereg denied: %p is a coalesced MR view\n", mr);
+        errno = EINVAL;
+        return IBV_REREG_MR_ERR_INPUT;
+    }
+    
+    /* 共享MR由多个进程持有，登记表按注册时的长度归还配额，不能单独改变 */
+    if (is_shared_mr(mr)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] rereg denied: %p is a shared MR\n", mr);
+        errno = EINVAL;
+        return IBV_REREG_MR_ERR_INPUT;
+    }
+    
+    uint32_t tenant_id = 0;
+    size_t old_length = 0;
+    if (!(flags & IBV_REREG_MR_CHANGE_TRANSLATION) || mr_account_get(mr, &tenant_id, &old_length) != 0) {
+        return real_ibv_rereg_mr(mr, flags, pd, addr, length, access);
+    }
+    
+    int64_t delta = (int64_t)length - (int64_t)old_length;
+    if (delta > 0 && !charge_tenant_memory(tenant_id, delta)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] rereg denied: tenant %u cannot grow MR %p by %lld bytes\n",
+                      tenant_id, mr, (long long)delta);
+        errno = EPERM;
+        return IBV_REREG_MR_ERR_INPUT;
+    }
+    
+    int result = real_ibv_rereg_mr(mr, flags, pd, addr, length, access);
+    if (result != 0) {
+        /* 失败时MR保持原范围，撤销预扣 */
+        int saved_errno = errno;
+        if (delta > 0) {
+            charge_tenant_memory(tenant_id, -delta);
+        }
+        errno = saved_errno;
+        return result;
+    }
+    
+    if (delta < 0) {
+        charge_tenant_memory(tenant_id, delta);
+    }
+    mr_account_set_length(mr, length);
+    
+    pthread_mutex_lock(&g_intercept_state.resource_mutex);
+    if (delta >= 0 || g_intercept_state.memory_used >= (uint64_t)(-delta)) {
+        g_intercept_state.memory_used += delta;
+    }
+    pthread_mutex_unlock(&g_intercept_state.resource_mutex);
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] MR reregistered: %p, length %zu -> %zu\n", mr, old_length, length);
+    return result;
+}
+
+/* 异步注册：后台线程执行真实注册和记账（准入已在提交时完成） */
+static struct ibv_mr *async_reg_tracked(struct ibv_pd *pd, void *addr, size_t length, int access,
+                                        uint32_t tenant_id) {
+    struct ibv_mr *mr = reg_mr_unhooked(pd, addr, length, access);
+    return track_registered_mr(tenant_id, mr, length, false);
+}
+
+/* 拦截未启用时只做后台注册 */
+static struct ibv_mr *async_reg_passthrough(struct ibv_pd *pd, void *addr, size_t length, int access,
+                                            uint32_t tenant_id) {
+    (void)tenant_id;
+    return reg_mr_unhooked(pd, addr, length, access);
+}
+
+/* 异步MR注册入口：配额在提交时预扣，超额立即失败而不是在后台失败 */
+rdma_mr_async_t *rdma_intercept_reg_mr_async(struct ibv_pd *pd, void *addr, size_t length, int access) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_reg_mr) {
+        errno = ENOSYS;
+        return NULL;
+    }
+    
+    if (!rdma_intercept_is_enabled()) {
+        return mr_async_submit(pd, addr, length, access, 0, async_reg_passthrough);
+    }
+    
+    uint32_t tenant_id = get_current_tenant_id();
+    if (!admit_tenant_mr(tenant_id, length)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] async MR registration denied: tenant %u limit\n", tenant_id);
+        errno = EPERM;
+        return NULL;
+    }
+    
+    rdma_mr_async_t *handle = mr_async_submit(pd, addr, length, access, tenant_id, async_reg_tracked);
+    if (!handle) {
+        int saved_errno = errno;
+        charge_tenant_memory(tenant_id, -(int64_t)length);
+        errno = saved_errno;
+        return NULL;
+    }
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] async MR registration queued: %p, length=%zu\n", addr, length);
+    return handle;
+}
+
+/* ========== AH缓存 ==========
+ * UD应用通常为每个目的端调用ibv_create_ah，同一目的端会反复创建。启用后按(PD, ibv_ah_attr)
+ * 缓存AH并引用计数，重复创建只是一次哈希查找；ibv_destroy_ah只减少引用，引用归零的AH
+ * 进入LRU链表，闲置数超过RDMA_INTERCEPT_AH_CACHE_MAX或租户AH配额不足时淘汰最久未用的AH。
+ * 缓存关闭时创建的AH只按指针登记，同样计入租户AH数，销毁时归还。
+ */
+#define AH_CACHE_BUCKETS 1024
+
+typedef struct ah_cache_entry {
+    struct ibv_pd *pd;
+    struct ibv_ah_attr attr;
+    struct ibv_ah *ah;
+    uint32_t tenant_id;                    // 计入AH数的租户
+    uint32_t refcnt;
+    bool uncached;                         // 缓存关闭时创建，只在按指针哈希链中
+    struct ah_cache_entry *next_by_key;    // 按(PD, 属性)哈希链
+    struct ah_cache_entry *next_by_ah;     // 按AH指针哈希链
+    struct ah_cache_entry *lru_prev;       // 闲置LRU链表（头部最近释放）
+    struct ah_cache_entry *lru_next;
+} ah_cache_entry_t;
+
+static ah_cache_entry_t *ah_by_key[AH_CACHE_BUCKETS];
+static ah_cache_entry_t *ah_by_ptr[AH_CACHE_BUCKETS];
+static ah_cache_entry_t *ah_lru_head = NULL;
+static ah_cache_entry_t *ah_lru_tail = NULL;
+static uint32_t ah_idle_count = 0;
+static pthread_mutex_t ah_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 逐字段比较，避免结构体填充字节影响匹配 */
+static bool ah_attr_equal(const struct ibv_ah_attr *a, const struct ibv_ah_attr *b) {
+    if (a->dlid != b->dlid || a->sl != b->sl || a->src_path_bits != b->src_path_bits ||
+        a->static_rate != b->static_rate || a->is_global != b->is_global || a->port_num != b->port_num) {
+        return false;
+    }
+    if (!a->is_global) {
+        return true;
+    }
+    return memcmp(a->grh.dgid.raw, b->grh.dgid.raw, sizeof(a->grh.dgid.raw)) == 0 &&
+           a->grh.flow_label == b->grh.flow_label &&
+           a->grh.sgid_index == b->grh.sgid_index &&
+           a->grh.hop_limit == b->grh.hop_limit &&
+           a->grh.traffic_class == b->grh.traffic_class;
+}
+
+static uint32_t ah_key_hash(struct ibv_pd *pd, const struct ibv_ah_attr *attr) {
+    uint64_t h = 14695981039346656037ULL;   // FNV-1a
+#define AH_HASH_MIX(v) do { h ^= (uint64_t)(v); h *= 1099511628211ULL; } while (0)
+    AH_HASH_MIX((uintptr_t)pd);
+    AH_HASH_MIX(attr->dlid);
+    AH_HASH_MIX(attr->sl);
+    AH_HASH_MIX(attr->port_num);
+    AH_HASH_MIX(attr->is_global);
+    if (attr->is_global) {
+        for (size_t i = 0; i < sizeof(attr->grh.dgid.raw); i++) {
+            AH_HASH_MIX(attr->grh.dgid.raw[i]);
+        }
+        AH_HASH_MIX(attr->grh.sgid_index);
+        AH_HASH_MIX(attr->grh.flow_label);
+    }
+#undef AH_HASH_MIX
+    return (uint32_t)(h % AH_CACHE_BUCKETS);
+}
+
+static uint32_t ah_ptr_hash(struct ibv_ah *ah) {
+    return (uint32_t)((((uintptr_t)ah) >> 4) * 2654435761U) % AH_CACHE_BUCKETS;
+}
+
+static void ah_lru_unlink_locked(ah_cache_entry_t *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else ah_lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else ah_lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+    ah_idle_count--;
+}
+
+static void ah_lru_push_locked(ah_cache_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = ah_lru_head;
+    if (ah_lru_head) ah_lru_head->lru_prev = e;
+    else ah_lru_tail = e;
+    ah_lru_head = e;
+    ah_idle_count++;
+}
+
+/* 从两个哈希表中摘除表项（调用方持锁） */
+static void ah_unhash_locked(ah_cache_entry_t *e) {
+    for (ah_cache_entry_t **pp = &ah_by_key[ah_key_hash(e->pd, &e->attr)]; *pp; pp = &(*pp)->next_by_key) {
+        if (*pp == e) {
+            *pp = e->next_by_key;
+            break;
+        }
+    }
+    for (ah_cache_entry_t **pp = &ah_by_ptr[ah_ptr_hash(e->ah)]; *pp; pp = &(*pp)->next_by_ah) {
+        if (*pp == e) {
+            *pp = e->next_by_ah;
+            break;
+        }
+    }
+}
+
+/* 真正销毁闲置AH并归还租户计数 */
+static void ah_cache_destroy_entry(ah_cache_entry_t *e) {
+    if (real_ibv_destroy_ah(e->ah) == 0) {
+        charge_tenant_ah(e->tenant_id, -1);
+    } else {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Failed to destroy cached AH %p\n", e->ah);
+    }
+    free(e);
+}
+
+/* 摘除最久未用的闲置AH，没有闲置AH时返回NULL */
+static ah_cache_entry_t *ah_cache_evict_oldest(void) {
+    pthread_mutex_lock(&ah_cache_mutex);
+    ah_cache_entry_t *e = ah_lru_tail;
+    if (e) {
+        ah_lru_unlink_locked(e);
+        ah_unhash_locked(e);
+    }
+    pthread_mutex_unlock(&ah_cache_mutex);
+    return e;
+}
+
+/* 销毁指定PD（pd非空）或上下文下的全部闲置AH，PD释放前调用 */
+static void ah_cache_flush(struct ibv_pd *pd, struct ibv_context *context) {
+    if (ah_idle_count == 0) {
+        return;
+    }
+    
+    ah_cache_entry_t *victims = NULL;
+    pthread_mutex_lock(&ah_cache_mutex);
+    for (ah_cache_entry_t *e = ah_lru_head; e; ) {
+        ah_cache_entry_t *next = e->lru_next;
+        if ((pd && e->pd == pd) || (context && e->pd->context == context)) {
+            ah_lru_unlink_locked(e);
+            ah_unhash_locked(e);
+            e->lru_next = victims;
+            victims = e;
+        }
+        e = next;
+    }
+    pthread_mutex_unlock(&ah_cache_mutex);
+    
+    while (victims) {
+        ah_cache_entry_t *e = victims;
+        victims = e->lru_next;
+        ah_cache_destroy_entry(e);
+    }
+}
+
+/* 预扣一个租户AH配额，不足时先淘汰闲置AH，仍不足则拒绝；创建失败时调用方归还 */
+static bool ah_admit(uint32_t tenant_id) {
+    while (!charge_tenant_ah(tenant_id, 1)) {
+        ah_cache_entry_t *victim = ah_cache_evict_oldest();
+        if (!victim) {
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] AH creation denied: tenant %u limit\n", tenant_id);
+            return false;
+        }
+        ah_cache_destroy_entry(victim);
+    }
+    return true;
+}
+
+/* 缓存关闭时的创建：不复用，但同样受租户AH配额限制并登记以便销毁时归还 */
+static struct ibv_ah *ah_create_uncached(struct ibv_pd *pd, struct ibv_ah_attr *attr, uint32_t tenant_id) {
+    if (!ah_admit(tenant_id)) {
+        errno = EPERM;
+        return NULL;
+    }
+    
+    ah_cache_entry_t *e = calloc(1, sizeof(*e));
+    if (!e) {
+        charge_tenant_ah(tenant_id, -1);
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    struct ibv_ah *ah = real_ibv_create_ah(pd, attr);
+    if (!ah) {
+        int saved_errno = errno;
+        charge_tenant_ah(tenant_id, -1);
+        free(e);
+        errno = saved_errno;
+        return NULL;
+    }
+    
+    e->pd = pd;
+    e->ah = ah;
+    e->tenant_id = tenant_id;
+    e->uncached = true;
+    
+    pthread_mutex_lock(&ah_cache_mutex);
+    uint32_t pb = ah_ptr_hash(ah);
+    e->next_by_ah = ah_by_ptr[pb];
+    ah_by_ptr[pb] = e;
+    pthread_mutex_unlock(&ah_cache_mutex);
+    return ah;
+}
+
+/* 被拦截的ibv_create_ah函数 */
+struct ibv_ah *ibv_create_ah(struct ibv_pd *pd, struct ibv_ah_attr *attr) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_create_ah) {
+        errno = ENOSYS;
+        return NULL;
+    }
+    
+    if (!rdma_intercept_is_enabled() || !pd || !attr) {
+        return real_ibv_create_ah(pd, attr);
+    }
+    
+    uint32_t tenant_id = get_current_tenant_id();
+    if (!g_intercept_state.config.enable_ah_cache) {
+        return ah_create_uncached(pd, attr, tenant_id);
+    }
+    
+    uint32_t bucket = ah_key_hash(pd, attr);
+    
+    /* 命中缓存：增加引用 */
+    pthread_mutex_lock(&ah_cache_mutex);
+    for (ah_cache_entry_t *e = ah_by_key[bucket]; e; e = e->next_by_key) {
+        if (e->pd == pd && ah_attr_equal(&e->attr, attr)) {
+            if (e->refcnt++ == 0) {
+                ah_lru_unlink_locked(e);
+            }
+            struct ibv_ah *ah = e->ah;
+            pthread_mutex_unlock(&ah_cache_mutex);
+            update_tenant_resource_count(tenant_id, 12, 1); // 12=AH缓存命中
+            return ah;
+        }
+    }
+    pthread_mutex_unlock(&ah_cache_mutex);
+    
+    /* 配额不足时先淘汰闲置AH */
+    if (!ah_admit(tenant_id)) {
+        errno = EPERM;
+        return NULL;
+    }
+    
+    ah_cache_entry_t *e = calloc(1, sizeof(*e));
+    if (!e) {
+        charge_tenant_ah(tenant_id, -1);
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    struct ibv_ah *ah = real_ibv_create_ah(pd, attr);
+    if (!ah) {
+        int saved_errno = errno;
+        charge_tenant_ah(tenant_id, -1);
+        free(e);
+        errno = saved_errno;
+        return NULL;
+    }
+    
+    e->pd = pd;
+    e->attr = *attr;
+    e->ah = ah;
+    e->tenant_id = tenant_id;
+    e->refcnt = 1;
+    
+    pthread_mutex_lock(&ah_cache_mutex);
+    /* 并发创建了相同的AH时保留先插入的 */
+    for (ah_cache_entry_t *c = ah_by_key[bucket]; c; c = c->next_by_key) {
+        if (c->pd == pd && ah_attr_equal(&c->attr, attr)) {
+            if (c->refcnt++ == 0) {
+                ah_lru_unlink_locked(c);
+            }
+            struct ibv_ah *existing = c->ah;
+            pthread_mutex_unlock(&ah_cache_mutex);
+            e->refcnt = 0;
+            ah_cache_destroy_entry(e);
+            return existing;
+        }
+    }
+    e->next_by_key = ah_by_key[bucket];
+    ah_by_key[bucket] = e;
+    uint32_t pb = ah_ptr_hash(ah);
+    e->next_by_ah = ah_by_ptr[pb];
+    ah_by_ptr[pb] = e;
+    pthread_mutex_unlock(&ah_cache_mutex);
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] AH created and cached: %p\n", ah);
+    return ah;
+}
+
+/* 被拦截的ibv_destroy_ah函数 */
+int ibv_destroy_ah(struct ibv_ah *ah) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_destroy_ah) {
+        errno = ENOSYS;
+        return -1;
+    }
+    
+    ah_cache_entry_t *evict = NULL;
+    ah_cache_entry_t *uncached = NULL;
+    bool cached = false;
+    
+    pthread_mutex_lock(&ah_cache_mutex);
+    for (ah_cache_entry_t **pp = &ah_by_ptr[ah_ptr_hash(ah)]; *pp; pp = &(*pp)->next_by_ah) {
+        ah_cache_entry_t *e = *pp;
+        if (e->ah == ah && e->uncached) {
+            *pp = e->next_by_ah;
+            uncached = e;
+            break;
+        }
+        if (e->ah == ah) {
+            cached = true;
+            if (e->refcnt > 0 && --e->refcnt == 0) {
+                ah_lru_push_locked(e);
+                if (ah_idle_count > g_intercept_state.config.ah_cache_max) {
+                    evict = ah_lru_tail;
+                    ah_lru_unlink_locked(evict);
+                    ah_unhash_locked(evict);
+                }
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ah_cache_mutex);
+    
+    if (evict) {
+        ah_cache_destroy_entry(evict);
+    }
+    
+    /* 缓存关闭时创建的AH直接销毁并归还计数，失败时恢复登记 */
+    if (uncached) {
+        int result = real_ibv_destroy_ah(ah);
+        if (result == 0) {
+            charge_tenant_ah(uncached->tenant_id, -1);
+            free(uncached);
+        } else {
+            int saved_errno = errno;
+            pthread_mutex_lock(&ah_cache_mutex);
+            uint32_t pb = ah_ptr_hash(ah);
+            uncached->next_by_ah = ah_by_ptr[pb];
+            ah_by_ptr[pb] = uncached;
+            pthread_mutex_unlock(&ah_cache_mutex);
+            errno = saved_errno;
+        }
+        return result;
+    }
+    
+    /* 拦截启用前创建的AH直接销毁 */
+    return cached ? 0 : real_ibv_destroy_ah(ah);
+}
+
+/* ========== CQ/PD池 ==========
+ * 启用后ibv_destroy_cq/ibv_dealloc_pd不真正释放对象，而是按上下文暂存，后续创建直接复用。
+ * CQ在入池前排空，容量向上取整到2的幂（不超过租户CQ容量预算）作为档位，按(上下文, 档位, 完成通道, 中断向量)匹配；
+ * PD只按上下文匹配。闲置对象不计入cq_count/pd_count，单独记在cq_pooled/pd_pooled，
+ * 闲置超过RDMA_INTERCEPT_CQ_PD_POOL_TTL秒后真正释放。超时检查是惰性的：只在应用创建或
+ * 销毁CQ/PD时进行，应用不再调用这些接口时闲置对象保留到关闭设备或进程退出。
+ * 应用销毁完成通道前先释放挂在该通道上的闲置CQ。
+ */
+#define RES_POOL_LIVE_BUCKETS 256
+#define CQ_POOL_MIN_CQE 16
+#define RES_POOL_CQ 0
+#define RES_POOL_PD 1
+
+typedef struct res_pool_entry {
+    void *obj;                        // struct ibv_cq * 或 struct ibv_pd *
+    int kind;                         // RES_POOL_CQ / RES_POOL_PD
+    struct ibv_context *context;
+    int cqe_class;                    // CQ容量档位
+    struct ibv_comp_channel *channel;
+    int comp_vector;
+    time_t idle_since;                // 入池时间
+    struct res_pool_entry *next;
+} res_pool_entry_t;
+
+static res_pool_entry_t *res_live[RES_POOL_LIVE_BUCKETS];  // 经池路径创建的活跃CQ/PD
+static res_pool_entry_t *res_pool_head[2] = {NULL, NULL};  // 闲置CQ/PD（头部最近入池）
+static uint32_t res_pool_count[2] = {0, 0};
+static time_t res_pool_last_sweep = 0;
+static pthread_mutex_t res_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t res_live_hash(void *obj) {
+    return (uint32_t)((((uintptr_t)obj) >> 4) * 2654435761U) % RES_POOL_LIVE_BUCKETS;
+}
+
+/* 容量档位：向上取整到2的幂，但不超过租户的CQ容量预算（cqe已在预算内） */
+static int cq_size_class(int cqe, uint32_t max_cqe) {
+    int cls = CQ_POOL_MIN_CQE;
+    while (cls < cqe && cls < (1 << 30)) {
+        cls <<= 1;
+    }
+    if (max_cqe > 0 && (uint32_t)cls > max_cqe) {
+        cls = (int)max_cqe;
+    }
+    return cls;
+}
+
+static void res_live_insert(res_pool_entry_t *e) {
+    uint32_t b = res_live_hash(e->obj);
+    pthread_mutex_lock(&res_pool_mutex);
+    e->next = res_live[b];
+    res_live[b] = e;
+    pthread_mutex_unlock(&res_pool_mutex);
+}
+
+static res_pool_entry_t *res_live_remove(void *obj) {
+    res_pool_entry_t *e = NULL;
+    pthread_mutex_lock(&res_pool_mutex);
+    for (res_pool_entry_t **pp = &res_live[res_live_hash(obj)]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->obj == obj) {
+            e = *pp;
+            *pp = e->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&res_pool_mutex);
+    return e;
+}
+
+static res_pool_entry_t *res_pool_take(int kind, struct ibv_context *context, int cqe_class,
+                                       struct ibv_comp_channel *channel, int comp_vector) {
+    res_pool_entry_t *e = NULL;
+    pthread_mutex_lock(&res_pool_mutex);
+    for (res_pool_entry_t **pp = &res_pool_head[kind]; *pp; pp = &(*pp)->next) {
+        res_pool_entry_t *c = *pp;
+        if (c->context == context &&
+            (kind == RES_POOL_PD ||
+             (c->cqe_class == cqe_class && c->channel == channel && c->comp_vector == comp_vector))) {
+            e = c;
+            *pp = c->next;
+            res_pool_count[kind]--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&res_pool_mutex);
+    return e;
+}
+
+static bool res_pool_park(res_pool_entry_t *e) {
+    bool parked = false;
+    pthread_mutex_lock(&res_pool_mutex);
+    if (res_pool_count[e->kind] < g_intercept_state.config.cq_pd_pool_max) {
+        e->idle_since = time(NULL);
+        e->next = res_pool_head[e->kind];
+        res_pool_head[e->kind] = e;
+        res_pool_count[e->kind]++;
+        parked = true;
+    }
+    pthread_mutex_unlock(&res_pool_mutex);
+    return parked;
+}
+
+/* 排空CQ中残留的完成，避免复用者收到上一个使用者的完成 */
+static bool cq_drain(struct ibv_cq *cq) {
+    struct ibv_wc wc[16];
+    int n;
+    while ((n = ibv_poll_cq(cq, 16, wc)) > 0) {
+    }
+    return n == 0;
+}
+
+/* 真正释放闲置的CQ/PD */
+static void destroy_pooled_res(res_pool_entry_t *e) {
+    int result;
+    if (e->kind == RES_POOL_CQ) {
+        result = real_ibv_destroy_cq((struct ibv_cq *)e->obj);
+        if (result == 0) {
+            queue_mem_release(e->obj);
+        }
+        update_tenant_resource_count(get_current_tenant_id(), 9, -1); // 9=池中CQ
+    } else {
+        result = real_ibv_dealloc_pd((struct ibv_pd *)e->obj);
+        update_tenant_resource_count(get_current_tenant_id(), 10, -1); // 10=池中PD
+    }
+    if (result != 0) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Failed to release pooled %s %p: %s\n",
+                      e->kind == RES_POOL_CQ ? "CQ" : "PD", e->obj, strerror(result > 0 ? result : errno));
+    }
+    free(e);
+}
+
+/*
+ * 从池中摘除满足条件的闲置对象：context非空时摘除该上下文的全部对象，
+ * channel非空时摘除挂在该完成通道上的CQ，否则摘除超时对象
+ */
+static res_pool_entry_t *res_pool_collect_locked(int kind, struct ibv_context *context,
+                                                 struct ibv_comp_channel *channel, time_t now) {
+    res_pool_entry_t *victims = NULL;
+    for (res_pool_entry_t **pp = &res_pool_head[kind]; *pp; ) {
+        res_pool_entry_t *e = *pp;
+        bool expired = context ? (e->context == context)
+                     : channel ? (e->channel == channel)
+                               : (now - e->idle_since >= (time_t)g_intercept_state.config.cq_pd_pool_ttl_sec);
+        if (expired) {
+            *pp = e->next;
+            res_pool_count[kind]--;
+            e->next = victims;
+            victims = e;
+        } else {
+            pp = &e->next;
+        }
+    }
+    return victims;
+}
+
+/* 释放超时（context和channel均为NULL）、属于指定上下文或完成通道的闲置CQ/PD。PD在CQ之后释放 */
+static void res_pool_release(struct ibv_context *context, struct ibv_comp_channel *channel) {
+    if (res_pool_count[RES_POOL_CQ] == 0 && res_pool_count[RES_POOL_PD] == 0) {
+        return;
+    }
+    
+    bool sweep = !context && !channel;
+    time_t now = time(NULL);
+    res_pool_entry_t *victims[2] = {NULL, NULL};
+    pthread_mutex_lock(&res_pool_mutex);
+    if (sweep && now == res_pool_last_sweep) {
+        pthread_mutex_unlock(&res_pool_mutex);
+        return;
+    }
+    if (sweep) {
+        res_pool_last_sweep = now;
+    }
+    victims[RES_POOL_CQ] = res_pool_collect_locked(RES_POOL_CQ, context, channel, now);
+    if (!channel) {
+        victims[RES_POOL_PD] = res_pool_collect_locked(RES_POOL_PD, context, NULL, now);
+    }
+    pthread_mutex_unlock(&res_pool_mutex);
+    
+    for (int kind = RES_POOL_CQ; kind <= RES_POOL_PD; kind++) {
+        while (victims[kind]) {
+            res_pool_entry_t *e = victims[kind];
+            victims[kind] = e->next;
+            destroy_pooled_res(e);
+        }
+    }
+}
+
+/* 释放超时或属于指定上下文的闲置CQ/PD */
+static void res_pool_flush(struct ibv_context *context) {
+    res_pool_release(context, NULL);
+}
+
+/* 被拦截的ibv_create_cq函数 */
+struct ibv_cq *ibv_create_cq(struct ibv_context *context, int cqe, void *cq_context,
+                            struct ibv_comp_channel *channel, int comp_vector) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!rdma_intercept_is_enabled() || !real_ibv_create_cq) {
+        if (real_ibv_create_cq) {
+            return real_ibv_create_cq(context, cqe, cq_context, channel, comp_vector);
+        }
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    uint32_t tenant_id = get_current_tenant_id();
+    res_pool_entry_t *entry = NULL;
+    struct ibv_cq *cq = NULL;
+    uint64_t qmem = 0;
+    uint32_t max_cqe = 0;
+    
+    /* 按租户容量预算检查或收缩CQ容量，实际容量由cq->cqe返回 */
+    if (!apply_tenant_cq_caps(tenant_id, &cqe, &max_cqe)) {
+        errno = EPERM;
+        return NULL;
+    }
+    
+    if (g_intercept_state.config.enable_cq_pd_pool && cqe > 0) {
+        res_pool_flush(NULL);
+        
+        int cls = cq_size_class(cqe, max_cqe);
+        entry = res_pool_take(RES_POOL_CQ, context, cls, channel, comp_vector);
+        if (entry) {
+            cq = (struct ibv_cq *)entry->obj;
+            cq->cq_context = cq_context;
+            res_live_insert(entry);
+            update_tenant_resource_count(tenant_id, 9, -1); // 9=池中CQ
+            update_tenant_resource_count(tenant_id, 3, 1);  // 3=CQ
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] CQ reused from pool: %p\n", cq);
+            return cq;
+        }
+        
+        /* 按档位创建，超出设备上限或队列内存配额时退回原始容量（不入池） */
+        qmem = tenant_id ? queue_mem_estimate_cq(cls) : 0;
+        if (queue_mem_admit(tenant_id, qmem)) {
+            cq = real_ibv_create_cq(context, cls, cq_context, channel, comp_vector);
+            if (cq) {
+                entry = calloc(1, sizeof(*entry));
+                if (entry) {
+                    entry->obj = cq;
+                    entry->kind = RES_POOL_CQ;
+                    entry->context = context;
+                    entry->cqe_class = cls;
+                    entry->channel = channel;
+                    entry->comp_vector = comp_vector;
+                    res_live_insert(entry);
+                }
+            } else {
+                queue_mem_cancel(tenant_id, qmem);
+            }
+        }
+    }
+    
+    if (!cq) {
+        qmem = tenant_id ? queue_mem_estimate_cq(cqe) : 0;
+        if (!queue_mem_admit(tenant_id, qmem)) {
+            errno = EPERM;
+            return NULL;
+        }
+        cq = real_ibv_create_cq(context, cqe, cq_context, channel, comp_vector);
+        if (!cq) {
+            queue_mem_cancel(tenant_id, qmem);
+        }
+    }
+    
+    if (cq) {
+        queue_mem_track(tenant_id, cq, qmem);
         /* 更新租户资源 */
-        update_tenant_resource_count(get_current_tenant_id(), 3, 1); // 3=CQ
+        update_tenant_resource_count(tenant_id, 3, 1); // 3=CQ
         DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] CQ created: %p\n", cq);
     }
 
@@ -529,9 +3518,27 @@ int ibv_destroy_cq(struct ibv_cq *cq) {
         return -1;
     }
 
+    /* 池中闲置QP仍引用该CQ，需先销毁 */
+    qp_pool_flush(NULL, NULL, cq, NULL);
+
+    /* 启用CQ池时排空后暂存（容量被缩小到档位以下的CQ不入池） */
+    res_pool_entry_t *e = g_intercept_state.config.enable_cq_pd_pool ? res_live_remove(cq) : NULL;
+    if (e) {
+        if (cq->cqe >= e->cqe_class && cq_drain(cq) && res_pool_park(e)) {
+            uint32_t tenant_id = get_current_tenant_id();
+            update_tenant_resource_count(tenant_id, 3, -1); // 3=CQ
+            update_tenant_resource_count(tenant_id, 9, 1);  // 9=池中CQ
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] CQ parked in pool: %p\n", cq);
+            res_pool_flush(NULL);
+            return 0;
+        }
+        free(e);
+    }
+
     int result = real_ibv_destroy_cq(cq);
     
     if (result == 0) {
+        queue_mem_release(cq);
         /* 更新租户资源 */
         update_tenant_resource_count(get_current_tenant_id(), 3, -1); // 3=CQ
         DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] CQ destroyed: %p\n", cq);
@@ -540,6 +3547,34 @@ int ibv_destroy_cq(struct ibv_cq *cq) {
     return result;
 }
 
+/* 被拦截的ibv_destroy_comp_channel函数：池中闲置CQ仍引用该通道，需先释放 */
+int ibv_destroy_comp_channel(struct ibv_comp_channel *channel) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_destroy_comp_channel) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (channel) {
+        res_pool_release(NULL, channel);
+    }
+    return real_ibv_destroy_comp_channel(channel);
+}
+
+/* 被拦截的ibv_destroy_srq函数：池中闲置QP仍挂在应用的SRQ上，需先销毁 */
+int ibv_destroy_srq(struct ibv_srq *srq) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_destroy_srq) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (rdma_intercept_is_enabled()) {
+        qp_pool_flush(NULL, NULL, NULL, srq);
+    }
+    return real_ibv_destroy_srq(srq);
+}
+
 /* 被拦截的ibv_alloc_pd函数 */
 struct ibv_pd *ibv_alloc_pd(struct ibv_context *context) {
     pthread_once(&hooks_init_once, init_function_pointers);
@@ -552,11 +3587,36 @@ struct ibv_pd *ibv_alloc_pd(struct ibv_context *context) {
         return NULL;
     }
 
+    uint32_t tenant_id = get_current_tenant_id();
+    
+    if (g_intercept_state.config.enable_cq_pd_pool) {
+        res_pool_flush(NULL);
+        
+        res_pool_entry_t *e = res_pool_take(RES_POOL_PD, context, 0, NULL, 0);
+        if (e) {
+            res_live_insert(e);
+            update_tenant_resource_count(tenant_id, 10, -1); // 10=池中PD
+            update_tenant_resource_count(tenant_id, 4, 1);   // 4=PD
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] PD reused from pool: %p\n", e->obj);
+            return (struct ibv_pd *)e->obj;
+        }
+    }
+
     struct ibv_pd *pd = real_ibv_alloc_pd(context);
     
+    if (pd && g_intercept_state.config.enable_cq_pd_pool) {
+        res_pool_entry_t *e = calloc(1, sizeof(*e));
+        if (e) {
+            e->obj = pd;
+            e->kind = RES_POOL_PD;
+            e->context = context;
+            res_live_insert(e);
+        }
+    }
+    
     if (pd) {
         /* 更新租户资源 */
-        update_tenant_resource_count(get_current_tenant_id(), 4, 1); // 4=PD
+        update_tenant_resource_count(tenant_id, 4, 1); // 4=PD
         DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] PD allocated: %p\n", pd);
     }
 
@@ -575,6 +3635,23 @@ int ibv_dealloc_pd(struct ibv_pd *pd) {
         return -1;
     }
 
+    qp_pool_flush(NULL, pd, NULL, NULL);
+    ah_cache_flush(pd, NULL);
+
+    /* 启用PD池时暂存 */
+    res_pool_entry_t *e = g_intercept_state.config.enable_cq_pd_pool ? res_live_remove(pd) : NULL;
+    if (e) {
+        if (res_pool_park(e)) {
+            uint32_t tenant_id = get_current_tenant_id();
+            update_tenant_resource_count(tenant_id, 4, -1); // 4=PD
+            update_tenant_resource_count(tenant_id, 10, 1); // 10=池中PD
+            DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] PD parked in pool: %p\n", pd);
+            res_pool_flush(NULL);
+            return 0;
+        }
+        free(e);
+    }
+
     int result = real_ibv_dealloc_pd(pd);
     
     if (result == 0) {
@@ -586,6 +3663,325 @@ int ibv_dealloc_pd(struct ibv_pd *pd) {
     return result;
 }
 
+/* ========== 设备内存（DM）配额 ==========
+ * ibv_alloc_dm/ibv_free_dm/ibv_reg_dm_mr是verbs.h中的内联函数，经由
+ * verbs_context操作表分发，无法通过LD_PRELOAD符号拦截。
+ * 因此在打开设备时替换该上下文操作表中的函数指针。
+ */
+#define MAX_HOOKED_CONTEXTS 64
+
+typedef struct {
+    struct ibv_context *context;
+    alloc_dm_op_fn alloc_dm;
+    free_dm_op_fn free_dm;
+    reg_dm_mr_op_fn reg_dm_mr;
+    post_recv_op_fn post_recv;
+    post_send_op_fn post_send;
+    poll_cq_op_fn poll_cq;
+} context_ops_t;
+
+/* DM分配记录（释放时按分配长度归还配额） */
+typedef struct dm_record {
+    struct ibv_dm *dm;
+    uint64_t length;
+    uint32_t tenant_id;
+    struct dm_record *next;
+} dm_record_t;
+
+static context_ops_t hooked_contexts[MAX_HOOKED_CONTEXTS];
+static dm_record_t *dm_records = NULL;
+static pthread_mutex_t context_ops_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 查找上下文的原始操作 */
+static bool lookup_context_ops(struct ibv_context *context, context_ops_t *ops) {
+    bool found = false;
+    pthread_mutex_lock(&context_ops_mutex);
+    for (int i = 0; i < MAX_HOOKED_CONTEXTS; i++) {
+        if (hooked_contexts[i].context == context) {
+            *ops = hooked_contexts[i];
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&context_ops_mutex);
+    return found;
+}
+
+static struct ibv_dm *hook_alloc_dm(struct ibv_context *context, struct ibv_alloc_dm_attr *attr) {
+    context_ops_t ops;
+    if (!lookup_context_ops(context, &ops) || !ops.alloc_dm) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+    
+    uint32_t tenant_id = tenant_initialized ? get_current_tenant_id() : 0;
+    uint64_t length = attr ? attr->length : 0;
+    
+    /* 先记账后分配，保证并发分配不会超出配额 */
+    if (tenant_id != 0 && tenant_charge_resource(tenant_id, 5, (int64_t)length) != 0) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DM allocation denied: tenant %u limit (%llu bytes)\n",
+                      tenant_id, (unsigned long long)length);
+        errno = EPERM;
+        return NULL;
+    }
+    
+    struct ibv_dm *dm = ops.alloc_dm(context, attr);
+    if (!dm) {
+        int saved_errno = errno;
+        if (tenant_id != 0) {
+            tenant_charge_resource(tenant_id, 5, -(int64_t)length);
+        }
+        errno = saved_errno;
+        return NULL;
+    }
+    
+    dm_record_t *rec = malloc(sizeof(*rec));
+    if (rec) {
+        rec->dm = dm;
+        rec->length = length;
+        rec->tenant_id = tenant_id;
+        pthread_mutex_lock(&context_ops_mutex);
+        rec->next = dm_records;
+        dm_records = rec;
+        pthread_mutex_unlock(&context_ops_mutex);
+    }
+    
+    update_tenant_resource_count(tenant_id, 5, 1); // 5=DM
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DM allocated: %p, length=%llu\n",
+                  dm, (unsigned long long)length);
+    return dm;
+}
+
+static int hook_free_dm(struct ibv_dm *dm) {
+    context_ops_t ops;
+    if (!dm || !lookup_context_ops(dm->context, &ops) || !ops.free_dm) {
+        errno = EOPNOTSUPP;
+        return EOPNOTSUPP;
+    }
+    
+    int result = ops.free_dm(dm);
+    if (result != 0) {
+        return result;
+    }
+    
+    /* 按分配时记录的长度和租户归还配额 */
+    dm_record_t *rec = NULL;
+    pthread_mutex_lock(&context_ops_mutex);
+    for (dm_record_t **pp = &dm_records; *pp; pp = &(*pp)->next) {
+        if ((*pp)->dm == dm) {
+            rec = *pp;
+            *pp = rec->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&context_ops_mutex);
+    
+    if (rec) {
+        if (rec->tenant_id != 0) {
+            tenant_charge_resource(rec->tenant_id, 5, -(int64_t)rec->length);
+            update_tenant_resource_count(rec->tenant_id, 5, -1); // 5=DM
+        }
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DM freed: %p, length=%llu\n",
+                      dm, (unsigned long long)rec->length);
+        free(rec);
+    }
+    
+    return 0;
+}
+
+static struct ibv_mr *hook_reg_dm_mr(struct ibv_pd *pd, struct ibv_dm *dm, uint64_t dm_offset,
+                                     size_t length, unsigned int access) {
+    context_ops_t ops;
+    if (!lookup_context_ops(pd->context, &ops) || !ops.reg_dm_mr) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+    
+    /* DM上的MR占用MR条目，但不占用主机内存 */
+    uint32_t tenant_id = get_current_tenant_id();
+    if (!check_tenant_mr_limit_inline(tenant_id, 0)) {
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] DM MR registration denied: tenant %u limit\n", tenant_id);
+        errno = EPERM;
+        return NULL;
+    }
+    
+    /* 记账长度为0：注销时只归还MR条目 */
+    struct ibv_mr *mr = ops.reg_dm_mr(pd, dm, dm_offset, length, access);
+    return track_registered_mr(tenant_id, mr, 0, false);
+}
+
+/* ibv_post_recv/ibv_post_send/ibv_poll_cq同样是内联函数：被替换到共享SRQ的QP改为投递到SRQ，
+ * 虚拟UD QP改为带标签投递到真实QP。
+ * 热路径上不加锁查找原始操作，槽位在替换操作表之前已写好。
+ */
+static const context_ops_t *find_context_ops_unlocked(struct ibv_context *context) {
+    for (int i = 0; i < MAX_HOOKED_CONTEXTS; i++) {
+        if (hooked_contexts[i].context == context) {
+            return &hooked_contexts[i];
+        }
+    }
+    return NULL;
+}
+
+static int hook_post_recv(struct ibv_qp *qp, struct ibv_recv_wr *wr, struct ibv_recv_wr **bad_wr) {
+    const context_ops_t *ops = find_context_ops_unlocked(qp->context);
+    if (!ops || !ops->post_recv) {
+        *bad_wr = wr;
+        return EOPNOTSUPP;
+    }
+    
+    ud_vqp_t *v = ud_mux_lookup(qp);
+    if (v) {
+        return ud_mux_post_recv(v, wr, bad_wr, ops->post_recv);
+    }
+    
+    struct ibv_srq *srq = srq_sub_lookup(qp);
+    if (srq) {
+        return ibv_post_srq_recv(srq, wr, bad_wr);
+    }
+    
+    if (g_intercept_state.config.enable_qp_working_set) {
+        qp_ws_touch(qp);
+    }
+    return ops->post_recv(qp, wr, bad_wr);
+}
+
+static int hook_post_send(struct ibv_qp *qp, struct ibv_send_wr *wr, struct ibv_send_wr **bad_wr) {
+    const context_ops_t *ops = find_context_ops_unlocked(qp->context);
+    if (!ops || !ops->post_send) {
+        *bad_wr = wr;
+        return EOPNOTSUPP;
+    }
+    
+    ud_vqp_t *v = ud_mux_lookup(qp);
+    if (v) {
+        return ud_mux_post_send(v, wr, bad_wr, ops->post_send);
+    }
+    
+    if (g_intercept_state.config.enable_qp_working_set) {
+        qp_ws_touch(qp);
+    }
+    return ops->post_send(qp, wr, bad_wr);
+}
+
+static int hook_poll_cq(struct ibv_cq *cq, int num_entries, struct ibv_wc *wc) {
+    const context_ops_t *ops = find_context_ops_unlocked(cq->context);
+    if (!ops || !ops->poll_cq) {
+        return -1;
+    }
+    
+    int n = ops->poll_cq(cq, num_entries, wc);
+    return ud_mux_demux_completions(wc, n);
+}
+
+/* 替换上下文操作表中的DM操作（重复调用无副作用） */
+static void install_context_hooks(struct ibv_context *context) {
+    struct verbs_context *vctx = verbs_get_ctx(context);
+    if (!vctx) {
+        return;
+    }
+    
+    pthread_mutex_lock(&context_ops_mutex);
+    
+    int slot = -1;
+    for (int i = 0; i < MAX_HOOKED_CONTEXTS; i++) {
+        if (hooked_contexts[i].context == context) {
+            pthread_mutex_unlock(&context_ops_mutex);
+            return;
+        }
+        if (slot < 0 && hooked_contexts[i].context == NULL) {
+            slot = i;
+        }
+    }
+    
+    if (slot < 0) {
+        pthread_mutex_unlock(&context_ops_mutex);
+        DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Too many contexts, DM quota not enforced for %p\n", context);
+        return;
+    }
+    
+    context_ops_t *ops = &hooked_contexts[slot];
+    ops->context = context;
+    ops->alloc_dm = verbs_get_ctx_op(context, alloc_dm) ? vctx->alloc_dm : NULL;
+    ops->free_dm = verbs_get_ctx_op(context, free_dm) ? vctx->free_dm : NULL;
+    ops->reg_dm_mr = verbs_get_ctx_op(context, reg_dm_mr) ? vctx->reg_dm_mr : NULL;
+    
+    /* 设备不支持的操作保持为空，内联函数会返回EOPNOTSUPP */
+    if (ops->alloc_dm) vctx->alloc_dm = hook_alloc_dm;
+    if (ops->free_dm) vctx->free_dm = hook_free_dm;
+    if (ops->reg_dm_mr) vctx->reg_dm_mr = hook_reg_dm_mr;
+    
+    /* 仅在启用SRQ替换、UD复用或工作集跟踪时接管数据路径，避免给其它应用的热路径增加开销 */
+    bool ud_mux = g_intercept_state.config.enable_ud_mux;
+    bool ws = g_intercept_state.config.enable_qp_working_set;
+    if ((g_intercept_state.config.enable_srq_substitute || ud_mux || ws) && context->ops.post_recv) {
+        ops->post_recv = context->ops.post_recv;
+        context->ops.post_recv = hook_post_recv;
+    }
+    if (((ud_mux && context->ops.poll_cq) || ws) && context->ops.post_send) {
+        ops->post_send = context->ops.post_send;
+        context->ops.post_send = hook_post_send;
+    }
+    if (ud_mux && ops->post_send && context->ops.poll_cq) {
+        ops->poll_cq = context->ops.poll_cq;
+        context->ops.poll_cq = hook_poll_cq;
+    }
+    
+    pthread_mutex_unlock(&context_ops_mutex);
+    
+    DEBUG_FPRINTF(stderr, "[RDMA_HOOKS_TENANT] Context ops hooked: %p\n", context);
+}
+
+/* 被拦截的ibv_open_device函数 */
+struct ibv_context *ibv_open_device(struct ibv_device *device) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_open_device) {
+        errno = ENOSYS;
+        return NULL;
+    }
+    
+    struct ibv_context *context = real_ibv_open_device(device);
+    
+    if (context && rdma_intercept_is_enabled()) {
+        install_context_hooks(context);
+    }
+    
+    return context;
+}
+
+/* 被拦截的ibv_close_device函数 */
+int ibv_close_device(struct ibv_context *context) {
+    pthread_once(&hooks_init_once, init_function_pointers);
+    
+    if (!real_ibv_close_device) {
+        errno = ENOSYS;
+        return -1;
+    }
+    
+    if (rdma_intercept_is_enabled()) {
+        qp_pool_flush(context, NULL, NULL, NULL);
+        ah_cache_flush(NULL, context);
+        res_pool_flush(context);
+    }
+    
+    int result = real_ibv_close_device(context);
+    
+    /* 上下文释放后槽位可复用 */
+    if (result == 0) {
+        pthread_mutex_lock(&context_ops_mutex);
+        for (int i = 0; i < MAX_HOOKED_CONTEXTS; i++) {
+            if (hooked_contexts[i].context == context) {
+                memset(&hooked_contexts[i], 0, sizeof(hooked_contexts[i]));
+                break;
+            }
+        }
+        pthread_mutex_unlock(&context_ops_mutex);
+    }
+    
+    return result;
+}
+
 /* LD_PRELOAD使用的实际拦截函数 - 包装租户检查函数
  * 注意：需要在包含verbs.h之前#undef ibv_reg_mr，因为它是一个宏
  */
@@ -7,8 +7,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "shared_memory_tenant.h"
 
+// 非队首等待者检查队首进程是否存活的间隔
+#define CREATE_ADMIT_POLL_NS (10ULL * 1000 * 1000)
+
 // 共享内存大小
 #define TENANT_SHM_SIZE (sizeof(tenant_shared_memory_t))
 
@@ -29,6 +36,45 @@ static void spin_unlock(volatile int *lock) {
     __sync_lock_release(lock);
 }
 
+// 从当前代读取配额：读之前和之后seq一致且为偶数才算读到完整的一份
+static void quota_snapshot(const tenant_shared_memory_t *shm, uint32_t tenant_id, tenant_quota_t *out) {
+    for (;;) {
+        uint32_t active = __atomic_load_n(&shm->quota_active, __ATOMIC_ACQUIRE);
+        const tenant_quota_gen_t *gen = &shm->quota_gens[active & 1];
+        uint64_t seq = __atomic_load_n(&gen->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(out, (const void *)&gen->quotas[tenant_id], sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&gen->seq, __ATOMIC_RELAXED) == seq) {
+            return;
+        }
+    }
+}
+
+// 开始发布：取得写锁，把当前代复制到非当前代，返回供写入的配额表
+static tenant_quota_t *quota_publish_begin(tenant_shared_memory_t *shm) {
+    spin_lock(&shm->quota_write_lock);
+    uint32_t active = shm->quota_active & 1;
+    tenant_quota_gen_t *next = &shm->quota_gens[active ^ 1];
+    __atomic_store_n(&next->seq, next->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(next->quotas, shm->quota_gens[active].quotas, sizeof(next->quotas));
+    return next->quotas;
+}
+
+// 结束发布：切换当前代并推进纪元，之后的读者看到新配额
+static void quota_publish_end(tenant_shared_memory_t *shm) {
+    uint32_t next = (shm->quota_active & 1) ^ 1;
+    tenant_quota_gen_t *gen = &shm->quota_gens[next];
+    __atomic_store_n(&gen->seq, gen->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->quota_active, next, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&shm->quota_epoch, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&shm->version, 1, __ATOMIC_RELAXED);
+    spin_unlock(&shm->quota_write_lock);
+}
+
 // 初始化租户共享内存
 int tenant_shm_init(void) {
     if (g_tenant_shm != NULL) {
@@ -42,8 +88,25 @@ int tenant_shm_init(void) {
         return -1;
     }
     
+    // 已有的段大小不同说明布局不兼容，不能用ftruncate改变其他进程正在使用的段
+    struct stat shm_stat;
+    if (fstat(g_tenant_shm_fd, &shm_stat) != 0) {
+        perror("[TENANT_SHM] fstat failed");
+        close(g_tenant_shm_fd);
+        g_tenant_shm_fd = -1;
+        return -1;
+    }
+    if (shm_stat.st_size != 0 && shm_stat.st_size != (off_t)TENANT_SHM_SIZE) {
+        fprintf(stderr, "[TENANT_SHM] 现有租户共享内存大小(%lld)与本程序的布局(%zu)不一致，拒绝连接\n",
+                (long long)shm_stat.st_size, TENANT_SHM_SIZE);
+        close(g_tenant_shm_fd);
+        g_tenant_shm_fd = -1;
+        errno = EPROTO;
+        return -1;
+    }
+    
     // 设置共享内存大小
-    if (ftruncate(g_tenant_shm_fd, TENANT_SHM_SIZE) < 0) {
+    if (shm_stat.st_size == 0 && ftruncate(g_tenant_shm_fd, TENANT_SHM_SIZE) < 0) {
         perror("[TENANT_SHM] ftruncate failed");
         close(g_tenant_shm_fd);
         g_tenant_shm_fd = -1;
@@ -60,19 +123,31 @@ int tenant_shm_init(void) {
         return -1;
     }
     
-    // 初始化共享内存（如果是新创建的）
-    struct stat shm_stat;
-    if (fstat(g_tenant_shm_fd, &shm_stat) == 0 && shm_stat.st_size == TENANT_SHM_SIZE) {
-        // 检查是否已经初始化（通过检查version字段）
-        if (g_tenant_shm->version == 0) {
-            memset(g_tenant_shm, 0, TENANT_SHM_SIZE);
-            g_tenant_shm->version = 1;
-            g_tenant_shm->last_update_time = time(NULL);
-            fprintf(stderr, "[TENANT_SHM] 初始化新的租户共享内存\n");
-        } else {
-            fprintf(stderr, "[TENANT_SHM] 连接到现有的租户共享内存 (version=%lu)\n", 
-                    g_tenant_shm->version);
-        }
+    // 初始化共享内存（如果是新创建的，通过检查version字段），否则核对布局标识
+    if (g_tenant_shm->version == 0) {
+        memset(g_tenant_shm, 0, TENANT_SHM_SIZE);
+        g_tenant_shm->layout_version = TENANT_SHM_LAYOUT_VERSION;
+        g_tenant_shm->layout_max_tenants = MAX_TENANTS;
+        g_tenant_shm->layout_size = TENANT_SHM_SIZE;
+        g_tenant_shm->version = 1;
+        g_tenant_shm->last_update_time = time(NULL);
+        fprintf(stderr, "[TENANT_SHM] 初始化新的租户共享内存\n");
+    } else if (g_tenant_shm->layout_version != TENANT_SHM_LAYOUT_VERSION ||
+               g_tenant_shm->layout_max_tenants != MAX_TENANTS ||
+               g_tenant_shm->layout_size != TENANT_SHM_SIZE) {
+        fprintf(stderr, "[TENANT_SHM] 现有租户共享内存的布局(version=%u, max_tenants=%u)与本程序"
+                "(version=%u, max_tenants=%u)不一致，拒绝连接\n",
+                g_tenant_shm->layout_version, g_tenant_shm->layout_max_tenants,
+                TENANT_SHM_LAYOUT_VERSION, MAX_TENANTS);
+        munmap(g_tenant_shm, TENANT_SHM_SIZE);
+        g_tenant_shm = NULL;
+        close(g_tenant_shm_fd);
+        g_tenant_shm_fd = -1;
+        errno = EPROTO;
+        return -1;
+    } else {
+        fprintf(stderr, "[TENANT_SHM] 连接到现有的租户共享内存 (version=%lu)\n", 
+                g_tenant_shm->version);
     }
     
     fprintf(stderr, "[TENANT_SHM] 租户共享内存初始化成功\n");
@@ -123,8 +198,32 @@ void tenant_shm_unlock(tenant_shared_memory_t* data) {
     }
 }
 
-// 创建租户
-int tenant_create(uint32_t tenant_id, const char *name, const tenant_quota_t *quota) {
+// 全局上限检查：按新的配额表（slot>=0的租户取quotas中的新值）求和，超出任一全局上限返回1
+static int global_limits_exceeded(const tenant_shared_memory_t *shm, const tenant_quota_t *next,
+                                  const int *slot, const tenant_quota_t *quotas) {
+    const tenant_global_limits_t *limits = &shm->global_limits;
+    if (!limits->max_total_qp && !limits->max_total_mr && !limits->max_total_memory) {
+        return 0;
+    }
+    
+    uint64_t qp = 0, mr = 0, mem = 0;
+    for (int id = 0; id < MAX_TENANTS; id++) {
+        if (slot[id] < 0 && shm->tenants[id].status == TENANT_STATUS_INACTIVE) {
+            continue;
+        }
+        const tenant_quota_t *q = slot[id] >= 0 ? &quotas[slot[id]] : &next[id];
+        qp += q->max_qp_per_tenant;
+        mr += q->max_mr_per_tenant;
+        mem += q->max_memory_per_tenant;
+    }
+    return (limits->max_total_qp && qp > limits->max_total_qp) ||
+           (limits->max_total_mr && mr > limits->max_total_mr) ||
+           (limits->max_total_memory && mem > limits->max_total_memory);
+}
+
+// 创建租户，check_global非0时新配额计入后不得超出全局上限
+static int tenant_create_common(uint32_t tenant_id, const char *name, const tenant_quota_t *quota,
+                                int check_global) {
     if (tenant_id == 0 || tenant_id >= MAX_TENANTS) {
         fprintf(stderr, "[TENANT] 无效的租户ID: %u\n", tenant_id);
         return -1;
@@ -146,6 +245,37 @@ int tenant_create(uint32_t tenant_id, const char *name, const tenant_quota_t *qu
         return -1;
     }
     
+    tenant_quota_t initial;
+    if (quota) {
+        memcpy(&initial, quota, sizeof(tenant_quota_t));
+    } else {
+        // 使用默认配额
+        memset(&initial, 0, sizeof(tenant_quota_t));
+        initial.max_qp_per_tenant = 100;
+        initial.max_mr_per_tenant = 1000;
+        initial.max_memory_per_tenant = 1024ULL * 1024 * 1024; // 1GB
+        initial.max_cq_per_tenant = 100;
+        initial.max_pd_per_tenant = 100;
+        // 设备内存、AH、容量、队列内存、活跃QP、工作集和QP创建速率默认不限制
+    }
+    
+    // 设置配额并发布（先于状态置为活跃，无锁读者不会看到上一个同ID租户的配额）
+    tenant_quota_t *next = quota_publish_begin(shm);
+    if (check_global) {
+        int slot[MAX_TENANTS];
+        memset(slot, -1, sizeof(slot));
+        slot[tenant_id] = 0;
+        if (global_limits_exceeded(shm, next, slot, &initial)) {
+            quota_publish_end(shm);
+            tenant_shm_unlock(shm);
+            fprintf(stderr, "[TENANT] 租户%u的配额超出全局上限\n", tenant_id);
+            errno = EDQUOT;
+            return -1;
+        }
+    }
+    memcpy(&next[tenant_id], &initial, sizeof(tenant_quota_t));
+    quota_publish_end(shm);
+    
     // 初始化租户信息
     memset(tenant, 0, sizeof(tenant_info_t));
     tenant->tenant_id = tenant_id;
@@ -155,18 +285,6 @@ int tenant_create(uint32_t tenant_id, const char *name, const tenant_quota_t *qu
     tenant->created_at = time(NULL);
     tenant->last_active_at = tenant->created_at;
     
-    // 设置配额
-    if (quota) {
-        memcpy(&tenant->quota, quota, sizeof(tenant_quota_t));
-    } else {
-        // 使用默认配额
-        tenant->quota.max_qp_per_tenant = 100;
-        tenant->quota.max_mr_per_tenant = 1000;
-        tenant->quota.max_memory_per_tenant = 1024ULL * 1024 * 1024; // 1GB
-        tenant->quota.max_cq_per_tenant = 100;
-        tenant->quota.max_pd_per_tenant = 100;
-    }
-    
     shm->active_tenant_count++;
     
     tenant_shm_unlock(shm);
@@ -175,6 +293,16 @@ int tenant_create(uint32_t tenant_id, const char *name, const tenant_quota_t *qu
     return 0;
 }
 
+// 创建租户（不检查全局上限，供日志回放和本地管理接口使用）
+int tenant_create(uint32_t tenant_id, const char *name, const tenant_quota_t *quota) {
+    return tenant_create_common(tenant_id, name, quota, 0);
+}
+
+// 创建租户，新配额计入后超出全局上限时拒绝
+int tenant_create_within_limits(uint32_t tenant_id, const char *name, const tenant_quota_t *quota) {
+    return tenant_create_common(tenant_id, name, quota, 1);
+}
+
 // 删除租户
 int tenant_delete(uint32_t tenant_id) {
     if (tenant_id == 0 || tenant_id >= MAX_TENANTS) {
@@ -235,7 +363,29 @@ int tenant_get_info(uint32_t tenant_id, tenant_info_t *info) {
     
     tenant_shm_unlock(shm);
     
-    return (tenant->status != TENANT_STATUS_INACTIVE) ? 0 : -1;
+    quota_snapshot(shm, tenant_id, &info->quota);
+    return (info->status != TENANT_STATUS_INACTIVE) ? 0 : -1;
+}
+
+// 无锁读取当前生效的配额
+int tenant_get_quota(uint32_t tenant_id, tenant_quota_t *quota) {
+    if (!quota || tenant_id >= MAX_TENANTS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm || shm->tenants[tenant_id].status == TENANT_STATUS_INACTIVE) {
+        return -1;
+    }
+    
+    quota_snapshot(shm, tenant_id, quota);
+    return 0;
+}
+
+// 获取配额发布纪元
+uint64_t tenant_quota_epoch(void) {
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    return shm ? __atomic_load_n(&shm->quota_epoch, __ATOMIC_ACQUIRE) : 0;
 }
 
 // 设置租户状态
@@ -278,24 +428,90 @@ int tenant_update_quota(uint32_t tenant_id, const tenant_quota_t *quota) {
         return -1;
     }
     
-    tenant_shm_lock(shm);
-    
+    // 只取配额写锁，持tenant_shm_lock的准入检查不受影响
     tenant_info_t *tenant = &shm->tenants[tenant_id];
+    tenant_quota_t *quotas = quota_publish_begin(shm);
     
     if (tenant->status == TENANT_STATUS_INACTIVE) {
-        tenant_shm_unlock(shm);
+        quota_publish_end(shm);
         return -1;
     }
     
-    memcpy(&tenant->quota, quota, sizeof(tenant_quota_t));
+    memcpy(&quotas[tenant_id], quota, sizeof(tenant_quota_t));
     tenant->last_active_at = time(NULL);
     
-    tenant_shm_unlock(shm);
+    quota_publish_end(shm);
     
     fprintf(stderr, "[TENANT] 租户%u配额已更新\n", tenant_id);
     return 0;
 }
 
+// 批量更新租户配额
+int tenant_update_quota_batch(const uint32_t *tenant_ids, const tenant_quota_t *quotas,
+                              int count, int *failed_index) {
+    if (failed_index) {
+        *failed_index = -1;
+    }
+    if (!tenant_ids || !quotas || count <= 0 || count > MAX_TENANTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    // 每个租户在批量中的位置（-1表示不在批量中），用于查重和计算新的配额之和
+    int slot[MAX_TENANTS];
+    memset(slot, -1, sizeof(slot));
+    
+    tenant_quota_t *next = quota_publish_begin(shm);
+    
+    for (int i = 0; i < count; i++) {
+        uint32_t id = tenant_ids[i];
+        if (id >= MAX_TENANTS || slot[id] >= 0 || shm->tenants[id].status == TENANT_STATUS_INACTIVE) {
+            quota_publish_end(shm);
+            if (failed_index) {
+                *failed_index = i;
+            }
+            errno = EINVAL;
+            return -1;
+        }
+        slot[id] = i;
+    }
+    
+    if (global_limits_exceeded(shm, next, slot, quotas)) {
+        quota_publish_end(shm);
+        errno = EDQUOT;
+        return -1;
+    }
+    
+    time_t now = time(NULL);
+    for (int i = 0; i < count; i++) {
+        memcpy(&next[tenant_ids[i]], &quotas[i], sizeof(tenant_quota_t));
+        shm->tenants[tenant_ids[i]].last_active_at = now;
+    }
+    
+    // 一次切换发布整个批量，只推进一次version和纪元
+    quota_publish_end(shm);
+    return 0;
+}
+
+// 设置全局配额上限
+int tenant_set_global_limits(const tenant_global_limits_t *limits) {
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm || !limits) {
+        return -1;
+    }
+    
+    tenant_shm_lock(shm);
+    shm->global_limits = *limits;
+    tenant_shm_unlock(shm);
+    return 0;
+}
+
 // 将进程绑定到租户
 int tenant_bind_process(pid_t pid, uint32_t tenant_id) {
     if (tenant_id >= MAX_TENANTS) {
@@ -463,7 +679,22 @@ int tenant_update_resource_usage(uint32_t tenant_id, const tenant_resource_usage
         return -1;
     }
     
+    // 字节用量和QP创建统计由专用接口在锁内维护，不被读-改-写的快照覆盖
+    tenant_resource_usage_t kept = tenant->usage;
     memcpy(&tenant->usage, usage, sizeof(tenant_resource_usage_t));
+    tenant->usage.memory_used = kept.memory_used;
+    tenant->usage.dm_used = kept.dm_used;
+    tenant->usage.queue_mem_used = kept.queue_mem_used;
+    tenant->usage.ah_count = kept.ah_count;
+    tenant->usage.qp_pool_hits = kept.qp_pool_hits;
+    tenant->usage.qp_pool_misses = kept.qp_pool_misses;
+    memcpy(tenant->usage.qp_create_lat_hist, kept.qp_create_lat_hist, sizeof(kept.qp_create_lat_hist));
+    memcpy(tenant->usage.qp_state_count, kept.qp_state_count, sizeof(kept.qp_state_count));
+    tenant->usage.ws_window = kept.ws_window;
+    tenant->usage.ws_qps = kept.ws_qps;
+    tenant->usage.ws_qps_last = kept.ws_qps_last;
+    tenant->usage.ws_qps_peak = kept.ws_qps_peak;
+    tenant->usage.ws_throttled = kept.ws_throttled;
     tenant->last_active_at = time(NULL);
     
     tenant_shm_unlock(shm);
@@ -498,6 +729,341 @@ int tenant_get_resource_usage(uint32_t tenant_id, tenant_resource_usage_t *usage
     return 0;
 }
 
+// 记录QP创建延迟与QP池命中
+int tenant_record_qp_create(uint32_t tenant_id, int pool_hit, uint64_t latency_us) {
+    if (tenant_id == 0 || tenant_id >= MAX_TENANTS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    int bucket = 0;
+    while (latency_us > 1 && bucket < QP_CREATE_LAT_BUCKETS - 1) {
+        latency_us >>= 1;
+        bucket++;
+    }
+    
+    tenant_shm_lock(shm);
+    
+    tenant_info_t *tenant = &shm->tenants[tenant_id];
+    if (tenant->status != TENANT_STATUS_ACTIVE) {
+        tenant_shm_unlock(shm);
+        return -1;
+    }
+    
+    tenant->usage.qp_create_lat_hist[bucket]++;
+    if (pool_hit > 0) {
+        tenant->usage.qp_pool_hits++;
+    } else if (pool_hit == 0) {
+        tenant->usage.qp_pool_misses++;
+    }
+    
+    tenant_shm_unlock(shm);
+    return 0;
+}
+
+// 记录QP状态迁移，进入RTS时检查活跃QP配额
+int tenant_qp_state_change(uint32_t tenant_id, int from, int to, bool enforce) {
+    if (tenant_id == 0 || tenant_id >= MAX_TENANTS || from == to ||
+        from >= TENANT_QP_STATES || to >= TENANT_QP_STATES) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    tenant_quota_t quota;
+    quota_snapshot(shm, tenant_id, &quota);
+    
+    tenant_shm_lock(shm);
+    
+    tenant_info_t *tenant = &shm->tenants[tenant_id];
+    
+    // 离开原状态总是允许（租户暂停后QP仍需复位和销毁）
+    if (tenant->status == TENANT_STATUS_INACTIVE) {
+        tenant_shm_unlock(shm);
+        return -1;
+    }
+    
+    uint32_t *counts = tenant->usage.qp_state_count;
+    if (enforce && to == TENANT_QP_STATE_RTS &&
+        quota.max_active_qp_per_tenant > 0 &&
+        counts[TENANT_QP_STATE_RTS] >= quota.max_active_qp_per_tenant) {
+        tenant_shm_unlock(shm);
+        fprintf(stderr, "[TENANT] 租户%u活跃QP数达到上限(%u)\n",
+                tenant_id, quota.max_active_qp_per_tenant);
+        return -1;
+    }
+    
+    if (from >= 0 && counts[from] > 0) {
+        counts[from]--;
+    }
+    if (to >= 0) {
+        counts[to]++;
+    }
+    
+    tenant_shm_unlock(shm);
+    return 0;
+}
+
+// 记录QP在窗口内的首次投递，窗口前进时滚动工作集计数
+int tenant_ws_enter(uint32_t tenant_id, uint64_t window, bool enforce) {
+    if (tenant_id == 0 || tenant_id >= MAX_TENANTS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    tenant_quota_t quota;
+    quota_snapshot(shm, tenant_id, &quota);
+    
+    tenant_shm_lock(shm);
+    
+    tenant_info_t *tenant = &shm->tenants[tenant_id];
+    if (tenant->status != TENANT_STATUS_ACTIVE) {
+        tenant_shm_unlock(shm);
+        return -1;
+    }
+    
+    tenant_resource_usage_t *u = &tenant->usage;
+    if (window > u->ws_window) {
+        // 中间有空闲窗口时上一个完整窗口的工作集为0
+        u->ws_qps_last = (window == u->ws_window + 1) ? u->ws_qps : 0;
+        u->ws_qps = 0;
+        u->ws_window = window;
+    } else if (window < u->ws_window) {
+        tenant_shm_unlock(shm);
+        return 0;
+    }
+    
+    int ret = 0;
+    if (enforce && quota.max_ws_qps_per_tenant > 0 &&
+        u->ws_qps >= quota.max_ws_qps_per_tenant) {
+        u->ws_throttled++;
+        ret = -1;
+    } else {
+        u->ws_qps++;
+        if (u->ws_qps > u->ws_qps_peak) {
+            u->ws_qps_peak = u->ws_qps;
+        }
+    }
+    
+    tenant_shm_unlock(shm);
+    return ret;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// 补充令牌，返回得到1个令牌还需等待的纳秒数（0表示已有令牌或不限速）
+static uint64_t create_bucket_refill(create_bucket_t *b, uint32_t rate, uint32_t burst, uint64_t now) {
+    if (rate == 0) {
+        return 0;
+    }
+    
+    uint64_t cap = (uint64_t)(burst ? burst : rate) * 1000;
+    if (b->last_refill_ns == 0 || now - b->last_refill_ns > 10000000000ULL) {
+        b->tokens_milli = cap;
+        b->last_refill_ns = now;
+    } else if (now > b->last_refill_ns) {
+        uint64_t add = (now - b->last_refill_ns) * rate / 1000000;
+        if (add > 0) {
+            // 只推进已折算成令牌的时间，保留不足千分之一令牌的余量
+            b->last_refill_ns += add * 1000000 / rate;
+            b->tokens_milli = (b->tokens_milli + add > cap) ? cap : b->tokens_milli + add;
+        }
+    }
+    
+    if (b->tokens_milli >= 1000) {
+        return 0;
+    }
+    return (1000 - b->tokens_milli) * 1000000 / rate + 1;
+}
+
+static void create_admit_wake(create_admit_queue_t *q) {
+    syscall(SYS_futex, &q->serving, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// 队首出队，跳过已放弃的票号（调用方持锁）
+static void create_admit_advance_locked(create_admit_queue_t *q) {
+    q->waiter_pid[q->serving % CREATE_ADMIT_SLOTS] = 0;
+    q->depth--;
+    q->serving++;
+    while (q->serving != q->next_ticket && q->waiter_pid[q->serving % CREATE_ADMIT_SLOTS] == 0) {
+        q->serving++;
+    }
+}
+
+// 记录等待时间并更新分位数（调用方持锁）
+static void create_admit_record_locked(create_admit_queue_t *q, uint64_t wait_ns) {
+    uint64_t us = wait_ns / 1000;
+    int bucket = 0;
+    while (us > 1 && bucket < CREATE_WAIT_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    q->wait_hist[bucket]++;
+    q->admitted++;
+    
+    uint64_t seen = 0;
+    q->wait_p50_us = 0;
+    q->wait_p99_us = 0;
+    for (int i = 0; i < CREATE_WAIT_BUCKETS; i++) {
+        seen += q->wait_hist[i];
+        if (q->wait_p50_us == 0 && seen * 100 >= q->admitted * 50) {
+            q->wait_p50_us = 2U << i;
+        }
+        if (seen * 100 >= q->admitted * 99) {
+            q->wait_p99_us = 2U << i;
+            break;
+        }
+    }
+}
+
+// QP创建准入
+int tenant_qp_create_admit(uint32_t tenant_id, uint32_t timeout_ms) {
+    if (tenant_id == 0 || tenant_id >= MAX_TENANTS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    tenant_quota_t quota;
+    quota_snapshot(shm, tenant_id, &quota);
+    
+    tenant_info_t *tenant = &shm->tenants[tenant_id];
+    create_admit_queue_t *q = &tenant->create_admit;
+    
+    // 不限速时不加锁
+    if (quota.qp_create_rate == 0 && shm->global_qp_create_rate == 0) {
+        return 0;
+    }
+    
+    uint64_t start = monotonic_ns();
+    uint64_t deadline = start + (uint64_t)timeout_ms * 1000000ULL;
+    pid_t self = getpid();
+    
+    tenant_shm_lock(shm);
+    
+    if (tenant->status != TENANT_STATUS_ACTIVE) {
+        tenant_shm_unlock(shm);
+        return -1;
+    }
+    
+    if (q->next_ticket - q->serving >= CREATE_ADMIT_SLOTS) {
+        q->timeouts++;
+        tenant_shm_unlock(shm);
+        errno = EAGAIN;
+        return -1;
+    }
+    
+    uint32_t ticket = q->next_ticket++;
+    q->waiter_pid[ticket % CREATE_ADMIT_SLOTS] = self;
+    q->depth++;
+    if (q->depth > q->depth_peak) {
+        q->depth_peak = q->depth;
+    }
+    
+    bool delayed = false;
+    for (;;) {
+        uint64_t now = monotonic_ns();
+        uint32_t serving = q->serving;
+        uint64_t wait_ns;
+        
+        if (serving == ticket) {
+            uint64_t wt = create_bucket_refill(&q->bucket, quota.qp_create_rate,
+                                               quota.qp_create_burst, now);
+            uint64_t wg = create_bucket_refill(&shm->global_create_bucket, shm->global_qp_create_rate,
+                                               shm->global_qp_create_burst, now);
+            if (wt == 0 && wg == 0) {
+                if (quota.qp_create_rate) {
+                    q->bucket.tokens_milli -= 1000;
+                }
+                if (shm->global_qp_create_rate) {
+                    shm->global_create_bucket.tokens_milli -= 1000;
+                }
+                create_admit_advance_locked(q);
+                create_admit_record_locked(q, now - start);
+                if (delayed) {
+                    q->delayed++;
+                }
+                tenant_shm_unlock(shm);
+                create_admit_wake(q);
+                return 0;
+            }
+            wait_ns = wt > wg ? wt : wg;
+        } else {
+            // 队首进程已退出时代为出队
+            pid_t head = q->waiter_pid[serving % CREATE_ADMIT_SLOTS];
+            if (head != 0 && head != self && kill(head, 0) != 0 && errno == ESRCH) {
+                create_admit_advance_locked(q);
+                create_admit_wake(q);
+                continue;
+            }
+            wait_ns = CREATE_ADMIT_POLL_NS;
+        }
+        
+        if (now >= deadline) {
+            // 放弃排队：队首直接出队，其余只清除持票标记，由前面的出队跳过
+            if (serving == ticket) {
+                create_admit_advance_locked(q);
+            } else {
+                q->waiter_pid[ticket % CREATE_ADMIT_SLOTS] = 0;
+                q->depth--;
+            }
+            q->timeouts++;
+            tenant_shm_unlock(shm);
+            create_admit_wake(q);
+            fprintf(stderr, "[TENANT] 租户%u QP创建排队超时(%ums)\n", tenant_id, timeout_ms);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        
+        if (now + wait_ns > deadline) {
+            wait_ns = deadline - now;
+        }
+        delayed = true;
+        tenant_shm_unlock(shm);
+        
+        struct timespec ts = {
+            .tv_sec = (time_t)(wait_ns / 1000000000ULL),
+            .tv_nsec = (long)(wait_ns % 1000000000ULL)
+        };
+        syscall(SYS_futex, &q->serving, FUTEX_WAIT, serving, &ts, NULL, 0);
+        
+        tenant_shm_lock(shm);
+    }
+}
+
+// 设置全局QP创建速率
+int tenant_set_global_create_rate(uint32_t rate, uint32_t burst) {
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    tenant_shm_lock(shm);
+    shm->global_qp_create_rate = rate;
+    shm->global_qp_create_burst = burst;
+    memset(&shm->global_create_bucket, 0, sizeof(shm->global_create_bucket));
+    tenant_shm_unlock(shm);
+    return 0;
+}
+
 // 检查租户资源限制
 bool tenant_check_resource_limit(uint32_t tenant_id, int resource_type, uint32_t requested_amount) {
     if (tenant_id >= MAX_TENANTS) {
@@ -509,6 +1075,9 @@ bool tenant_check_resource_limit(uint32_t tenant_id, int resource_type, uint32_t
         return false;
     }
     
+    tenant_quota_t quota;
+    quota_snapshot(shm, tenant_id, &quota);
+    
     tenant_shm_lock(shm);
     
     tenant_info_t *tenant = &shm->tenants[tenant_id];
@@ -522,27 +1091,39 @@ bool tenant_check_resource_limit(uint32_t tenant_id, int resource_type, uint32_t
     
     switch (resource_type) {
         case 0: // QP
-            if (tenant->usage.qp_count + requested_amount > tenant->quota.max_qp_per_tenant) {
+            if (tenant->usage.qp_count + requested_amount > quota.max_qp_per_tenant) {
                 exceeded = true;
             }
             break;
         case 1: // MR
-            if (tenant->usage.mr_count + requested_amount > tenant->quota.max_mr_per_tenant) {
+            if (tenant->usage.mr_count + requested_amount > quota.max_mr_per_tenant) {
                 exceeded = true;
             }
             break;
         case 2: // Memory
-            if (tenant->usage.memory_used + requested_amount > tenant->quota.max_memory_per_tenant) {
+            if (tenant->usage.memory_used + requested_amount > quota.max_memory_per_tenant) {
                 exceeded = true;
             }
             break;
         case 3: // CQ
-            if (tenant->usage.cq_count + requested_amount > tenant->quota.max_cq_per_tenant) {
+            if (tenant->usage.cq_count + requested_amount > quota.max_cq_per_tenant) {
                 exceeded = true;
             }
             break;
         case 4: // PD
-            if (tenant->usage.pd_count + requested_amount > tenant->quota.max_pd_per_tenant) {
+            if (tenant->usage.pd_count + requested_amount > quota.max_pd_per_tenant) {
+                exceeded = true;
+            }
+            break;
+        case 5: // Device Memory
+            if (quota.max_dm_bytes_per_tenant > 0 &&
+                tenant->usage.dm_used + requested_amount > quota.max_dm_bytes_per_tenant) {
+                exceeded = true;
+            }
+            break;
+        case 18: // Queue Memory
+            if (quota.max_queue_memory > 0 &&
+                tenant->usage.queue_mem_used + requested_amount > quota.max_queue_memory) {
                 exceeded = true;
             }
             break;
@@ -558,6 +1139,83 @@ bool tenant_check_resource_limit(uint32_t tenant_id, int resource_type, uint32_t
     return exceeded;
 }
 
+// 原子地检查并记账租户字节类资源
+int tenant_charge_resource(uint32_t tenant_id, int resource_type, int64_t amount) {
+    if (tenant_id == 0 || tenant_id >= MAX_TENANTS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    tenant_quota_t quota;
+    quota_snapshot(shm, tenant_id, &quota);
+    
+    tenant_shm_lock(shm);
+    
+    tenant_info_t *tenant = &shm->tenants[tenant_id];
+    
+    // 归还总是允许（租户暂停后资源仍需释放），申请仅限活跃租户
+    if (tenant->status == TENANT_STATUS_INACTIVE ||
+        (amount > 0 && tenant->status != TENANT_STATUS_ACTIVE)) {
+        tenant_shm_unlock(shm);
+        return -1;
+    }
+    
+    uint64_t *used;
+    uint64_t limit;
+    uint64_t ah_used = (uint64_t)(tenant->usage.ah_count > 0 ? tenant->usage.ah_count : 0);
+    
+    switch (resource_type) {
+        case 2: // Memory
+            used = &tenant->usage.memory_used;
+            limit = quota.max_memory_per_tenant;
+            break;
+        case 5: // Device Memory
+            used = &tenant->usage.dm_used;
+            limit = quota.max_dm_bytes_per_tenant;
+            break;
+        case 18: // Queue Memory
+            used = &tenant->usage.queue_mem_used;
+            limit = quota.max_queue_memory;
+            break;
+        case 11: // AH（计数，含缓存中闲置的AH）
+            used = &ah_used;
+            limit = quota.max_ah_per_tenant;
+            break;
+        default:
+            tenant_shm_unlock(shm);
+            return -1;
+    }
+    
+    int ret = 0;
+    if (amount > 0) {
+        // 配额为0表示不限制
+        if (limit > 0 && *used + (uint64_t)amount > limit) {
+            ret = -1;
+        } else {
+            *used += (uint64_t)amount;
+        }
+    } else {
+        uint64_t dec = (uint64_t)(-amount);
+        *used = (*used >= dec) ? *used - dec : 0;
+    }
+    if (resource_type == 11) {
+        tenant->usage.ah_count = (int)ah_used;
+    }
+    
+    tenant_shm_unlock(shm);
+    
+    if (ret != 0) {
+        fprintf(stderr, "[TENANT] 租户%u超出资源限制(type=%d, request=%lld)\n",
+                tenant_id, resource_type, (long long)amount);
+    }
+    
+    return ret;
+}
+
 // 获取所有活跃租户列表
 int tenant_get_active_list(tenant_info_t *tenants, int max_count) {
     if (!tenants || max_count <= 0) {
@@ -581,9 +1239,49 @@ int tenant_get_active_list(tenant_info_t *tenants, int max_count) {
     
     tenant_shm_unlock(shm);
     
+    for (int i = 0; i < count; i++) {
+        quota_snapshot(shm, tenants[i].tenant_id, &tenants[i].quota);
+    }
+    
     return count;
 }
 
+// 一次加锁复制所有租户槽位；读者解锁时不推进version，避免监视者自己触发变化
+uint64_t tenant_snapshot_all(tenant_snapshot_t *snaps) {
+    if (!snaps) {
+        return 0;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return 0;
+    }
+    
+    // 先读版本号：复制期间发生的修改会推进version，调用方下次比较时重新快照
+    uint64_t version = __atomic_load_n(&shm->version, __ATOMIC_ACQUIRE);
+    
+    // 每次加锁只复制一个租户，不让准入路径在整表复制期间等锁
+    for (int i = 0; i < MAX_TENANTS; i++) {
+        const tenant_info_t *t = &shm->tenants[i];
+        spin_lock(&shm->tenant_shm_lock);
+        snaps[i].tenant_id = t->tenant_id;
+        memcpy(snaps[i].tenant_name, t->tenant_name, TENANT_NAME_MAX);
+        snaps[i].status = t->status;
+        snaps[i].usage = t->usage;
+        snaps[i].process_count = t->process_count;
+        spin_unlock(&shm->tenant_shm_lock);
+    }
+    
+    for (int i = 0; i < MAX_TENANTS; i++) {
+        if (snaps[i].status != TENANT_STATUS_INACTIVE) {
+            quota_snapshot(shm, i, &snaps[i].quota);
+        } else {
+            memset(&snaps[i].quota, 0, sizeof(snaps[i].quota));
+        }
+    }
+    return version;
+}
+
 // 打印所有租户信息
 void tenant_print_all(void) {
     tenant_shared_memory_t *shm = tenant_shm_get_ptr();
@@ -601,16 +1299,24 @@ void tenant_print_all(void) {
     for (int i = 0; i < MAX_TENANTS; i++) {
         tenant_info_t *tenant = &shm->tenants[i];
         if (tenant->status == TENANT_STATUS_ACTIVE) {
+            tenant_quota_t quota;
+            quota_snapshot(shm, (uint32_t)i, &quota);
             fprintf(stderr, "租户ID: %u\n", tenant->tenant_id);
             fprintf(stderr, "  名称: %s\n", tenant->tenant_name);
             fprintf(stderr, "  状态: %s\n", 
                     tenant->status == TENANT_STATUS_ACTIVE ? "活跃" : 
                     (tenant->status == TENANT_STATUS_SUSPENDED ? "暂停" : "未激活"));
-            fprintf(stderr, "  QP: %d/%u\n", tenant->usage.qp_count, tenant->quota.max_qp_per_tenant);
-            fprintf(stderr, "  MR: %d/%u\n", tenant->usage.mr_count, tenant->quota.max_mr_per_tenant);
+            fprintf(stderr, "  QP: %d/%u\n", tenant->usage.qp_count, quota.max_qp_per_tenant);
+            fprintf(stderr, "  MR: %d/%u\n", tenant->usage.mr_count, quota.max_mr_per_tenant);
             fprintf(stderr, "  内存: %llu/%llu bytes\n", 
                     (unsigned long long)tenant->usage.memory_used,
-                    (unsigned long long)tenant->quota.max_memory_per_tenant);
+                    (unsigned long long)quota.max_memory_per_tenant);
+            fprintf(stderr, "  设备内存: %llu/%llu bytes\n", 
+                    (unsigned long long)tenant->usage.dm_used,
+                    (unsigned long long)quota.max_dm_bytes_per_tenant);
+            fprintf(stderr, "  队列内存: %llu/%llu bytes\n", 
+                    (unsigned long long)tenant->usage.queue_mem_used,
+                    (unsigned long long)quota.max_queue_memory);
             fprintf(stderr, "  进程数: %u\n", tenant->process_count);
             fprintf(stderr, "  创建时间: %s", ctime(&tenant->created_at));
         }
@@ -648,3 +1354,259 @@ int tenant_get_statistics(uint32_t tenant_id, uint64_t *total_qp_creates, uint64
     
     return 0;
 }
+
+// ========== 跨进程共享MR登记表 ==========
+
+static bool shared_mr_pid_alive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+// 移除第i个持有者，必要时更换供导入的进程（调用方持锁）
+static void shared_mr_remove_holder_locked(shared_mr_entry_t *e, uint32_t i) {
+    pid_t pid = e->holders[i].pid;
+    e->holders[i] = e->holders[e->holder_count - 1];
+    e->holder_count--;
+    
+    if (e->owner_pid == pid) {
+        e->owner_pid = 0;
+        e->owner_fd = -1;
+        for (uint32_t j = 0; j < e->holder_count; j++) {
+            if (e->holders[j].cmd_fd >= 0) {
+                e->owner_pid = e->holders[j].pid;
+                e->owner_fd = e->holders[j].cmd_fd;
+                break;
+            }
+        }
+    }
+}
+
+// 清空表项并归还租户资源（调用方持锁）
+static void shared_mr_free_locked(tenant_shared_memory_t *shm, shared_mr_entry_t *e) {
+    if (e->charged && e->tenant_id < MAX_TENANTS) {
+        tenant_resource_usage_t *usage = &shm->tenants[e->tenant_id].usage;
+        usage->memory_used = (usage->memory_used >= e->length) ? usage->memory_used - e->length : 0;
+        if (usage->mr_count > 0) {
+            usage->mr_count--;
+        }
+        usage->total_mr_deregs++;
+    }
+    memset(e, 0, sizeof(*e));
+    e->owner_fd = -1;
+}
+
+// 清理已退出的持有者（调用方持锁）
+static int shared_mr_reap_locked(tenant_shared_memory_t *shm) {
+    int freed = 0;
+    for (int s = 0; s < MAX_SHARED_MRS; s++) {
+        shared_mr_entry_t *e = &shm->shared_mrs[s];
+        if (e->state == SHARED_MR_FREE) {
+            continue;
+        }
+        for (uint32_t i = 0; i < e->holder_count; ) {
+            if (!shared_mr_pid_alive(e->holders[i].pid)) {
+                shared_mr_remove_holder_locked(e, i);
+            } else {
+                i++;
+            }
+        }
+        // 剩余持有者仍在导入中时保留表项（owner_pid为0期间不供新进程导入）
+        if (e->holder_count == 0) {
+            shared_mr_free_locked(shm, e);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+int tenant_shared_mr_acquire(uint32_t tenant_id, const char *shm_name, uint64_t offset, uint64_t length,
+                             int access, pid_t pid, int *slot, shared_mr_entry_t *entry) {
+    if (tenant_id == 0 || tenant_id >= MAX_TENANTS || !shm_name || !slot || length == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        errno = ENODEV;
+        return -1;
+    }
+    
+    tenant_shm_lock(shm);
+    shared_mr_reap_locked(shm);
+    
+    int free_slot = -1;
+    for (int s = 0; s < MAX_SHARED_MRS; s++) {
+        shared_mr_entry_t *e = &shm->shared_mrs[s];
+        if (e->state == SHARED_MR_FREE) {
+            if (free_slot < 0) free_slot = s;
+            continue;
+        }
+        if (e->tenant_id != tenant_id || e->offset != offset || e->length != length ||
+            e->access != access || strncmp(e->shm_name, shm_name, SHARED_MR_NAME_MAX) != 0) {
+            continue;
+        }
+        
+        if (e->state == SHARED_MR_PENDING || e->owner_pid == 0) {
+            tenant_shm_unlock(shm);
+            errno = EBUSY;
+            return -1;
+        }
+        if (e->holder_count >= MAX_SHARED_MR_HOLDERS) {
+            tenant_shm_unlock(shm);
+            errno = ENOSPC;
+            return -1;
+        }
+        
+        e->holders[e->holder_count].pid = pid;
+        e->holders[e->holder_count].cmd_fd = -1;
+        e->holder_count++;
+        if (entry) {
+            memcpy(entry, e, sizeof(*e));
+        }
+        *slot = s;
+        tenant_shm_unlock(shm);
+        return 1;
+    }
+    
+    if (free_slot < 0) {
+        tenant_shm_unlock(shm);
+        errno = ENOSPC;
+        return -1;
+    }
+    
+    shared_mr_entry_t *e = &shm->shared_mrs[free_slot];
+    memset(e, 0, sizeof(*e));
+    e->state = SHARED_MR_PENDING;
+    e->tenant_id = tenant_id;
+    strncpy(e->shm_name, shm_name, SHARED_MR_NAME_MAX - 1);
+    e->offset = offset;
+    e->length = length;
+    e->access = access;
+    e->owner_pid = pid;
+    e->owner_fd = -1;
+    e->holders[0].pid = pid;
+    e->holders[0].cmd_fd = -1;
+    e->holder_count = 1;
+    e->created_at = time(NULL);
+    if (entry) {
+        memcpy(entry, e, sizeof(*e));
+    }
+    *slot = free_slot;
+    
+    tenant_shm_unlock(shm);
+    return 0;
+}
+
+int tenant_shared_mr_publish(int slot, pid_t pid, int cmd_fd, uint32_t pd_handle, uint32_t mr_handle,
+                             uint32_t lkey, uint32_t rkey) {
+    if (slot < 0 || slot >= MAX_SHARED_MRS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    tenant_shm_lock(shm);
+    
+    shared_mr_entry_t *e = &shm->shared_mrs[slot];
+    if (e->state != SHARED_MR_PENDING || e->owner_pid != pid) {
+        tenant_shm_unlock(shm);
+        return -1;
+    }
+    
+    e->pd_handle = pd_handle;
+    e->mr_handle = mr_handle;
+    e->lkey = lkey;
+    e->rkey = rkey;
+    e->owner_fd = cmd_fd;
+    e->holders[0].cmd_fd = cmd_fd;
+    e->charged = true;
+    e->state = SHARED_MR_READY;
+    
+    tenant_resource_usage_t *usage = &shm->tenants[e->tenant_id].usage;
+    usage->mr_count++;
+    usage->total_mr_regs++;
+    
+    tenant_shm_unlock(shm);
+    return 0;
+}
+
+int tenant_shared_mr_set_holder_fd(int slot, pid_t pid, int cmd_fd) {
+    if (slot < 0 || slot >= MAX_SHARED_MRS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    int ret = -1;
+    tenant_shm_lock(shm);
+    
+    shared_mr_entry_t *e = &shm->shared_mrs[slot];
+    for (uint32_t i = 0; i < e->holder_count; i++) {
+        if (e->holders[i].pid == pid) {
+            e->holders[i].cmd_fd = cmd_fd;
+            if (e->owner_pid == 0) {
+                e->owner_pid = pid;
+                e->owner_fd = cmd_fd;
+            }
+            ret = 0;
+            break;
+        }
+    }
+    
+    tenant_shm_unlock(shm);
+    return ret;
+}
+
+int tenant_shared_mr_release(int slot, pid_t pid, bool *last) {
+    if (last) {
+        *last = false;
+    }
+    if (slot < 0 || slot >= MAX_SHARED_MRS) {
+        return -1;
+    }
+    
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return -1;
+    }
+    
+    tenant_shm_lock(shm);
+    
+    shared_mr_entry_t *e = &shm->shared_mrs[slot];
+    int ret = -1;
+    for (uint32_t i = 0; i < e->holder_count; i++) {
+        if (e->holders[i].pid == pid) {
+            shared_mr_remove_holder_locked(e, i);
+            ret = 0;
+            break;
+        }
+    }
+    
+    if (ret == 0 && e->holder_count == 0) {
+        shared_mr_free_locked(shm, e);
+        if (last) {
+            *last = true;
+        }
+    }
+    
+    tenant_shm_unlock(shm);
+    return ret;
+}
+
+int tenant_shared_mr_reap(void) {
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    if (!shm) {
+        return 0;
+    }
+    
+    tenant_shm_lock(shm);
+    int freed = shared_mr_reap_locked(shm);
+    tenant_shm_unlock(shm);
+    return freed;
+}
@@ -6,10 +6,32 @@
 #include <stdbool.h>
 #include "shared_memory.h"
 
-// 最大租户数
+// 最大租户数（基准测试可以在编译时放大，此时须同时指定独立的TENANT_SHM_NAME）
+#ifndef MAX_TENANTS
 #define MAX_TENANTS 64
+#endif
 #define TENANT_NAME_MAX 64
+#ifndef TENANT_SHM_NAME
 #define TENANT_SHM_NAME "/rdma_intercept_tenant_shm_v2"
+#endif
+// 共享内存布局版本（tenant_shared_memory_t及其成员的布局变化时加1）
+#define TENANT_SHM_LAYOUT_VERSION 1
+
+// 跨进程共享MR登记表
+#define MAX_SHARED_MRS 128
+#define MAX_SHARED_MR_HOLDERS 16
+#define SHARED_MR_NAME_MAX 64
+
+// QP创建延迟直方图桶数（第i桶为[2^i, 2^(i+1))微秒，第0桶含<2us，最后一桶含更长）
+#define QP_CREATE_LAT_BUCKETS 16
+
+// QP状态统计槽数（与enum ibv_qp_state取值一致：RESET..ERR, UNKNOWN），RTS为活跃状态
+#define TENANT_QP_STATES 8
+#define TENANT_QP_STATE_RTS 3
+
+// QP创建准入队列槽数（同一租户同时排队的创建请求上限）与等待时间直方图桶数
+#define CREATE_ADMIT_SLOTS 256
+#define CREATE_WAIT_BUCKETS 16
 
 // 租户状态
 enum tenant_status {
@@ -18,6 +40,16 @@ enum tenant_status {
     TENANT_STATUS_SUSPENDED = 2, // 暂停
 };
 
+// 单个QP/CQ的容量预算（各项为0表示不限制）
+typedef struct {
+    uint32_t max_send_wr;            // 发送队列深度
+    uint32_t max_recv_wr;            // 接收队列深度
+    uint32_t max_sge;                // 每个WR的SGE数（发送和接收）
+    uint32_t max_inline_data;        // 内联数据长度
+    uint32_t max_cqe;                // CQ容量
+    uint8_t clamp;                   // 1=超出预算时收缩到预算，0=拒绝创建
+} tenant_caps_budget_t;
+
 // 租户资源配额
 typedef struct {
     uint32_t max_qp_per_tenant;      // 每租户最大QP数
@@ -25,8 +57,38 @@ typedef struct {
     uint64_t max_memory_per_tenant;  // 每租户最大内存
     uint32_t max_cq_per_tenant;      // 每租户最大CQ数
     uint32_t max_pd_per_tenant;      // 每租户最大PD数
+    uint64_t max_dm_bytes_per_tenant; // 每租户最大设备内存（字节，0表示不限制）
+    uint32_t max_ah_per_tenant;      // 每租户最大AH数（0表示不限制）
+    tenant_caps_budget_t caps;       // 单个QP/CQ的容量预算
+    uint64_t max_queue_memory;       // 每租户QP/CQ队列缓冲区估算总量上限（字节，0表示不限制）
+    uint32_t max_active_qp_per_tenant; // 每租户处于RTS状态的QP数上限（0表示不限制）
+    uint32_t max_ws_qps_per_tenant;  // 每租户每个窗口内投递过的QP数上限（0表示不限制，启用节流时生效）
+    uint32_t qp_create_rate;         // 每秒允许真实创建的QP数（0表示不限制）
+    uint32_t qp_create_burst;        // 创建令牌桶容量（0表示等于qp_create_rate）
 } tenant_quota_t;
 
+// 令牌桶状态
+typedef struct {
+    uint64_t tokens_milli;           // 当前令牌数（千分之一个）
+    uint64_t last_refill_ns;         // 上次补充时间（CLOCK_MONOTONIC，0表示未初始化）
+} create_bucket_t;
+
+// QP创建准入队列：超出速率的调用方按票号FIFO排队，队首等待令牌，其余在serving上futex等待
+typedef struct {
+    create_bucket_t bucket;
+    volatile uint32_t serving;       // 当前队首票号（futex字）
+    uint32_t next_ticket;            // 下一个票号
+    pid_t waiter_pid[CREATE_ADMIT_SLOTS]; // 持票进程（0表示已放弃）
+    uint32_t depth;                  // 当前排队数
+    uint32_t depth_peak;             // 排队数峰值
+    uint64_t admitted;               // 放行次数
+    uint64_t delayed;                // 需要排队等待的次数
+    uint64_t timeouts;               // 超时或队列满被拒绝的次数
+    uint64_t wait_hist[CREATE_WAIT_BUCKETS]; // 等待时间分布（第i桶为[2^i, 2^(i+1))微秒，第0桶含<2us）
+    uint32_t wait_p50_us;            // 等待时间中位数（所在桶上界）
+    uint32_t wait_p99_us;            // 等待时间P99（所在桶上界）
+} create_admit_queue_t;
+
 // 租户资源使用统计
 typedef struct {
     int qp_count;
@@ -38,6 +100,30 @@ typedef struct {
     uint64_t total_qp_destroys;
     uint64_t total_mr_regs;
     uint64_t total_mr_deregs;
+    uint64_t total_mr_coalesced;   // 合并注册命中次数（节省的MR条目）
+    int dm_count;                  // 设备内存分配数
+    uint64_t dm_used;              // 设备内存使用量（字节）
+    uint64_t total_mr_imported;    // 从共享登记表导入MR的次数（省去的重复注册）
+    int qp_pooled;                 // QP池中闲置的QP数（仍计入qp_count）
+    uint64_t qp_pool_hits;         // 由QP池直接满足的创建次数
+    uint64_t qp_pool_misses;       // 启用QP池时需要真实创建的次数
+    uint64_t qp_create_lat_hist[QP_CREATE_LAT_BUCKETS]; // QP创建延迟分布
+    int cq_pooled;                 // CQ池中闲置的CQ数（不计入cq_count）
+    int pd_pooled;                 // PD池中闲置的PD数（不计入pd_count）
+    int ah_count;                  // 地址句柄数（含缓存中闲置的AH）
+    uint64_t ah_cache_hits;        // 由AH缓存直接满足的创建次数
+    int srq_substituted;           // 透明挂到共享SRQ的QP数
+    uint64_t recv_wr_saved;        // 共享SRQ省去的接收队列深度（WR数）
+    uint64_t caps_clamped;         // 容量被收缩到预算内的QP/CQ创建次数
+    uint64_t queue_mem_used;       // QP/CQ队列缓冲区估算用量（字节）
+    int ud_vqp_count;              // 虚拟UD QP数（不计入qp_count）
+    int ud_real_qp_count;          // 承载虚拟UD QP的真实QP数（计入qp_count）
+    uint32_t qp_state_count[TENANT_QP_STATES]; // 按状态（enum ibv_qp_state）统计的QP数
+    uint64_t ws_window;            // 工作集当前窗口号（单调时钟/窗口长度）
+    uint32_t ws_qps;               // 当前窗口内投递过的不同QP数
+    uint32_t ws_qps_last;          // 最近一个完整窗口的工作集
+    uint32_t ws_qps_peak;          // 工作集峰值
+    uint64_t ws_throttled;         // 因超出工作集被节流的次数
 } tenant_resource_usage_t;
 
 // 租户信息结构
@@ -45,14 +131,25 @@ typedef struct {
     uint32_t tenant_id;                          // 租户ID
     char tenant_name[TENANT_NAME_MAX];           // 租户名称
     enum tenant_status status;                   // 租户状态
-    tenant_quota_t quota;                        // 资源配额
+    tenant_quota_t quota;                        // 资源配额（共享内存中以quota_gens为准，查询接口返回时填充）
     tenant_resource_usage_t usage;               // 资源使用
     time_t created_at;                           // 创建时间
     time_t last_active_at;                       // 最后活跃时间
     uint32_t process_count;                      // 关联的进程数
     pid_t processes[MAX_PROCESSES];              // 关联的进程列表
+    create_admit_queue_t create_admit;           // QP创建准入队列
 } tenant_info_t;
 
+// 租户状态快照（不含进程列表与准入队列，供WATCH比较变化）
+typedef struct {
+    uint32_t tenant_id;
+    char tenant_name[TENANT_NAME_MAX];
+    enum tenant_status status;
+    tenant_quota_t quota;
+    tenant_resource_usage_t usage;
+    uint32_t process_count;
+} tenant_snapshot_t;
+
 // 进程到租户的映射
 typedef struct {
     pid_t pid;           // 进程ID
@@ -60,8 +157,60 @@ typedef struct {
     time_t mapped_at;    // 映射时间
 } pid_tenant_mapping_t;
 
+// 共享MR表项状态
+enum shared_mr_state {
+    SHARED_MR_FREE = 0,      // 空闲
+    SHARED_MR_PENDING = 1,   // 首个进程正在注册
+    SHARED_MR_READY = 2,     // 已发布，可导入
+};
+
+// 共享MR持有者（持有MR句柄及其上下文cmd_fd的进程）
+typedef struct {
+    pid_t pid;
+    int cmd_fd;                  // 该进程中上下文的cmd_fd，-1表示尚未导入完成
+} shared_mr_holder_t;
+
+// 共享MR表项：同一租户的进程按(共享内存对象, 偏移, 长度, 权限)共享一个MR
+typedef struct {
+    enum shared_mr_state state;
+    uint32_t tenant_id;
+    char shm_name[SHARED_MR_NAME_MAX];
+    uint64_t offset;
+    uint64_t length;
+    int access;
+    uint32_t pd_handle;          // 内核PD句柄
+    uint32_t mr_handle;          // 内核MR句柄
+    uint32_t lkey;
+    uint32_t rkey;
+    pid_t owner_pid;             // 供导入的进程（cmd_fd通过pidfd_getfd获取）
+    int owner_fd;
+    bool charged;                // 内存是否已计入租户（只计一次）
+    uint32_t holder_count;
+    shared_mr_holder_t holders[MAX_SHARED_MR_HOLDERS];
+    time_t created_at;
+} shared_mr_entry_t;
+
+// 全局配额上限：所有活跃租户配额之和不能超过该值（0表示不检查）
+typedef struct {
+    uint64_t max_total_qp;
+    uint64_t max_total_mr;
+    uint64_t max_total_memory;
+} tenant_global_limits_t;
+
+// 配额表的一代：写者只改非当前代，seq为奇数表示正在写入
+typedef struct {
+    volatile uint64_t seq;
+    tenant_quota_t quotas[MAX_TENANTS];
+} tenant_quota_gen_t;
+
 // 租户共享内存数据结构
 typedef struct {
+    // 布局标识（位于开头，偏移与布局无关）：连接已有的共享内存时核对，
+    // 不一致说明段由不同布局的程序创建，拒绝连接而不是按错误的偏移读写
+    uint32_t layout_version;             // TENANT_SHM_LAYOUT_VERSION
+    uint32_t layout_max_tenants;         // MAX_TENANTS
+    uint64_t layout_size;                // sizeof(tenant_shared_memory_t)
+    
     // 租户信息数组
     tenant_info_t tenants[MAX_TENANTS];
     
@@ -80,13 +229,31 @@ typedef struct {
     
     // 最后更新时间
     uint64_t last_update_time;
+    
+    // 跨进程共享MR登记表
+    shared_mr_entry_t shared_mrs[MAX_SHARED_MRS];
+    
+    // 全局QP创建速率（所有租户共享的令牌桶，0表示不限制）
+    uint32_t global_qp_create_rate;
+    uint32_t global_qp_create_burst;
+    create_bucket_t global_create_bucket;
+    
+    // 全局配额上限（批量或单个更新配额时检查配额之和）
+    tenant_global_limits_t global_limits;
+    
+    // 双缓冲配额表：写者在quota_write_lock下写非当前代，再原子切换quota_active，
+    // 读者不取tenant_shm_lock，更新配额也不阻塞准入检查
+    tenant_quota_gen_t quota_gens[2];
+    volatile uint32_t quota_active;      // 当前代下标
+    volatile int quota_write_lock;       // 配额写者之间互斥
+    volatile uint64_t quota_epoch;       // 每次发布加1
 } tenant_shared_memory_t;
 
 // ========== 租户管理API ==========
 
 /**
- * 初始化租户共享内存
- * @return 0成功，-1失败
+ * 初始化租户共享内存（不存在时创建，已存在时核对布局标识）
+ * @return 0成功，-1失败（布局不兼容时errno为EPROTO）
  */
 int tenant_shm_init(void);
 
@@ -123,6 +290,15 @@ void tenant_shm_unlock(tenant_shared_memory_t* data);
  */
 int tenant_create(uint32_t tenant_id, const char *name, const tenant_quota_t *quota);
 
+/**
+ * 创建租户，与批量配额更新相同地检查全部活跃租户的配额之和不超出全局上限
+ * @param tenant_id 租户ID
+ * @param name 租户名称
+ * @param quota 资源配额
+ * @return 0成功，-1失败（超出全局上限时errno为EDQUOT）
+ */
+int tenant_create_within_limits(uint32_t tenant_id, const char *name, const tenant_quota_t *quota);
+
 /**
  * 删除租户
  * @param tenant_id 租户ID
@@ -154,6 +330,36 @@ int tenant_set_status(uint32_t tenant_id, enum tenant_status status);
  */
 int tenant_update_quota(uint32_t tenant_id, const tenant_quota_t *quota);
 
+/**
+ * 读取租户当前生效的配额（无锁，读到正在被覆盖的代时重试）
+ * @param tenant_id 租户ID
+ * @param quota 输出参数
+ * @return 0成功，-1租户不存在
+ */
+int tenant_get_quota(uint32_t tenant_id, tenant_quota_t *quota);
+
+/**
+ * 获取配额发布的纪元号，每次单个或批量更新配额加1
+ */
+uint64_t tenant_quota_epoch(void);
+
+/**
+ * 批量更新租户配额：全部校验通过后写入非当前代，一次切换发布，
+ * 只推进一次version和配额纪元，读者要么看到全部旧配额，要么看到全部新配额
+ * @param tenant_ids 租户ID数组（不允许重复）
+ * @param quotas 对应的新配额
+ * @param count 数量
+ * @param failed_index 输出参数，校验失败的条目下标（-1表示全局配额之和超限），可为NULL
+ * @return 0成功，-1失败（errno=EINVAL租户无效或重复，EDQUOT超过全局配额上限），失败时不修改任何配额
+ */
+int tenant_update_quota_batch(const uint32_t *tenant_ids, const tenant_quota_t *quotas,
+                              int count, int *failed_index);
+
+/**
+ * 设置全局配额上限（不影响已生效的配额，只约束之后的更新）
+ */
+int tenant_set_global_limits(const tenant_global_limits_t *limits);
+
 /**
  * 将进程绑定到租户
  * @param pid 进程ID
@@ -179,6 +385,7 @@ int tenant_get_process_tenant(pid_t pid, uint32_t *tenant_id);
 
 /**
  * 更新租户资源使用
+ * 注意：memory_used/dm_used/queue_mem_used/ah_count由tenant_charge_resource维护，此处不会覆盖
  * @param tenant_id 租户ID
  * @param usage 资源使用情况
  * @return 0成功，-1失败
@@ -193,10 +400,58 @@ int tenant_update_resource_usage(uint32_t tenant_id, const tenant_resource_usage
  */
 int tenant_get_resource_usage(uint32_t tenant_id, tenant_resource_usage_t *usage);
 
+/**
+ * 原子地检查并记账租户字节类资源和AH数（检查与更新在同一把锁内完成）
+ * @param tenant_id 租户ID
+ * @param resource_type 资源类型（2=Memory, 5=Device Memory, 11=AH, 18=Queue Memory）
+ * @param amount 正数为申请（超出配额则不记账），负数为归还
+ * @return 0成功，-1超出配额或租户无效
+ */
+int tenant_charge_resource(uint32_t tenant_id, int resource_type, int64_t amount);
+
+/**
+ * 记录一次QP创建（延迟分布与QP池命中统计）
+ * @param pool_hit 1命中QP池，0未命中，-1未启用QP池
+ * @param latency_us 创建耗时（微秒）
+ * @return 0成功，-1失败
+ */
+int tenant_record_qp_create(uint32_t tenant_id, int pool_hit, uint64_t latency_us);
+
+/**
+ * 记录一次QP状态迁移（检查与更新在同一把锁内完成）
+ * @param from 原状态（enum ibv_qp_state），-1表示新建
+ * @param to 新状态，-1表示销毁
+ * @param enforce 为true时进入RTS受max_active_qp_per_tenant限制
+ * @return 0成功，-1超出活跃QP配额或租户无效
+ */
+int tenant_qp_state_change(uint32_t tenant_id, int from, int to, bool enforce);
+
+/**
+ * 记录某个QP在窗口内的首次投递（工作集计数）
+ * @param window 窗口号，早于当前窗口的记录被忽略，晚于当前窗口时先滚动窗口
+ * @param enforce 为true时工作集达到max_ws_qps_per_tenant则拒绝（不计入）
+ * @return 0计入工作集，-1超出工作集或租户无效
+ */
+int tenant_ws_enter(uint32_t tenant_id, uint64_t window, bool enforce);
+
+/**
+ * QP创建准入：按租户和全局令牌桶限速，超出速率时在租户FIFO队列中等待
+ * @param timeout_ms 最长等待时间
+ * @return 0放行，-1超时、队列满（errno=ETIMEDOUT/EAGAIN）或租户无效
+ */
+int tenant_qp_create_admit(uint32_t tenant_id, uint32_t timeout_ms);
+
+/**
+ * 设置全局QP创建速率
+ * @param rate 每秒创建数（0表示不限制）
+ * @param burst 令牌桶容量（0表示等于rate）
+ */
+int tenant_set_global_create_rate(uint32_t rate, uint32_t burst);
+
 /**
  * 检查租户资源限制
  * @param tenant_id 租户ID
- * @param resource_type 资源类型（0=QP, 1=MR, 2=Memory）
+ * @param resource_type 资源类型（0=QP, 1=MR, 2=Memory, 3=CQ, 4=PD, 5=Device Memory, 18=Queue Memory）
  * @param requested_amount 请求的资源量
  * @return true超出限制，false未超出
  */
@@ -210,6 +465,14 @@ bool tenant_check_resource_limit(uint32_t tenant_id, int resource_type, uint32_t
  */
 int tenant_get_active_list(tenant_info_t *tenants, int max_count);
 
+/**
+ * 逐个租户短暂加锁复制所有租户槽位的状态和用量（只读，不推进version）。
+ * 每个租户的数据自洽，不同租户之间不保证是同一时刻
+ * @param snaps 输出参数，长度为MAX_TENANTS，下标即租户ID
+ * @return 开始复制前的数据版本号，共享内存不可用时返回0
+ */
+uint64_t tenant_snapshot_all(tenant_snapshot_t *snaps);
+
 /**
  * 打印所有租户信息（调试用）
  */
@@ -224,4 +487,43 @@ void tenant_print_all(void);
  */
 int tenant_get_statistics(uint32_t tenant_id, uint64_t *total_qp_creates, uint64_t *total_mr_regs);
 
+// ========== 跨进程共享MR登记表API ==========
+
+/**
+ * 查找或预留共享MR表项（先清理已退出的持有者）
+ * 找到已发布的表项时登记pid为持有者；未找到时预留新表项，由调用方注册后发布
+ * @param slot 输出参数，表项下标
+ * @param entry 输出参数，表项快照（导入时使用）
+ * @return 1表示可导入，0表示调用方成为首个注册者，-1失败（errno=EBUSY正在被其它进程注册，ENOSPC表满）
+ */
+int tenant_shared_mr_acquire(uint32_t tenant_id, const char *shm_name, uint64_t offset, uint64_t length,
+                             int access, pid_t pid, int *slot, shared_mr_entry_t *entry);
+
+/**
+ * 首个注册者发布MR句柄（内存已由调用方计入租户，此后由登记表负责归还）
+ * @return 0成功，-1失败
+ */
+int tenant_shared_mr_publish(int slot, pid_t pid, int cmd_fd, uint32_t pd_handle, uint32_t mr_handle,
+                             uint32_t lkey, uint32_t rkey);
+
+/**
+ * 导入方导入成功后登记自己的cmd_fd，使其在原注册者退出后可继续供导入
+ * @return 0成功，-1失败
+ */
+int tenant_shared_mr_set_holder_fd(int slot, pid_t pid, int cmd_fd);
+
+/**
+ * 释放持有（包括放弃预留的表项）
+ * 最后一个持有者释放时清空表项并归还租户的MR计数和内存
+ * @param last 输出参数，是否为最后一个持有者（调用方需真正注销MR）
+ * @return 0成功，-1失败
+ */
+int tenant_shared_mr_release(int slot, pid_t pid, bool *last);
+
+/**
+ * 清理已退出进程的持有记录
+ * @return 被清空的表项数
+ */
+int tenant_shared_mr_reap(void);
+
 #endif // SHARED_MEMORY_TENANT_H
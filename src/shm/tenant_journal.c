@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "tenant_journal.h"
+
+#define JOURNAL_MAGIC "TNTJRNL1"
+#define JOURNAL_VERSION 1
+#define JOURNAL_PAGE_SIZE 4096
+#define JOURNAL_HEADER_SIZE JOURNAL_PAGE_SIZE
+#define JOURNAL_RECORD_SIZE 256
+
+// 记录类型
+enum {
+    JOURNAL_REC_PUT = 1,                // 创建或修改租户（完整定义）
+    JOURNAL_REC_DELETE = 2,             // 删除租户
+    JOURNAL_REC_GLOBALS = 3,            // 全局设置
+};
+
+// 文件头：打开已有文件时与当前编译的布局逐项比较
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t max_tenants;
+    uint32_t record_size;
+    uint32_t tenant_size;               // sizeof(tenant_journal_tenant_t)，配额结构变化时不兼容
+    uint32_t slot_size;
+    uint32_t capacity;
+} journal_file_header_t;
+
+// 快照槽
+typedef struct {
+    uint32_t crc;                       // 覆盖crc之后到最后一个租户
+    uint32_t count;
+    uint64_t gen;
+    tenant_journal_globals_t globals;
+    tenant_journal_tenant_t tenants[];  // 只保存存在的租户
+} journal_snapshot_t;
+
+// 记录（文件中按JOURNAL_RECORD_SIZE对齐存放）
+typedef struct {
+    uint32_t crc;                       // 覆盖crc之后的整条记录
+    uint32_t type;
+    uint32_t group_left;                // 同组中其后还有的记录数，0表示组结束
+    uint32_t reserved;
+    uint64_t gen;                       // 所属快照代号
+    uint64_t seq;                       // 代内序号，等于记录下标
+    union {
+        tenant_journal_tenant_t tenant;
+        tenant_journal_globals_t globals;
+        uint32_t tenant_id;
+    } u;
+} journal_record_t;
+
+_Static_assert(sizeof(journal_record_t) <= JOURNAL_RECORD_SIZE, "journal record too large");
+_Static_assert(sizeof(journal_file_header_t) <= JOURNAL_HEADER_SIZE, "journal header too large");
+
+struct tenant_journal {
+    int fd;
+    int flags;
+    uint8_t *map;
+    size_t map_size;
+    uint32_t capacity;
+    uint32_t slot_size;
+    uint64_t gen;                       // 当前代号（最新快照的代号）
+    uint32_t next;                      // 下一条记录的下标
+    tenant_journal_state_t state;
+};
+
+static uint32_t crc_table[256];
+
+static void crc32_init(void) {
+    if (crc_table[1]) {
+        return;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_buf(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t c = 0xFFFFFFFFU;
+    while (len--) {
+        c = crc_table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFU;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t journal_slot_size(void) {
+    size_t size = sizeof(journal_snapshot_t) + MAX_TENANTS * sizeof(tenant_journal_tenant_t);
+    return (uint32_t)((size + JOURNAL_PAGE_SIZE - 1) / JOURNAL_PAGE_SIZE * JOURNAL_PAGE_SIZE);
+}
+
+static size_t journal_file_size(const journal_file_header_t *hdr) {
+    return JOURNAL_HEADER_SIZE + 2 * (size_t)hdr->slot_size + (size_t)hdr->capacity * JOURNAL_RECORD_SIZE;
+}
+
+static journal_snapshot_t *journal_slot(const tenant_journal_t *j, uint64_t gen) {
+    return (journal_snapshot_t *)(j->map + JOURNAL_HEADER_SIZE + (gen & 1) * j->slot_size);
+}
+
+static journal_record_t *journal_rec(const tenant_journal_t *j, uint32_t idx) {
+    return (journal_record_t *)(j->map + JOURNAL_HEADER_SIZE + 2 * (size_t)j->slot_size +
+                                (size_t)idx * JOURNAL_RECORD_SIZE);
+}
+
+static uint32_t snapshot_crc(const journal_snapshot_t *s) {
+    return crc32_buf(&s->count, offsetof(journal_snapshot_t, tenants) - offsetof(journal_snapshot_t, count) +
+                     (size_t)s->count * sizeof(tenant_journal_tenant_t));
+}
+
+static uint32_t record_crc(const journal_record_t *r) {
+    return crc32_buf((const uint8_t *)r + sizeof(r->crc), sizeof(*r) - sizeof(r->crc));
+}
+
+static int snapshot_valid(const journal_snapshot_t *s) {
+    return s->gen != 0 && s->count <= MAX_TENANTS && s->crc == snapshot_crc(s);
+}
+
+static void journal_apply(tenant_journal_state_t *st, const journal_record_t *r) {
+    switch (r->type) {
+        case JOURNAL_REC_PUT:
+            if (r->u.tenant.tenant_id < MAX_TENANTS) {
+                st->present[r->u.tenant.tenant_id] = 1;
+                st->tenants[r->u.tenant.tenant_id] = r->u.tenant;
+            }
+            break;
+        case JOURNAL_REC_DELETE:
+            if (r->u.tenant_id < MAX_TENANTS) {
+                st->present[r->u.tenant_id] = 0;
+            }
+            break;
+        case JOURNAL_REC_GLOBALS:
+            st->globals = r->u.globals;
+            break;
+    }
+}
+
+// 把当前状态写入gen对应的快照槽并落盘
+static int journal_write_snapshot(tenant_journal_t *j, uint64_t gen) {
+    journal_snapshot_t *s = journal_slot(j, gen);
+    uint32_t n = 0;
+    
+    s->gen = gen;
+    s->globals = j->state.globals;
+    for (uint32_t id = 0; id < MAX_TENANTS; id++) {
+        if (j->state.present[id]) {
+            s->tenants[n++] = j->state.tenants[id];
+        }
+    }
+    s->count = n;
+    s->crc = snapshot_crc(s);
+    if (msync(s, j->slot_size, MS_SYNC) != 0) {
+        // 没有落盘的快照不能被重放选中，否则之后按旧代号写的记录会被忽略
+        s->crc = ~s->crc;
+        return -1;
+    }
+    return 0;
+}
+
+// 从快照和同代记录重建状态，返回后j->next指向第一条无效记录
+static int journal_replay(tenant_journal_t *j, tenant_journal_stats_t *stats) {
+    const journal_snapshot_t *s0 = journal_slot(j, 0), *s1 = journal_slot(j, 1);
+    const journal_snapshot_t *snap = NULL;
+    
+    if (snapshot_valid(s0)) {
+        snap = s0;
+    }
+    if (snapshot_valid(s1) && (!snap || s1->gen > snap->gen)) {
+        snap = s1;
+    }
+    if (!snap) {
+        errno = EBADMSG;
+        return -1;
+    }
+    
+    memset(&j->state, 0, sizeof(j->state));
+    j->state.globals = snap->globals;
+    for (uint32_t i = 0; i < snap->count; i++) {
+        uint32_t id = snap->tenants[i].tenant_id;
+        if (id < MAX_TENANTS) {
+            j->state.present[id] = 1;
+            j->state.tenants[id] = snap->tenants[i];
+        }
+    }
+    j->gen = snap->gen;
+    
+    // 逐条校验，整组完整后才应用
+    uint32_t group_start = 0, i;
+    for (i = 0; i < j->capacity; i++) {
+        const journal_record_t *r = journal_rec(j, i);
+        if (r->gen != j->gen || r->seq != i || r->crc != record_crc(r)) {
+            break;
+        }
+        if (i > group_start && r->group_left + 1 != journal_rec(j, i - 1)->group_left) {
+            break;
+        }
+        if (r->group_left == 0) {
+            for (uint32_t k = group_start; k <= i; k++) {
+                journal_apply(&j->state, journal_rec(j, k));
+            }
+            group_start = i + 1;
+        }
+    }
+    
+    // 清掉不完整的组，之后的追加不会与残留记录拼成一组
+    for (uint32_t k = group_start; k < i; k++) {
+        memset(journal_rec(j, k), 0, JOURNAL_RECORD_SIZE);
+    }
+    j->next = group_start;
+    
+    if (stats) {
+        stats->snapshot_gen = snap->gen;
+        stats->snapshot_tenants = snap->count;
+        stats->records = group_start;
+        stats->discarded = i - group_start;
+    }
+    return 0;
+}
+
+// 打开或创建日志文件并重放
+tenant_journal_t* tenant_journal_open(const char *path, uint32_t capacity, int flags,
+                                      tenant_journal_stats_t *stats) {
+    uint64_t start = monotonic_ns();
+    crc32_init();
+    
+    // 一组记录最多MAX_TENANTS条，容量至少能放下两组
+    if (capacity < 2 * MAX_TENANTS) {
+        capacity = 2 * MAX_TENANTS;
+    }
+    
+    tenant_journal_t *j = calloc(1, sizeof(*j));
+    if (!j) {
+        return NULL;
+    }
+    j->flags = flags;
+    j->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (j->fd < 0) {
+        free(j);
+        return NULL;
+    }
+    
+    journal_file_header_t want = {
+        .magic = JOURNAL_MAGIC,
+        .version = JOURNAL_VERSION,
+        .max_tenants = MAX_TENANTS,
+        .record_size = JOURNAL_RECORD_SIZE,
+        .tenant_size = sizeof(tenant_journal_tenant_t),
+        .slot_size = journal_slot_size(),
+        .capacity = capacity,
+    };
+    journal_file_header_t hdr;
+    struct stat st;
+    int created = 0;
+    
+    if (fstat(j->fd, &st) != 0) {
+        goto fail;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if (st.st_size > 0 && pread(j->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    if (hdr.magic[0] == '\0') {
+        // 新文件（或创建后还没写入文件头）
+        hdr = want;
+        if (ftruncate(j->fd, journal_file_size(&hdr)) != 0) {
+            goto fail;
+        }
+        created = 1;
+    } else {
+        want.capacity = hdr.capacity;
+        if (memcmp(&hdr, &want, sizeof(hdr)) != 0 || (size_t)st.st_size != journal_file_size(&hdr)) {
+            fprintf(stderr, "[TENANT_JOURNAL] %s的格式与当前版本不兼容\n", path);
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+    
+    j->capacity = hdr.capacity;
+    j->slot_size = hdr.slot_size;
+    j->map_size = journal_file_size(&hdr);
+    j->map = mmap(NULL, j->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+    if (j->map == MAP_FAILED) {
+        j->map = NULL;
+        goto fail;
+    }
+    
+    if (created) {
+        // 先写空快照，文件头最后写入，中途崩溃的文件下次仍按新文件处理
+        j->gen = 1;
+        if (journal_write_snapshot(j, j->gen) != 0) {
+            goto fail;
+        }
+        memcpy(j->map, &hdr, sizeof(hdr));
+        if (msync(j->map, JOURNAL_HEADER_SIZE, MS_SYNC) != 0) {
+            goto fail;
+        }
+        if (stats) {
+            memset(stats, 0, sizeof(*stats));
+            stats->snapshot_gen = j->gen;
+        }
+    } else {
+        if (stats) {
+            memset(stats, 0, sizeof(*stats));
+        }
+        if (journal_replay(j, stats) != 0) {
+            fprintf(stderr, "[TENANT_JOURNAL] %s的两个快照槽都已损坏\n", path);
+            goto fail;
+        }
+    }
+    
+    if (stats) {
+        stats->tenants = 0;
+        for (uint32_t id = 0; id < MAX_TENANTS; id++) {
+            stats->tenants += j->state.present[id];
+        }
+        stats->replay_ns = monotonic_ns() - start;
+    }
+    return j;
+    
+fail:
+    {
+        int err = errno;
+        tenant_journal_close(j);
+        errno = err;
+    }
+    return NULL;
+}
+
+// 当前折叠后的状态
+const tenant_journal_state_t* tenant_journal_state(const tenant_journal_t *j) {
+    return &j->state;
+}
+
+// 为count条记录腾出连续空间，返回第一条的下标
+static int journal_reserve(tenant_journal_t *j, uint32_t count) {
+    if (count == 0 || count > MAX_TENANTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (j->next + count > j->capacity && tenant_journal_compact(j) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// 填写已写好内容的count条记录的头部并校验，落盘（SYNC）后应用到状态
+static int journal_commit(tenant_journal_t *j, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        journal_record_t *r = journal_rec(j, j->next + i);
+        r->group_left = count - 1 - i;
+        r->reserved = 0;
+        r->gen = j->gen;
+        r->seq = j->next + i;
+        r->crc = record_crc(r);
+    }
+    if (j->flags & TENANT_JOURNAL_SYNC) {
+        uintptr_t begin = (uintptr_t)journal_rec(j, j->next) & ~(uintptr_t)(JOURNAL_PAGE_SIZE - 1);
+        uintptr_t end = (uintptr_t)journal_rec(j, j->next + count);
+        if (msync((void *)begin, end - begin, MS_SYNC) != 0) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        journal_apply(&j->state, journal_rec(j, j->next + i));
+    }
+    j->next += count;
+    return 0;
+}
+
+// 追加一组租户定义
+int tenant_journal_put(tenant_journal_t *j, const tenant_journal_tenant_t *tenants, int count) {
+    if (!j || !tenants || count <= 0 || journal_reserve(j, (uint32_t)count) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        journal_record_t *r = journal_rec(j, j->next + i);
+        memset(r, 0, JOURNAL_RECORD_SIZE);
+        r->type = JOURNAL_REC_PUT;
+        r->u.tenant = tenants[i];
+        r->u.tenant.name[TENANT_NAME_MAX - 1] = '\0';
+    }
+    return journal_commit(j, (uint32_t)count);
+}
+
+// 追加租户删除记录
+int tenant_journal_delete(tenant_journal_t *j, uint32_t tenant_id) {
+    if (!j || journal_reserve(j, 1) != 0) {
+        return -1;
+    }
+    journal_record_t *r = journal_rec(j, j->next);
+    memset(r, 0, JOURNAL_RECORD_SIZE);
+    r->type = JOURNAL_REC_DELETE;
+    r->u.tenant_id = tenant_id;
+    return journal_commit(j, 1);
+}
+
+// 追加全局设置
+int tenant_journal_set_globals(tenant_journal_t *j, const tenant_journal_globals_t *globals) {
+    if (!j || !globals || journal_reserve(j, 1) != 0) {
+        return -1;
+    }
+    journal_record_t *r = journal_rec(j, j->next);
+    memset(r, 0, JOURNAL_RECORD_SIZE);
+    r->type = JOURNAL_REC_GLOBALS;
+    r->u.globals = *globals;
+    return journal_commit(j, 1);
+}
+
+// 写新快照并从头开始新一代记录
+int tenant_journal_compact(tenant_journal_t *j) {
+    if (!j) {
+        return -1;
+    }
+    if (journal_write_snapshot(j, j->gen + 1) != 0) {
+        return -1;
+    }
+    j->gen++;
+    j->next = 0;
+    return 0;
+}
+
+// 用给定状态替换日志内容
+int tenant_journal_reset(tenant_journal_t *j, const tenant_journal_state_t *state) {
+    if (!j || !state) {
+        return -1;
+    }
+    j->state = *state;
+    return tenant_journal_compact(j);
+}
+
+// 当前代中的记录数
+uint32_t tenant_journal_records(const tenant_journal_t *j) {
+    return j ? j->next : 0;
+}
+
+// 关闭日志
+void tenant_journal_close(tenant_journal_t *j) {
+    if (!j) {
+        return;
+    }
+    if (j->map) {
+        munmap(j->map, j->map_size);
+    }
+    if (j->fd >= 0) {
+        close(j->fd);
+    }
+    free(j);
+}
+
+// 按状态在租户共享内存中创建租户
+int tenant_journal_restore(const tenant_journal_state_t *state) {
+    int n = 0;
+    
+    for (uint32_t id = 0; id < MAX_TENANTS; id++) {
+        if (!state->present[id]) {
+            continue;
+        }
+        const tenant_journal_tenant_t *t = &state->tenants[id];
+        if (tenant_create(id, t->name, &t->quota) != 0) {
+            continue;
+        }
+        if (t->status != TENANT_STATUS_ACTIVE && t->status != TENANT_STATUS_INACTIVE) {
+            tenant_set_status(id, (enum tenant_status)t->status);
+        }
+        n++;
+    }
+    tenant_set_global_limits(&state->globals.limits);
+    tenant_set_global_create_rate(state->globals.create_rate, state->globals.create_burst);
+    return n;
+}
+
+// 从租户共享内存读取当前定义
+int tenant_journal_capture(tenant_journal_state_t *state) {
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    tenant_info_t info;
+    int n = 0;
+    
+    memset(state, 0, sizeof(*state));
+    if (!shm) {
+        return 0;
+    }
+    for (uint32_t id = 0; id < MAX_TENANTS; id++) {
+        if (tenant_get_info(id, &info) != 0) {
+            continue;
+        }
+        tenant_journal_tenant_t *t = &state->tenants[id];
+        t->tenant_id = id;
+        t->status = info.status;
+        memcpy(t->name, info.tenant_name, TENANT_NAME_MAX);
+        t->quota = info.quota;
+        state->present[id] = 1;
+        n++;
+    }
+    tenant_shm_lock(shm);
+    state->globals.limits = shm->global_limits;
+    state->globals.create_rate = shm->global_qp_create_rate;
+    state->globals.create_burst = shm->global_qp_create_burst;
+    tenant_shm_unlock(shm);
+    return n;
+}
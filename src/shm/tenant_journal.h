@@ -0,0 +1,126 @@
+#ifndef TENANT_JOURNAL_H
+#define TENANT_JOURNAL_H
+
+#include <stdint.h>
+#include "shared_memory_tenant.h"
+
+/*
+ * 租户定义的持久化日志
+ *
+ * /dev/shm中的租户表在节点重启或tenant_shm_destroy()后丢失。守护进程把每次成功的修改
+ * 作为定长记录追加到内存映射文件中，记录写满时把当前全部定义压缩成快照，从头开始新一代
+ * 日志。启动时取最新的有效快照，再按顺序重放同一代的记录。
+ *
+ * 文件布局：文件头 | 快照槽0 | 快照槽1 | 记录[capacity]
+ * - 快照按代号轮流写入两个槽，msync落盘后才开始写新一代记录，写快照时崩溃仍能用旧槽恢复
+ * - 记录带CRC、代号和代内序号，重放遇到校验失败、代号或序号不符即停止，撕裂的尾部被丢弃
+ * - 一次修改涉及多个租户（BATCH）时成组写入，只有整组完整才生效
+ *
+ * 记录保存租户的完整定义而不是操作，重放是幂等的覆盖。接口不加锁，由调用方串行化。
+ */
+
+#define TENANT_JOURNAL_DEFAULT_CAPACITY 16384   // 默认记录容量（每条256字节，共4MB）
+#define TENANT_JOURNAL_SYNC 0x1                 // 每次追加后msync(MS_SYNC)，掉电也不丢已确认的修改
+
+// 持久化的租户定义
+typedef struct {
+    uint32_t tenant_id;
+    uint32_t status;                    // enum tenant_status
+    char name[TENANT_NAME_MAX];
+    tenant_quota_t quota;
+} tenant_journal_tenant_t;
+
+// 持久化的全局设置
+typedef struct {
+    tenant_global_limits_t limits;
+    uint32_t create_rate;
+    uint32_t create_burst;
+} tenant_journal_globals_t;
+
+// 日志折叠后的状态（按租户ID索引）
+typedef struct {
+    tenant_journal_globals_t globals;
+    uint8_t present[MAX_TENANTS];
+    tenant_journal_tenant_t tenants[MAX_TENANTS];
+} tenant_journal_state_t;
+
+// 打开日志时的重放统计
+typedef struct {
+    uint64_t snapshot_gen;              // 使用的快照代号
+    uint32_t snapshot_tenants;          // 快照中的租户数
+    uint32_t records;                   // 重放的记录数
+    uint32_t discarded;                 // 丢弃的不完整组中的记录数
+    uint32_t tenants;                   // 重放后的租户数
+    uint64_t replay_ns;                 // 映射、校验和重放的耗时
+} tenant_journal_stats_t;
+
+typedef struct tenant_journal tenant_journal_t;
+
+/**
+ * 打开或创建日志文件并重放
+ * @param capacity 新建文件的记录容量（已有文件以文件头为准）
+ * @param flags TENANT_JOURNAL_SYNC等
+ * @param stats 输出重放统计，可为NULL
+ * @return 日志句柄，失败返回NULL并设置errno（EINVAL：文件格式不兼容，EBADMSG：两个快照槽都损坏）
+ */
+tenant_journal_t* tenant_journal_open(const char *path, uint32_t capacity, int flags,
+                                      tenant_journal_stats_t *stats);
+
+/**
+ * 当前折叠后的状态（包含已追加的全部修改）
+ */
+const tenant_journal_state_t* tenant_journal_state(const tenant_journal_t *j);
+
+/**
+ * 追加一组租户定义（创建或修改），count条记录整体生效
+ * @return 0成功，-1失败
+ */
+int tenant_journal_put(tenant_journal_t *j, const tenant_journal_tenant_t *tenants, int count);
+
+/**
+ * 追加租户删除记录
+ * @return 0成功，-1失败
+ */
+int tenant_journal_delete(tenant_journal_t *j, uint32_t tenant_id);
+
+/**
+ * 追加全局设置
+ * @return 0成功，-1失败
+ */
+int tenant_journal_set_globals(tenant_journal_t *j, const tenant_journal_globals_t *globals);
+
+/**
+ * 把当前状态写成新快照并清空记录（记录写满时自动调用）
+ * @return 0成功，-1失败
+ */
+int tenant_journal_compact(tenant_journal_t *j);
+
+/**
+ * 用给定状态替换日志内容并写快照
+ * @return 0成功，-1失败
+ */
+int tenant_journal_reset(tenant_journal_t *j, const tenant_journal_state_t *state);
+
+/**
+ * 当前代中的记录数
+ */
+uint32_t tenant_journal_records(const tenant_journal_t *j);
+
+/**
+ * 关闭日志（不自动压缩）
+ */
+void tenant_journal_close(tenant_journal_t *j);
+
+/**
+ * 在租户共享内存中按状态创建租户并设置全局参数（共享内存中尚无这些租户）
+ * @return 创建的租户数
+ */
+int tenant_journal_restore(const tenant_journal_state_t *state);
+
+/**
+ * 从租户共享内存读取当前的租户定义和全局参数
+ * @return 租户数
+ */
+int tenant_journal_capture(tenant_journal_state_t *state);
+
+#endif // TENANT_JOURNAL_H
@@ -5,11 +5,17 @@
  * 支持动态配额更新（无需重启应用程序）
  * 
  * 用法：
- *   tenant_manager_client create <tenant_id> <qp> <mr> [memory] [name]
+ *   tenant_manager_client create <tenant_id> <qp> <mr> [memory] [name] [dm] [ah] [qmem] [active_qp] [ws_qps]
  *   tenant_manager_client delete <tenant_id>
- *   tenant_manager_client update <tenant_id> <qp> <mr> [memory]   <- ★ 热更新
+ *   tenant_manager_client update <tenant_id> <qp> <mr> [memory] [dm] [ah] [qmem] [active_qp] [ws_qps]   <- ★ 热更新
+ *   tenant_manager_client caps <tenant_id> <send_wr> <recv_wr> <sge> <inline> <cqe> [clamp|reject]
+ *   tenant_manager_client batch <file|->        <- 原子地批量更新多个租户的配额
+ *   tenant_manager_client limits <total_qp> <total_mr> <total_memory>
  *   tenant_manager_client status [tenant_id]
  *   tenant_manager_client list
+ *   tenant_manager_client watch [tenant_id|all] [interval_ms] [field,...]   <- 持续输出发生变化的租户字段
+ *   tenant_manager_client --binary update|delete ...    <- 使用二进制协议（见tenant_proto.h）
+ *   tenant_manager_client --ring update|delete ...      <- 经共享内存命令环提交（见tenant_cmd_ring.h），不可用时改走Socket
  * 
  * 示例：
  *   # 创建租户
@@ -26,20 +32,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <errno.h>
 #include <json-c/json.h>
 
+#include "tenant_proto.h"
+#include "tenant_cmd_ring.h"
+
 #define SOCKET_PATH "/tmp/rdma_tenant_manager.sock"
 #define BUFFER_SIZE 4096
 
-/* 发送命令到daemon并接收响应 */
-char* send_command(const char* json_cmd) {
+/* 连接daemon */
+static int connect_daemon(void) {
     int fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (fd < 0) {
         perror("socket");
-        return NULL;
+        return -1;
     }
     
     struct sockaddr_un addr;
@@ -50,33 +63,263 @@ char* send_command(const char* json_cmd) {
     if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("connect (is daemon running?)");
         close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 发送命令到daemon并接收响应 */
+char* send_command(const char* json_cmd) {
+    int fd = connect_daemon();
+    if (fd < 0) {
         return NULL;
     }
     
-    if (send(fd, json_cmd, strlen(json_cmd), 0) < 0) {
+    // 请求以换行结尾
+    if (send(fd, json_cmd, strlen(json_cmd), 0) < 0 || send(fd, "\n", 1, 0) < 0) {
         perror("send");
         close(fd);
         return NULL;
     }
     
-    char* response = malloc(BUFFER_SIZE);
+    // 读到换行为止（STATUS响应可能超过一个缓冲区）
+    size_t cap = BUFFER_SIZE, len = 0;
+    char* response = malloc(cap);
     if (!response) {
         close(fd);
         return NULL;
     }
     
-    int n = recv(fd, response, BUFFER_SIZE - 1, 0);
+    for (;;) {
+        if (len + 1 >= cap) {
+            char* p = realloc(response, cap * 2);
+            if (!p) {
+                break;
+            }
+            response = p;
+            cap *= 2;
+        }
+        ssize_t n = recv(fd, response + len, cap - len - 1, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        if (memchr(response + len - n, '\n', n)) {
+            break;
+        }
+    }
     close(fd);
     
-    if (n <= 0) {
+    if (len == 0) {
         free(response);
         return NULL;
     }
     
-    response[n] = '\0';
+    response[len] = '\0';
     return response;
 }
 
+/* 二进制协议：读取一个完整的帧 */
+static int recv_frame(int fd, tenant_proto_hdr_t* hdr, uint8_t* body, size_t cap) {
+    size_t got = 0;
+    while (got < sizeof(*hdr)) {
+        ssize_t n = recv(fd, (char*)hdr + got, sizeof(*hdr) - got, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        got += n;
+    }
+    if (hdr->magic != TENANT_PROTO_MAGIC || hdr->length > cap) {
+        return -1;
+    }
+    got = 0;
+    while (got < hdr->length) {
+        ssize_t n = recv(fd, body + got, hdr->length - got, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+/* 二进制协议：解析响应中的状态、协商版本和说明 */
+static uint64_t parse_binary_status(const uint8_t* body, uint32_t len, uint64_t* version, char* msg, size_t cap) {
+    uint64_t status = 0;
+    size_t off = 0;
+    uint16_t tag, vlen;
+    const uint8_t* val;
+    msg[0] = '\0';
+    while (tenant_proto_next(body, len, &off, &tag, &val, &vlen) > 0) {
+        if (tag == TENANT_TLV_STATUS) {
+            tenant_proto_get_uint(val, vlen, &status);
+        } else if (tag == TENANT_TLV_VERSION && version) {
+            tenant_proto_get_uint(val, vlen, version);
+        } else if (tag == TENANT_TLV_MESSAGE) {
+            size_t n = vlen < cap - 1 ? vlen : cap - 1;
+            memcpy(msg, val, n);
+            msg[n] = '\0';
+        }
+    }
+    return status;
+}
+
+/* 二进制协议：HELLO与请求一次发出，返回请求的状态（0成功，-1通信失败） */
+int send_binary_command(uint16_t type, const uint8_t* body, size_t len) {
+    int fd = connect_daemon();
+    if (fd < 0) {
+        return -1;
+    }
+    
+    uint8_t buf[2 * sizeof(tenant_proto_hdr_t) + 64 + 512];
+    size_t off = sizeof(tenant_proto_hdr_t);
+    tenant_proto_put_u32(buf, &off, sizeof(buf), TENANT_TLV_VERSION, TENANT_PROTO_VERSION);
+    tenant_proto_hdr_t hello = {
+        .magic = TENANT_PROTO_MAGIC,
+        .version = TENANT_PROTO_VERSION,
+        .type = TENANT_PROTO_HELLO,
+        .seq = 0,
+        .length = (uint32_t)(off - sizeof(tenant_proto_hdr_t))
+    };
+    memcpy(buf, &hello, sizeof(hello));
+    
+    tenant_proto_hdr_t req = {
+        .magic = TENANT_PROTO_MAGIC,
+        .version = TENANT_PROTO_VERSION,
+        .type = type,
+        .seq = 1,
+        .length = (uint32_t)len
+    };
+    if (off + sizeof(req) + len > sizeof(buf)) {
+        close(fd);
+        return -1;
+    }
+    memcpy(buf + off, &req, sizeof(req));
+    memcpy(buf + off + sizeof(req), body, len);
+    off += sizeof(req) + len;
+    
+    if (send(fd, buf, off, 0) < 0) {
+        perror("send");
+        close(fd);
+        return -1;
+    }
+    
+    // 依次读取HELLO和请求的响应
+    tenant_proto_hdr_t hdr;
+    uint8_t resp[TENANT_PROTO_MAX_BODY];
+    int ret = -1;
+    for (int i = 0; i < 2; i++) {
+        if (recv_frame(fd, &hdr, resp, sizeof(resp)) != 0) {
+            fprintf(stderr, "Invalid binary response (daemon may not support the binary protocol)\n");
+            ret = -1;
+            break;
+        }
+        
+        uint64_t version = 0;
+        char msg[256];
+        uint64_t status = parse_binary_status(resp, hdr.length, &version, msg, sizeof(msg));
+        
+        if (hdr.seq == 0) {
+            printf("Protocol version: %lu\n", (unsigned long)version);
+            if (status != 0) {
+                printf("✗ Failed\nMessage: %s\n", msg);
+                ret = (int)status;
+                break;
+            }
+            continue;
+        }
+        printf("%s\n", status == 0 ? "✓ Success" : "✗ Failed");
+        if (status != 0) {
+            printf("Message: %s (%s)\n", msg, strerror((int)status));
+        }
+        ret = (int)status;
+    }
+    
+    close(fd);
+    return ret;
+}
+
+/*
+ * 共享内存命令环：不经过Socket提交一个二进制请求，返回请求的状态；
+ * 命令环不存在、无权限、守护进程不在或环已满时返回-1，调用方改走Socket
+ */
+int send_ring_command(uint16_t type, const uint8_t* body, size_t len) {
+    int fd = shm_open(TENANT_RING_NAME, O_RDWR, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    tenant_cmd_ring_t* ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        return -1;
+    }
+    
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != TENANT_RING_MAGIC ||
+        ring->version != TENANT_RING_VERSION ||
+        (kill(ring->daemon_pid, 0) != 0 && errno == ESRCH)) {
+        munmap(ring, sizeof(*ring));
+        return -1;
+    }
+    
+    int slot = tenant_ring_acquire_slot(ring);
+    if (slot < 0) {
+        munmap(ring, sizeof(*ring));
+        return -1;
+    }
+    
+    tenant_proto_hdr_t hdr;
+    uint8_t resp[TENANT_RING_MSG_MAX];
+    uint64_t start = tenant_ring_now_ns();
+    if (tenant_ring_submit(ring, slot, type, 1, body, (uint32_t)len) != 0) {
+        tenant_ring_release_slot(ring, slot);
+        munmap(ring, sizeof(*ring));
+        return -1;
+    }
+    if (tenant_ring_wait(ring, slot, 5000, &hdr, resp) != 0) {
+        // 请求已进入命令环，不能再改走Socket重复提交；槽留给守护进程写回后回收
+        fprintf(stderr, "No response from daemon over the command ring: %s\n", strerror(errno));
+        munmap(ring, sizeof(*ring));
+        return -2;
+    }
+    uint64_t rtt_ns = tenant_ring_now_ns() - start;
+    tenant_ring_release_slot(ring, slot);
+    munmap(ring, sizeof(*ring));
+    
+    if (hdr.length == 0) {
+        fprintf(stderr, "Empty response from daemon\n");
+        return -2;
+    }
+    char msg[256];
+    uint64_t status = parse_binary_status(resp, hdr.length, NULL, msg, sizeof(msg));
+    printf("%s (command ring, %.1f us)\n", status == 0 ? "✓ Success" : "✗ Failed", rtt_ns / 1e3);
+    if (status != 0) {
+        printf("Message: %s (%s)\n", msg, strerror((int)status));
+    }
+    return (int)status;
+}
+
+/* 二进制协议：根据命令行构建请求消息体，返回消息类型（0表示不支持） */
+uint16_t build_binary_cmd(int argc, char* argv[], uint8_t* body, size_t cap, size_t* len) {
+    *len = 0;
+    if (strcmp(argv[1], "delete") == 0 && argc >= 3) {
+        tenant_proto_put_u32(body, len, cap, TENANT_TLV_TENANT, (uint32_t)atoi(argv[2]));
+        return TENANT_PROTO_DELETE;
+    }
+    if ((strcmp(argv[1], "update") == 0 || strcmp(argv[1], "set-quota") == 0) && argc >= 5) {
+        tenant_proto_put_u32(body, len, cap, TENANT_TLV_TENANT, (uint32_t)atoi(argv[2]));
+        tenant_proto_put_u32(body, len, cap, TENANT_TLV_QP, (uint32_t)atoi(argv[3]));
+        tenant_proto_put_u32(body, len, cap, TENANT_TLV_MR, (uint32_t)atoi(argv[4]));
+        // 可选字段依次为memory, dm, ah, qmem, active_qp, ws_qps，与JSON的update参数一致
+        static const uint16_t tags[] = {TENANT_TLV_MEMORY, TENANT_TLV_DM, TENANT_TLV_AH,
+                                        TENANT_TLV_QMEM, TENANT_TLV_ACTIVE_QP, TENANT_TLV_WS_QPS};
+        for (int i = 0; i < 6 && 5 + i < argc; i++) {
+            tenant_proto_put_u64(body, len, cap, tags[i], (uint64_t)atoll(argv[5 + i]));
+        }
+        return TENANT_PROTO_UPDATE_QUOTA;
+    }
+    return 0;
+}
+
 /* 打印JSON响应（格式化） */
 void print_response(const char* response) {
     json_object* obj = json_tokener_parse(response);
@@ -148,6 +391,25 @@ void print_response(const char* response) {
             if (json_object_object_get_ex(data_obj, "version", &version_obj)) {
                 printf("  Policy version: %lu\n", json_object_get_int64(version_obj));
             }
+            if (json_object_object_get_ex(data_obj, "quota_epoch", &version_obj)) {
+                printf("  Quota epoch: %lu\n", json_object_get_int64(version_obj));
+            }
+            json_object *applied_obj, *apply_obj, *limits_obj, *v;
+            if (json_object_object_get_ex(data_obj, "applied", &applied_obj) &&
+                json_object_object_get_ex(data_obj, "apply_ns", &apply_obj)) {
+                printf("  Applied: %d tenants in %.1f us\n", json_object_get_int(applied_obj),
+                       json_object_get_int64(apply_obj) / 1000.0);
+            }
+            if (json_object_object_get_ex(data_obj, "global_limits", &limits_obj)) {
+                const char *keys[] = {"qp", "mr", "memory"};
+                printf("  Global limits (0 = unchecked):");
+                for (int k = 0; k < 3; k++) {
+                    if (json_object_object_get_ex(limits_obj, keys[k], &v)) {
+                        printf(" %s=%lu", keys[k], (unsigned long)json_object_get_int64(v));
+                    }
+                }
+                printf("\n");
+            }
             
             if (json_object_object_get_ex(data_obj, "tenants", &tenants_obj) &&
                 json_object_is_type(tenants_obj, json_type_array)) {
@@ -182,7 +444,7 @@ void print_response(const char* response) {
             // 单个租户状态
             else {
                 json_object *id_obj, *name_obj, *qp_used, *qp_limit, *mr_used, *mr_limit;
-                json_object *mem_used, *mem_limit, *total_qp, *total_mr;
+                json_object *mem_used, *mem_limit, *total_qp, *total_mr, *coalesced, *imported;
                 
                 if (json_object_object_get_ex(data_obj, "id", &id_obj)) {
                     printf("  Tenant ID: %d\n", json_object_get_int(id_obj));
@@ -198,6 +460,23 @@ void print_response(const char* response) {
                     json_object_object_get_ex(data_obj, "qp_limit", &qp_limit)) {
                     printf("  QP: %d/%d\n", json_object_get_int(qp_used), json_object_get_int(qp_limit));
                 }
+                json_object *qp_states, *active_limit;
+                if (json_object_object_get_ex(data_obj, "qp_states", &qp_states) &&
+                    json_object_object_get_ex(data_obj, "active_qp_limit", &active_limit)) {
+                    json_object *f;
+                    printf("  QP states:");
+                    const char *states[] = {"reset", "init", "rtr", "rts", "sqd", "sqe", "err", "unknown"};
+                    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); i++) {
+                        if (json_object_object_get_ex(qp_states, states[i], &f) && json_object_get_int64(f) > 0) {
+                            printf(" %s=%ld", states[i], (long)json_object_get_int64(f));
+                        }
+                    }
+                    if (json_object_object_get_ex(qp_states, "rts", &f)) {
+                        printf(" (active %ld/%ld)", (long)json_object_get_int64(f),
+                               (long)json_object_get_int64(active_limit));
+                    }
+                    printf("\n");
+                }
                 if (json_object_object_get_ex(data_obj, "mr_used", &mr_used) &&
                     json_object_object_get_ex(data_obj, "mr_limit", &mr_limit)) {
                     printf("  MR: %d/%d\n", json_object_get_int(mr_used), json_object_get_int(mr_limit));
@@ -208,12 +487,131 @@ void print_response(const char* response) {
                            (unsigned long)json_object_get_int64(mem_used),
                            (unsigned long)json_object_get_int64(mem_limit));
                 }
+                if (json_object_object_get_ex(data_obj, "dm_used", &mem_used) &&
+                    json_object_object_get_ex(data_obj, "dm_limit", &mem_limit)) {
+                    printf("  Device memory: %lu/%lu bytes\n", 
+                           (unsigned long)json_object_get_int64(mem_used),
+                           (unsigned long)json_object_get_int64(mem_limit));
+                }
+                if (json_object_object_get_ex(data_obj, "queue_mem_used", &mem_used) &&
+                    json_object_object_get_ex(data_obj, "queue_mem_limit", &mem_limit)) {
+                    printf("  Queue memory (estimated): %lu/%lu bytes\n", 
+                           (unsigned long)json_object_get_int64(mem_used),
+                           (unsigned long)json_object_get_int64(mem_limit));
+                }
                 if (json_object_object_get_ex(data_obj, "total_qp_creates", &total_qp)) {
                     printf("  Total QP creates: %lu\n", (unsigned long)json_object_get_int64(total_qp));
                 }
                 if (json_object_object_get_ex(data_obj, "total_mr_regs", &total_mr)) {
                     printf("  Total MR registers: %lu\n", (unsigned long)json_object_get_int64(total_mr));
                 }
+                if (json_object_object_get_ex(data_obj, "mr_coalesced", &coalesced)) {
+                    printf("  MR coalesced (entries saved): %lu\n", (unsigned long)json_object_get_int64(coalesced));
+                }
+                if (json_object_object_get_ex(data_obj, "mr_imported", &imported)) {
+                    printf("  MR imported (shared registrations): %lu\n", (unsigned long)json_object_get_int64(imported));
+                }
+                json_object *pooled, *pool_hits, *pool_misses, *lat_hist;
+                if (json_object_object_get_ex(data_obj, "qp_pooled", &pooled) &&
+                    json_object_object_get_ex(data_obj, "qp_pool_hits", &pool_hits) &&
+                    json_object_object_get_ex(data_obj, "qp_pool_misses", &pool_misses)) {
+                    uint64_t hits = (uint64_t)json_object_get_int64(pool_hits);
+                    uint64_t misses = (uint64_t)json_object_get_int64(pool_misses);
+                    if (hits + misses > 0 || json_object_get_int(pooled) > 0) {
+                        printf("  QP pool: %d idle, hit rate %.1f%% (%lu/%lu)\n",
+                               json_object_get_int(pooled),
+                               hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+                               (unsigned long)hits, (unsigned long)(hits + misses));
+                    }
+                }
+                json_object *cq_used, *cq_pooled, *pd_used, *pd_pooled;
+                if (json_object_object_get_ex(data_obj, "cq_used", &cq_used) &&
+                    json_object_object_get_ex(data_obj, "cq_pooled", &cq_pooled) &&
+                    json_object_object_get_ex(data_obj, "pd_used", &pd_used) &&
+                    json_object_object_get_ex(data_obj, "pd_pooled", &pd_pooled)) {
+                    printf("  CQ: %d in use, %d pooled; PD: %d in use, %d pooled\n",
+                           json_object_get_int(cq_used), json_object_get_int(cq_pooled),
+                           json_object_get_int(pd_used), json_object_get_int(pd_pooled));
+                }
+                json_object *ah_used, *ah_limit, *ah_hits;
+                if (json_object_object_get_ex(data_obj, "ah_used", &ah_used) &&
+                    json_object_object_get_ex(data_obj, "ah_limit", &ah_limit) &&
+                    json_object_object_get_ex(data_obj, "ah_cache_hits", &ah_hits)) {
+                    printf("  AH: %d/%lu, cache hits %lu\n", json_object_get_int(ah_used),
+                           (unsigned long)json_object_get_int64(ah_limit),
+                           (unsigned long)json_object_get_int64(ah_hits));
+                }
+                json_object *srq_sub, *wr_saved;
+                if (json_object_object_get_ex(data_obj, "srq_substituted", &srq_sub) &&
+                    json_object_object_get_ex(data_obj, "recv_wr_saved", &wr_saved) &&
+                    json_object_get_int(srq_sub) > 0) {
+                    printf("  QPs on shared SRQ: %d (receive WRs saved: %lu)\n", json_object_get_int(srq_sub),
+                           (unsigned long)json_object_get_int64(wr_saved));
+                }
+                json_object *caps, *clamped;
+                if (json_object_object_get_ex(data_obj, "caps", &caps)) {
+                    json_object *f;
+                    printf("  Caps budget:");
+                    const char *keys[] = {"send_wr", "recv_wr", "sge", "inline", "cqe"};
+                    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+                        if (json_object_object_get_ex(caps, keys[i], &f) && json_object_get_int64(f) > 0) {
+                            printf(" %s=%ld", keys[i], (long)json_object_get_int64(f));
+                        }
+                    }
+                    if (json_object_object_get_ex(caps, "policy", &f)) {
+                        printf(" (%s)", json_object_get_string(f));
+                    }
+                    if (json_object_object_get_ex(data_obj, "caps_clamped", &clamped)) {
+                        printf(", clamped %lu", (unsigned long)json_object_get_int64(clamped));
+                    }
+                    printf("\n");
+                }
+                json_object *ud_vqps, *ud_real;
+                if (json_object_object_get_ex(data_obj, "ud_vqps", &ud_vqps) &&
+                    json_object_object_get_ex(data_obj, "ud_real_qps", &ud_real) &&
+                    json_object_get_int(ud_vqps) > 0) {
+                    printf("  Virtual UD QPs: %d over %d real QPs\n", json_object_get_int(ud_vqps),
+                           json_object_get_int(ud_real));
+                }
+                json_object *ws_cur, *ws_last, *ws_peak, *ws_limit, *ws_throttled;
+                if (json_object_object_get_ex(data_obj, "ws_qps", &ws_cur) &&
+                    json_object_object_get_ex(data_obj, "ws_qps_last", &ws_last) &&
+                    json_object_object_get_ex(data_obj, "ws_qps_peak", &ws_peak) &&
+                    json_object_object_get_ex(data_obj, "ws_limit", &ws_limit) &&
+                    json_object_object_get_ex(data_obj, "ws_throttled", &ws_throttled) &&
+                    json_object_get_int64(ws_peak) > 0) {
+                    printf("  QP working set: current %ld, last window %ld, peak %ld (limit %ld, throttled %lu)\n",
+                           (long)json_object_get_int64(ws_cur), (long)json_object_get_int64(ws_last),
+                           (long)json_object_get_int64(ws_peak), (long)json_object_get_int64(ws_limit),
+                           (unsigned long)json_object_get_int64(ws_throttled));
+                }
+                json_object *create_rate, *v;
+                if (json_object_object_get_ex(data_obj, "create_rate", &create_rate)) {
+                    const char *keys[] = {"rate", "burst", "global_rate", "depth", "depth_peak",
+                                          "admitted", "delayed", "timeouts", "wait_p50_us", "wait_p99_us"};
+                    long vals[10] = {0};
+                    for (int k = 0; k < 10; k++) {
+                        if (json_object_object_get_ex(create_rate, keys[k], &v)) {
+                            vals[k] = (long)json_object_get_int64(v);
+                        }
+                    }
+                    if (vals[0] > 0 || vals[2] > 0) {
+                        printf("  QP create rate: %ld/s (burst %ld, global %ld/s), queue %ld (peak %ld)\n",
+                               vals[0], vals[1], vals[2], vals[3], vals[4]);
+                        printf("  QP create admission: %ld admitted, %ld delayed, %ld timed out, wait p50 %ld us, p99 %ld us\n",
+                               vals[5], vals[6], vals[7], vals[8], vals[9]);
+                    }
+                }
+                if (json_object_object_get_ex(data_obj, "qp_create_lat_hist", &lat_hist)) {
+                    size_t n = json_object_array_length(lat_hist);
+                    for (size_t i = 0; i < n; i++) {
+                        uint64_t cnt = (uint64_t)json_object_get_int64(json_object_array_get_idx(lat_hist, i));
+                        if (cnt > 0) {
+                            printf("  QP create latency %s%lu us: %lu\n", i == 0 ? "<" : ">=",
+                                   i == 0 ? 2UL : 1UL << i, (unsigned long)cnt);
+                        }
+                    }
+                }
             }
         }
     }
@@ -224,7 +622,7 @@ void print_response(const char* response) {
 /* 构建JSON命令 */
 char* build_create_cmd(int argc, char* argv[]) {
     if (argc < 5) {
-        fprintf(stderr, "Usage: %s create <tenant_id> <qp> <mr> [memory] [name]\n", argv[0]);
+        fprintf(stderr, "Usage: %s create <tenant_id> <qp> <mr> [memory] [name] [dm] [ah] [qmem] [active_qp] [ws_qps]\n", argv[0]);
         return NULL;
     }
     
@@ -233,6 +631,11 @@ char* build_create_cmd(int argc, char* argv[]) {
     int mr = atoi(argv[4]);
     uint64_t mem = (argc > 5) ? (uint64_t)atoll(argv[5]) : 1073741824ULL;
     const char* name = (argc > 6) ? argv[6] : "unnamed";
+    uint64_t dm = (argc > 7) ? (uint64_t)atoll(argv[7]) : 0;
+    uint32_t ah = (argc > 8) ? (uint32_t)atoi(argv[8]) : 0;
+    uint64_t qmem = (argc > 9) ? (uint64_t)atoll(argv[9]) : 0;
+    uint32_t active = (argc > 10) ? (uint32_t)atoi(argv[10]) : 0;
+    uint32_t ws = (argc > 11) ? (uint32_t)atoi(argv[11]) : 0;
     
     json_object* cmd = json_object_new_object();
     json_object_object_add(cmd, "cmd", json_object_new_string("CREATE"));
@@ -241,6 +644,11 @@ char* build_create_cmd(int argc, char* argv[]) {
     json_object_object_add(cmd, "qp", json_object_new_int(qp));
     json_object_object_add(cmd, "mr", json_object_new_int(mr));
     json_object_object_add(cmd, "memory", json_object_new_int64(mem));
+    json_object_object_add(cmd, "dm", json_object_new_int64(dm));
+    json_object_object_add(cmd, "ah", json_object_new_int(ah));
+    json_object_object_add(cmd, "qmem", json_object_new_int64(qmem));
+    json_object_object_add(cmd, "active_qp", json_object_new_int(active));
+    json_object_object_add(cmd, "ws_qps", json_object_new_int(ws));
     
     const char* str = json_object_to_json_string(cmd);
     char* result = strdup(str);
@@ -268,7 +676,7 @@ char* build_delete_cmd(int argc, char* argv[]) {
 
 char* build_update_cmd(int argc, char* argv[]) {
     if (argc < 5) {
-        fprintf(stderr, "Usage: %s update <tenant_id> <qp> <mr> [memory]\n", argv[0]);
+        fprintf(stderr, "Usage: %s update <tenant_id> <qp> <mr> [memory] [dm] [ah] [qmem] [active_qp] [ws_qps]\n", argv[0]);
         fprintf(stderr, "\n  ★ Hot Update - No application restart needed!\n");
         return NULL;
     }
@@ -284,6 +692,139 @@ char* build_update_cmd(int argc, char* argv[]) {
     json_object_object_add(cmd, "qp", json_object_new_int(qp));
     json_object_object_add(cmd, "mr", json_object_new_int(mr));
     json_object_object_add(cmd, "memory", json_object_new_int64(mem));
+    if (argc > 6) {
+        json_object_object_add(cmd, "dm", json_object_new_int64(atoll(argv[6])));
+    }
+    if (argc > 7) {
+        json_object_object_add(cmd, "ah", json_object_new_int(atoi(argv[7])));
+    }
+    if (argc > 8) {
+        json_object_object_add(cmd, "qmem", json_object_new_int64(atoll(argv[8])));
+    }
+    if (argc > 9) {
+        json_object_object_add(cmd, "active_qp", json_object_new_int(atoi(argv[9])));
+    }
+    if (argc > 10) {
+        json_object_object_add(cmd, "ws_qps", json_object_new_int(atoi(argv[10])));
+    }
+    
+    const char* str = json_object_to_json_string(cmd);
+    char* result = strdup(str);
+    json_object_put(cmd);
+    return result;
+}
+
+char* build_caps_cmd(int argc, char* argv[]) {
+    if (argc < 8) {
+        fprintf(stderr, "Usage: %s caps <tenant_id> <send_wr> <recv_wr> <sge> <inline> <cqe> [clamp|reject]\n", argv[0]);
+        fprintf(stderr, "\n  0 means unlimited; clamp shrinks oversized QPs/CQs instead of rejecting them\n");
+        return NULL;
+    }
+    
+    json_object* cmd = json_object_new_object();
+    json_object_object_add(cmd, "cmd", json_object_new_string("SET_CAPS"));
+    json_object_object_add(cmd, "tenant", json_object_new_int(atoi(argv[2])));
+    json_object_object_add(cmd, "send_wr", json_object_new_int(atoi(argv[3])));
+    json_object_object_add(cmd, "recv_wr", json_object_new_int(atoi(argv[4])));
+    json_object_object_add(cmd, "sge", json_object_new_int(atoi(argv[5])));
+    json_object_object_add(cmd, "inline", json_object_new_int(atoi(argv[6])));
+    json_object_object_add(cmd, "cqe", json_object_new_int(atoi(argv[7])));
+    json_object_object_add(cmd, "policy", json_object_new_string(argc > 8 ? argv[8] : "clamp"));
+    
+    const char* str = json_object_to_json_string(cmd);
+    char* result = strdup(str);
+    json_object_put(cmd);
+    return result;
+}
+
+/* 从文件读取批量配额更新，每行"<tenant_id> <qp> <mr> [memory]"，#开头为注释 */
+char* build_batch_cmd(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s batch <file|->\n", argv[0]);
+        fprintf(stderr, "\n  Each line: <tenant_id> <qp> <mr> [memory]; all updates are applied atomically\n");
+        return NULL;
+    }
+    
+    FILE* fp = strcmp(argv[2], "-") == 0 ? stdin : fopen(argv[2], "r");
+    if (!fp) {
+        perror("fopen");
+        return NULL;
+    }
+    
+    json_object* updates = json_object_new_array();
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        unsigned int tenant, qp, mr;
+        unsigned long long mem;
+        char* p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0') {
+            continue;
+        }
+        int n = sscanf(p, "%u %u %u %llu", &tenant, &qp, &mr, &mem);
+        if (n < 3) {
+            fprintf(stderr, "Line %d: expected <tenant_id> <qp> <mr> [memory]\n", lineno);
+            json_object_put(updates);
+            if (fp != stdin) fclose(fp);
+            return NULL;
+        }
+        json_object* u = json_object_new_object();
+        json_object_object_add(u, "tenant", json_object_new_int(tenant));
+        json_object_object_add(u, "qp", json_object_new_int(qp));
+        json_object_object_add(u, "mr", json_object_new_int(mr));
+        if (n > 3) {
+            json_object_object_add(u, "memory", json_object_new_int64(mem));
+        }
+        json_object_array_add(updates, u);
+    }
+    if (fp != stdin) fclose(fp);
+    
+    json_object* cmd = json_object_new_object();
+    json_object_object_add(cmd, "cmd", json_object_new_string("BATCH"));
+    json_object_object_add(cmd, "updates", updates);
+    
+    const char* str = json_object_to_json_string(cmd);
+    char* result = strdup(str);
+    json_object_put(cmd);
+    return result;
+}
+
+char* build_limits_cmd(int argc, char* argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s limits <total_qp> <total_mr> <total_memory>\n", argv[0]);
+        fprintf(stderr, "\n  Upper bound on the sum of all tenants' quotas; 0 means unchecked\n");
+        return NULL;
+    }
+    
+    json_object* cmd = json_object_new_object();
+    json_object_object_add(cmd, "cmd", json_object_new_string("SET_GLOBAL_LIMITS"));
+    json_object_object_add(cmd, "qp", json_object_new_int64(atoll(argv[2])));
+    json_object_object_add(cmd, "mr", json_object_new_int64(atoll(argv[3])));
+    json_object_object_add(cmd, "memory", json_object_new_int64(atoll(argv[4])));
+    
+    const char* str = json_object_to_json_string(cmd);
+    char* result = strdup(str);
+    json_object_put(cmd);
+    return result;
+}
+
+char* build_rate_cmd(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s rate <tenant_id|global> <creates_per_sec> [burst]\n", argv[0]);
+        fprintf(stderr, "\n  0 means unlimited; burst defaults to creates_per_sec\n");
+        return NULL;
+    }
+    
+    json_object* cmd = json_object_new_object();
+    json_object_object_add(cmd, "cmd", json_object_new_string("SET_CREATE_RATE"));
+    if (strcmp(argv[2], "global") != 0) {
+        json_object_object_add(cmd, "tenant", json_object_new_int(atoi(argv[2])));
+    }
+    json_object_object_add(cmd, "rate", json_object_new_int(atoi(argv[3])));
+    if (argc > 4) {
+        json_object_object_add(cmd, "burst", json_object_new_int(atoi(argv[4])));
+    }
     
     const char* str = json_object_to_json_string(cmd);
     char* result = strdup(str);
@@ -316,28 +857,138 @@ char* build_list_cmd(void) {
     return result;
 }
 
+/*
+ * 订阅租户变化：先打印守护进程的确认，之后每行输出一个变化事件（JSON），
+ * 直到守护进程关闭连接或被中断
+ */
+int run_watch(int argc, char* argv[]) {
+    json_object* cmd = json_object_new_object();
+    json_object_object_add(cmd, "cmd", json_object_new_string("WATCH"));
+    if (argc > 2 && strcmp(argv[2], "all") != 0) {
+        json_object_object_add(cmd, "tenant", json_object_new_int(atoi(argv[2])));
+    }
+    if (argc > 3) {
+        json_object_object_add(cmd, "interval_ms", json_object_new_int(atoi(argv[3])));
+    }
+    if (argc > 4) {
+        json_object* fields = json_object_new_array();
+        char* list = strdup(argv[4]);
+        char* save = NULL;
+        for (char* f = list ? strtok_r(list, ",", &save) : NULL; f; f = strtok_r(NULL, ",", &save)) {
+            json_object_array_add(fields, json_object_new_string(f));
+        }
+        free(list);
+        json_object_object_add(cmd, "fields", fields);
+    }
+    
+    int fd = connect_daemon();
+    if (fd < 0) {
+        json_object_put(cmd);
+        return -1;
+    }
+    const char* str = json_object_to_json_string(cmd);
+    int sent = send(fd, str, strlen(str), 0) >= 0 && send(fd, "\n", 1, 0) >= 0;
+    json_object_put(cmd);
+    if (!sent) {
+        perror("send");
+        close(fd);
+        return -1;
+    }
+    
+    // 按行转发到stdout，便于交给其他监控工具处理
+    char buf[BUFFER_SIZE + 1];
+    int first = 1;
+    ssize_t n;
+    while ((n = recv(fd, buf, BUFFER_SIZE, 0)) > 0) {
+        buf[n] = '\0';
+        if (first) {
+            first = 0;
+            if (strstr(buf, "\"success\": false") || strstr(buf, "\"success\":false")) {
+                fwrite(buf, 1, n, stderr);
+                close(fd);
+                return -1;
+            }
+        }
+        fwrite(buf, 1, n, stdout);
+        fflush(stdout);
+    }
+    close(fd);
+    return 0;
+}
+
 /* 打印用法 */
 void print_usage(const char* prog) {
-    fprintf(stderr, "Usage: %s <command> [args...]\n", prog);
+    fprintf(stderr, "Usage: %s [--binary|--ring] <command> [args...]\n", prog);
     fprintf(stderr, "\nCommands:\n");
-    fprintf(stderr, "  create <tenant_id> <qp> <mr> [memory] [name]  Create a new tenant\n");
+    fprintf(stderr, "  create <tenant_id> <qp> <mr> [memory] [name] [dm] [ah] [qmem] [active_qp] [ws_qps]  Create a new tenant\n");
     fprintf(stderr, "  delete <tenant_id>                             Delete a tenant\n");
-    fprintf(stderr, "  update <tenant_id> <qp> <mr> [memory]          ★ Hot update quota\n");
+    fprintf(stderr, "  update <tenant_id> <qp> <mr> [memory] [dm] [ah] [qmem] [active_qp] [ws_qps]     ★ Hot update quota\n");
+    fprintf(stderr, "  caps <tenant_id> <send_wr> <recv_wr> <sge> <inline> <cqe> [clamp|reject]  Per-QP/CQ capability budget\n");
+    fprintf(stderr, "  rate <tenant_id|global> <creates_per_sec> [burst]  QP creation rate limit\n");
+    fprintf(stderr, "  batch <file|->                                 Atomically apply many quota updates\n");
+    fprintf(stderr, "  limits <total_qp> <total_mr> <total_memory>    Cap the sum of all tenants' quotas\n");
     fprintf(stderr, "  status [tenant_id]                             Show tenant status\n");
     fprintf(stderr, "  list                                           List all tenants\n");
+    fprintf(stderr, "  watch [tenant_id|all] [interval_ms] [field,...]  Stream changed tenant fields\n");
+    fprintf(stderr, "                    (fields: status, usage, quota or names such as qp_used,qp_limit)\n");
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  --binary          Send update/delete over the compact binary protocol\n");
+    fprintf(stderr, "  --ring            Submit update/delete through the local shared-memory command ring\n");
+    fprintf(stderr, "                    (falls back to the binary protocol over the socket)\n");
     fprintf(stderr, "\nExamples:\n");
     fprintf(stderr, "  %s create 20 100 100 1073741824 \"TestTenant\"\n", prog);
     fprintf(stderr, "  %s update 20 50 50           # Reduce quota dynamically\n", prog);
     fprintf(stderr, "  %s status 20                  # Show specific tenant\n", prog);
     fprintf(stderr, "  %s list                       # Show all tenants\n", prog);
+    fprintf(stderr, "  %s watch all 500 usage        # Usage changes, at most every 500ms\n", prog);
+    fprintf(stderr, "  %s --binary update 20 50 50  # Hot update without JSON\n", prog);
+    fprintf(stderr, "  %s --ring update 20 50 50    # Hot update without a socket round trip\n", prog);
 }
 
 int main(int argc, char* argv[]) {
+    int binary = 0, ring = 0;
+    if (argc > 1 && (strcmp(argv[1], "--binary") == 0 || strcmp(argv[1], "--ring") == 0)) {
+        binary = 1;
+        ring = strcmp(argv[1], "--ring") == 0;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    
     if (argc < 2) {
         print_usage(argv[0]);
         return 1;
     }
     
+    if (binary) {
+        uint8_t body[512];
+        size_t len;
+        uint16_t type = build_binary_cmd(argc, argv, body, sizeof(body), &len);
+        if (type == 0) {
+            fprintf(stderr, "Binary protocol supports: update <tenant_id> <qp> <mr> [memory] [dm] [ah] [qmem] [active_qp] [ws_qps], delete <tenant_id>\n");
+            return 1;
+        }
+        int ret = ring ? send_ring_command(type, body, len) : -1;
+        if (ret == -1) {
+            if (ring) {
+                fprintf(stderr, "Command ring unavailable, using the socket\n");
+            }
+            ret = send_binary_command(type, body, len);
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Failed to communicate with daemon\n");
+        }
+        return ret == 0 ? 0 : 1;
+    }
+    
+    if (strcmp(argv[1], "watch") == 0) {
+        if (run_watch(argc, argv) != 0) {
+            fprintf(stderr, "Failed to watch tenants\n");
+            return 1;
+        }
+        return 0;
+    }
+    
     char* json_cmd = NULL;
     
     if (strcmp(argv[1], "create") == 0) {
@@ -346,6 +997,14 @@ int main(int argc, char* argv[]) {
         json_cmd = build_delete_cmd(argc, argv);
     } else if (strcmp(argv[1], "update") == 0 || strcmp(argv[1], "set-quota") == 0) {
         json_cmd = build_update_cmd(argc, argv);
+    } else if (strcmp(argv[1], "caps") == 0) {
+        json_cmd = build_caps_cmd(argc, argv);
+    } else if (strcmp(argv[1], "rate") == 0) {
+        json_cmd = build_rate_cmd(argc, argv);
+    } else if (strcmp(argv[1], "batch") == 0) {
+        json_cmd = build_batch_cmd(argc, argv);
+    } else if (strcmp(argv[1], "limits") == 0) {
+        json_cmd = build_limits_cmd(argc, argv);
     } else if (strcmp(argv[1], "status") == 0) {
         json_cmd = build_status_cmd(argc, argv);
     } else if (strcmp(argv[1], "list") == 0) {
@@ -4,46 +4,146 @@
  * 方案A实现：共享内存热更新（Shared Memory Hot-Update）
  * 
  * 功能：
- * - 轻量级守护进程，监听Unix Socket
- * - 支持JSON协议命令
+ * - 轻量级守护进程，监听Unix Socket（epoll事件循环，支持长连接）
+ * - 支持JSON协议命令，每行一个请求，同一连接上可流水线发送多个请求
  * - 实时更新租户配额（无需重启应用）
- * - 命令：CREATE, UPDATE_QUOTA, DELETE, STATUS, LIST
+ * - 命令：CREATE, UPDATE_QUOTA, BATCH, SET_GLOBAL_LIMITS, SET_CAPS, SET_CREATE_RATE, DELETE, STATUS, LIST, WATCH
+ * - WATCH：连接保持打开，按客户端指定的最小间隔只推送发生变化的租户字段
  * 
  * 用法：
  *   tenant_manager_daemon --daemon --foreground    # 前台调试模式
  *   tenant_manager_daemon --daemon                 # 后台守护模式
+ *   tenant_manager_daemon --max-clients 512        # 最大并发连接数（默认256）
+ *   tenant_manager_daemon --readers 4              # 处理STATUS/LIST_TENANTS的线程数（默认2）
+ *   tenant_manager_daemon --state /path/journal    # 租户定义的持久化日志（--no-state关闭）
+ *   tenant_manager_daemon --daemon --upgrade       # 从运行中的旧进程接管监听Socket和客户端连接
  * 
- * 协议（JSON over Unix Socket）：
- *   {"cmd":"UPDATE_QUOTA","tenant":20,"qp":50,"mr":100,"memory":1073741824}
+ * 线程模型：事件循环线程负责accept、收发和请求分帧，只读请求（STATUS、LIST_TENANTS）
+ * 交给读线程池从租户快照并发处理（--readers，降低调度优先级），修改请求进入唯一的
+ * 写线程队列，配额更新（UPDATE_QUOTA、BATCH、二进制协议）优先于其他修改，写线程空闲时
+ * 直接在事件循环线程执行。同一连接上的请求按顺序打包成任务，一次只有一个任务在处理，
+ * 响应顺序与请求顺序一致；WATCH由事件循环线程推送。
+ * 
+ * 二进制协议（定长消息头+TLV，见tenant_proto.h）与JSON协议按连接首字节区分，
+ * 供脚本化控制器高频下发UPDATE_QUOTA/DELETE。
+ * 
+ * 租户、配额和全局设置的每次修改都追加到内存映射的持久化日志（见shm/tenant_journal.h），
+ * 写满时压缩成快照。节点重启或共享内存被销毁后，守护进程启动时按日志重新创建全部租户。
+ * 
+ * 同节点的控制器还可以通过共享内存命令环（见tenant_cmd_ring.h）提交二进制请求，
+ * 由守护进程的命令环线程处理，与写线程互斥执行，守护进程仍是租户状态的
+ * 唯一写者（--no-ring关闭）。
+ * 
+ * 平滑升级：新版本以--upgrade启动，经交接Socket从旧进程用SCM_RIGHTS接收监听Socket和
+ * 全部客户端连接，核对租户共享内存的布局版本后接管命令环和持久化日志，旧进程处理完
+ * 已读入的请求后退出。Socket文件始终可连接，客户端连接不中断。
+ * 
+ * 协议（JSON over Unix Socket，请求和响应均以换行结尾，响应按请求顺序返回）：
+ *   {"cmd":"UPDATE_QUOTA","tenant":20,"qp":50,"mr":100,"memory":1073741824,"dm":262144,"qmem":67108864,"active_qp":16,"ws_qps":64}
+ *   {"cmd":"BATCH","updates":[{"tenant":20,"qp":40},{"tenant":21,"qp":60,"memory":2147483648}]}
+ *   {"cmd":"SET_GLOBAL_LIMITS","qp":1000,"mr":10000,"memory":68719476736}  # 0表示不检查
  *   {"cmd":"CREATE","tenant":20,"name":"Test","qp":50,"mr":100,"memory":1073741824}
+ *   {"cmd":"SET_CAPS","tenant":20,"send_wr":1024,"recv_wr":1024,"sge":4,"inline":256,"cqe":4096,"policy":"clamp"}
+ *   {"cmd":"SET_CREATE_RATE","tenant":20,"rate":200,"burst":50}    # 省略tenant时设置全局速率
  *   {"cmd":"DELETE","tenant":20}
  *   {"cmd":"STATUS","tenant":20}
  *   {"cmd":"LIST_TENANTS"}
+ *   {"cmd":"WATCH","tenant":20,"interval_ms":500,"fields":["usage","qp_limit"]}   # 之后持续推送变化
  */
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <limits.h>
 #include <json-c/json.h>
 
 #include "shm/shared_memory_tenant.h"
+#include "shm/tenant_journal.h"
+#include "tenant_proto.h"
+#include "tenant_cmd_ring.h"
+#include "json_stream.h"
 
 #define SOCKET_PATH "/tmp/rdma_tenant_manager.sock"
 #define PID_FILE "/tmp/rdma_tenant_manager.pid"
+#define UPGRADE_SOCKET_PATH "/tmp/rdma_tenant_manager.upgrade.sock"
 #define BUFFER_SIZE 4096
+#define MAX_REQUEST_SIZE 65536          // 单个请求行的最大长度
+#define OUTPUT_HIGH_WATER (1024 * 1024) // 待发送响应超过该值时暂停读取该连接
+#define DEFAULT_MAX_CLIENTS 256
+#define DEFAULT_READERS 2               // 处理只读请求的线程数
+#define READER_NICE 10                  // 读线程降低调度优先级，CPU紧张时让位给IO线程和写线程
+#define DEFAULT_STATE_FILE "/var/lib/rdma_intercept/tenant_state.journal"
 
 static volatile int running = 1;
 static int server_fd = -1;
+static int max_clients = DEFAULT_MAX_CLIENTS;
+static int num_readers = DEFAULT_READERS;
+static tenant_cmd_ring_t* cmd_ring = NULL;
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;  // 串行化写线程与命令环线程上的修改
+static tenant_journal_t* journal = NULL;                          // 租户定义的持久化日志，NULL表示不持久化
+static const char* journal_path = NULL;
+static int journal_sync = 0;
+static int upgrade_fd = -1;                                       // 接受新进程交接请求的监听Socket
+static int owns_endpoints = 1;                                    // 退出时删除Socket文件和命令环（已交给新进程时为0）
+
+/* 连接使用的协议，由连接上的第一个字节决定 */
+#define CONN_PROTO_UNKNOWN 0
+#define CONN_PROTO_JSON    1
+#define CONN_PROTO_BINARY  2
+
+/* 请求的处理方式 */
+#define REQ_INLINE     0                // 由事件循环线程直接处理（WATCH、无法解析的请求）
+#define REQ_READ       1                // 只读，由读线程池从快照并发处理
+#define REQ_WRITE      2                // 修改租户状态，由写线程串行处理
+#define REQ_WRITE_HIGH 3                // 配额更新，写队列中优先处理
+#define REQ_BINARY     4                // 二进制协议连接上的请求（均为配额更新），由写线程优先处理
+
+#define JOB_MAX_REQS 64                 // 一次交给工作线程的连续同类请求数上限
+
+/* 客户端连接状态：输入缓冲保存未成行的部分请求，输出缓冲保存未发完的响应 */
+typedef struct client_conn {
+    int fd;
+    int proto;                          // CONN_PROTO_*
+    uint16_t version;                   // 二进制协议协商的版本
+    char* in;
+    size_t in_len, in_cap;
+    char* out;
+    size_t out_off, out_len, out_cap;
+    int closing;                        // 发完响应后关闭
+    uint32_t events;                    // 当前注册的epoll事件
+    int watching;                       // WATCH连接：不再处理请求，只推送变化
+    uint64_t watch_fields;              // 订阅的字段（watch_fields[]下标位图）
+    uint32_t watch_tenant;              // 只推送该租户，0表示全部
+    uint32_t watch_interval_ms;         // 两次推送的最小间隔
+    uint64_t watch_seq;                 // 已推送到的变化序号
+    uint64_t watch_next_ns;             // 下一次允许推送的时间（CLOCK_MONOTONIC）
+    int busy;                           // 已交给工作线程，完成前连接（含缓冲区）归工作线程所有
+    int job_kind;                       // REQ_*
+    int job_n;
+    int job_failed;
+    json_object* job_reqs[JOB_MAX_REQS];
+    struct client_conn* job_next;       // 任务队列/完成队列链表
+} client_conn_t;
+
+static int watch_count = 0;             // 当前WATCH连接数
 
 /* 信号处理 */
 void signal_handler(int sig) {
@@ -57,10 +157,19 @@ void signal_handler(int sig) {
     }
 }
 
-/* 清理资源 */
+/* 清理资源（交接给新进程后Socket文件、PID文件和命令环归新进程） */
 void cleanup(void) {
+    if (!owns_endpoints) {
+        return;
+    }
     unlink(SOCKET_PATH);
     unlink(PID_FILE);
+    if (upgrade_fd >= 0) {
+        unlink(UPGRADE_SOCKET_PATH);
+    }
+    if (cmd_ring) {
+        shm_unlink(TENANT_RING_NAME);
+    }
 }
 
 /* 写入PID文件 */
@@ -104,7 +213,7 @@ int create_server_socket(void) {
     // 设置权限（允许所有用户访问，实验环境）
     chmod(SOCKET_PATH, 0777);
 
-    if (listen(fd, 10) < 0) {
+    if (listen(fd, SOMAXCONN) < 0) {
         perror("[MANAGER] listen failed");
         close(fd);
         return -1;
@@ -129,54 +238,268 @@ char* build_response(int success, const char* message, json_object* data) {
     return result;
 }
 
+/* 配额更新请求（JSON和二进制协议共用），未在present中标记的可选字段保留原值 */
+#define QUOTA_UPD_DM        (1U << 0)
+#define QUOTA_UPD_AH        (1U << 1)
+#define QUOTA_UPD_QMEM      (1U << 2)
+#define QUOTA_UPD_ACTIVE_QP (1U << 3)
+#define QUOTA_UPD_WS_QPS    (1U << 4)
+
+typedef struct {
+    uint32_t tenant_id;
+    uint32_t qp;
+    uint32_t mr;
+    uint64_t mem;
+    uint64_t dm;
+    uint32_t ah;
+    uint64_t qmem;
+    uint32_t active;
+    uint32_t ws;
+    uint32_t present;
+} quota_update_t;
+
+/* 把租户的当前定义追加到持久化日志（修改成功后在state_lock下调用） */
+static void journal_put(const uint32_t* ids, int count) {
+    static tenant_journal_tenant_t recs[MAX_TENANTS];   // 由state_lock保护
+    int n = 0;
+    
+    if (!journal) {
+        return;
+    }
+    const tenant_journal_state_t* st = tenant_journal_state(journal);
+    for (int i = 0; i < count; i++) {
+        tenant_journal_tenant_t* t = &recs[n];
+        uint32_t id = ids[i];
+        if (id < MAX_TENANTS && st->present[id]) {
+            *t = st->tenants[id];
+        } else {
+            tenant_info_t info;
+            if (tenant_get_info(id, &info) != 0) {
+                continue;
+            }
+            memset(t, 0, sizeof(*t));
+            t->tenant_id = id;
+            t->status = info.status;
+            memcpy(t->name, info.tenant_name, TENANT_NAME_MAX);
+        }
+        if (tenant_get_quota(id, &t->quota) != 0) {
+            continue;
+        }
+        n++;
+    }
+    if (n > 0 && tenant_journal_put(journal, recs, n) != 0) {
+        fprintf(stderr, "[MANAGER] Failed to append to state journal: %s\n", strerror(errno));
+    }
+}
+
+static void journal_delete(uint32_t tenant_id) {
+    if (journal && tenant_journal_delete(journal, tenant_id) != 0) {
+        fprintf(stderr, "[MANAGER] Failed to append to state journal: %s\n", strerror(errno));
+    }
+}
+
+static void journal_globals(void) {
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    if (!journal || !shm) {
+        return;
+    }
+    tenant_journal_globals_t globals = {
+        .limits = shm->global_limits,
+        .create_rate = shm->global_qp_create_rate,
+        .create_burst = shm->global_qp_create_burst,
+    };
+    if (tenant_journal_set_globals(journal, &globals) != 0) {
+        fprintf(stderr, "[MANAGER] Failed to append to state journal: %s\n", strerror(errno));
+    }
+}
+
+/* 由更新请求和当前配额生成新配额 */
+static void build_quota_update(const quota_update_t* upd, tenant_quota_t* quota) {
+    // 未指定设备内存/AH/队列内存/活跃QP/工作集配额时保留原值，避免更新其它配额时意外放开限制
+    tenant_quota_t current;
+    bool has_current = (tenant_get_quota(upd->tenant_id, &current) == 0);
+    
+    *quota = (tenant_quota_t){
+        .max_qp_per_tenant = upd->qp,
+        .max_mr_per_tenant = upd->mr,
+        .max_memory_per_tenant = upd->mem,
+        .max_cq_per_tenant = upd->qp,
+        .max_pd_per_tenant = 10,
+        .max_dm_bytes_per_tenant = (upd->present & QUOTA_UPD_DM) ? upd->dm :
+                                   (has_current ? current.max_dm_bytes_per_tenant : 0),
+        .max_ah_per_tenant = (upd->present & QUOTA_UPD_AH) ? upd->ah :
+                             (has_current ? current.max_ah_per_tenant : 0),
+        .max_queue_memory = (upd->present & QUOTA_UPD_QMEM) ? upd->qmem :
+                            (has_current ? current.max_queue_memory : 0),
+        .max_active_qp_per_tenant = (upd->present & QUOTA_UPD_ACTIVE_QP) ? upd->active :
+                                    (has_current ? current.max_active_qp_per_tenant : 0),
+        .max_ws_qps_per_tenant = (upd->present & QUOTA_UPD_WS_QPS) ? upd->ws :
+                                 (has_current ? current.max_ws_qps_per_tenant : 0)
+    };
+    // 容量预算由SET_CAPS、创建速率由SET_CREATE_RATE单独维护
+    if (has_current) {
+        quota->caps = current.caps;
+        quota->qp_create_rate = current.qp_create_rate;
+        quota->qp_create_burst = current.qp_create_burst;
+    }
+}
+
+/* 写入配额并推进策略版本（与BATCH一样检查全局配额之和） */
+static int apply_quota_update(const quota_update_t* upd) {
+    tenant_quota_t quota;
+    build_quota_update(upd, &quota);
+    if (tenant_update_quota_batch(&upd->tenant_id, &quota, 1, NULL) != 0) {
+        return -1;
+    }
+    journal_put(&upd->tenant_id, 1);
+    return 0;
+}
+
+/* 从JSON对象解析配额更新请求，缺少必填字段时返回-1 */
+static int parse_quota_update(json_object* obj, quota_update_t* upd) {
+    json_object* tenant_obj, *qp_obj, *mr_obj, *mem_obj, *dm_obj, *ah_obj, *qmem_obj, *active_obj, *ws_obj;
+    
+    if (!json_object_object_get_ex(obj, "tenant", &tenant_obj) ||
+        !json_object_object_get_ex(obj, "qp", &qp_obj)) {
+        return -1;
+    }
+    
+    memset(upd, 0, sizeof(*upd));
+    upd->tenant_id = json_object_get_int(tenant_obj);
+    upd->qp = json_object_get_int(qp_obj);
+    upd->mr = json_object_object_get_ex(obj, "mr", &mr_obj) ? 
+              (uint32_t)json_object_get_int(mr_obj) : upd->qp;
+    upd->mem = json_object_object_get_ex(obj, "memory", &mem_obj) ? 
+               (uint64_t)json_object_get_int64(mem_obj) : 1073741824ULL;
+    if (json_object_object_get_ex(obj, "dm", &dm_obj)) {
+        upd->dm = (uint64_t)json_object_get_int64(dm_obj);
+        upd->present |= QUOTA_UPD_DM;
+    }
+    if (json_object_object_get_ex(obj, "ah", &ah_obj)) {
+        upd->ah = (uint32_t)json_object_get_int(ah_obj);
+        upd->present |= QUOTA_UPD_AH;
+    }
+    if (json_object_object_get_ex(obj, "qmem", &qmem_obj)) {
+        upd->qmem = (uint64_t)json_object_get_int64(qmem_obj);
+        upd->present |= QUOTA_UPD_QMEM;
+    }
+    if (json_object_object_get_ex(obj, "active_qp", &active_obj)) {
+        upd->active = (uint32_t)json_object_get_int(active_obj);
+        upd->present |= QUOTA_UPD_ACTIVE_QP;
+    }
+    if (json_object_object_get_ex(obj, "ws_qps", &ws_obj)) {
+        upd->ws = (uint32_t)json_object_get_int(ws_obj);
+        upd->present |= QUOTA_UPD_WS_QPS;
+    }
+    return 0;
+}
+
 /* 处理 UPDATE_QUOTA 命令 */
 char* handle_update_quota(json_object* cmd_obj) {
-    json_object* tenant_obj, *qp_obj, *mr_obj, *mem_obj;
-    
-    if (!json_object_object_get_ex(cmd_obj, "tenant", &tenant_obj) ||
-        !json_object_object_get_ex(cmd_obj, "qp", &qp_obj)) {
+    quota_update_t upd;
+    if (parse_quota_update(cmd_obj, &upd) != 0) {
         return build_response(0, "Missing required fields: tenant, qp", NULL);
     }
     
-    uint32_t tenant_id = json_object_get_int(tenant_obj);
-    int qp = json_object_get_int(qp_obj);
-    int mr = json_object_object_get_ex(cmd_obj, "mr", &mr_obj) ? 
-             json_object_get_int(mr_obj) : qp;
-    uint64_t mem = json_object_object_get_ex(cmd_obj, "memory", &mem_obj) ? 
-                   (uint64_t)json_object_get_int64(mem_obj) : 1073741824ULL;
+    fprintf(stderr, "[MANAGER] UPDATE_QUOTA: tenant=%u, QP=%u, MR=%u, Mem=%llu, DM=%llu, AH=%u, QMem=%llu, ActiveQP=%u, WS=%u\n",
+            upd.tenant_id, upd.qp, upd.mr, (unsigned long long)upd.mem, (unsigned long long)upd.dm, upd.ah,
+            (unsigned long long)upd.qmem, upd.active, upd.ws);
     
-    tenant_quota_t quota = {
-        .max_qp_per_tenant = qp,
-        .max_mr_per_tenant = mr,
-        .max_memory_per_tenant = mem,
-        .max_cq_per_tenant = qp,
-        .max_pd_per_tenant = 10
-    };
+    if (apply_quota_update(&upd) != 0) {
+        return build_response(0, errno == EDQUOT ? "Global quota limit exceeded" : "Failed to update quota", NULL);
+    }
+    
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Quota updated for tenant %u", upd.tenant_id);
+    return build_response(1, msg, NULL);
+}
+
+/* 处理 BATCH 命令：校验全部配额更新后一次性发布 */
+char* handle_batch(json_object* cmd_obj) {
+    json_object* updates_obj;
     
-    fprintf(stderr, "[MANAGER] UPDATE_QUOTA: tenant=%u, QP=%d, MR=%d, Mem=%llu\n",
-            tenant_id, qp, mr, (unsigned long long)mem);
+    if (!json_object_object_get_ex(cmd_obj, "updates", &updates_obj) ||
+        !json_object_is_type(updates_obj, json_type_array)) {
+        return build_response(0, "Missing required field: updates", NULL);
+    }
     
-    if (tenant_update_quota(tenant_id, &quota) != 0) {
-        return build_response(0, "Failed to update quota", NULL);
+    int count = (int)json_object_array_length(updates_obj);
+    if (count <= 0 || count > MAX_TENANTS) {
+        return build_response(0, "Batch size out of range", NULL);
+    }
+    
+    uint32_t ids[MAX_TENANTS];
+    tenant_quota_t quotas[MAX_TENANTS];
+    char msg[256];
+    for (int i = 0; i < count; i++) {
+        quota_update_t upd;
+        if (parse_quota_update(json_object_array_get_idx(updates_obj, i), &upd) != 0) {
+            snprintf(msg, sizeof(msg), "Update %d: missing required fields: tenant, qp", i);
+            return build_response(0, msg, NULL);
+        }
+        ids[i] = upd.tenant_id;
+        build_quota_update(&upd, &quotas[i]);
     }
     
-    // 更新时间戳
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int failed = -1;
+    int ret = tenant_update_quota_batch(ids, quotas, count, &failed);
+    int err = errno;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t apply_ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+    
+    if (ret != 0) {
+        if (err == EDQUOT) {
+            snprintf(msg, sizeof(msg), "Batch rejected: global quota limit exceeded");
+        } else {
+            snprintf(msg, sizeof(msg), "Batch rejected: update %d (tenant %u) is invalid or duplicated",
+                     failed, failed >= 0 ? ids[failed] : 0);
+        }
+        fprintf(stderr, "[MANAGER] BATCH: %s\n", msg);
+        return build_response(0, msg, NULL);
+    }
+    
+    journal_put(ids, count);
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    fprintf(stderr, "[MANAGER] BATCH: %d tenants updated in %llu ns\n", count, (unsigned long long)apply_ns);
+    
+    json_object* data = json_object_new_object();
+    json_object_object_add(data, "applied", json_object_new_int(count));
+    json_object_object_add(data, "version", json_object_new_int64(shm ? shm->version : 0));
+    json_object_object_add(data, "quota_epoch", json_object_new_int64(tenant_quota_epoch()));
+    json_object_object_add(data, "apply_ns", json_object_new_int64(apply_ns));
+    snprintf(msg, sizeof(msg), "Batch of %d updates applied", count);
+    return build_response(1, msg, data);
+}
+
+/* 处理 SET_GLOBAL_LIMITS 命令：设置所有租户配额之和的上限 */
+char* handle_set_global_limits(json_object* cmd_obj) {
+    json_object* obj;
+    tenant_global_limits_t limits = {0};
+    
     tenant_shared_memory_t* shm = tenant_shm_get_ptr();
     if (shm) {
-        struct timespec ts;
-        clock_gettime(CLOCK_MONOTONIC, &ts);
-        shm->last_update_time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-        shm->version++;
+        limits = shm->global_limits;
     }
+    if (json_object_object_get_ex(cmd_obj, "qp", &obj)) limits.max_total_qp = json_object_get_int64(obj);
+    if (json_object_object_get_ex(cmd_obj, "mr", &obj)) limits.max_total_mr = json_object_get_int64(obj);
+    if (json_object_object_get_ex(cmd_obj, "memory", &obj)) limits.max_total_memory = json_object_get_int64(obj);
     
-    char msg[256];
-    snprintf(msg, sizeof(msg), "Quota updated for tenant %u", tenant_id);
-    return build_response(1, msg, NULL);
+    fprintf(stderr, "[MANAGER] SET_GLOBAL_LIMITS: QP=%llu, MR=%llu, Mem=%llu\n",
+            (unsigned long long)limits.max_total_qp, (unsigned long long)limits.max_total_mr,
+            (unsigned long long)limits.max_total_memory);
+    
+    if (tenant_set_global_limits(&limits) != 0) {
+        return build_response(0, "Failed to set global limits", NULL);
+    }
+    journal_globals();
+    return build_response(1, "Global limits updated", NULL);
 }
 
 /* 处理 CREATE 命令 */
 char* handle_create(json_object* cmd_obj) {
-    json_object* tenant_obj, *name_obj, *qp_obj, *mr_obj, *mem_obj;
+    json_object* tenant_obj, *name_obj, *qp_obj, *mr_obj, *mem_obj, *dm_obj, *ah_obj, *qmem_obj, *active_obj, *ws_obj;
     
     if (!json_object_object_get_ex(cmd_obj, "tenant", &tenant_obj)) {
         return build_response(0, "Missing required field: tenant", NULL);
@@ -191,284 +514,2425 @@ char* handle_create(json_object* cmd_obj) {
              json_object_get_int(mr_obj) : 100;
     uint64_t mem = json_object_object_get_ex(cmd_obj, "memory", &mem_obj) ?
                    (uint64_t)json_object_get_int64(mem_obj) : 1073741824ULL;
+    uint64_t dm = json_object_object_get_ex(cmd_obj, "dm", &dm_obj) ?
+                  (uint64_t)json_object_get_int64(dm_obj) : 0;
+    uint32_t ah = json_object_object_get_ex(cmd_obj, "ah", &ah_obj) ?
+                  (uint32_t)json_object_get_int(ah_obj) : 0;
+    uint64_t qmem = json_object_object_get_ex(cmd_obj, "qmem", &qmem_obj) ?
+                    (uint64_t)json_object_get_int64(qmem_obj) : 0;
+    uint32_t active = json_object_object_get_ex(cmd_obj, "active_qp", &active_obj) ?
+                      (uint32_t)json_object_get_int(active_obj) : 0;
+    uint32_t ws = json_object_object_get_ex(cmd_obj, "ws_qps", &ws_obj) ?
+                  (uint32_t)json_object_get_int(ws_obj) : 0;
     
     tenant_quota_t quota = {
         .max_qp_per_tenant = qp,
         .max_mr_per_tenant = mr,
         .max_memory_per_tenant = mem,
         .max_cq_per_tenant = qp,
-        .max_pd_per_tenant = 10
+        .max_pd_per_tenant = 10,
+        .max_dm_bytes_per_tenant = dm,
+        .max_ah_per_tenant = ah,
+        .max_queue_memory = qmem,
+        .max_active_qp_per_tenant = active,
+        .max_ws_qps_per_tenant = ws
     };
     
     fprintf(stderr, "[MANAGER] CREATE: tenant=%u, name=%s, QP=%d, MR=%d\n",
             tenant_id, name, qp, mr);
     
-    if (tenant_create(tenant_id, name, &quota) != 0) {
-        return build_response(0, "Failed to create tenant", NULL);
+    if (tenant_create_within_limits(tenant_id, name, &quota) != 0) {
+        return build_response(0, errno == EDQUOT ? "Global quota limit exceeded" : "Failed to create tenant", NULL);
     }
+    journal_put(&tenant_id, 1);
     
     char msg[256];
     snprintf(msg, sizeof(msg), "Tenant %u created", tenant_id);
     return build_response(1, msg, NULL);
 }
 
-/* 处理 DELETE 命令 */
-char* handle_delete(json_object* cmd_obj) {
-    json_object* tenant_obj;
+/* 处理 SET_CAPS 命令：设置单个QP/CQ的容量预算及超出时的策略 */
+char* handle_set_caps(json_object* cmd_obj) {
+    json_object *tenant_obj, *obj;
     
     if (!json_object_object_get_ex(cmd_obj, "tenant", &tenant_obj)) {
         return build_response(0, "Missing required field: tenant", NULL);
     }
     
     uint32_t tenant_id = json_object_get_int(tenant_obj);
+    tenant_quota_t quota;
+    if (tenant_get_quota(tenant_id, &quota) != 0) {
+        return build_response(0, "Tenant not found", NULL);
+    }
     
-    fprintf(stderr, "[MANAGER] DELETE: tenant=%u\n", tenant_id);
+    tenant_caps_budget_t *caps = &quota.caps;
+    if (json_object_object_get_ex(cmd_obj, "send_wr", &obj)) caps->max_send_wr = json_object_get_int(obj);
+    if (json_object_object_get_ex(cmd_obj, "recv_wr", &obj)) caps->max_recv_wr = json_object_get_int(obj);
+    if (json_object_object_get_ex(cmd_obj, "sge", &obj)) caps->max_sge = json_object_get_int(obj);
+    if (json_object_object_get_ex(cmd_obj, "inline", &obj)) caps->max_inline_data = json_object_get_int(obj);
+    if (json_object_object_get_ex(cmd_obj, "cqe", &obj)) caps->max_cqe = json_object_get_int(obj);
+    if (json_object_object_get_ex(cmd_obj, "policy", &obj)) {
+        const char *policy = json_object_get_string(obj);
+        if (strcmp(policy, "clamp") == 0) {
+            caps->clamp = 1;
+        } else if (strcmp(policy, "reject") == 0) {
+            caps->clamp = 0;
+        } else {
+            return build_response(0, "Invalid policy (clamp|reject)", NULL);
+        }
+    }
     
-    if (tenant_delete(tenant_id) != 0) {
-        return build_response(0, "Failed to delete tenant", NULL);
+    fprintf(stderr, "[MANAGER] SET_CAPS: tenant=%u, send_wr=%u, recv_wr=%u, sge=%u, inline=%u, cqe=%u, policy=%s\n",
+            tenant_id, caps->max_send_wr, caps->max_recv_wr, caps->max_sge, caps->max_inline_data,
+            caps->max_cqe, caps->clamp ? "clamp" : "reject");
+    
+    if (tenant_update_quota(tenant_id, &quota) != 0) {
+        return build_response(0, "Failed to update caps", NULL);
     }
+    journal_put(&tenant_id, 1);
     
     char msg[256];
-    snprintf(msg, sizeof(msg), "Tenant %u deleted", tenant_id);
+    snprintf(msg, sizeof(msg), "Caps updated for tenant %u", tenant_id);
     return build_response(1, msg, NULL);
 }
 
-/* 处理 STATUS 命令 */
-char* handle_status(json_object* cmd_obj) {
-    json_object* tenant_obj;
+/* 处理 SET_CREATE_RATE 命令：设置租户或全局的QP创建速率 */
+char* handle_set_create_rate(json_object* cmd_obj) {
+    json_object *tenant_obj, *rate_obj, *burst_obj;
+    
+    if (!json_object_object_get_ex(cmd_obj, "rate", &rate_obj)) {
+        return build_response(0, "Missing required field: rate", NULL);
+    }
+    
+    uint32_t rate = (uint32_t)json_object_get_int(rate_obj);
+    uint32_t burst = json_object_object_get_ex(cmd_obj, "burst", &burst_obj) ?
+                     (uint32_t)json_object_get_int(burst_obj) : 0;
+    char msg[256];
     
     if (!json_object_object_get_ex(cmd_obj, "tenant", &tenant_obj)) {
-        // 返回所有租户状态
-        json_object* tenants_array = json_object_new_array();
-        tenant_shared_memory_t* shm = tenant_shm_get_ptr();
-        
-        if (shm) {
-            for (int i = 0; i < MAX_TENANTS; i++) {
-                if (shm->tenants[i].status != TENANT_STATUS_INACTIVE) {
-                    json_object* t = json_object_new_object();
-                    json_object_object_add(t, "id", json_object_new_int(shm->tenants[i].tenant_id));
-                    json_object_object_add(t, "name", json_object_new_string(shm->tenants[i].tenant_name));
-                    json_object_object_add(t, "status", json_object_new_int(shm->tenants[i].status));
-                    json_object_object_add(t, "qp_used", json_object_new_int(shm->tenants[i].usage.qp_count));
-                    json_object_object_add(t, "qp_limit", json_object_new_int(shm->tenants[i].quota.max_qp_per_tenant));
-                    json_object_object_add(t, "mr_used", json_object_new_int(shm->tenants[i].usage.mr_count));
-                    json_object_object_add(t, "mr_limit", json_object_new_int(shm->tenants[i].quota.max_mr_per_tenant));
-                    json_object_object_add(t, "memory_used", json_object_new_int64(shm->tenants[i].usage.memory_used));
-                    json_object_object_add(t, "memory_limit", json_object_new_int64(shm->tenants[i].quota.max_memory_per_tenant));
-                    json_object_array_add(tenants_array, t);
-                }
-            }
+        fprintf(stderr, "[MANAGER] SET_CREATE_RATE: global, rate=%u, burst=%u\n", rate, burst);
+        if (tenant_set_global_create_rate(rate, burst) != 0) {
+            return build_response(0, "Failed to set global create rate", NULL);
         }
-        
-        return build_response(1, "All tenants status", tenants_array);
+        journal_globals();
+        snprintf(msg, sizeof(msg), "Global create rate set to %u/s", rate);
+        return build_response(1, msg, NULL);
     }
     
     uint32_t tenant_id = json_object_get_int(tenant_obj);
-    tenant_info_t info;
-    
-    if (tenant_get_info(tenant_id, &info) != 0) {
+    tenant_quota_t quota;
+    if (tenant_get_quota(tenant_id, &quota) != 0) {
         return build_response(0, "Tenant not found", NULL);
     }
     
-    json_object* data = json_object_new_object();
-    json_object_object_add(data, "id", json_object_new_int(info.tenant_id));
-    json_object_object_add(data, "name", json_object_new_string(info.tenant_name));
-    json_object_object_add(data, "status", json_object_new_int(info.status));
-    json_object_object_add(data, "qp_used", json_object_new_int(info.usage.qp_count));
-    json_object_object_add(data, "qp_limit", json_object_new_int(info.quota.max_qp_per_tenant));
-    json_object_object_add(data, "mr_used", json_object_new_int(info.usage.mr_count));
-    json_object_object_add(data, "mr_limit", json_object_new_int(info.quota.max_mr_per_tenant));
-    json_object_object_add(data, "memory_used", json_object_new_int64(info.usage.memory_used));
-    json_object_object_add(data, "memory_limit", json_object_new_int64(info.quota.max_memory_per_tenant));
-    json_object_object_add(data, "total_qp_creates", json_object_new_int64(info.usage.total_qp_creates));
-    json_object_object_add(data, "total_mr_regs", json_object_new_int64(info.usage.total_mr_regs));
-    
-    return build_response(1, "Tenant status", data);
-}
-
-/* 处理 LIST_TENANTS 命令 */
-char* handle_list_tenants(void) {
-    json_object* tenants_array = json_object_new_array();
-    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    quota.qp_create_rate = rate;
+    quota.qp_create_burst = burst;
     
-    if (shm) {
-        for (int i = 0; i < MAX_TENANTS; i++) {
-            if (shm->tenants[i].status != TENANT_STATUS_INACTIVE) {
-                json_object* t = json_object_new_object();
-                json_object_object_add(t, "id", json_object_new_int(shm->tenants[i].tenant_id));
-                json_object_object_add(t, "name", json_object_new_string(shm->tenants[i].tenant_name));
-                json_object_object_add(t, "qp_used", json_object_new_int(shm->tenants[i].usage.qp_count));
-                json_object_object_add(t, "qp_limit", json_object_new_int(shm->tenants[i].quota.max_qp_per_tenant));
-                json_object_object_add(t, "mr_used", json_object_new_int(shm->tenants[i].usage.mr_count));
-                json_object_object_add(t, "mr_limit", json_object_new_int(shm->tenants[i].quota.max_mr_per_tenant));
-                json_object_array_add(tenants_array, t);
-            }
-        }
-    }
+    fprintf(stderr, "[MANAGER] SET_CREATE_RATE: tenant=%u, rate=%u, burst=%u\n", tenant_id, rate, burst);
     
-    json_object* data = json_object_new_object();
-    json_object_object_add(data, "count", json_object_new_int(json_object_array_length(tenants_array)));
-    json_object_object_add(data, "version", json_object_new_int64(shm ? shm->version : 0));
-    json_object_object_add(data, "tenants", tenants_array);
+    if (tenant_update_quota(tenant_id, &quota) != 0) {
+        return build_response(0, "Failed to update create rate", NULL);
+    }
+    journal_put(&tenant_id, 1);
     
-    return build_response(1, "Tenant list", data);
+    snprintf(msg, sizeof(msg), "Create rate updated for tenant %u", tenant_id);
+    return build_response(1, msg, NULL);
 }
 
-/* 处理客户端命令 */
-char* process_command(const char* json_str) {
-    json_object* cmd_obj = json_tokener_parse(json_str);
-    if (!cmd_obj) {
-        return build_response(0, "Invalid JSON", NULL);
-    }
+/* 处理 DELETE 命令 */
+char* handle_delete(json_object* cmd_obj) {
+    json_object* tenant_obj;
     
-    json_object* cmd_type_obj;
-    if (!json_object_object_get_ex(cmd_obj, "cmd", &cmd_type_obj)) {
-        json_object_put(cmd_obj);
-        return build_response(0, "Missing 'cmd' field", NULL);
+    if (!json_object_object_get_ex(cmd_obj, "tenant", &tenant_obj)) {
+        return build_response(0, "Missing required field: tenant", NULL);
     }
     
-    const char* cmd = json_object_get_string(cmd_type_obj);
-    char* response = NULL;
+    uint32_t tenant_id = json_object_get_int(tenant_obj);
     
-    if (strcmp(cmd, "UPDATE_QUOTA") == 0) {
-        response = handle_update_quota(cmd_obj);
-    } else if (strcmp(cmd, "CREATE") == 0) {
-        response = handle_create(cmd_obj);
-    } else if (strcmp(cmd, "DELETE") == 0) {
-        response = handle_delete(cmd_obj);
-    } else if (strcmp(cmd, "STATUS") == 0) {
-        response = handle_status(cmd_obj);
-    } else if (strcmp(cmd, "LIST_TENANTS") == 0) {
-        response = handle_list_tenants();
-    } else {
-        response = build_response(0, "Unknown command", NULL);
+    fprintf(stderr, "[MANAGER] DELETE: tenant=%u\n", tenant_id);
+    
+    if (tenant_delete(tenant_id) != 0) {
+        return build_response(0, "Failed to delete tenant", NULL);
     }
+    journal_delete(tenant_id);
     
-    json_object_put(cmd_obj);
-    return response;
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Tenant %u deleted", tenant_id);
+    return build_response(1, msg, NULL);
 }
 
-/* 处理单个客户端连接 */
-void handle_client(int client_fd) {
-    char buffer[BUFFER_SIZE];
-    memset(buffer, 0, sizeof(buffer));
-    
-    int n = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (n <= 0) {
-        close(client_fd);
-        return;
-    }
-    
-    buffer[n] = '\0';
-    fprintf(stderr, "[MANAGER] Received: %s\n", buffer);
-    
-    char* response = process_command(buffer);
-    if (response) {
-        send(client_fd, response, strlen(response), 0);
-        send(client_fd, "\n", 1, 0);  // 添加换行符
-        free(response);
+/* 缓冲区追加数据 */
+static int buf_append(char** buf, size_t* len, size_t* cap, const char* data, size_t n) {
+    if (*len + n > *cap) {
+        size_t new_cap = *cap ? *cap : BUFFER_SIZE;
+        while (new_cap < *len + n) {
+            new_cap *= 2;
+        }
+        char* p = realloc(*buf, new_cap);
+        if (!p) {
+            return -1;
+        }
+        *buf = p;
+        *cap = new_cap;
     }
-    
-    close(client_fd);
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    return 0;
 }
 
-/* 主循环 */
-void main_loop(void) {
-    fd_set readfds;
-    struct timeval tv;
-    
-    while (running) {
-        FD_ZERO(&readfds);
-        FD_SET(server_fd, &readfds);
-        
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        
-        int ret = select(server_fd + 1, &readfds, NULL, NULL, &tv);
-        if (ret < 0) {
-            if (errno == EINTR) continue;
-            perror("[MANAGER] select failed");
-            break;
-        }
-        
-        if (ret > 0 && FD_ISSET(server_fd, &readfds)) {
-            struct sockaddr_un client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            
-            int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
-            if (client_fd < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    perror("[MANAGER] accept failed");
-                }
-                continue;
+/* ========== STATUS / LIST_TENANTS：流式JSON响应 ========== */
+
+#define STREAM_CHUNK 16384              // 流式响应每次交给send的最大字节数
+
+/* 流式响应的输出：没有待发数据时直接send，发不完的部分留在输出缓冲，保持响应顺序 */
+static int conn_stream_write(void* ctx, const char* data, size_t len) {
+    client_conn_t* conn = ctx;
+    if (conn->out_len == 0) {
+        while (len > 0) {
+            ssize_t n = send(conn->fd, data, len, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return -1;
             }
-            
-            handle_client(client_fd);
+            data += n;
+            len -= n;
+        }
+        if (len == 0) {
+            return 0;
         }
     }
+    return buf_append(&conn->out, &conn->out_len, &conn->out_cap, data, len);
 }
 
-/* 打印用法 */
-void print_usage(const char* prog) {
-    fprintf(stderr, "Usage: %s [options]\n", prog);
-    fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  --daemon          Run as daemon\n");
-    fprintf(stderr, "  --foreground      Run in foreground (with --daemon)\n");
-    fprintf(stderr, "  --help            Show this help\n");
-    fprintf(stderr, "\nExamples:\n");
-    fprintf(stderr, "  %s --daemon --foreground    # Debug mode\n", prog);
-    fprintf(stderr, "  %s --daemon                 # Production mode\n", prog);
+/* 开始一个成功响应：{"success":true,"message":"...","data": 之后由调用方写data */
+static void stream_response_begin(json_stream_t* js, const char* message) {
+    json_stream_begin_object(js, NULL);
+    json_stream_bool(js, "success", 1);
+    json_stream_string(js, "message", message);
 }
 
-int main(int argc, char* argv[]) {
-    int daemon_mode = 0;
-    int foreground = 0;
+/* 结束响应并交出剩余输出，发送失败时连接在发完已有数据后关闭 */
+static void stream_response_end(json_stream_t* js, client_conn_t* conn) {
+    json_stream_end_object(js);
+    json_stream_putc(js, '\n');
+    if (json_stream_finish(js) != 0) {
+        fprintf(stderr, "[MANAGER] Failed to stream response on fd %d, closing\n", conn->fd);
+        conn->closing = 1;
+    }
+}
+
+/* 所有租户槽位的快照（一次加锁复制，不含进程列表），每个读线程一份 */
+static __thread tenant_snapshot_t status_snaps[MAX_TENANTS];
+
+static void stream_status_all(json_stream_t* js) {
+    tenant_snapshot_all(status_snaps);
     
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--daemon") == 0) {
-            daemon_mode = 1;
-        } else if (strcmp(argv[i], "--foreground") == 0) {
-            foreground = 1;
-        } else if (strcmp(argv[i], "--help") == 0) {
-            print_usage(argv[0]);
-            return 0;
+    json_stream_begin_array(js, "data");
+    for (int i = 0; i < MAX_TENANTS; i++) {
+        const tenant_snapshot_t* t = &status_snaps[i];
+        if (t->status == TENANT_STATUS_INACTIVE) {
+            continue;
         }
+        json_stream_begin_object(js, NULL);
+        json_stream_uint(js, "id", t->tenant_id);
+        json_stream_string(js, "name", t->tenant_name);
+        json_stream_int(js, "status", t->status);
+        json_stream_int(js, "qp_used", t->usage.qp_count);
+        json_stream_uint(js, "qp_limit", t->quota.max_qp_per_tenant);
+        json_stream_int(js, "mr_used", t->usage.mr_count);
+        json_stream_uint(js, "mr_limit", t->quota.max_mr_per_tenant);
+        json_stream_uint(js, "memory_used", t->usage.memory_used);
+        json_stream_uint(js, "memory_limit", t->quota.max_memory_per_tenant);
+        json_stream_uint(js, "dm_used", t->usage.dm_used);
+        json_stream_uint(js, "dm_limit", t->quota.max_dm_bytes_per_tenant);
+        json_stream_end_object(js);
     }
+    json_stream_end_array(js);
+}
+
+static void stream_status_tenant(json_stream_t* js, const tenant_info_t* info) {
+    static const char *qp_state_names[TENANT_QP_STATES] = {"reset", "init", "rtr", "rts", "sqd", "sqe", "err", "unknown"};
     
-    // 初始化共享内存
-    if (tenant_shm_init() != 0) {
-        fprintf(stderr, "[MANAGER] Failed to initialize shared memory\n");
-        return 1;
+    json_stream_begin_object(js, "data");
+    json_stream_uint(js, "id", info->tenant_id);
+    json_stream_string(js, "name", info->tenant_name);
+    json_stream_int(js, "status", info->status);
+    json_stream_int(js, "qp_used", info->usage.qp_count);
+    json_stream_uint(js, "qp_limit", info->quota.max_qp_per_tenant);
+    json_stream_begin_object(js, "qp_states");
+    for (int s = 0; s < TENANT_QP_STATES; s++) {
+        json_stream_uint(js, qp_state_names[s], info->usage.qp_state_count[s]);
     }
-    fprintf(stderr, "[MANAGER] Shared memory initialized\n");
+    json_stream_end_object(js);
+    json_stream_uint(js, "active_qp_limit", info->quota.max_active_qp_per_tenant);
+    json_stream_int(js, "mr_used", info->usage.mr_count);
+    json_stream_uint(js, "mr_limit", info->quota.max_mr_per_tenant);
+    json_stream_uint(js, "memory_used", info->usage.memory_used);
+    json_stream_uint(js, "memory_limit", info->quota.max_memory_per_tenant);
+    json_stream_int(js, "dm_count", info->usage.dm_count);
+    json_stream_uint(js, "dm_used", info->usage.dm_used);
+    json_stream_uint(js, "dm_limit", info->quota.max_dm_bytes_per_tenant);
+    json_stream_uint(js, "queue_mem_used", info->usage.queue_mem_used);
+    json_stream_uint(js, "queue_mem_limit", info->quota.max_queue_memory);
+    json_stream_uint(js, "total_qp_creates", info->usage.total_qp_creates);
+    json_stream_uint(js, "total_mr_regs", info->usage.total_mr_regs);
+    json_stream_uint(js, "mr_coalesced", info->usage.total_mr_coalesced);
+    json_stream_uint(js, "mr_imported", info->usage.total_mr_imported);
+    json_stream_int(js, "qp_pooled", info->usage.qp_pooled);
+    json_stream_int(js, "cq_used", info->usage.cq_count);
+    json_stream_int(js, "cq_pooled", info->usage.cq_pooled);
+    json_stream_int(js, "pd_used", info->usage.pd_count);
+    json_stream_int(js, "pd_pooled", info->usage.pd_pooled);
+    json_stream_int(js, "ah_used", info->usage.ah_count);
+    json_stream_uint(js, "ah_limit", info->quota.max_ah_per_tenant);
+    json_stream_uint(js, "ah_cache_hits", info->usage.ah_cache_hits);
+    json_stream_int(js, "srq_substituted", info->usage.srq_substituted);
+    json_stream_uint(js, "recv_wr_saved", info->usage.recv_wr_saved);
+    json_stream_begin_object(js, "caps");
+    json_stream_uint(js, "send_wr", info->quota.caps.max_send_wr);
+    json_stream_uint(js, "recv_wr", info->quota.caps.max_recv_wr);
+    json_stream_uint(js, "sge", info->quota.caps.max_sge);
+    json_stream_uint(js, "inline", info->quota.caps.max_inline_data);
+    json_stream_uint(js, "cqe", info->quota.caps.max_cqe);
+    json_stream_string(js, "policy", info->quota.caps.clamp ? "clamp" : "reject");
+    json_stream_end_object(js);
+    json_stream_uint(js, "caps_clamped", info->usage.caps_clamped);
+    json_stream_int(js, "ud_vqps", info->usage.ud_vqp_count);
+    json_stream_int(js, "ud_real_qps", info->usage.ud_real_qp_count);
+    json_stream_uint(js, "ws_qps", info->usage.ws_qps);
+    json_stream_uint(js, "ws_qps_last", info->usage.ws_qps_last);
+    json_stream_uint(js, "ws_qps_peak", info->usage.ws_qps_peak);
+    json_stream_uint(js, "ws_limit", info->quota.max_ws_qps_per_tenant);
+    json_stream_uint(js, "ws_throttled", info->usage.ws_throttled);
+    json_stream_uint(js, "qp_pool_hits", info->usage.qp_pool_hits);
+    json_stream_uint(js, "qp_pool_misses", info->usage.qp_pool_misses);
     
-    // 如果作为daemon运行
-    if (daemon_mode && !foreground) {
-        if (daemon(0, 0) != 0) {
-            perror("[MANAGER] daemon failed");
-            return 1;
-        }
-        if (write_pid_file() != 0) {
-            return 1;
-        }
-        fprintf(stderr, "[MANAGER] Running as daemon (PID: %d)\n", getpid());
+    /* QP创建限速与排队情况 */
+    const create_admit_queue_t *cq = &info->create_admit;
+    json_stream_begin_object(js, "create_rate");
+    json_stream_uint(js, "rate", info->quota.qp_create_rate);
+    json_stream_uint(js, "burst", info->quota.qp_create_burst);
+    json_stream_uint(js, "depth", cq->depth);
+    json_stream_uint(js, "depth_peak", cq->depth_peak);
+    json_stream_uint(js, "admitted", cq->admitted);
+    json_stream_uint(js, "delayed", cq->delayed);
+    json_stream_uint(js, "timeouts", cq->timeouts);
+    json_stream_uint(js, "wait_p50_us", cq->wait_p50_us);
+    json_stream_uint(js, "wait_p99_us", cq->wait_p99_us);
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    if (shm) {
+        json_stream_uint(js, "global_rate", shm->global_qp_create_rate);
+        json_stream_uint(js, "global_burst", shm->global_qp_create_burst);
     }
+    json_stream_end_object(js);
     
-    // 注册信号处理
-    signal(SIGTERM, signal_handler);
-    signal(SIGINT, signal_handler);
-    atexit(cleanup);
+    /* QP创建延迟直方图（第i桶为[2^i, 2^(i+1)) us） */
+    json_stream_begin_array(js, "qp_create_lat_hist");
+    for (int i = 0; i < QP_CREATE_LAT_BUCKETS; i++) {
+        json_stream_uint(js, NULL, info->usage.qp_create_lat_hist[i]);
+    }
+    json_stream_end_array(js);
+    json_stream_end_object(js);
+}
+
+/*
+ * 处理 STATUS 命令：响应直接从租户快照编码到连接上，不构建json-c对象树。
+ * 已流式写出响应时返回NULL，出错时返回普通的错误响应
+ */
+char* handle_status(json_object* cmd_obj, client_conn_t* conn) {
+    json_object* tenant_obj;
+    char chunk[STREAM_CHUNK];
+    json_stream_t js;
     
-    // 创建服务器socket
-    server_fd = create_server_socket();
-    if (server_fd < 0) {
-        return 1;
+    if (!json_object_object_get_ex(cmd_obj, "tenant", &tenant_obj)) {
+        // 返回所有租户状态
+        json_stream_init(&js, chunk, sizeof(chunk), conn_stream_write, conn);
+        stream_response_begin(&js, "All tenants status");
+        stream_status_all(&js);
+        stream_response_end(&js, conn);
+        return NULL;
     }
     
-    fprintf(stderr, "[MANAGER] Ready. Waiting for commands...\n");
+    uint32_t tenant_id = json_object_get_int(tenant_obj);
+    tenant_info_t info;
     
-    // 主循环
-    main_loop();
+    if (tenant_get_info(tenant_id, &info) != 0) {
+        return build_response(0, "Tenant not found", NULL);
+    }
+    
+    json_stream_init(&js, chunk, sizeof(chunk), conn_stream_write, conn);
+    stream_response_begin(&js, "Tenant status");
+    stream_status_tenant(&js, &info);
+    stream_response_end(&js, conn);
+    return NULL;
+}
+
+static void stream_list_tenants(json_stream_t* js) {
+    uint64_t version = tenant_snapshot_all(status_snaps);
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    
+    uint32_t count = 0;
+    for (int i = 0; i < MAX_TENANTS; i++) {
+        if (status_snaps[i].status != TENANT_STATUS_INACTIVE) {
+            count++;
+        }
+    }
+    
+    json_stream_begin_object(js, "data");
+    json_stream_uint(js, "count", count);
+    json_stream_uint(js, "version", version);
+    json_stream_uint(js, "quota_epoch", tenant_quota_epoch());
+    if (shm) {
+        json_stream_begin_object(js, "global_limits");
+        json_stream_uint(js, "qp", shm->global_limits.max_total_qp);
+        json_stream_uint(js, "mr", shm->global_limits.max_total_mr);
+        json_stream_uint(js, "memory", shm->global_limits.max_total_memory);
+        json_stream_end_object(js);
+    }
+    json_stream_begin_array(js, "tenants");
+    for (int i = 0; i < MAX_TENANTS; i++) {
+        const tenant_snapshot_t* t = &status_snaps[i];
+        if (t->status == TENANT_STATUS_INACTIVE) {
+            continue;
+        }
+        json_stream_begin_object(js, NULL);
+        json_stream_uint(js, "id", t->tenant_id);
+        json_stream_string(js, "name", t->tenant_name);
+        json_stream_int(js, "qp_used", t->usage.qp_count);
+        json_stream_uint(js, "qp_limit", t->quota.max_qp_per_tenant);
+        json_stream_int(js, "mr_used", t->usage.mr_count);
+        json_stream_uint(js, "mr_limit", t->quota.max_mr_per_tenant);
+        json_stream_uint(js, "dm_used", t->usage.dm_used);
+        json_stream_uint(js, "dm_limit", t->quota.max_dm_bytes_per_tenant);
+        json_stream_end_object(js);
+    }
+    json_stream_end_array(js);
+    json_stream_end_object(js);
+}
+
+/* 处理 LIST_TENANTS 命令（流式写出，返回NULL） */
+char* handle_list_tenants(client_conn_t* conn) {
+    char chunk[STREAM_CHUNK];
+    json_stream_t js;
+    
+    json_stream_init(&js, chunk, sizeof(chunk), conn_stream_write, conn);
+    stream_response_begin(&js, "Tenant list");
+    stream_list_tenants(&js);
+    stream_response_end(&js, conn);
+    return NULL;
+}
+
+/* ========== WATCH：只推送变化的租户字段 ========== */
+
+#define WATCH_DEFAULT_INTERVAL_MS 1000
+#define WATCH_MIN_INTERVAL_MS     10
+#define WATCH_MAX_INTERVAL_MS     3600000
+
+#define WATCH_T_INT 0                   // int
+#define WATCH_T_U32 1                   // uint32_t
+#define WATCH_T_U64 2                   // uint64_t
+#define WATCH_T_STR 3                   // char[TENANT_NAME_MAX]
+
+#define WATCH_G_STATUS (1U << 0)
+#define WATCH_G_USAGE  (1U << 1)
+#define WATCH_G_QUOTA  (1U << 2)
+
+typedef struct {
+    const char* name;                   // 推送时使用的键名（与STATUS一致）
+    size_t off;                         // 在tenant_snapshot_t中的偏移
+    int type;                           // WATCH_T_*
+    uint32_t group;                     // WATCH_G_*，fields中可以用组名订阅整组
+} watch_field_t;
+
+#define WATCH_FIELD(name, member, type, group) { name, offsetof(tenant_snapshot_t, member), type, group }
+
+static const watch_field_t watch_fields[] = {
+    WATCH_FIELD("name",             tenant_name,                 WATCH_T_STR, WATCH_G_STATUS),
+    WATCH_FIELD("status",           status,                      WATCH_T_INT, WATCH_G_STATUS),
+    WATCH_FIELD("processes",        process_count,               WATCH_T_U32, WATCH_G_STATUS),
+    WATCH_FIELD("qp_used",          usage.qp_count,              WATCH_T_INT, WATCH_G_USAGE),
+    WATCH_FIELD("qp_active",        usage.qp_state_count[TENANT_QP_STATE_RTS], WATCH_T_U32, WATCH_G_USAGE),
+    WATCH_FIELD("mr_used",          usage.mr_count,              WATCH_T_INT, WATCH_G_USAGE),
+    WATCH_FIELD("cq_used",          usage.cq_count,              WATCH_T_INT, WATCH_G_USAGE),
+    WATCH_FIELD("pd_used",          usage.pd_count,              WATCH_T_INT, WATCH_G_USAGE),
+    WATCH_FIELD("ah_used",          usage.ah_count,              WATCH_T_INT, WATCH_G_USAGE),
+    WATCH_FIELD("memory_used",      usage.memory_used,           WATCH_T_U64, WATCH_G_USAGE),
+    WATCH_FIELD("dm_used",          usage.dm_used,               WATCH_T_U64, WATCH_G_USAGE),
+    WATCH_FIELD("queue_mem_used",   usage.queue_mem_used,        WATCH_T_U64, WATCH_G_USAGE),
+    WATCH_FIELD("ws_qps_last",      usage.ws_qps_last,           WATCH_T_U32, WATCH_G_USAGE),
+    WATCH_FIELD("ws_throttled",     usage.ws_throttled,          WATCH_T_U64, WATCH_G_USAGE),
+    WATCH_FIELD("total_qp_creates", usage.total_qp_creates,      WATCH_T_U64, WATCH_G_USAGE),
+    WATCH_FIELD("total_mr_regs",    usage.total_mr_regs,         WATCH_T_U64, WATCH_G_USAGE),
+    WATCH_FIELD("caps_clamped",     usage.caps_clamped,          WATCH_T_U64, WATCH_G_USAGE),
+    WATCH_FIELD("qp_limit",         quota.max_qp_per_tenant,     WATCH_T_U32, WATCH_G_QUOTA),
+    WATCH_FIELD("mr_limit",         quota.max_mr_per_tenant,     WATCH_T_U32, WATCH_G_QUOTA),
+    WATCH_FIELD("memory_limit",     quota.max_memory_per_tenant, WATCH_T_U64, WATCH_G_QUOTA),
+    WATCH_FIELD("dm_limit",         quota.max_dm_bytes_per_tenant, WATCH_T_U64, WATCH_G_QUOTA),
+    WATCH_FIELD("ah_limit",         quota.max_ah_per_tenant,     WATCH_T_U32, WATCH_G_QUOTA),
+    WATCH_FIELD("queue_mem_limit",  quota.max_queue_memory,      WATCH_T_U64, WATCH_G_QUOTA),
+    WATCH_FIELD("active_qp_limit",  quota.max_active_qp_per_tenant, WATCH_T_U32, WATCH_G_QUOTA),
+    WATCH_FIELD("ws_limit",         quota.max_ws_qps_per_tenant, WATCH_T_U32, WATCH_G_QUOTA),
+    WATCH_FIELD("create_rate",      quota.qp_create_rate,        WATCH_T_U32, WATCH_G_QUOTA),
+};
+
+#define WATCH_NFIELDS (sizeof(watch_fields) / sizeof(watch_fields[0]))
+
+/*
+ * 所有WATCH连接共享的变化表：数据版本号变化后复制一次全部租户，与上次快照逐字段比较，
+ * 变化的字段记下新的变化序号。每个连接只需比较序号，推送开销与变化数成正比，
+ * 与租户数和监视者数无关；连接来不及接收时跳过的变化在下一次推送中合并。
+ */
+static struct {
+    int valid;
+    uint64_t version;                               // 上次刷新时的数据版本号
+    uint64_t seq;                                   // 最新的变化序号
+    tenant_snapshot_t snaps[MAX_TENANTS];
+    uint64_t field_seq[MAX_TENANTS][WATCH_NFIELDS]; // 字段最近一次变化的序号
+    uint64_t present_seq[MAX_TENANTS];              // 租户创建或删除时的序号
+} watch_cache;
+
+static tenant_snapshot_t watch_scratch[MAX_TENANTS];
+
+static size_t watch_field_size(int type) {
+    switch (type) {
+    case WATCH_T_U64: return sizeof(uint64_t);
+    case WATCH_T_STR: return TENANT_NAME_MAX;
+    default:          return sizeof(uint32_t);
+    }
+}
+
+/* 数据版本号变化时重新比较所有租户（每轮最多一次，由所有监视者共享） */
+static void watch_refresh(void) {
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    if (!shm || (watch_cache.valid && shm->version == watch_cache.version)) {
+        return;
+    }
+    
+    uint64_t version = tenant_snapshot_all(watch_scratch);
+    uint64_t seq = watch_cache.seq + 1;
+    int changed = 0;
+    for (int i = 0; i < MAX_TENANTS; i++) {
+        const tenant_snapshot_t* old = &watch_cache.snaps[i];
+        const tenant_snapshot_t* cur = &watch_scratch[i];
+        int was = watch_cache.valid && old->status != TENANT_STATUS_INACTIVE;
+        int now = cur->status != TENANT_STATUS_INACTIVE;
+        if (was != now) {
+            watch_cache.present_seq[i] = seq;
+            changed = 1;
+        }
+        if (!now) {
+            continue;
+        }
+        for (size_t f = 0; f < WATCH_NFIELDS; f++) {
+            const watch_field_t* wf = &watch_fields[f];
+            if (!was || memcmp((const char*)old + wf->off, (const char*)cur + wf->off,
+                               watch_field_size(wf->type)) != 0) {
+                watch_cache.field_seq[i][f] = seq;
+                changed = 1;
+            }
+        }
+    }
+    memcpy(watch_cache.snaps, watch_scratch, sizeof(watch_cache.snaps));
+    watch_cache.version = version;
+    watch_cache.valid = 1;
+    if (changed) {
+        watch_cache.seq = seq;
+    }
+}
+
+static json_object* watch_field_value(const tenant_snapshot_t* snap, const watch_field_t* wf) {
+    const char* p = (const char*)snap + wf->off;
+    switch (wf->type) {
+    case WATCH_T_STR: {
+        char name[TENANT_NAME_MAX + 1];
+        memcpy(name, p, TENANT_NAME_MAX);
+        name[TENANT_NAME_MAX] = '\0';
+        return json_object_new_string(name);
+    }
+    case WATCH_T_U64: {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return json_object_new_int64(v);
+    }
+    case WATCH_T_U32: {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return json_object_new_int64(v);
+    }
+    default: {
+        int v;
+        memcpy(&v, p, sizeof(v));
+        return json_object_new_int(v);
+    }
+    }
+}
+
+/*
+ * 生成一条变化事件（只含该连接订阅且在上次推送后变化的字段），没有变化时返回NULL：
+ *   {"event":"delta","seq":12,"version":3456,"tenants":[{"id":20,"qp_used":8}],"removed":[21]}
+ */
+static char* watch_build_event(const client_conn_t* conn) {
+    json_object* tenants = NULL;
+    json_object* removed = NULL;
+    
+    for (int i = 0; i < MAX_TENANTS; i++) {
+        if (conn->watch_tenant != 0 && (uint32_t)i != conn->watch_tenant) {
+            continue;
+        }
+        const tenant_snapshot_t* snap = &watch_cache.snaps[i];
+        if (snap->status == TENANT_STATUS_INACTIVE) {
+            // 首次推送之前删除的租户对该连接不可见
+            if (conn->watch_seq != 0 && watch_cache.present_seq[i] > conn->watch_seq) {
+                if (!removed) {
+                    removed = json_object_new_array();
+                }
+                json_object_array_add(removed, json_object_new_int(i));
+            }
+            continue;
+        }
+        
+        json_object* t = NULL;
+        for (size_t f = 0; f < WATCH_NFIELDS; f++) {
+            if (!(conn->watch_fields & (1ULL << f)) || watch_cache.field_seq[i][f] <= conn->watch_seq) {
+                continue;
+            }
+            if (!t) {
+                t = json_object_new_object();
+                json_object_object_add(t, "id", json_object_new_int(i));
+            }
+            json_object_object_add(t, watch_fields[f].name, watch_field_value(snap, &watch_fields[f]));
+        }
+        if (t) {
+            if (!tenants) {
+                tenants = json_object_new_array();
+            }
+            json_object_array_add(tenants, t);
+        }
+    }
+    
+    if (!tenants && !removed) {
+        return NULL;
+    }
+    json_object* ev = json_object_new_object();
+    json_object_object_add(ev, "event", json_object_new_string("delta"));
+    json_object_object_add(ev, "seq", json_object_new_int64(watch_cache.seq));
+    json_object_object_add(ev, "version", json_object_new_int64(watch_cache.version));
+    json_object_object_add(ev, "tenants", tenants ? tenants : json_object_new_array());
+    if (removed) {
+        json_object_object_add(ev, "removed", removed);
+    }
+    char* result = strdup(json_object_to_json_string(ev));
+    json_object_put(ev);
+    return result;
+}
+
+/* 处理 WATCH 命令：连接转为推送模式，首个事件包含所有订阅字段的当前值 */
+char* handle_watch(json_object* cmd_obj, client_conn_t* conn) {
+    uint32_t tenant_id = 0;
+    uint32_t interval_ms = WATCH_DEFAULT_INTERVAL_MS;
+    uint64_t mask = 0;
+    json_object* val;
+    
+    if (json_object_object_get_ex(cmd_obj, "tenant", &val)) {
+        int64_t id = json_object_get_int64(val);
+        if (id <= 0 || id >= MAX_TENANTS) {
+            return build_response(0, "Invalid tenant ID", NULL);
+        }
+        tenant_id = (uint32_t)id;
+    }
+    if (json_object_object_get_ex(cmd_obj, "interval_ms", &val)) {
+        int64_t ms = json_object_get_int64(val);
+        if (ms < WATCH_MIN_INTERVAL_MS) {
+            ms = WATCH_MIN_INTERVAL_MS;
+        } else if (ms > WATCH_MAX_INTERVAL_MS) {
+            ms = WATCH_MAX_INTERVAL_MS;
+        }
+        interval_ms = (uint32_t)ms;
+    }
+    if (json_object_object_get_ex(cmd_obj, "fields", &val) && json_object_is_type(val, json_type_array)) {
+        size_t n = json_object_array_length(val);
+        for (size_t i = 0; i < n; i++) {
+            const char* name = json_object_get_string(json_object_array_get_idx(val, i));
+            uint32_t group = 0;
+            if (!name) {
+                return build_response(0, "Invalid field name", NULL);
+            }
+            if (strcmp(name, "all") == 0) {
+                group = WATCH_G_STATUS | WATCH_G_USAGE | WATCH_G_QUOTA;
+            } else if (strcmp(name, "status") == 0) {
+                // "status"既是字段名也是组名，按组处理（包含status字段本身）
+                group = WATCH_G_STATUS;
+            } else if (strcmp(name, "usage") == 0) {
+                group = WATCH_G_USAGE;
+            } else if (strcmp(name, "quota") == 0) {
+                group = WATCH_G_QUOTA;
+            }
+            int found = 0;
+            for (size_t f = 0; f < WATCH_NFIELDS; f++) {
+                if ((watch_fields[f].group & group) || strcmp(watch_fields[f].name, name) == 0) {
+                    mask |= 1ULL << f;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "Unknown field: %s", name);
+                return build_response(0, msg, NULL);
+            }
+        }
+    }
+    if (mask == 0) {
+        mask = (WATCH_NFIELDS >= 64) ? ~0ULL : (1ULL << WATCH_NFIELDS) - 1;
+    }
+    
+    if (!conn->watching) {
+        watch_count++;
+    }
+    conn->watching = 1;
+    conn->watch_fields = mask;
+    conn->watch_tenant = tenant_id;
+    conn->watch_interval_ms = interval_ms;
+    conn->watch_seq = 0;
+    conn->watch_next_ns = 0;
+    
+    json_object* data = json_object_new_object();
+    json_object* fields = json_object_new_array();
+    for (size_t f = 0; f < WATCH_NFIELDS; f++) {
+        if (mask & (1ULL << f)) {
+            json_object_array_add(fields, json_object_new_string(watch_fields[f].name));
+        }
+    }
+    json_object_object_add(data, "tenant", json_object_new_int(tenant_id));
+    json_object_object_add(data, "interval_ms", json_object_new_int(interval_ms));
+    json_object_object_add(data, "fields", fields);
+    return build_response(1, "Watching", data);
+}
+
+/*
+ * 处理已解析的客户端命令（cmd_obj为NULL表示请求不是合法JSON）。
+ * STATUS/LIST_TENANTS的响应直接写到conn上（返回NULL），WATCH把conn转为推送模式
+ */
+char* process_command(json_object* cmd_obj, client_conn_t* conn) {
+    if (!cmd_obj) {
+        return build_response(0, "Invalid JSON", NULL);
+    }
+    
+    json_object* cmd_type_obj;
+    if (!json_object_object_get_ex(cmd_obj, "cmd", &cmd_type_obj)) {
+        return build_response(0, "Missing 'cmd' field", NULL);
+    }
+    
+    const char* cmd = json_object_get_string(cmd_type_obj);
+    char* response = NULL;
+    
+    if (strcmp(cmd, "UPDATE_QUOTA") == 0) {
+        response = handle_update_quota(cmd_obj);
+    } else if (strcmp(cmd, "BATCH") == 0) {
+        response = handle_batch(cmd_obj);
+    } else if (strcmp(cmd, "SET_GLOBAL_LIMITS") == 0) {
+        response = handle_set_global_limits(cmd_obj);
+    } else if (strcmp(cmd, "CREATE") == 0) {
+        response = handle_create(cmd_obj);
+    } else if (strcmp(cmd, "SET_CAPS") == 0) {
+        response = handle_set_caps(cmd_obj);
+    } else if (strcmp(cmd, "SET_CREATE_RATE") == 0) {
+        response = handle_set_create_rate(cmd_obj);
+    } else if (strcmp(cmd, "DELETE") == 0) {
+        response = handle_delete(cmd_obj);
+    } else if (strcmp(cmd, "STATUS") == 0) {
+        response = handle_status(cmd_obj, conn);
+    } else if (strcmp(cmd, "LIST_TENANTS") == 0) {
+        response = handle_list_tenants(conn);
+    } else if (strcmp(cmd, "WATCH") == 0) {
+        response = handle_watch(cmd_obj, conn);
+    } else {
+        response = build_response(0, "Unknown command", NULL);
+    }
+    
+    return response;
+}
+
+/* 按命令决定请求由哪个线程处理 */
+static int classify_request(json_object* cmd_obj) {
+    json_object* cmd_type_obj;
+    if (!cmd_obj || !json_object_object_get_ex(cmd_obj, "cmd", &cmd_type_obj)) {
+        return REQ_INLINE;
+    }
+    const char* cmd = json_object_get_string(cmd_type_obj);
+    if (!cmd || strcmp(cmd, "WATCH") == 0) {
+        return REQ_INLINE;
+    }
+    if (strcmp(cmd, "STATUS") == 0 || strcmp(cmd, "LIST_TENANTS") == 0) {
+        return REQ_READ;
+    }
+    if (strcmp(cmd, "UPDATE_QUOTA") == 0 || strcmp(cmd, "BATCH") == 0) {
+        return REQ_WRITE_HIGH;
+    }
+    return REQ_WRITE;
+}
+
+static void conn_close(int epfd, client_conn_t* conn) {
+    if (conn->watching) {
+        watch_count--;
+    }
+    for (int i = 0; i < conn->job_n; i++) {
+        json_object_put(conn->job_reqs[i]);
+    }
+    if (conn->events) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    }
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = -1;
+}
+
+/* 处理一个请求（处理后释放req）并把响应追加到输出缓冲 */
+static int conn_handle_request(client_conn_t* conn, json_object* req) {
+    char* response = process_command(req, conn);
+    if (req) {
+        json_object_put(req);
+    }
+    if (!response) {
+        return 0;
+    }
+    int ret = buf_append(&conn->out, &conn->out_len, &conn->out_cap, response, strlen(response));
+    if (ret == 0) {
+        ret = buf_append(&conn->out, &conn->out_len, &conn->out_cap, "\n", 1);
+    }
+    free(response);
+    return ret;
+}
+
+/* 尽量发送输出缓冲，返回-1表示连接已失效 */
+static int conn_flush(client_conn_t* conn) {
+    while (conn->out_off < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        conn->out_off += n;
+    }
+    conn->out_off = 0;
+    conn->out_len = 0;
+    return 0;
+}
+
+/* 追加一个二进制响应帧 */
+static int bin_respond(client_conn_t* conn, const tenant_proto_hdr_t* req, const uint8_t* body, size_t len) {
+    tenant_proto_hdr_t hdr = {
+        .magic = TENANT_PROTO_MAGIC,
+        .version = conn->version,
+        .type = req->type | TENANT_PROTO_RESPONSE,
+        .seq = req->seq,
+        .length = (uint32_t)len
+    };
+    if (buf_append(&conn->out, &conn->out_len, &conn->out_cap, (const char*)&hdr, sizeof(hdr)) != 0) {
+        return -1;
+    }
+    return buf_append(&conn->out, &conn->out_len, &conn->out_cap, (const char*)body, len);
+}
+
+static int bin_respond_status(client_conn_t* conn, const tenant_proto_hdr_t* req, uint32_t status, const char* msg) {
+    uint8_t body[256];
+    size_t off = 0;
+    tenant_proto_put_u32(body, &off, sizeof(body), TENANT_TLV_STATUS, status);
+    if (msg) {
+        size_t len = strlen(msg);
+        tenant_proto_put(body, &off, sizeof(body), TENANT_TLV_MESSAGE, msg,
+                         (uint16_t)(len < 128 ? len : 128));
+    }
+    return bin_respond(conn, req, body, off);
+}
+
+/* 处理一个二进制请求（不经过json-c） */
+static int bin_handle_request(client_conn_t* conn, const tenant_proto_hdr_t* hdr, const uint8_t* body) {
+    uint16_t tag, len;
+    const uint8_t* val;
+    uint64_t v;
+    size_t off = 0;
+    int r;
+    
+    if (hdr->type == TENANT_PROTO_HELLO) {
+        uint64_t peer = hdr->version;
+        while ((r = tenant_proto_next(body, hdr->length, &off, &tag, &val, &len)) > 0) {
+            if (tag == TENANT_TLV_VERSION && tenant_proto_get_uint(val, len, &v) == 0) {
+                peer = v;
+            }
+        }
+        if (r < 0 || peer == 0) {
+            return bin_respond_status(conn, hdr, EPROTO, "Malformed HELLO");
+        }
+        conn->version = peer < TENANT_PROTO_VERSION ? (uint16_t)peer : TENANT_PROTO_VERSION;
+        uint8_t out[32];
+        size_t out_len = 0;
+        tenant_proto_put_u32(out, &out_len, sizeof(out), TENANT_TLV_STATUS, 0);
+        tenant_proto_put_u32(out, &out_len, sizeof(out), TENANT_TLV_VERSION, conn->version);
+        return bin_respond(conn, hdr, out, out_len);
+    }
+    
+    if (hdr->version == 0 || hdr->version > TENANT_PROTO_VERSION) {
+        return bin_respond_status(conn, hdr, EPROTONOSUPPORT, "Unsupported protocol version");
+    }
+    
+    quota_update_t upd = {0};
+    uint32_t seen = 0;
+    while ((r = tenant_proto_next(body, hdr->length, &off, &tag, &val, &len)) > 0) {
+        if (tag > TENANT_TLV_WS_QPS || tenant_proto_get_uint(val, len, &v) != 0) {
+            continue;
+        }
+        seen |= 1U << tag;
+        switch (tag) {
+            case TENANT_TLV_TENANT:    upd.tenant_id = (uint32_t)v; break;
+            case TENANT_TLV_QP:        upd.qp = (uint32_t)v; break;
+            case TENANT_TLV_MR:        upd.mr = (uint32_t)v; break;
+            case TENANT_TLV_MEMORY:    upd.mem = v; break;
+            case TENANT_TLV_DM:        upd.dm = v; upd.present |= QUOTA_UPD_DM; break;
+            case TENANT_TLV_AH:        upd.ah = (uint32_t)v; upd.present |= QUOTA_UPD_AH; break;
+            case TENANT_TLV_QMEM:      upd.qmem = v; upd.present |= QUOTA_UPD_QMEM; break;
+            case TENANT_TLV_ACTIVE_QP: upd.active = (uint32_t)v; upd.present |= QUOTA_UPD_ACTIVE_QP; break;
+            case TENANT_TLV_WS_QPS:    upd.ws = (uint32_t)v; upd.present |= QUOTA_UPD_WS_QPS; break;
+        }
+    }
+    if (r < 0) {
+        return bin_respond_status(conn, hdr, EPROTO, "Malformed TLV");
+    }
+    if (!(seen & (1U << TENANT_TLV_TENANT))) {
+        return bin_respond_status(conn, hdr, EINVAL, "Missing required field: tenant");
+    }
+    
+    switch (hdr->type) {
+        case TENANT_PROTO_UPDATE_QUOTA:
+            if (!(seen & (1U << TENANT_TLV_QP))) {
+                return bin_respond_status(conn, hdr, EINVAL, "Missing required fields: tenant, qp");
+            }
+            // 缺省值与JSON协议一致
+            if (!(seen & (1U << TENANT_TLV_MR))) {
+                upd.mr = upd.qp;
+            }
+            if (!(seen & (1U << TENANT_TLV_MEMORY))) {
+                upd.mem = 1073741824ULL;
+            }
+            if (apply_quota_update(&upd) != 0) {
+                return bin_respond_status(conn, hdr, errno == EDQUOT ? EDQUOT : EINVAL,
+                                          errno == EDQUOT ? "Global quota limit exceeded" : "Failed to update quota");
+            }
+            return bin_respond_status(conn, hdr, 0, NULL);
+        case TENANT_PROTO_DELETE:
+            fprintf(stderr, "[MANAGER] DELETE: tenant=%u\n", upd.tenant_id);
+            if (tenant_delete(upd.tenant_id) != 0) {
+                return bin_respond_status(conn, hdr, ENOENT, "Failed to delete tenant");
+            }
+            journal_delete(upd.tenant_id);
+            return bin_respond_status(conn, hdr, 0, NULL);
+        default:
+            return bin_respond_status(conn, hdr, EOPNOTSUPP, "Unknown command");
+    }
+}
+
+/* 处理缓冲区中的完整二进制帧 */
+static int conn_process_binary(client_conn_t* conn) {
+    size_t start = 0;
+    tenant_proto_hdr_t hdr;
+    
+    while (conn->in_len - start >= sizeof(hdr)) {
+        memcpy(&hdr, conn->in + start, sizeof(hdr));
+        if (hdr.magic != TENANT_PROTO_MAGIC || hdr.length > TENANT_PROTO_MAX_BODY) {
+            // 帧边界已失去同步，回复错误后关闭连接
+            fprintf(stderr, "[MANAGER] Bad binary frame on fd %d, closing\n", conn->fd);
+            hdr.seq = 0;
+            hdr.type = 0;
+            bin_respond_status(conn, &hdr, EPROTO, "Bad frame");
+            conn->in_len = 0;
+            conn->closing = 1;
+            return 0;
+        }
+        if (conn->in_len - start - sizeof(hdr) < hdr.length) {
+            break;
+        }
+        pthread_mutex_lock(&state_lock);
+        int ret = bin_handle_request(conn, &hdr, (const uint8_t*)conn->in + start + sizeof(hdr));
+        pthread_mutex_unlock(&state_lock);
+        if (ret != 0) {
+            return -1;
+        }
+        start += sizeof(hdr) + hdr.length;
+    }
+    memmove(conn->in, conn->in + start, conn->in_len - start);
+    conn->in_len -= start;
+    return 0;
+}
+
+/* ========== 工作线程：读线程池并发处理只读请求，单个写线程串行处理修改 ========== */
+
+/* 任务队列：队列中的元素是交出去的连接，prio 1（配额更新）先于prio 0 */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    client_conn_t* head[2];
+    client_conn_t* tail[2];
+    int active;                         // 正在处理的任务数
+    int stop;
+} job_queue_t;
+
+static job_queue_t read_queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { NULL, NULL }, { NULL, NULL }, 0, 0 };
+static job_queue_t write_queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { NULL, NULL }, { NULL, NULL }, 0, 0 };
+
+/* 已完成任务的连接，工作线程写done_fd（eventfd）通知事件循环线程收回 */
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static client_conn_t* done_head = NULL;
+static int done_fd = -1;
+
+static void job_queue_push(job_queue_t* q, client_conn_t* conn, int prio) {
+    conn->job_next = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail[prio]) {
+        q->tail[prio]->job_next = conn;
+    } else {
+        q->head[prio] = conn;
+    }
+    q->tail[prio] = conn;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* 取出下一个任务，优先取prio 1；队列停止后返回NULL */
+static client_conn_t* job_queue_pop(job_queue_t* q) {
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        if (q->stop) {
+            pthread_mutex_unlock(&q->lock);
+            return NULL;
+        }
+        for (int prio = 1; prio >= 0; prio--) {
+            client_conn_t* conn = q->head[prio];
+            if (conn) {
+                q->head[prio] = conn->job_next;
+                if (!q->head[prio]) {
+                    q->tail[prio] = NULL;
+                }
+                q->active++;
+                pthread_mutex_unlock(&q->lock);
+                return conn;
+            }
+        }
+        pthread_cond_wait(&q->cond, &q->lock);
+    }
+}
+
+static void job_queue_finish(job_queue_t* q) {
+    pthread_mutex_lock(&q->lock);
+    q->active--;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* 队列为空且没有正在处理的任务 */
+static int job_queue_idle(job_queue_t* q) {
+    pthread_mutex_lock(&q->lock);
+    int idle = !q->head[0] && !q->head[1] && q->active == 0;
+    pthread_mutex_unlock(&q->lock);
+    return idle;
+}
+
+static void job_queue_stop(job_queue_t* q) {
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* 把连接交给工作线程，完成前事件循环线程不再访问它的缓冲区 */
+static void job_submit(client_conn_t* conn, int kind) {
+    conn->busy = 1;
+    conn->job_kind = kind;
+    if (kind == REQ_READ) {
+        job_queue_push(&read_queue, conn, 0);
+    } else {
+        job_queue_push(&write_queue, conn, kind == REQ_WRITE ? 0 : 1);
+    }
+}
+
+/* 执行连接上的任务；写线程每个请求持有state_lock，与命令环线程互斥，读线程只读快照不加锁 */
+static void conn_run_job(client_conn_t* conn, int writer) {
+    if (conn->job_kind == REQ_BINARY) {
+        conn->job_failed = conn_process_binary(conn) != 0;
+        return;
+    }
+    for (int i = 0; i < conn->job_n; i++) {
+        json_object* req = conn->job_reqs[i];
+        conn->job_reqs[i] = NULL;
+        if (conn->job_failed) {
+            json_object_put(req);
+            continue;
+        }
+        if (writer) {
+            pthread_mutex_lock(&state_lock);
+        }
+        conn->job_failed = conn_handle_request(conn, req) != 0;
+        if (writer) {
+            pthread_mutex_unlock(&state_lock);
+        }
+    }
+    conn->job_n = 0;
+}
+
+static void* worker_thread(void* arg) {
+    job_queue_t* q = arg;
+    int writer = (q == &write_queue);
+    client_conn_t* conn;
+    
+    if (!writer && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), READER_NICE) != 0) {
+        perror("[MANAGER] setpriority failed");
+    }
+    
+    while ((conn = job_queue_pop(q)) != NULL) {
+        conn_run_job(conn, writer);
+        job_queue_finish(q);
+        pthread_mutex_lock(&done_lock);
+        conn->job_next = done_head;
+        done_head = conn;
+        pthread_mutex_unlock(&done_lock);
+        uint64_t one = 1;
+        if (write(done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("[MANAGER] eventfd write failed");
+        }
+    }
+    return NULL;
+}
+
+/* 二进制连接的输入缓冲中是否有完整的帧（帧头无法同步时也交给写线程回复错误） */
+static int bin_frame_ready(const client_conn_t* conn) {
+    tenant_proto_hdr_t hdr;
+    if (conn->in_len < sizeof(hdr)) {
+        return 0;
+    }
+    memcpy(&hdr, conn->in, sizeof(hdr));
+    if (hdr.magic != TENANT_PROTO_MAGIC || hdr.length > TENANT_PROTO_MAX_BODY) {
+        return 1;
+    }
+    return conn->in_len - sizeof(hdr) >= hdr.length;
+}
+
+/* 把请求放进待交出的任务；与已打包的请求不同类或任务已满时返回-1，留到当前任务完成后再处理 */
+static int job_add(client_conn_t* conn, int kind, json_object* req) {
+    if (conn->job_n > 0 && (kind != conn->job_kind || conn->job_n == JOB_MAX_REQS)) {
+        return -1;
+    }
+    conn->job_kind = kind;
+    conn->job_reqs[conn->job_n++] = req;
+    return 0;
+}
+
+/*
+ * 交出打包好的任务。配额更新在写线程空闲时直接在IO线程执行（仍持有state_lock），
+ * 省去两次线程切换；写线程忙时排在写队列的高优先级一端。
+ * 返回1表示已直接执行，0表示已排队，-1表示处理失败需要关闭连接。
+ */
+static int conn_start_job(client_conn_t* conn, int kind) {
+    if ((kind == REQ_WRITE_HIGH || kind == REQ_BINARY) && job_queue_idle(&write_queue)) {
+        conn->job_kind = kind;
+        conn_run_job(conn, 1);
+        int failed = conn->job_failed;
+        conn->job_failed = 0;
+        return failed ? -1 : 1;
+    }
+    job_submit(conn, kind);
+    return 0;
+}
+
+/*
+ * 分派输入缓冲中的完整请求：WATCH和无法解析的请求由事件循环线程直接处理，
+ * 连续的同类请求打包成一个任务交给读线程池或写线程。连接同一时刻只有一个任务，
+ * 任务完成后再分派后续请求，响应顺序与请求顺序一致
+ */
+static int conn_dispatch(client_conn_t* conn) {
+again:
+    if (conn->busy) {
+        return 0;
+    }
+    
+    // WATCH连接只推送事件，之后收到的数据直接丢弃（读取只用于发现对端关闭）
+    if (conn->watching) {
+        conn->in_len = 0;
+        return 0;
+    }
+    
+    if (conn->proto == CONN_PROTO_UNKNOWN && conn->in_len > 0) {
+        conn->proto = ((uint8_t)conn->in[0] == TENANT_PROTO_MAGIC_BYTE) ? CONN_PROTO_BINARY : CONN_PROTO_JSON;
+        conn->version = TENANT_PROTO_VERSION;
+    }
+    if (conn->proto == CONN_PROTO_BINARY) {
+        if (bin_frame_ready(conn)) {
+            if (conn_flush(conn) != 0) {
+                return -1;
+            }
+            return conn_start_job(conn, REQ_BINARY) < 0 ? -1 : 0;
+        }
+        return 0;
+    }
+    
+    // 逐行解析请求，剩余的部分行留在缓冲区等待后续数据
+    size_t start = 0;
+    int deferred = 0;
+    for (;;) {
+        char* nl = memchr(conn->in + start, '\n', conn->in_len - start);
+        if (!nl) {
+            break;
+        }
+        *nl = '\0';
+        char* req = conn->in + start;
+        if (req[0] == '\0' || (req[0] == '\r' && req[1] == '\0')) {
+            start = nl - conn->in + 1;
+            continue;
+        }
+        json_object* obj = json_tokener_parse(req);
+        int kind = classify_request(obj);
+        if (kind != REQ_INLINE ? job_add(conn, kind, obj) != 0 : conn->job_n > 0) {
+            *nl = '\n';
+            if (obj) {
+                json_object_put(obj);
+            }
+            deferred = 1;
+            break;
+        }
+        fprintf(stderr, "[MANAGER] Received: %s\n", req);
+        start = nl - conn->in + 1;
+        if (kind == REQ_INLINE) {
+            if (conn_handle_request(conn, obj) != 0) {
+                return -1;
+            }
+            if (conn->watching) {
+                start = conn->in_len;
+                break;
+            }
+        }
+    }
+    memmove(conn->in, conn->in + start, conn->in_len - start);
+    conn->in_len -= start;
+    
+    // 兼容不带换行的旧客户端：剩余数据本身是完整的JSON请求时直接处理
+    if (!deferred && !conn->watching && conn->in_len > 0 && conn->in_len < conn->in_cap) {
+        conn->in[conn->in_len] = '\0';
+        json_object* obj = json_tokener_parse(conn->in);
+        if (obj) {
+            int kind = classify_request(obj);
+            if (kind != REQ_INLINE ? job_add(conn, kind, obj) != 0 : conn->job_n > 0) {
+                json_object_put(obj);
+            } else {
+                fprintf(stderr, "[MANAGER] Received: %s\n", conn->in);
+                conn->in_len = 0;
+                if (kind == REQ_INLINE && conn_handle_request(conn, obj) != 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+    
+    if (conn->job_n == 0 && conn->in_len > MAX_REQUEST_SIZE) {
+        fprintf(stderr, "[MANAGER] Request too large on fd %d, closing\n", conn->fd);
+        char* response = build_response(0, "Request too large", NULL);
+        if (response) {
+            buf_append(&conn->out, &conn->out_len, &conn->out_cap, response, strlen(response));
+            buf_append(&conn->out, &conn->out_len, &conn->out_cap, "\n", 1);
+            free(response);
+        }
+        conn->in_len = 0;
+        conn->closing = 1;
+    }
+    
+    if (conn->job_n > 0) {
+        // 先发出此前直接处理的响应，任务期间输出缓冲归工作线程
+        if (conn_flush(conn) != 0) {
+            return -1;
+        }
+        int ret = conn_start_job(conn, conn->job_kind);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret > 0 && conn->in_len > 0) {
+            goto again;
+        }
+    }
+    return 0;
+}
+
+/* 读取已到达的数据并分派其中的完整请求；peer_closed表示对端已关闭写端 */
+static int conn_read(client_conn_t* conn, int* peer_closed) {
+    char chunk[BUFFER_SIZE];
+    
+    for (;;) {
+        ssize_t n = recv(conn->fd, chunk, sizeof(chunk), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        if (n == 0) {
+            *peer_closed = 1;
+            break;
+        }
+        if (buf_append(&conn->in, &conn->in_len, &conn->in_cap, chunk, n) != 0) {
+            return -1;
+        }
+        // 短读说明暂时读空，剩余数据由水平触发的下一次事件处理，省去一次返回EAGAIN的recv
+        if ((size_t)n < sizeof(chunk) ||
+            conn->out_len - conn->out_off > OUTPUT_HIGH_WATER || conn->in_len > MAX_REQUEST_SIZE) {
+            break;
+        }
+    }
+    
+    return conn_dispatch(conn);
+}
+
+/* 根据缓冲状态更新关注的事件；任务处理期间连接从epoll中移除，完成后重新加入 */
+static int conn_update_events(int epfd, client_conn_t* conn) {
+    uint32_t events = 0;
+    size_t pending = conn->out_len - conn->out_off;
+    if (!conn->busy) {
+        if (!conn->closing && pending <= OUTPUT_HIGH_WATER) {
+            events |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (pending > 0) {
+            events |= EPOLLOUT;
+        }
+    }
+    if (events == conn->events) {
+        return 0;
+    }
+    int op = conn->events == 0 ? EPOLL_CTL_ADD : (events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD);
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    if (epoll_ctl(epfd, op, conn->fd, &ev) != 0) {
+        return -1;
+    }
+    conn->events = events;
+    return 0;
+}
+
+/* 处理完一次事件或一个任务后：发送已有响应，按状态关闭连接或更新关注的事件 */
+static void conn_settle(int epfd, client_conn_t* conn, int failed) {
+    if (conn->busy) {
+        conn_update_events(epfd, conn);
+        return;
+    }
+    if (!failed) {
+        failed = conn_flush(conn) != 0;
+    }
+    if (failed || (conn->closing && conn->out_len == 0) || conn_update_events(epfd, conn) != 0) {
+        conn_close(epfd, conn);
+    }
+}
+
+/* 收回已完成任务的连接，继续分派其缓冲区中剩余的请求 */
+static void collect_done_jobs(int epfd) {
+    uint64_t n;
+    if (read(done_fd, &n, sizeof(n)) < 0 && errno != EAGAIN) {
+        perror("[MANAGER] eventfd read failed");
+    }
+    
+    pthread_mutex_lock(&done_lock);
+    client_conn_t* list = done_head;
+    done_head = NULL;
+    pthread_mutex_unlock(&done_lock);
+    
+    while (list) {
+        client_conn_t* conn = list;
+        list = conn->job_next;
+        conn->job_next = NULL;
+        conn->busy = 0;
+        int failed = conn->job_failed;
+        conn->job_failed = 0;
+        if (!failed) {
+            failed = conn_dispatch(conn) != 0;
+        }
+        conn_settle(epfd, conn, failed);
+    }
+}
+
+/* 接受新连接，超过最大连接数时返回错误后关闭 */
+static void accept_clients(int epfd, client_conn_t* conns) {
+    for (;;) {
+        int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("[MANAGER] accept failed");
+            }
+            return;
+        }
+        
+        client_conn_t* conn = NULL;
+        for (int i = 0; i < max_clients; i++) {
+            if (conns[i].fd < 0) {
+                conn = &conns[i];
+                break;
+            }
+        }
+        if (!conn) {
+            char* response = build_response(0, "Too many clients", NULL);
+            if (response) {
+                send(client_fd, response, strlen(response), MSG_NOSIGNAL);
+                send(client_fd, "\n", 1, MSG_NOSIGNAL);
+                free(response);
+            }
+            close(client_fd);
+            continue;
+        }
+        
+        conn->fd = client_fd;
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        struct epoll_event ev = { .events = conn->events, .data.ptr = conn };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_fd, &ev) != 0) {
+            perror("[MANAGER] epoll_ctl failed");
+            close(client_fd);
+            conn->fd = -1;
+        }
+    }
+}
+
+static pthread_t ring_tid;
+static int have_ring = 0;               // 命令环线程在运行
+static volatile int ring_running = 0;   // 清零后命令环线程退出（交接时先于进程退出停止）
+
+/* 创建共享内存命令环（已存在的旧段先删除，客户端按magic判断是否可用） */
+static int ring_create(void) {
+    shm_unlink(TENANT_RING_NAME);
+    int fd = shm_open(TENANT_RING_NAME, O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0) {
+        perror("[MANAGER] shm_open command ring failed");
+        return -1;
+    }
+    // 不受umask影响，只对同组的本机控制器开放
+    if (fchmod(fd, 0660) != 0 || ftruncate(fd, sizeof(tenant_cmd_ring_t)) != 0) {
+        perror("[MANAGER] Failed to size command ring");
+        close(fd);
+        shm_unlink(TENANT_RING_NAME);
+        return -1;
+    }
+    void* p = mmap(NULL, sizeof(tenant_cmd_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("[MANAGER] mmap command ring failed");
+        shm_unlink(TENANT_RING_NAME);
+        return -1;
+    }
+    cmd_ring = p;
+    tenant_ring_init(cmd_ring);
+    return 0;
+}
+
+/* 处理命令环中已提交的全部请求，返回处理的个数 */
+static int ring_drain(void) {
+    static client_conn_t ring_conn = { .fd = -1, .proto = CONN_PROTO_BINARY, .version = TENANT_PROTO_VERSION };
+    tenant_ring_entry_t* e;
+    int count = 0;
+    
+    while ((e = tenant_ring_peek(cmd_ring)) != NULL) {
+        const tenant_ring_resp_t* req = tenant_ring_request(cmd_ring, e);
+        tenant_proto_hdr_t hdr = req ? req->req_hdr : (tenant_proto_hdr_t){ 0 };
+        ring_conn.out_len = 0;
+        if (!req || hdr.magic != TENANT_PROTO_MAGIC || hdr.length > TENANT_RING_MSG_MAX) {
+            bin_respond_status(&ring_conn, &hdr, EPROTO, "Bad frame");
+        } else {
+            pthread_mutex_lock(&state_lock);
+            bin_handle_request(&ring_conn, &hdr, req->req_body);
+            pthread_mutex_unlock(&state_lock);
+        }
+        
+        if (ring_conn.out_len >= sizeof(tenant_proto_hdr_t)) {
+            memcpy(&hdr, ring_conn.out, sizeof(hdr));
+            tenant_ring_complete(cmd_ring, e, &hdr, (const uint8_t*)ring_conn.out + sizeof(hdr));
+        } else {
+            // 内存不足时没有生成响应，回复空消息体，客户端按通信失败处理
+            hdr.type |= TENANT_PROTO_RESPONSE;
+            hdr.length = 0;
+            tenant_ring_complete(cmd_ring, e, &hdr, (const uint8_t*)"");
+        }
+        count++;
+    }
+    
+    // 尾部位置被已退出或停住的生产者占着时跳过它，之后提交的请求继续处理
+    if (count == 0 && tenant_ring_reclaim_stale(cmd_ring)) {
+        fprintf(stderr, "[MANAGER] Command ring: skipped a stale reservation (total %llu)\n",
+                (unsigned long long)cmd_ring->stale_skipped);
+        count = 1 + ring_drain();
+    }
+    return count;
+}
+
+/*
+ * 命令环线程：处理过请求后自旋一小段时间等待后续请求（单CPU时不自旋），
+ * 之后设置daemon_sleeping并复查，在门铃上睡眠直到生产者敲门铃
+ */
+static void* ring_thread(void* arg) {
+    (void)arg;
+    uint64_t spin_ns = tenant_ring_spin_ns();
+    uint64_t idle_since = tenant_ring_now_ns();
+    const struct timespec timeout = { .tv_sec = 1, .tv_nsec = 0 };
+    
+    while (running && ring_running) {
+        if (ring_drain() > 0) {
+            idle_since = tenant_ring_now_ns();
+            continue;
+        }
+        if (tenant_ring_now_ns() - idle_since < spin_ns) {
+            continue;
+        }
+        
+        uint32_t bell = __atomic_load_n(&cmd_ring->doorbell, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&cmd_ring->daemon_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (tenant_ring_peek(cmd_ring) == NULL) {
+            // 1秒超时，保证收到信号后能及时退出
+            tenant_ring_futex(&cmd_ring->doorbell, FUTEX_WAIT, bell, &timeout);
+        }
+        __atomic_store_n(&cmd_ring->daemon_sleeping, 0, __ATOMIC_RELAXED);
+        idle_since = tenant_ring_now_ns();
+    }
+    return NULL;
+}
+
+static int ring_start(void) {
+    ring_running = 1;
+    if (pthread_create(&ring_tid, NULL, ring_thread, NULL) != 0) {
+        ring_running = 0;
+        return -1;
+    }
+    have_ring = 1;
+    return 0;
+}
+
+/* 停止命令环线程，已提交但未处理的请求留在环中 */
+static void ring_stop(void) {
+    ring_running = 0;
+    __atomic_add_fetch(&cmd_ring->doorbell, 1, __ATOMIC_RELEASE);
+    tenant_ring_futex(&cmd_ring->doorbell, FUTEX_WAKE, 1, NULL);
+    pthread_join(ring_tid, NULL);
+    have_ring = 0;
+}
+
+/* 升级时接管旧进程的命令环（不重新初始化），交接期间提交的请求由本进程继续处理 */
+static int ring_adopt(void) {
+    int fd = shm_open(TENANT_RING_NAME, O_RDWR, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(tenant_cmd_ring_t)) {
+        close(fd);
+        return -1;
+    }
+    void* p = mmap(NULL, sizeof(tenant_cmd_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    tenant_cmd_ring_t* ring = p;
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != TENANT_RING_MAGIC || ring->version != TENANT_RING_VERSION) {
+        munmap(p, sizeof(tenant_cmd_ring_t));
+        return -1;
+    }
+    __atomic_store_n(&ring->daemon_pid, getpid(), __ATOMIC_RELEASE);
+    cmd_ring = ring;
+    return 0;
+}
+
+/* 推送到期的WATCH事件，返回距下一次推送的毫秒数，没有监视者时返回-1 */
+static int watch_tick(int epfd, client_conn_t* conns) {
+    uint64_t now = tenant_ring_now_ns();
+    uint64_t next = UINT64_MAX;
+    int refreshed = 0;
+    
+    for (int i = 0; i < max_clients; i++) {
+        client_conn_t* conn = &conns[i];
+        if (conn->fd < 0 || !conn->watching) {
+            continue;
+        }
+        if (conn->watch_next_ns <= now) {
+            // 上一次的事件还没发完时跳过本轮，期间的变化合并到下一次推送
+            if (conn->out_len == 0) {
+                if (!refreshed) {
+                    watch_refresh();
+                    refreshed = 1;
+                }
+                if (watch_cache.seq > conn->watch_seq) {
+                    char* ev = watch_build_event(conn);
+                    int failed = 0;
+                    if (ev) {
+                        failed = buf_append(&conn->out, &conn->out_len, &conn->out_cap, ev, strlen(ev)) != 0 ||
+                                 buf_append(&conn->out, &conn->out_len, &conn->out_cap, "\n", 1) != 0;
+                        free(ev);
+                    }
+                    conn->watch_seq = watch_cache.seq;
+                    if (!failed) {
+                        failed = conn_flush(conn) != 0;
+                    }
+                    if (failed || conn_update_events(epfd, conn) != 0) {
+                        conn_close(epfd, conn);
+                        continue;
+                    }
+                }
+            }
+            conn->watch_next_ns = now + (uint64_t)conn->watch_interval_ms * 1000000ULL;
+        }
+        if (conn->watch_next_ns < next) {
+            next = conn->watch_next_ns;
+        }
+    }
+    
+    if (next == UINT64_MAX) {
+        return -1;
+    }
+    return (int)((next - now + 999999) / 1000000);
+}
+
+static void journal_init(const char* path, int sync);
+
+/* ========== 平滑升级：把监听Socket和客户端连接交给新进程 ========== */
+
+/*
+ * 新进程以--upgrade启动时连接旧进程的交接Socket（只接受同一用户或root），双方核对交接
+ * 格式版本和租户共享内存的布局版本。旧进程随后停止accept和读取Socket，处理完已读入的
+ * 请求，给WATCH连接补推交接前的变化，停止命令环线程，压缩并关闭持久化日志，再依次交出
+ * 监听Socket和每个客户端连接（fd随记录以SCM_RIGHTS传递，连同未成行的输入和未发完的响应）。
+ * 新进程接管后回复确认，旧进程回复告别后退出；告别之前任何一步失败，旧进程恢复服务，
+ * 新进程退出。交接期间到达的连接留在监听队列中，命令环中的请求留在环中，都由接管的
+ * 进程继续处理。
+ */
+
+#define UPGRADE_MAGIC      0x47505554U  // "TUPG"
+#define UPGRADE_VERSION    1            // 交接消息格式版本
+#define UPGRADE_TIMEOUT_MS 10000        // 等待对方每条消息的最长时间
+
+#define UPGRADE_F_RING     0x1          // 旧进程的命令环线程在运行，新进程接管该环
+
+#define UPGRADE_REC_LISTEN 1
+#define UPGRADE_REC_CONN   2
+#define UPGRADE_REC_END    3
+
+/* 握手、确认和告别消息 */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout_version;            // TENANT_SHM_LAYOUT_VERSION
+    uint32_t max_tenants;
+    uint64_t shm_size;                  // sizeof(tenant_shared_memory_t)
+    int32_t pid;
+    int32_t status;                     // 0表示同意/成功，否则为errno
+    uint32_t flags;                     // UPGRADE_F_*
+    uint32_t reserved;
+} upgrade_hello_t;
+
+/* 交接记录，记录之后紧跟in_len字节未处理的输入和out_len字节未发送的响应 */
+typedef struct {
+    uint32_t type;                      // UPGRADE_REC_*
+    uint32_t proto;
+    uint32_t version;
+    uint32_t closing;
+    uint32_t watching;
+    uint32_t watch_tenant;
+    uint32_t watch_interval_ms;
+    uint32_t reserved;
+    uint64_t watch_fields;
+    uint64_t in_len;
+    uint64_t out_len;
+} upgrade_rec_t;
+
+static client_conn_t* adopted = NULL;   // 新进程：接收到的连接，由main_loop放入连接表
+static int adopted_count = 0;
+static int upgrade_peer = -1;           // 新进程：与旧进程的交接连接，收到告别后关闭
+
+static void upgrade_hello_init(upgrade_hello_t* h) {
+    memset(h, 0, sizeof(*h));
+    h->magic = UPGRADE_MAGIC;
+    h->version = UPGRADE_VERSION;
+    h->layout_version = TENANT_SHM_LAYOUT_VERSION;
+    h->max_tenants = MAX_TENANTS;
+    h->shm_size = sizeof(tenant_shared_memory_t);
+    h->pid = getpid();
+}
+
+/* 对方的交接格式和租户共享内存布局与本进程一致 */
+static int upgrade_hello_compatible(const upgrade_hello_t* h) {
+    return h->magic == UPGRADE_MAGIC && h->version == UPGRADE_VERSION &&
+           h->layout_version == TENANT_SHM_LAYOUT_VERSION && h->max_tenants == MAX_TENANTS &&
+           h->shm_size == sizeof(tenant_shared_memory_t);
+}
+
+static void upgrade_set_timeout(int fd) {
+    struct timeval tv = { .tv_sec = UPGRADE_TIMEOUT_MS / 1000, .tv_usec = (UPGRADE_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* 在交接连接上发送len字节，pass_fd >= 0时随第一段数据传递该描述符 */
+static int upgrade_send(int fd, const void* data, size_t len, int pass_fd) {
+    char ctl[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = (void*)data, .iov_len = len };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    
+    if (pass_fd >= 0) {
+        memset(ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl;
+        msg.msg_controllen = sizeof(ctl);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &pass_fd, sizeof(int));
+    }
+    while (iov.iov_len > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        iov.iov_base = (char*)iov.iov_base + n;
+        iov.iov_len -= n;
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+    }
+    return 0;
+}
+
+/* 接收len字节，recv_fd非NULL时取出随数据传递的描述符（没有时为-1） */
+static int upgrade_recv(int fd, void* data, size_t len, int* recv_fd) {
+    char ctl[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = data, .iov_len = len };
+    
+    if (recv_fd) {
+        *recv_fd = -1;
+    }
+    while (iov.iov_len > 0) {
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl, .msg_controllen = sizeof(ctl) };
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int got;
+            memcpy(&got, CMSG_DATA(c), sizeof(int));
+            if (recv_fd && *recv_fd < 0) {
+                *recv_fd = got;
+            } else {
+                close(got);
+            }
+        }
+        iov.iov_base = (char*)iov.iov_base + n;
+        iov.iov_len -= n;
+    }
+    return 0;
+}
+
+/* 创建交接Socket（权限0600，另外按SO_PEERCRED只接受同一用户或root） */
+static int create_upgrade_socket(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("[MANAGER] socket failed");
+        return -1;
+    }
+    
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, UPGRADE_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    
+    unlink(UPGRADE_SOCKET_PATH);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || chmod(UPGRADE_SOCKET_PATH, 0600) != 0 ||
+        listen(fd, 1) < 0) {
+        perror("[MANAGER] Failed to create upgrade socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 旧进程：处理完已读入的完整请求（不再读取Socket），给WATCH连接补推交接前的变化 */
+static void upgrade_drain(int epfd, client_conn_t* conns) {
+    for (;;) {
+        int busy = 0;
+        for (int i = 0; i < max_clients; i++) {
+            if (conns[i].fd >= 0 && conns[i].busy) {
+                busy++;
+            }
+        }
+        if (busy == 0) {
+            break;
+        }
+        struct pollfd pfd = { .fd = done_fd, .events = POLLIN };
+        poll(&pfd, 1, 1000);
+        collect_done_jobs(epfd);
+    }
+    
+    // 新进程以接管时的快照为基准继续推送，交接前的变化由旧进程推送（不受推送间隔限制）
+    watch_refresh();
+    for (int i = 0; i < max_clients; i++) {
+        client_conn_t* conn = &conns[i];
+        if (conn->fd < 0 || !conn->watching || watch_cache.seq <= conn->watch_seq) {
+            continue;
+        }
+        char* ev = watch_build_event(conn);
+        if (ev) {
+            buf_append(&conn->out, &conn->out_len, &conn->out_cap, ev, strlen(ev));
+            buf_append(&conn->out, &conn->out_len, &conn->out_cap, "\n", 1);
+            free(ev);
+        }
+        conn->watch_seq = watch_cache.seq;
+    }
+}
+
+/* 旧进程：依次交出监听Socket和所有客户端连接，返回交出的连接数，失败返回-1 */
+static int upgrade_send_conns(int fd, client_conn_t* conns) {
+    upgrade_rec_t rec = { .type = UPGRADE_REC_LISTEN };
+    if (upgrade_send(fd, &rec, sizeof(rec), server_fd) != 0) {
+        return -1;
+    }
+    
+    int count = 0;
+    for (int i = 0; i < max_clients; i++) {
+        client_conn_t* conn = &conns[i];
+        if (conn->fd < 0) {
+            continue;
+        }
+        memset(&rec, 0, sizeof(rec));
+        rec.type = UPGRADE_REC_CONN;
+        rec.proto = conn->proto;
+        rec.version = conn->version;
+        rec.closing = conn->closing;
+        rec.watching = conn->watching;
+        rec.watch_tenant = conn->watch_tenant;
+        rec.watch_interval_ms = conn->watch_interval_ms;
+        rec.watch_fields = conn->watch_fields;
+        rec.in_len = conn->in_len;
+        rec.out_len = conn->out_len - conn->out_off;
+        if (upgrade_send(fd, &rec, sizeof(rec), conn->fd) != 0 ||
+            upgrade_send(fd, conn->in, rec.in_len, -1) != 0 ||
+            upgrade_send(fd, conn->out + conn->out_off, rec.out_len, -1) != 0) {
+            return -1;
+        }
+        count++;
+    }
+    
+    memset(&rec, 0, sizeof(rec));
+    rec.type = UPGRADE_REC_END;
+    return upgrade_send(fd, &rec, sizeof(rec), -1) == 0 ? count : -1;
+}
+
+/* 旧进程：交接失败后恢复服务（新进程可能已替换交接Socket，重新创建） */
+static void upgrade_resume(int epfd, int ring_was_running) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev);
+    
+    if (ring_was_running) {
+        __atomic_store_n(&cmd_ring->daemon_pid, getpid(), __ATOMIC_RELEASE);
+        if (ring_start() != 0) {
+            fprintf(stderr, "[MANAGER] Failed to restart command ring thread\n");
+        }
+    }
+    if (journal_path) {
+        journal_init(journal_path, journal_sync);
+    }
+    
+    epoll_ctl(epfd, EPOLL_CTL_DEL, upgrade_fd, NULL);
+    close(upgrade_fd);
+    upgrade_fd = create_upgrade_socket();
+    struct epoll_event uev = { .events = EPOLLIN, .data.ptr = &upgrade_fd };
+    if (upgrade_fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_ADD, upgrade_fd, &uev);
+    }
+    fprintf(stderr, "[MANAGER] Upgrade aborted, resumed serving\n");
+}
+
+/* 旧进程：处理一个交接请求，已交给新进程返回1（随后退出），拒绝或失败返回0 */
+static int upgrade_serve(int epfd, client_conn_t* conns) {
+    int fd = accept4(upgrade_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    upgrade_set_timeout(fd);
+    
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || (cred.uid != 0 && cred.uid != geteuid())) {
+        fprintf(stderr, "[MANAGER] Rejected upgrade request from uid %u\n", (unsigned)cred.uid);
+        close(fd);
+        return 0;
+    }
+    
+    upgrade_hello_t peer, reply;
+    if (upgrade_recv(fd, &peer, sizeof(peer), NULL) != 0) {
+        close(fd);
+        return 0;
+    }
+    upgrade_hello_init(&reply);
+    if (!upgrade_hello_compatible(&peer)) {
+        fprintf(stderr, "[MANAGER] Refused upgrade from PID %d: handoff version %u, shared memory layout %u "
+                "with %u tenants (ours %u, %u with %u tenants)\n", peer.pid, peer.version, peer.layout_version,
+                peer.max_tenants, UPGRADE_VERSION, TENANT_SHM_LAYOUT_VERSION, MAX_TENANTS);
+        reply.status = EPROTO;
+        upgrade_send(fd, &reply, sizeof(reply), -1);
+        close(fd);
+        return 0;
+    }
+    
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    fprintf(stderr, "[MANAGER] Handing over to PID %d\n", peer.pid);
+    
+    // 停止accept和读取新请求；之后到达的连接和数据留在内核中，由新进程处理
+    epoll_ctl(epfd, EPOLL_CTL_DEL, server_fd, NULL);
+    upgrade_drain(epfd, conns);
+    
+    int ring_was_running = have_ring;
+    if (have_ring) {
+        ring_stop();
+        reply.flags |= UPGRADE_F_RING;
+    }
+    // 修改已全部完成：压缩并关闭日志，新进程打开时只需读取快照
+    if (journal) {
+        if (tenant_journal_compact(journal) != 0) {
+            perror("[MANAGER] Failed to compact state journal");
+        }
+        tenant_journal_close(journal);
+        journal = NULL;
+    }
+    
+    upgrade_hello_t ack;
+    int count = -1;
+    int ok = upgrade_send(fd, &reply, sizeof(reply), -1) == 0 && (count = upgrade_send_conns(fd, conns)) >= 0 &&
+             upgrade_recv(fd, &ack, sizeof(ack), NULL) == 0 && ack.magic == UPGRADE_MAGIC && ack.status == 0 &&
+             upgrade_send(fd, &reply, sizeof(reply), -1) == 0;
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "[MANAGER] Handoff to PID %d failed: %s\n", peer.pid, strerror(errno));
+        upgrade_resume(epfd, ring_was_running);
+        return 0;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    owns_endpoints = 0;
+    fprintf(stderr, "[MANAGER] Handed over %d connections to PID %d in %.3f ms, exiting\n", count, ack.pid,
+            ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e6);
+    return 1;
+}
+
+/* 新进程：从旧进程接收监听Socket和客户端连接；失败返回-1，旧进程继续服务 */
+static int upgrade_receive(int* adopt_ring) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, UPGRADE_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "[MANAGER] Cannot reach running daemon at %s: %s\n", UPGRADE_SOCKET_PATH, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    upgrade_set_timeout(fd);
+    
+    upgrade_hello_t hello, reply;
+    upgrade_hello_init(&hello);
+    if (upgrade_send(fd, &hello, sizeof(hello), -1) != 0 || upgrade_recv(fd, &reply, sizeof(reply), NULL) != 0) {
+        fprintf(stderr, "[MANAGER] Upgrade handshake failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (reply.status != 0 || !upgrade_hello_compatible(&reply)) {
+        fprintf(stderr, "[MANAGER] Running daemon (PID %d) refused the upgrade: handoff version %u, shared memory "
+                "layout %u with %u tenants (ours %u, %u with %u tenants)\n", reply.pid, reply.version,
+                reply.layout_version, reply.max_tenants, UPGRADE_VERSION, TENANT_SHM_LAYOUT_VERSION, MAX_TENANTS);
+        close(fd);
+        return -1;
+    }
+    
+    int cap = 0;
+    for (;;) {
+        upgrade_rec_t rec;
+        int rfd;
+        if (upgrade_recv(fd, &rec, sizeof(rec), &rfd) != 0) {
+            fprintf(stderr, "[MANAGER] Handoff interrupted: %s\n", strerror(errno));
+            goto fail;
+        }
+        if (rec.type == UPGRADE_REC_END) {
+            break;
+        }
+        if (rfd < 0) {
+            fprintf(stderr, "[MANAGER] Handoff record without a descriptor\n");
+            goto fail;
+        }
+        if (rec.type == UPGRADE_REC_LISTEN) {
+            server_fd = rfd;
+            continue;
+        }
+        
+        if (adopted_count == cap) {
+            cap = cap ? cap * 2 : 64;
+            client_conn_t* p = realloc(adopted, cap * sizeof(client_conn_t));
+            if (!p) {
+                close(rfd);
+                goto fail;
+            }
+            adopted = p;
+        }
+        client_conn_t* conn = &adopted[adopted_count++];
+        memset(conn, 0, sizeof(*conn));
+        conn->fd = rfd;
+        conn->proto = rec.proto;
+        conn->version = rec.version;
+        conn->closing = rec.closing;
+        conn->watching = rec.watching;
+        conn->watch_tenant = rec.watch_tenant;
+        conn->watch_interval_ms = rec.watch_interval_ms;
+        conn->watch_fields = rec.watch_fields;
+        conn->in = malloc(rec.in_len + 1);
+        conn->out = malloc(rec.out_len + 1);
+        if (!conn->in || !conn->out ||
+            upgrade_recv(fd, conn->in, rec.in_len, NULL) != 0 || upgrade_recv(fd, conn->out, rec.out_len, NULL) != 0) {
+            fprintf(stderr, "[MANAGER] Handoff interrupted: %s\n", strerror(errno));
+            goto fail;
+        }
+        conn->in_len = rec.in_len;
+        conn->in_cap = rec.in_len + 1;
+        conn->out_len = rec.out_len;
+        conn->out_cap = rec.out_len + 1;
+    }
+    if (server_fd < 0) {
+        fprintf(stderr, "[MANAGER] Handoff did not include the listening socket\n");
+        goto fail;
+    }
+    
+    *adopt_ring = (reply.flags & UPGRADE_F_RING) != 0;
+    upgrade_peer = fd;
+    fprintf(stderr, "[MANAGER] Received listening socket and %d connections from PID %d\n", adopted_count, reply.pid);
+    return 0;
+    
+fail:
+    // 关闭收到的描述符副本，连接仍由旧进程持有
+    for (int i = 0; i < adopted_count; i++) {
+        close(adopted[i].fd);
+        free(adopted[i].in);
+        free(adopted[i].out);
+    }
+    free(adopted);
+    adopted = NULL;
+    adopted_count = 0;
+    if (server_fd >= 0) {
+        close(server_fd);
+        server_fd = -1;
+    }
+    close(fd);
+    return -1;
+}
+
+/* 新进程：准备好后发送确认并等待旧进程告别；失败说明旧进程已恢复服务 */
+static int upgrade_confirm(void) {
+    upgrade_hello_t ack, bye;
+    upgrade_hello_init(&ack);
+    int ok = upgrade_send(upgrade_peer, &ack, sizeof(ack), -1) == 0 &&
+             upgrade_recv(upgrade_peer, &bye, sizeof(bye), NULL) == 0 && bye.magic == UPGRADE_MAGIC;
+    close(upgrade_peer);
+    upgrade_peer = -1;
+    return ok ? 0 : -1;
+}
+
+/* 新进程：把接收到的连接放入连接表，按缓冲状态注册事件并发出待发送的响应 */
+static void upgrade_install(int epfd, client_conn_t* conns) {
+    int watchers = 0;
+    
+    for (int i = 0; i < adopted_count; i++) {
+        client_conn_t* conn = &adopted[i];
+        if (i >= max_clients) {
+            fprintf(stderr, "[MANAGER] Too many handed-over connections, closing fd %d\n", conn->fd);
+            close(conn->fd);
+            free(conn->in);
+            free(conn->out);
+            continue;
+        }
+        conns[i] = *conn;
+        if (conns[i].watching) {
+            watch_count++;
+            watchers++;
+        }
+    }
+    
+    // WATCH连接以接管时的快照为基准，只推送之后的变化
+    if (watchers > 0) {
+        watch_refresh();
+    }
+    for (int i = 0; i < adopted_count && i < max_clients; i++) {
+        client_conn_t* conn = &conns[i];
+        conn->watch_seq = watch_cache.seq;
+        int failed = conn_dispatch(conn) != 0;
+        conn_settle(epfd, conn, failed);
+    }
+    
+    free(adopted);
+    adopted = NULL;
+    adopted_count = 0;
+}
+
+/* 主循环 */
+void main_loop(void) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("[MANAGER] epoll_create1 failed");
+        return;
+    }
+    
+    client_conn_t* conns = calloc(max_clients, sizeof(client_conn_t));
+    if (!conns) {
+        close(epfd);
+        return;
+    }
+    for (int i = 0; i < max_clients; i++) {
+        conns[i].fd = -1;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev) != 0) {
+        perror("[MANAGER] epoll_ctl failed");
+        free(conns);
+        close(epfd);
+        return;
+    }
+    
+    // 工作线程完成任务后写done_fd，事件循环线程收回连接
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event done_ev = { .events = EPOLLIN, .data.ptr = &done_fd };
+    if (done_fd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, done_fd, &done_ev) != 0) {
+        perror("[MANAGER] eventfd failed");
+        if (done_fd >= 0) {
+            close(done_fd);
+        }
+        free(conns);
+        close(epfd);
+        return;
+    }
+    
+    int nworkers = 0;
+    pthread_t* workers = calloc(num_readers + 1, sizeof(pthread_t));
+    if (workers && pthread_create(&workers[0], NULL, worker_thread, &write_queue) == 0) {
+        for (nworkers = 1; nworkers <= num_readers; nworkers++) {
+            if (pthread_create(&workers[nworkers], NULL, worker_thread, &read_queue) != 0) {
+                break;
+            }
+        }
+    }
+    if (nworkers < 2) {
+        fprintf(stderr, "[MANAGER] Failed to start worker threads\n");
+        job_queue_stop(&write_queue);
+        for (int i = 0; i < nworkers; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+        close(done_fd);
+        free(conns);
+        close(epfd);
+        return;
+    }
+    fprintf(stderr, "[MANAGER] Started 1 writer and %d reader threads\n", nworkers - 1);
+    
+    if (cmd_ring) {
+        if (ring_start() != 0) {
+            fprintf(stderr, "[MANAGER] Failed to start command ring, using the socket only\n");
+            // magic清零后已映射的客户端改走Unix Socket
+            __atomic_store_n(&cmd_ring->magic, 0, __ATOMIC_RELEASE);
+            shm_unlink(TENANT_RING_NAME);
+            cmd_ring = NULL;
+        } else {
+            fprintf(stderr, "[MANAGER] Command ring ready: /dev/shm%s\n", TENANT_RING_NAME);
+        }
+    }
+    
+    // 从旧进程接管的连接（--upgrade）
+    upgrade_install(epfd, conns);
+    struct epoll_event upgrade_ev = { .events = EPOLLIN, .data.ptr = &upgrade_fd };
+    if (upgrade_fd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, upgrade_fd, &upgrade_ev) != 0) {
+        perror("[MANAGER] epoll_ctl upgrade socket failed");
+    }
+    
+    struct epoll_event events[64];
+    int timeout_ms = 1000;
+    while (running) {
+        // 最长1秒超时，保证收到信号后能及时退出；有WATCH连接时在下一次推送到期时醒来
+        int n = epoll_wait(epfd, events, 64, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("[MANAGER] epoll_wait failed");
+            break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            client_conn_t* conn = events[i].data.ptr;
+            if (!conn) {
+                if (server_fd >= 0) {
+                    accept_clients(epfd, conns);
+                }
+                continue;
+            }
+            if (events[i].data.ptr == &done_fd) {
+                collect_done_jobs(epfd);
+                continue;
+            }
+            if (events[i].data.ptr == &upgrade_fd) {
+                // 交给新进程后不再访问任何连接，直接退出
+                if (upgrade_serve(epfd, conns)) {
+                    running = 0;
+                    break;
+                }
+                continue;
+            }
+            // 同一批事件中已关闭或已交给工作线程的连接
+            if (conn->fd < 0 || conn->busy) {
+                continue;
+            }
+            
+            int peer_closed = 0;
+            int failed = (events[i].events & EPOLLERR) != 0;
+            if (!failed && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+                failed = conn_read(conn, &peer_closed) != 0;
+            }
+            if (peer_closed) {
+                conn->closing = 1;
+            }
+            conn_settle(epfd, conn, failed);
+        }
+        if (!running) {
+            break;
+        }
+        
+        timeout_ms = 1000;
+        if (watch_count > 0) {
+            int ms = watch_tick(epfd, conns);
+            if (ms >= 0 && ms < timeout_ms) {
+                timeout_ms = ms;
+            }
+        }
+    }
+    
+    // 工作线程做完手上的任务后退出，之后再关闭所有连接（含仍在队列中的）
+    job_queue_stop(&write_queue);
+    job_queue_stop(&read_queue);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    close(done_fd);
+    done_fd = -1;
+    
+    for (int i = 0; i < max_clients; i++) {
+        if (conns[i].fd >= 0) {
+            conn_close(epfd, &conns[i]);
+        }
+    }
+    if (have_ring) {
+        ring_stop();
+    }
+    free(conns);
+    close(epfd);
+}
+
+/*
+ * 打开持久化日志。共享内存中没有租户时（节点重启或共享内存被销毁）按日志恢复租户，
+ * 已有租户时（只有守护进程重启）以共享内存为准重写快照。
+ */
+static void journal_init(const char* path, int sync) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+    
+    tenant_journal_stats_t stats;
+    journal = tenant_journal_open(path, TENANT_JOURNAL_DEFAULT_CAPACITY, sync ? TENANT_JOURNAL_SYNC : 0, &stats);
+    if (!journal) {
+        fprintf(stderr, "[MANAGER] State journal %s unavailable (%s), tenant definitions will not be persisted\n",
+                path, strerror(errno));
+        return;
+    }
+    
+    tenant_shared_memory_t* shm = tenant_shm_get_ptr();
+    if (shm && shm->active_tenant_count > 0) {
+        static tenant_journal_state_t state;
+        int n = tenant_journal_capture(&state);
+        if (tenant_journal_reset(journal, &state) != 0) {
+            perror("[MANAGER] Failed to write state snapshot");
+        }
+        fprintf(stderr, "[MANAGER] Shared memory already holds %d tenants, snapshot rewritten to %s\n", n, path);
+        return;
+    }
+    
+    if (stats.tenants == 0) {
+        fprintf(stderr, "[MANAGER] State journal %s holds no tenants\n", path);
+        return;
+    }
+    
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int n = tenant_journal_restore(tenant_journal_state(journal));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t apply_ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+    fprintf(stderr, "[MANAGER] Restored %d tenants from %s (snapshot gen %llu with %u tenants, %u records replayed, "
+            "%u discarded) in %.3f ms + %.3f ms\n",
+            n, path, (unsigned long long)stats.snapshot_gen, stats.snapshot_tenants, stats.records,
+            stats.discarded, stats.replay_ns / 1e6, apply_ns / 1e6);
+}
+
+/* 打印用法 */
+void print_usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --daemon          Run as daemon\n");
+    fprintf(stderr, "  --foreground      Run in foreground (with --daemon)\n");
+    fprintf(stderr, "  --max-clients N   Maximum concurrent client connections (default %d)\n", DEFAULT_MAX_CLIENTS);
+    fprintf(stderr, "  --no-ring         Do not create the shared-memory command ring\n");
+    fprintf(stderr, "  --readers N       Threads serving STATUS/LIST_TENANTS (default %d)\n", DEFAULT_READERS);
+    fprintf(stderr, "  --state FILE      Tenant state journal (default %s)\n", DEFAULT_STATE_FILE);
+    fprintf(stderr, "  --state-sync      msync the journal after every change\n");
+    fprintf(stderr, "  --no-state        Do not persist tenant definitions\n");
+    fprintf(stderr, "  --upgrade         Take over the listening socket and connections of the running daemon\n");
+    fprintf(stderr, "  --help            Show this help\n");
+    fprintf(stderr, "\nExamples:\n");
+    fprintf(stderr, "  %s --daemon --foreground    # Debug mode\n", prog);
+    fprintf(stderr, "  %s --daemon                 # Production mode\n", prog);
+    fprintf(stderr, "  %s --daemon --upgrade       # Replace the running daemon without dropping clients\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    int daemon_mode = 0;
+    int foreground = 0;
+    int use_ring = 1;
+    const char* state_path = DEFAULT_STATE_FILE;
+    int state_sync = 0;
+    int upgrade = 0;
+    int adopt_ring = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = 1;
+        } else if (strcmp(argv[i], "--foreground") == 0) {
+            foreground = 1;
+        } else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc) {
+            max_clients = atoi(argv[++i]);
+            if (max_clients <= 0) {
+                fprintf(stderr, "[MANAGER] Invalid --max-clients value\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--no-ring") == 0) {
+            use_ring = 0;
+        } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            num_readers = atoi(argv[++i]);
+            if (num_readers <= 0) {
+                fprintf(stderr, "[MANAGER] Invalid --readers value\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+            state_path = argv[++i];
+        } else if (strcmp(argv[i], "--state-sync") == 0) {
+            state_sync = 1;
+        } else if (strcmp(argv[i], "--no-state") == 0) {
+            state_path = NULL;
+        } else if (strcmp(argv[i], "--upgrade") == 0) {
+            upgrade = 1;
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
+    
+    // 初始化共享内存
+    if (tenant_shm_init() != 0) {
+        fprintf(stderr, "[MANAGER] Failed to initialize shared memory\n");
+        return 1;
+    }
+    fprintf(stderr, "[MANAGER] Shared memory initialized\n");
+    
+    // 接管运行中的旧进程：旧进程交出连接前已停止修改并关闭日志。确认接管之前
+    // Socket文件和命令环仍属于旧进程，本进程失败退出时不能删除
+    if (upgrade) {
+        if (upgrade_receive(&adopt_ring) != 0) {
+            return 1;
+        }
+        owns_endpoints = 0;
+    }
+    
+    // 在daemon()切换工作目录之前打开，相对路径按启动目录解析
+    if (state_path) {
+        journal_path = state_path;
+        journal_sync = state_sync;
+        journal_init(state_path, state_sync);
+    }
+    
+    // 如果作为daemon运行
+    if (daemon_mode && !foreground) {
+        if (daemon(0, 0) != 0) {
+            perror("[MANAGER] daemon failed");
+            return 1;
+        }
+        if (write_pid_file() != 0) {
+            return 1;
+        }
+        fprintf(stderr, "[MANAGER] Running as daemon (PID: %d)\n", getpid());
+    }
+    
+    // 注册信号处理
+    signal(SIGTERM, signal_handler);
+    signal(SIGINT, signal_handler);
+    atexit(cleanup);
+    
+    // 创建服务器socket（升级时使用旧进程交出的监听Socket）
+    if (!upgrade) {
+        server_fd = create_server_socket();
+        if (server_fd < 0) {
+            return 1;
+        }
+    }
+    
+    // 命令环在daemon()之后创建或接管，记录的是实际处理请求的进程
+    int ring_adopted = use_ring && adopt_ring && ring_adopt() == 0;
+    
+    if (upgrade) {
+        if (upgrade_confirm() != 0) {
+            fprintf(stderr, "[MANAGER] Running daemon did not complete the handoff, exiting\n");
+            return 1;
+        }
+        owns_endpoints = 1;
+        fprintf(stderr, "[MANAGER] Took over %d connections on %s\n", adopted_count, SOCKET_PATH);
+    }
+    
+    // 无法接管时新建命令环；升级时必须在交接确认之后，否则交接失败会删掉旧进程仍在使用的环
+    if (use_ring && !ring_adopted && ring_create() != 0) {
+        fprintf(stderr, "[MANAGER] Command ring unavailable, using the socket only\n");
+    }
+    upgrade_fd = create_upgrade_socket();
+    
+    fprintf(stderr, "[MANAGER] Ready. Waiting for commands...\n");
+    
+    // 主循环
+    main_loop();
+    
+    // 正常退出时压缩日志，下次启动只需读取快照
+    if (journal) {
+        if (tenant_journal_compact(journal) != 0) {
+            perror("[MANAGER] Failed to compact state journal");
+        }
+        tenant_journal_close(journal);
+    }
     
     fprintf(stderr, "[MANAGER] Shutdown complete\n");
     return 0;
@@ -213,6 +213,77 @@ test_tenant_isolation() {
     return 0
 }
 
+# 测试5: MR注册/注销后租户用量归零
+# libibverbs的ibv_reg_mr内部调用ibv_reg_mr_iova2，两个入口都被拦截时不能重复记账
+test_mr_accounting() {
+    echo -e "\n${YELLOW}测试5: MR注册/注销记账${NC}"
+    
+    cat > /tmp/test_tenant_mr.c << 'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <infiniband/verbs.h>
+
+int main(void) {
+    size_t len = 4 * 1024 * 1024;
+    struct ibv_device **dev_list = ibv_get_device_list(NULL);
+    if (!dev_list || !dev_list[0]) {
+        printf("未找到RDMA设备\n");
+        return 1;
+    }
+    
+    struct ibv_context *ctx = ibv_open_device(dev_list[0]);
+    struct ibv_pd *pd = ibv_alloc_pd(ctx);
+    void *buf = malloc(len);
+    
+    struct ibv_mr *mr = ibv_reg_mr(pd, buf, len, IBV_ACCESS_LOCAL_WRITE);
+    if (!mr) {
+        perror("ibv_reg_mr");
+        return 1;
+    }
+    ibv_dereg_mr(mr);
+    
+    free(buf);
+    ibv_dealloc_pd(pd);
+    ibv_close_device(ctx);
+    ibv_free_device_list(dev_list);
+    return 0;
+}
+EOF
+    
+    gcc -o /tmp/test_tenant_mr /tmp/test_tenant_mr.c -libverbs 2>/dev/null || {
+        echo "编译测试程序失败，跳过此测试"
+        return 0
+    }
+    
+    export RDMA_INTERCEPT_ENABLE=1
+    export LD_PRELOAD="$INTERCEPT_LIB"
+    
+    local result=0
+    for coalesce in 0 1; do
+        $TENANT_MANAGER --bind $$ --tenant 2
+        RDMA_INTERCEPT_MR_COALESCE=$coalesce timeout 10s /tmp/test_tenant_mr > /tmp/tenant_mr_test.log 2>&1 || true
+        $TENANT_MANAGER --unbind $$
+        
+        if grep -q "未找到RDMA设备" /tmp/tenant_mr_test.log; then
+            echo "未找到RDMA设备，跳过此测试"
+            break
+        fi
+        
+        # 一次注册/注销后MR数和内存用量都应回到0
+        $TENANT_MANAGER --status 2 > /tmp/tenant_mr_status.log
+        if grep -q "MR:  0 /" /tmp/tenant_mr_status.log && grep -q "Memory: 0 /" /tmp/tenant_mr_status.log; then
+            echo -e "${GREEN}MR记账测试通过 (合并注册=$coalesce)${NC}"
+        else
+            echo -e "${RED}MR记账未归零 (合并注册=$coalesce)${NC}"
+            cat /tmp/tenant_mr_test.log /tmp/tenant_mr_status.log
+            result=1
+        fi
+    done
+    
+    unset LD_PRELOAD
+    return $result
+}
+
 # 主测试流程
 main() {
     # 注册清理函数
@@ -241,6 +312,10 @@ main() {
         all_passed=false
     fi
     
+    if ! test_mr_accounting; then
+        all_passed=false
+    fi
+    
     # 输出测试结果
     echo -e "\n${YELLOW}========================================${NC}"
     if $all_passed; then
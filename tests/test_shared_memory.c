@@ -8,6 +8,14 @@
 #include <sys/wait.h>
 #include "../src/shm/shared_memory.h"
 #include "../src/shm/shared_memory_tenant.h"
+#include "../src/shm/tenant_journal.h"
+#include "../include/tenant_cmd_ring.h"
+#include "../include/mr_table.h"
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #define TEST_ASSERT(cond, msg) do { \
     if (!(cond)) { \
@@ -182,6 +190,224 @@ int test_tenant_shm() {
     TEST_ASSERT(tenant_check_resource_limit(1, 0, 50) == true, 
                 "租户资源超限检测正确 (50+10 > 50)");
     
+    // 设备内存原子记账
+    quota.max_dm_bytes_per_tenant = 4096;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "设置设备内存配额成功");
+    TEST_ASSERT(tenant_charge_resource(1, 5, 3000) == 0, "设备内存申请成功 (3000 <= 4096)");
+    TEST_ASSERT(tenant_charge_resource(1, 5, 2000) != 0, "设备内存超限被拒绝 (5000 > 4096)");
+    TEST_ASSERT(tenant_charge_resource(1, 5, -3000) == 0, "设备内存归还成功");
+
+    // 队列内存原子记账
+    quota.max_queue_memory = 65536;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "设置队列内存配额成功");
+    TEST_ASSERT(tenant_charge_resource(1, 18, 49152) == 0, "队列内存申请成功 (48K <= 64K)");
+    TEST_ASSERT(tenant_charge_resource(1, 18, 32768) != 0, "队列内存超限被拒绝 (80K > 64K)");
+    TEST_ASSERT(tenant_check_resource_limit(1, 18, 16384) == false, "队列内存剩余额度检查正确");
+    TEST_ASSERT(tenant_charge_resource(1, 18, -49152) == 0, "队列内存归还成功");
+    quota.max_queue_memory = 0;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "恢复队列内存不限制");
+
+    // AH计数原子记账，且不被读-改-写的用量快照覆盖
+    quota.max_ah_per_tenant = 2;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "设置AH配额成功");
+    TEST_ASSERT(tenant_charge_resource(1, 11, 1) == 0 && tenant_charge_resource(1, 11, 1) == 0 &&
+                tenant_charge_resource(1, 11, 1) != 0, "AH超限被拒绝 (3 > 2)");
+    TEST_ASSERT(tenant_update_resource_usage(1, &usage) == 0 && tenant_get_resource_usage(1, &read_usage) == 0 &&
+                read_usage.ah_count == 2, "用量快照不覆盖AH计数");
+    TEST_ASSERT(tenant_charge_resource(1, 11, -2) == 0, "AH归还成功");
+    quota.max_ah_per_tenant = 0;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "恢复AH不限制");
+
+    // 活跃QP（RTS）配额只在进入RTS时检查
+    quota.max_active_qp_per_tenant = 1;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "设置活跃QP配额成功");
+    TEST_ASSERT(tenant_qp_state_change(1, -1, 0, true) == 0 && tenant_qp_state_change(1, -1, 0, true) == 0,
+                "新建两个RESET状态QP");
+    TEST_ASSERT(tenant_qp_state_change(1, 0, 3, true) == 0, "第一个QP进入RTS");
+    TEST_ASSERT(tenant_qp_state_change(1, 0, 3, true) != 0, "第二个QP进入RTS被拒绝");
+    TEST_ASSERT(tenant_update_resource_usage(1, &read_usage) == 0, "写回旧快照成功");
+    TEST_ASSERT(tenant_get_resource_usage(1, &read_usage) == 0 &&
+                read_usage.qp_state_count[0] == 1 && read_usage.qp_state_count[3] == 1,
+                "QP状态计数正确且未被快照覆盖");
+    TEST_ASSERT(tenant_qp_state_change(1, 3, -1, true) == 0 && tenant_qp_state_change(1, 0, 3, true) == 0,
+                "销毁活跃QP后另一个QP可以进入RTS");
+    TEST_ASSERT(tenant_qp_state_change(1, 3, -1, true) == 0, "销毁剩余QP");
+    quota.max_active_qp_per_tenant = 0;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "恢复活跃QP不限制");
+
+    // 工作集按窗口滚动计数，节流时超出上限的QP不计入
+    quota.max_ws_qps_per_tenant = 2;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "设置工作集上限成功");
+    TEST_ASSERT(tenant_ws_enter(1, 100, true) == 0 && tenant_ws_enter(1, 100, true) == 0,
+                "窗口内前两个QP计入工作集");
+    TEST_ASSERT(tenant_ws_enter(1, 100, true) != 0, "超出工作集的QP被节流");
+    TEST_ASSERT(tenant_ws_enter(1, 100, false) == 0, "不节流时只计数");
+    TEST_ASSERT(tenant_ws_enter(1, 99, true) == 0, "迟到的旧窗口记录被忽略");
+    TEST_ASSERT(tenant_ws_enter(1, 101, true) == 0, "新窗口重新计数");
+    TEST_ASSERT(tenant_get_resource_usage(1, &read_usage) == 0 &&
+                read_usage.ws_qps == 1 && read_usage.ws_qps_last == 3 &&
+                read_usage.ws_qps_peak == 3 && read_usage.ws_throttled == 1,
+                "工作集统计正确");
+    TEST_ASSERT(tenant_ws_enter(1, 105, true) == 0 && tenant_get_resource_usage(1, &read_usage) == 0 &&
+                read_usage.ws_qps_last == 0, "空闲窗口后上一窗口工作集为0");
+    quota.max_ws_qps_per_tenant = 0;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "恢复工作集不限制");
+
+    // 内存记账不被计数快照覆盖
+    TEST_ASSERT(tenant_get_resource_usage(1, &read_usage) == 0, "读取资源使用成功");
+    uint64_t memory_before = read_usage.memory_used;
+    TEST_ASSERT(tenant_charge_resource(1, 2, 1024) == 0, "内存记账成功");
+    TEST_ASSERT(tenant_update_resource_usage(1, &read_usage) == 0, "写回旧快照成功");
+    TEST_ASSERT(tenant_get_resource_usage(1, &read_usage) == 0 && read_usage.memory_used == memory_before + 1024,
+                "记账的内存用量未被覆盖");
+    TEST_ASSERT(tenant_charge_resource(1, 2, -1024) == 0, "内存归还成功");
+    TEST_ASSERT(tenant_get_resource_usage(1, &read_usage) == 0 && read_usage.dm_used == 0,
+                "设备内存用量归零");
+    
+    // 跨进程共享MR登记表：首个进程注册，其余进程导入，内存只计一次
+    // （持有者必须是存活进程，否则会被当作已退出进程清理）
+    pid_t owner = getpid(), importer = getppid();
+    int slot = -1, slot2 = -1;
+    bool last = false;
+    shared_mr_entry_t entry;
+    TEST_ASSERT(tenant_shared_mr_acquire(1, "/test_seg", 0, 8192, 1, owner, &slot, &entry) == 0,
+                "首个进程预留共享MR表项");
+    TEST_ASSERT(tenant_shared_mr_acquire(1, "/test_seg", 0, 8192, 1, importer, &slot2, &entry) == -1 &&
+                errno == EBUSY, "注册未完成时其它进程等待");
+    TEST_ASSERT(tenant_charge_resource(1, 2, 8192) == 0, "首个进程计入内存");
+    TEST_ASSERT(tenant_shared_mr_publish(slot, owner, 5, 10, 20, 30, 40) == 0, "发布共享MR句柄");
+    TEST_ASSERT(tenant_shared_mr_acquire(1, "/test_seg", 0, 8192, 1, importer, &slot2, &entry) == 1 &&
+                slot2 == slot && entry.mr_handle == 20, "其它进程获得导入信息");
+    TEST_ASSERT(tenant_shared_mr_release(slot, owner, &last) == 0 && !last, "首个进程释放后表项保留");
+    TEST_ASSERT(tenant_shared_mr_release(slot, importer, &last) == 0 && last, "最后一个持有者释放");
+    TEST_ASSERT(tenant_get_resource_usage(1, &read_usage) == 0 && read_usage.memory_used == memory_before,
+                "共享MR内存归还");
+    
+    // QP创建统计：命中/未命中与延迟直方图
+    TEST_ASSERT(tenant_record_qp_create(1, 1, 1) == 0, "记录QP池命中");
+    TEST_ASSERT(tenant_record_qp_create(1, 0, 300) == 0, "记录QP池未命中");
+    TEST_ASSERT(tenant_update_resource_usage(1, &usage) == 0, "快照更新不覆盖QP统计");
+    TEST_ASSERT(tenant_get_resource_usage(1, &read_usage) == 0 &&
+                read_usage.qp_pool_hits == 1 && read_usage.qp_pool_misses == 1 &&
+                read_usage.qp_create_lat_hist[0] == 1 && read_usage.qp_create_lat_hist[8] == 1,
+                "QP创建统计正确");
+    
+    // QP创建限速：桶内令牌立即放行，用尽后排队等待补充，等不到则超时
+    TEST_ASSERT(tenant_get_info(1, &info) == 0, "读取配额成功");
+    quota = info.quota;
+    quota.qp_create_rate = 100;
+    quota.qp_create_burst = 2;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "设置创建速率成功");
+    TEST_ASSERT(tenant_qp_create_admit(1, 0) == 0 && tenant_qp_create_admit(1, 0) == 0,
+                "突发额度内立即放行");
+    TEST_ASSERT(tenant_qp_create_admit(1, 0) != 0 && errno == ETIMEDOUT, "令牌用尽且不等待时超时");
+    TEST_ASSERT(tenant_qp_create_admit(1, 100) == 0, "等待令牌补充后放行");
+    TEST_ASSERT(tenant_get_info(1, &info) == 0 && info.create_admit.admitted == 3 &&
+                info.create_admit.delayed == 1 && info.create_admit.timeouts == 1 &&
+                info.create_admit.depth == 0 && info.create_admit.wait_p99_us >= 1024,
+                "排队统计正确");
+    TEST_ASSERT(tenant_set_global_create_rate(1, 1) == 0, "设置全局创建速率成功");
+    quota.qp_create_rate = 0;
+    TEST_ASSERT(tenant_update_quota(1, &quota) == 0, "取消租户创建速率");
+    TEST_ASSERT(tenant_qp_create_admit(1, 0) == 0 && tenant_qp_create_admit(1, 0) != 0,
+                "全局速率同样生效");
+    TEST_ASSERT(tenant_set_global_create_rate(0, 0) == 0 && tenant_qp_create_admit(1, 0) == 0,
+                "取消全局速率后不再限速");
+    
+    // 批量更新配额：其余租户槽位全部参与，全局配额之和超限时整体拒绝
+    uint32_t ids[MAX_TENANTS];
+    tenant_quota_t quotas[MAX_TENANTS];
+    int batch = 0, failed = 0;
+    for (uint32_t id = 2; id < MAX_TENANTS; id++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Batch%u", id);
+        if (tenant_create(id, name, &quota) != 0) {
+            break;
+        }
+        ids[batch] = id;
+        quotas[batch] = quota;
+        quotas[batch].max_qp_per_tenant = 7;
+        batch++;
+    }
+    TEST_ASSERT(batch == MAX_TENANTS - 2, "创建批量测试租户成功");
+    tenant_shared_memory_t *shm = tenant_shm_get_ptr();
+    uint64_t version = shm->version;
+    uint64_t epoch = tenant_quota_epoch();
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    TEST_ASSERT(tenant_update_quota_batch(ids, quotas, batch, NULL) == 0, "批量更新成功");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("[Test] 批量更新%d个租户耗时 %.1f us\n", batch,
+           (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3);
+    TEST_ASSERT(shm->version == version + 1, "批量更新只推进一次版本号");
+    TEST_ASSERT(tenant_quota_epoch() == epoch + 1, "批量更新只发布一次配额纪元");
+    TEST_ASSERT(tenant_get_info(MAX_TENANTS - 1, &info) == 0 && info.quota.max_qp_per_tenant == 7,
+                "批量配额生效");
+    
+    // 子进程无锁读取配额，父进程反复整体发布QP/MR配额相等的两组值，读者不应看到不一致的一份
+    tenant_quota_t saved[MAX_TENANTS];
+    memcpy(saved, quotas, sizeof(saved));
+    for (int i = 0; i < batch; i++) {
+        quotas[i].max_qp_per_tenant = quotas[i].max_mr_per_tenant = 11;
+    }
+    tenant_update_quota_batch(ids, quotas, batch, NULL);
+    pid_t reader = fork();
+    if (reader == 0) {
+        int torn = 0;
+        for (int n = 0; n < 200000; n++) {
+            tenant_quota_t q;
+            uint32_t id = ids[n % batch];
+            if (tenant_get_quota(id, &q) != 0 || q.max_mr_per_tenant != q.max_qp_per_tenant) {
+                torn++;
+            }
+        }
+        _exit(torn ? 1 : 0);
+    }
+    for (int n = 0; n < 2000; n++) {
+        for (int i = 0; i < batch; i++) {
+            quotas[i].max_qp_per_tenant = quotas[i].max_mr_per_tenant = (n & 1) ? 9 : 11;
+        }
+        tenant_update_quota_batch(ids, quotas, batch, NULL);
+    }
+    int reader_status = 0;
+    waitpid(reader, &reader_status, 0);
+    TEST_ASSERT(WIFEXITED(reader_status) && WEXITSTATUS(reader_status) == 0, "并发发布时读者不会读到撕裂的配额");
+    TEST_ASSERT(tenant_quota_epoch() == epoch + 2002, "每次发布推进一次配额纪元");
+    memcpy(quotas, saved, sizeof(saved));
+    TEST_ASSERT(tenant_update_quota_batch(ids, quotas, batch, NULL) == 0, "恢复批量配额");
+    
+    tenant_global_limits_t limits = { .max_total_qp = (uint64_t)batch * 7 + quota.max_qp_per_tenant };
+    TEST_ASSERT(tenant_set_global_limits(&limits) == 0, "设置全局配额上限成功");
+    quotas[0].max_qp_per_tenant = 8;
+    TEST_ASSERT(tenant_update_quota_batch(ids, quotas, batch, &failed) != 0 && errno == EDQUOT && failed == -1,
+                "超过全局配额之和时整体拒绝");
+    TEST_ASSERT(tenant_get_info(ids[0], &info) == 0 && info.quota.max_qp_per_tenant == 7,
+                "被拒绝的批量不修改任何配额");
+    quotas[1].max_qp_per_tenant = 6;
+    TEST_ASSERT(tenant_update_quota_batch(ids, quotas, batch, NULL) == 0, "此消彼长的批量在上限内");
+    ids[1] = ids[0];
+    TEST_ASSERT(tenant_update_quota_batch(ids, quotas, 2, &failed) != 0 && errno == EINVAL && failed == 1,
+                "重复的租户被拒绝");
+    TEST_ASSERT(tenant_delete(MAX_TENANTS - 1) == 0, "删除一个批量租户腾出配额");
+    tenant_quota_t extra = quota;
+    extra.max_qp_per_tenant = 8;
+    TEST_ASSERT(tenant_create_within_limits(MAX_TENANTS - 1, "Over", &extra) != 0 && errno == EDQUOT &&
+                tenant_get_info(MAX_TENANTS - 1, &info) != 0, "创建超过全局配额之和的租户被拒绝");
+    extra.max_qp_per_tenant = 7;
+    TEST_ASSERT(tenant_create_within_limits(MAX_TENANTS - 1, "Fit", &extra) == 0, "上限内的租户创建成功");
+    memset(&limits, 0, sizeof(limits));
+    TEST_ASSERT(tenant_set_global_limits(&limits) == 0, "取消全局配额上限");
+    
+    // 全量快照反映当前配额与状态，且读取本身不推进数据版本号
+    static tenant_snapshot_t snaps[MAX_TENANTS];
+    uint64_t snap_version = tenant_snapshot_all(snaps);
+    TEST_ASSERT(snap_version != 0 && snap_version == tenant_shm_get_ptr()->version, "快照不推进数据版本号");
+    TEST_ASSERT(snaps[ids[0]].status == TENANT_STATUS_ACTIVE && snaps[ids[0]].quota.max_qp_per_tenant == 8 &&
+                snaps[ids[2]].quota.max_qp_per_tenant == 7, "快照包含已发布的配额");
+    for (uint32_t id = 2; id < MAX_TENANTS; id++) {
+        tenant_delete(id);
+    }
+    
     // 解绑进程
     TEST_ASSERT(tenant_unbind_process(test_pid) == 0, "解绑进程成功");
     
@@ -253,6 +479,271 @@ int test_concurrent_access() {
     return 0;
 }
 
+// 测试共享内存命令环
+int test_cmd_ring() {
+    printf("\n[Test] 共享内存命令环\n");
+    
+    tenant_cmd_ring_t *ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT(ring != MAP_FAILED, "映射命令环成功");
+    tenant_ring_init(ring);
+    
+    int slot = tenant_ring_acquire_slot(ring);
+    TEST_ASSERT(slot >= 0, "占用响应槽成功");
+    
+    // 没有消费者时环满后拒绝提交
+    uint8_t body[16];
+    size_t len = 0;
+    tenant_proto_put_u32(body, &len, sizeof(body), TENANT_TLV_TENANT, 7);
+    int n = 0;
+    while (tenant_ring_submit(ring, slot, TENANT_PROTO_UPDATE_QUOTA, n, body, len) == 0) {
+        n++;
+    }
+    TEST_ASSERT(n == TENANT_RING_SLOTS && errno == EAGAIN, "环满时返回EAGAIN");
+    TEST_ASSERT(tenant_ring_submit(ring, slot, TENANT_PROTO_UPDATE_QUOTA, 0, body, TENANT_RING_MSG_MAX + 1) != 0 &&
+                errno == EMSGSIZE, "超长消息被拒绝");
+    tenant_ring_init(ring);
+    slot = tenant_ring_acquire_slot(ring);
+    
+    // 子进程充当守护进程：把请求的seq作为状态写回
+    pid_t consumer = fork();
+    if (consumer == 0) {
+        int served = 0;
+        while (served < 1000) {
+            tenant_ring_entry_t *e = tenant_ring_peek(ring);
+            if (!e) {
+                continue;
+            }
+            uint8_t out[16];
+            size_t off = 0;
+            tenant_proto_hdr_t hdr = tenant_ring_request(ring, e)->req_hdr;
+            tenant_proto_put_u32(out, &off, sizeof(out), TENANT_TLV_STATUS, hdr.seq);
+            hdr.type |= TENANT_PROTO_RESPONSE;
+            hdr.length = (uint32_t)off;
+            tenant_ring_complete(ring, e, &hdr, out);
+            served++;
+        }
+        _exit(0);
+    }
+    
+    int matched = 0;
+    for (int i = 0; i < 1000; i++) {
+        tenant_proto_hdr_t hdr;
+        uint8_t resp[TENANT_RING_MSG_MAX];
+        const uint8_t *val;
+        uint16_t tag, vlen;
+        uint64_t status = UINT64_MAX;
+        size_t off = 0;
+        if (tenant_ring_submit(ring, slot, TENANT_PROTO_UPDATE_QUOTA, i, body, len) != 0 ||
+            tenant_ring_wait(ring, slot, 5000, &hdr, resp) != 0) {
+            break;
+        }
+        while (tenant_proto_next(resp, hdr.length, &off, &tag, &val, &vlen) > 0) {
+            if (tag == TENANT_TLV_STATUS) {
+                tenant_proto_get_uint(val, vlen, &status);
+            }
+        }
+        if (hdr.seq == (uint32_t)i && status == (uint64_t)i) {
+            matched++;
+        }
+    }
+    int consumer_status = 0;
+    waitpid(consumer, &consumer_status, 0);
+    TEST_ASSERT(matched == 1000, "每个请求都收到自己的响应");
+    TEST_ASSERT(ring->processed == 1000, "消费者处理了全部请求");
+    
+    // 生产者占位并登记后未提交就退出：守护进程跳过该位置并替它写回空响应
+    uint32_t pos = ring->head;
+    tenant_ring_entry_t *stuck = &ring->entries[pos & (TENANT_RING_SLOTS - 1)];
+    int dead_slot = -1;
+    pid_t producer = fork();
+    if (producer == 0) {
+        int s = tenant_ring_acquire_slot(ring);
+        ring->head = pos + 1;
+        ring->resp[s].reserved_ns = tenant_ring_now_ns();
+        stuck->state = TENANT_RING_STATE(pos, s);
+        _exit(0);
+    }
+    waitpid(producer, NULL, 0);
+    dead_slot = (int)TENANT_RING_CLIENT(stuck->state);
+    TEST_ASSERT(tenant_ring_peek(ring) == NULL && tenant_ring_reclaim_stale(ring) == 1 && ring->tail == pos + 1,
+                "跳过已退出生产者占用的位置");
+    TEST_ASSERT(dead_slot >= 0 && dead_slot < TENANT_RING_CLIENTS &&
+                ring->resp[dead_slot].state == TENANT_RING_RESP_READY, "已退出生产者的响应槽可回收");
+    
+    // 仍存活的占用者超时后同样被跳过，之后它迟到的发布CAS失败，不会改写下一圈的占用者
+    stuck = &ring->entries[(pos + 1) & (TENANT_RING_SLOTS - 1)];
+    ring->head = pos + 2;
+    ring->resp[slot].reserved_ns = tenant_ring_now_ns();
+    stuck->state = TENANT_RING_STATE(pos + 1, slot);
+    TEST_ASSERT(tenant_ring_reclaim_stale(ring) == 0, "存活的占用者未超时前不跳过");
+    ring->resp[slot].reserved_ns -= TENANT_RING_STALE_NS;
+    TEST_ASSERT(tenant_ring_reclaim_stale(ring) == 1 && ring->stale_skipped == 2, "占用超时后跳过");
+    uint64_t late = TENANT_RING_STATE(pos + 1, slot);
+    TEST_ASSERT(!__atomic_compare_exchange_n(&stuck->state, &late, TENANT_RING_STATE(pos + 2, slot), false,
+                                             __ATOMIC_RELEASE, __ATOMIC_RELAXED) &&
+                TENANT_RING_SEQ(stuck->state) == pos + 1 + TENANT_RING_SLOTS &&
+                TENANT_RING_CLIENT(stuck->state) == TENANT_RING_NO_CLIENT, "被跳过的生产者迟到的发布失败");
+    TEST_ASSERT(tenant_ring_submit(ring, slot, TENANT_PROTO_UPDATE_QUOTA, 0, body, len) == 0 &&
+                tenant_ring_peek(ring) != NULL && tenant_ring_request(ring, tenant_ring_peek(ring)) == &ring->resp[slot],
+                "跳过后新的请求可以处理");
+    
+    tenant_ring_release_slot(ring, slot);
+    TEST_ASSERT(ring->resp[slot].state == TENANT_RING_RESP_FREE, "归还响应槽");
+    munmap(ring, sizeof(*ring));
+    return 0;
+}
+
+// 测试租户定义持久化日志
+int test_tenant_journal() {
+    printf("\n[Test] 租户定义持久化日志\n");
+    
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_tenant_journal_%d", getpid());
+    unlink(path);
+    
+    tenant_journal_stats_t stats;
+    tenant_journal_t *j = tenant_journal_open(path, 0, 0, &stats);
+    TEST_ASSERT(j != NULL && stats.tenants == 0, "创建空日志");
+    
+    tenant_journal_tenant_t t[2] = {
+        { .tenant_id = 5, .status = TENANT_STATUS_ACTIVE, .name = "five", .quota = { .max_qp_per_tenant = 10 } },
+        { .tenant_id = 6, .status = TENANT_STATUS_SUSPENDED, .name = "six", .quota = { .max_qp_per_tenant = 20 } },
+    };
+    tenant_journal_globals_t g = { .limits = { .max_total_qp = 1000 }, .create_rate = 50 };
+    TEST_ASSERT(tenant_journal_put(j, &t[0], 1) == 0 && tenant_journal_put(j, t, 2) == 0 &&
+                tenant_journal_delete(j, 5) == 0 && tenant_journal_set_globals(j, &g) == 0, "追加记录");
+    tenant_journal_close(j);
+    
+    j = tenant_journal_open(path, 0, 0, &stats);
+    const tenant_journal_state_t *st = j ? tenant_journal_state(j) : NULL;
+    TEST_ASSERT(st && stats.records == 5 && stats.tenants == 1 && !st->present[5] && st->present[6] &&
+                st->tenants[6].quota.max_qp_per_tenant == 20 && st->tenants[6].status == TENANT_STATUS_SUSPENDED &&
+                strcmp(st->tenants[6].name, "six") == 0 && st->globals.limits.max_total_qp == 1000, "重放得到最终状态");
+    
+    // 撕裂的组：破坏一组中最后一条记录，整组都不生效
+    tenant_journal_tenant_t torn[2] = {
+        { .tenant_id = 8, .name = "torn-8" }, { .tenant_id = 9, .name = "torn-9" },
+    };
+    TEST_ASSERT(tenant_journal_put(j, torn, 2) == 0, "追加一组记录");
+    tenant_journal_close(j);
+    int fd = open(path, O_RDWR);
+    struct stat sb;
+    fstat(fd, &sb);
+    char *raw = malloc(sb.st_size);
+    pread(fd, raw, sb.st_size, 0);
+    char *hit = NULL;
+    for (off_t off = 0; off + 6 <= sb.st_size && !hit; off++) {
+        if (memcmp(raw + off, "torn-9", 6) == 0) {
+            hit = raw + off;
+        }
+    }
+    if (hit) {
+        hit[0] ^= 0xff;
+        pwrite(fd, hit, 1, hit - raw);
+    }
+    free(raw);
+    close(fd);
+    j = tenant_journal_open(path, 0, 0, &stats);
+    st = j ? tenant_journal_state(j) : NULL;
+    TEST_ASSERT(hit && st && stats.records == 5 && stats.discarded == 1 && !st->present[8] && !st->present[9],
+                "不完整的组被丢弃");
+    
+    // 写满后自动压缩成快照
+    uint32_t capacity = 2 * MAX_TENANTS;
+    for (uint32_t i = 0; i < capacity + 10; i++) {
+        t[1].quota.max_qp_per_tenant = 100 + i;
+        if (tenant_journal_put(j, &t[1], 1) != 0) {
+            break;
+        }
+    }
+    TEST_ASSERT(tenant_journal_records(j) < capacity, "记录写满时压缩");
+    tenant_journal_close(j);
+    j = tenant_journal_open(path, 0, 0, &stats);
+    st = j ? tenant_journal_state(j) : NULL;
+    TEST_ASSERT(st && stats.snapshot_gen == 2 && stats.snapshot_tenants == 1 &&
+                st->tenants[6].quota.max_qp_per_tenant == 100 + capacity + 9 &&
+                st->globals.create_rate == 50, "从快照和新一代记录恢复");
+    tenant_journal_close(j);
+    unlink(path);
+    return 0;
+}
+
+// 合并注册用的假注册函数：只记录注册次数和固定的字节数
+static size_t fake_pinned = 0;
+static int fake_regs = 0;
+
+static struct ibv_mr *fake_reg_mr(struct ibv_pd *pd, void *addr, size_t length, int access) {
+    (void)access;
+    struct ibv_mr *mr = calloc(1, sizeof(*mr));
+    if (!mr) {
+        return NULL;
+    }
+    mr->pd = pd;
+    mr->addr = addr;
+    mr->length = length;
+    fake_pinned += length;
+    fake_regs++;
+    return mr;
+}
+
+static int fake_dereg_mr(struct ibv_mr *mr) {
+    fake_pinned -= mr->length;
+    fake_regs--;
+    free(mr);
+    return 0;
+}
+
+// 测试MR合并注册的覆盖范围
+int test_mr_coalesce() {
+    printf("\n[Test] MR合并注册覆盖范围\n");
+    
+    const size_t M = 1024 * 1024;
+    struct ibv_pd *pd = (struct ibv_pd *)0x1000;
+    uintptr_t base = 0x40000000;
+    struct ibv_mr *views[16];
+    size_t total = 0;
+    mr_coalesce_set_align(2 * M);
+    
+    // 顺序注册8个1MB缓冲区：每2MB一个父MR，固定的字节数与缓冲区总量相同
+    int n = 0;
+    for (int i = 0; i < 8; i++) {
+        void *addr = (void *)(base + i * M);
+        size_t pinned = 0;
+        views[n] = mr_coalesce_lookup(pd, addr, M, IBV_ACCESS_LOCAL_WRITE);
+        if (!views[n]) {
+            views[n] = mr_coalesce_register(pd, addr, M, IBV_ACCESS_LOCAL_WRITE, fake_reg_mr, fake_dereg_mr, &pinned);
+            total += pinned;
+        }
+        n += views[n] != NULL;
+    }
+    TEST_ASSERT(n == 8 && fake_regs == 4, "顺序注册每2MB只注册一个父MR");
+    TEST_ASSERT(fake_pinned == 8 * M && total == 8 * M, "顺序注册固定和计费的字节数不随次数平方增长");
+    
+    // 跨过已有父MR边界的注册只向未覆盖的一侧扩展
+    size_t pinned = 0;
+    views[n] = mr_coalesce_register(pd, (void *)(base + 7 * M + M / 2), M, IBV_ACCESS_LOCAL_WRITE,
+                                    fake_reg_mr, fake_dereg_mr, &pinned);
+    TEST_ASSERT(views[n] && pinned == 2 * M + M / 2 && fake_regs == 5,
+                "重叠注册只重复固定请求本身跨界的部分");
+    n++;
+    views[n] = mr_coalesce_lookup(pd, (void *)(base + 9 * M), M, IBV_ACCESS_LOCAL_WRITE);
+    TEST_ASSERT(views[n] != NULL && fake_regs == 5, "扩展部分服务后续相邻注册");
+    n++;
+    
+    size_t released = 0;
+    for (int i = 0; i < n; i++) {
+        size_t len = 0;
+        mr_coalesce_release(views[i], fake_dereg_mr, &len);
+        released += len;
+    }
+    mr_coalesce_stats_t stats;
+    mr_coalesce_get_stats(&stats);
+    TEST_ASSERT(fake_regs == 0 && fake_pinned == 0 && released == 8 * M + 2 * M + M / 2 &&
+                stats.active_parents == 0 && stats.active_views == 0, "释放全部视图后父MR全部注销");
+    mr_coalesce_set_align(0);
+    return 0;
+}
+
 int main() {
     printf("======================================\n");
     printf("   共享内存功能单元测试\n");
@@ -264,6 +755,9 @@ int main() {
     if (test_multi_process_shm() != 0) failed++;
     if (test_tenant_shm() != 0) failed++;
     if (test_concurrent_access() != 0) failed++;
+    if (test_cmd_ring() != 0) failed++;
+    if (test_tenant_journal() != 0) failed++;
+    if (test_mr_coalesce() != 0) failed++;
     
     printf("\n======================================\n");
     if (failed == 0) {